@@ -0,0 +1,390 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afcclientpool.h"
+#include "iDescriptor.h"
+#include <QDebug>
+#include <algorithm>
+#include <chrono>
+#include <libimobiledevice/lockdown.h>
+
+AfcClientLease::AfcClientLease(std::shared_ptr<AfcClientPool> pool,
+                               afc_client_t client, IoPriority priority)
+    : m_pool(std::move(pool)), m_client(client), m_priority(priority)
+{
+}
+
+AfcClientLease::AfcClientLease(AfcClientLease &&other) noexcept
+    : m_pool(std::move(other.m_pool)), m_client(other.m_client),
+      m_priority(other.m_priority), m_broken(other.m_broken)
+{
+    other.m_client = nullptr;
+    other.m_broken = false;
+}
+
+AfcClientLease &AfcClientLease::operator=(AfcClientLease &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        m_pool = std::move(other.m_pool);
+        m_client = other.m_client;
+        m_priority = other.m_priority;
+        m_broken = other.m_broken;
+        other.m_client = nullptr;
+        other.m_broken = false;
+    }
+    return *this;
+}
+
+AfcClientLease::~AfcClientLease() { release(); }
+
+void AfcClientLease::release()
+{
+    if (m_pool && m_client) {
+        m_pool->release(m_client, m_broken);
+    }
+    m_client = nullptr;
+    m_broken = false;
+    m_pool.reset();
+}
+
+bool AfcClientLease::shouldYield() const
+{
+    return m_pool && m_client && m_priority == IoPriority::Bulk &&
+           m_pool->foregroundStarved();
+}
+
+void AfcClientLease::yield(int timeoutMs)
+{
+    if (!m_pool || !m_client) {
+        return;
+    }
+    std::shared_ptr<AfcClientPool> pool = m_pool;
+    const IoPriority priority = m_priority;
+    release();
+    *this = pool->acquire(timeoutMs, priority);
+}
+
+AfcClientPool::AfcClientPool(idevice_t device, int capacity)
+    : m_device(device), m_capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+AfcClientPool::~AfcClientPool() { shutdown(); }
+
+afc_client_t AfcClientPool::openClient()
+{
+    lockdownd_client_t lockdownClient = nullptr;
+    lockdownd_service_descriptor_t service = nullptr;
+    afc_client_t client = nullptr;
+
+    if (lockdownd_client_new_with_handshake(m_device, &lockdownClient,
+                                            APP_LABEL) != LOCKDOWN_E_SUCCESS) {
+        qDebug() << "AfcClientPool: could not connect to lockdownd";
+        return nullptr;
+    }
+
+    if (lockdownd_start_service(lockdownClient, "com.apple.afc", &service) !=
+        LOCKDOWN_E_SUCCESS) {
+        qDebug() << "AfcClientPool: could not start AFC service";
+        lockdownd_client_free(lockdownClient);
+        return nullptr;
+    }
+
+    if (afc_client_new(m_device, service, &client) != AFC_E_SUCCESS) {
+        qDebug() << "AfcClientPool: could not create AFC client";
+        client = nullptr;
+    }
+
+    lockdownd_service_descriptor_free(service);
+    lockdownd_client_free(lockdownClient);
+    return client;
+}
+
+bool AfcClientPool::hasSlotFor(IoPriority priority) const
+{
+    if (m_idle.empty() &&
+        static_cast<int>(m_busy.size()) + m_opening >= m_capacity) {
+        return false;
+    }
+    return priority != IoPriority::Bulk ||
+           m_held[static_cast<int>(IoPriority::Bulk)] < bulkShare();
+}
+
+bool AfcClientPool::isNextInLine(std::list<Waiter>::const_iterator waiter) const
+{
+    if (!hasSlotFor(waiter->priority)) {
+        return false;
+    }
+    // Earliest deadline first among the waiters that could be served now
+    for (auto it = m_waiters.cbegin(); it != m_waiters.cend(); ++it) {
+        if (it == waiter || !hasSlotFor(it->priority)) {
+            continue;
+        }
+        if (it->deadline < waiter->deadline ||
+            (it->deadline == waiter->deadline &&
+             it->sequence < waiter->sequence)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AfcClientLease AfcClientPool::acquire(int timeoutMs, IoPriority priority)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    const int cls = static_cast<int>(priority);
+    const auto queuedAt = std::chrono::steady_clock::now();
+    const auto waiter = m_waiters.insert(
+        m_waiters.end(),
+        Waiter{priority,
+               queuedAt + std::chrono::milliseconds(DEADLINE_BUDGET_MS[cls]),
+               m_nextSequence++});
+    if (priority != IoPriority::Bulk) {
+        m_foregroundWaiting++;
+    }
+    auto leaveQueue = [&]() {
+        m_waiters.erase(waiter);
+        if (priority != IoPriority::Bulk) {
+            m_foregroundWaiting--;
+        }
+        // Whoever is behind us may be next now
+        m_available.notify_all();
+    };
+
+    auto canProceed = [&]() {
+        return m_shutdown.load() || isNextInLine(waiter);
+    };
+
+    if (!canProceed()) {
+        m_waits++;
+        m_classStats[cls].waits++;
+        if (timeoutMs < 0) {
+            m_available.wait(lock, canProceed);
+        } else if (!m_available.wait_for(
+                       lock, std::chrono::milliseconds(timeoutMs),
+                       canProceed)) {
+            leaveQueue();
+            return AfcClientLease();
+        }
+    }
+    leaveQueue();
+
+    if (m_shutdown.load()) {
+        return AfcClientLease();
+    }
+
+    const auto waited = std::chrono::steady_clock::now() - queuedAt;
+    ClassStats &stats = m_classStats[cls];
+    stats.totalWait += waited;
+    stats.maxWait = std::max<std::chrono::nanoseconds>(stats.maxWait, waited);
+    m_held[cls]++;
+
+    if (!m_idle.empty()) {
+        afc_client_t client = m_idle.back();
+        m_idle.pop_back();
+        m_busy.emplace(client, priority);
+        m_checkouts++;
+        stats.checkouts++;
+        return AfcClientLease(shared_from_this(), client, priority);
+    }
+
+    // Reserve a slot and open the connection without holding the lock, the
+    // lockdown handshake is a few round trips
+    m_opening++;
+    lock.unlock();
+    afc_client_t client = openClient();
+    lock.lock();
+    m_opening--;
+
+    if (!client) {
+        m_held[cls]--;
+        m_available.notify_all();
+        return AfcClientLease();
+    }
+
+    if (m_shutdown.load()) {
+        lock.unlock();
+        afc_client_free(client);
+        return AfcClientLease();
+    }
+
+    m_connectionsOpened++;
+    m_checkouts++;
+    stats.checkouts++;
+    m_busy.emplace(client, priority);
+    m_known.insert(client);
+    return AfcClientLease(shared_from_this(), client, priority);
+}
+
+void AfcClientPool::release(afc_client_t client, bool broken)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_shutdown.load()) {
+        // already freed by shutdown()
+        m_busy.erase(client);
+        return;
+    }
+
+    auto it = m_busy.find(client);
+    if (it == m_busy.end()) {
+        qWarning() << "AfcClientPool: released a client it does not own";
+        return;
+    }
+    m_held[static_cast<int>(it->second)]--;
+    m_busy.erase(it);
+
+    if (broken) {
+        m_known.erase(client);
+        lock.unlock();
+        afc_client_free(client);
+        lock.lock();
+    } else {
+        m_idle.push_back(client);
+    }
+    // Waiters of several classes may be queued, each checks whether it is
+    // next in line
+    m_available.notify_all();
+}
+
+bool AfcClientPool::foregroundBusy() const
+{
+    return m_foregroundWaiting > 0 ||
+           m_held[static_cast<int>(IoPriority::Interactive)] > 0;
+}
+
+bool AfcClientPool::foregroundStarvedLocked() const
+{
+    for (const Waiter &waiter : m_waiters) {
+        if (waiter.priority != IoPriority::Bulk &&
+            !hasSlotFor(waiter.priority)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool AfcClientPool::foregroundStarved() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return foregroundStarvedLocked();
+}
+
+void AfcClientPool::pauseBulkTransfer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_shutdown.load() || !foregroundBusy()) {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    m_available.wait_for(lock, std::chrono::milliseconds(BULK_MAX_PAUSE_MS),
+                         [this]() {
+                             return m_shutdown.load() || !foregroundBusy();
+                         });
+    m_bulkPauses++;
+    m_bulkPaused += std::chrono::steady_clock::now() - start;
+}
+
+std::optional<IoPriority> AfcClientPool::priorityOf(afc_client_t client) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_busy.find(client);
+    if (it == m_busy.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+bool AfcClientPool::owns(afc_client_t client) const
+{
+    if (!client)
+        return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_known.count(client) > 0;
+}
+
+void AfcClientPool::shutdown()
+{
+    if (m_shutdown.exchange(true)) {
+        return;
+    }
+
+    // Wake up everyone waiting for a client so they can bail out
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_available.notify_all();
+    }
+
+    // Wait for in-flight operations on pooled clients to complete
+    std::unique_lock<std::shared_mutex> operationLock(m_operationMutex);
+
+    std::vector<afc_client_t> toFree;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        toFree.insert(toFree.end(), m_idle.begin(), m_idle.end());
+        for (const auto &[client, priority] : m_busy) {
+            toFree.push_back(client);
+        }
+        m_idle.clear();
+        m_busy.clear();
+    }
+
+    for (afc_client_t client : toFree) {
+        afc_client_free(client);
+    }
+
+    qDebug() << "AfcClientPool: shut down, freed" << toFree.size()
+             << "connections";
+}
+
+int AfcClientPool::busyCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<int>(m_busy.size());
+}
+
+int AfcClientPool::idleCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return static_cast<int>(m_idle.size());
+}
+
+AfcClientPool::Stats AfcClientPool::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats s;
+    s.capacity = m_capacity;
+    s.busy = static_cast<int>(m_busy.size());
+    s.idle = static_cast<int>(m_idle.size());
+    s.checkouts = m_checkouts;
+    s.connectionsOpened = m_connectionsOpened;
+    s.waits = m_waits;
+    s.classes = m_classStats;
+    for (int cls = 0; cls < IO_PRIORITY_COUNT; ++cls) {
+        s.classes[cls].held = m_held[cls];
+    }
+    for (const Waiter &waiter : m_waiters) {
+        s.classes[static_cast<int>(waiter.priority)].waiting++;
+    }
+    s.bulkPauses = m_bulkPauses;
+    s.bulkPaused = m_bulkPaused;
+    return s;
+}
@@ -0,0 +1,254 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCCLIENTPOOL_H
+#define AFCCLIENTPOOL_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/libimobiledevice.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class AfcClientPool;
+
+/*
+    Scheduling class of a pooled connection. Interactive is someone looking
+    at the screen (previews, thumbnails, the file explorer), Streaming is
+    media playback and Bulk covers exports, imports and tree walks.
+*/
+enum class IoPriority { Interactive = 0, Streaming = 1, Bulk = 2 };
+constexpr int IO_PRIORITY_COUNT = 3;
+
+/**
+ * @brief RAII handle for an AFC client checked out of an AfcClientPool
+ *
+ * The client is exclusively owned by the holder until the lease is released
+ * or destroyed, at which point it goes back to the pool. File handles opened
+ * through a leased client are only valid on that same client, so keep the
+ * lease alive for the whole open/read/close sequence.
+ */
+class AfcClientLease
+{
+public:
+    AfcClientLease() = default;
+    AfcClientLease(AfcClientLease &&other) noexcept;
+    AfcClientLease &operator=(AfcClientLease &&other) noexcept;
+    AfcClientLease(const AfcClientLease &) = delete;
+    AfcClientLease &operator=(const AfcClientLease &) = delete;
+    ~AfcClientLease();
+
+    afc_client_t client() const { return m_client; }
+    bool isValid() const { return m_client != nullptr; }
+    explicit operator bool() const { return isValid(); }
+
+    /*
+        Convenience for the ServiceManager wrappers which take an
+        optional altAfc, an invalid lease falls back to the shared client
+    */
+    std::optional<afc_client_t> altAfc() const
+    {
+        return m_client ? std::optional<afc_client_t>(m_client)
+                        : std::nullopt;
+    }
+
+    IoPriority priority() const { return m_priority; }
+
+    // Drop the connection instead of recycling it (e.g. after an I/O error)
+    void invalidate() { m_broken = true; }
+    void release();
+
+    /*
+        Bulk holders check this between files: true while interactive or
+        streaming requests wait for a connection and none is free
+    */
+    bool shouldYield() const;
+    // Hands the connection to whoever waits and queues up for a new one
+    void yield(int timeoutMs = -1);
+
+private:
+    friend class AfcClientPool;
+    AfcClientLease(std::shared_ptr<AfcClientPool> pool, afc_client_t client,
+                   IoPriority priority);
+
+    std::shared_ptr<AfcClientPool> m_pool;
+    afc_client_t m_client = nullptr;
+    IoPriority m_priority = IoPriority::Interactive;
+    bool m_broken = false;
+};
+
+/**
+ * @brief Per-device pool of com.apple.afc connections
+ *
+ * Every client is opened lazily through lockdown the first time it is needed
+ * and recycled afterwards, so independent consumers (gallery, exports,
+ * streaming, file explorer) no longer serialize on the single shared
+ * afcClient and the device-wide recursive mutex.
+ *
+ * Checkouts are scheduled by IoPriority. Waiters are served earliest
+ * deadline first, where the deadline is the time they queued up plus their
+ * class's budget, so interactive requests jump ahead while bulk ones still
+ * get served after waiting long enough. Bulk holds at most all connections
+ * but one, and bulk transfers pause between chunks while foreground work
+ * is in flight (pauseBulkTransfer), so a preview opened during an export
+ * neither waits for a connection nor shares the USB link with the export.
+ *
+ * shutdown() is called from device removal: it wakes up waiters, waits for
+ * in-flight operations to finish and frees every connection. Leases that are
+ * still held afterwards stay safe to use, their operations simply fail.
+ */
+class AfcClientPool : public std::enable_shared_from_this<AfcClientPool>
+{
+public:
+    struct ClassStats {
+        // Queue depth right now
+        int waiting = 0;
+        int held = 0;
+        uint64_t checkouts = 0;
+        uint64_t waits = 0;
+        std::chrono::nanoseconds totalWait{0};
+        std::chrono::nanoseconds maxWait{0};
+    };
+
+    struct Stats {
+        int capacity = 0;
+        int busy = 0;
+        int idle = 0;
+        uint64_t checkouts = 0;
+        uint64_t connectionsOpened = 0;
+        uint64_t waits = 0;
+        std::array<ClassStats, IO_PRIORITY_COUNT> classes;
+        // Chunks bulk transfers held back for foreground work
+        uint64_t bulkPauses = 0;
+        std::chrono::nanoseconds bulkPaused{0};
+    };
+
+    explicit AfcClientPool(idevice_t device, int capacity);
+    ~AfcClientPool();
+
+    AfcClientPool(const AfcClientPool &) = delete;
+    AfcClientPool &operator=(const AfcClientPool &) = delete;
+
+    /**
+     * @brief Check out a client, opening a new connection if under capacity
+     * @param timeoutMs How long to wait for a free client, -1 waits forever
+     * @param priority Scheduling class, decides the order waiters are served
+     * @return An invalid lease on timeout, shutdown or connection failure
+     */
+    AfcClientLease acquire(int timeoutMs = -1,
+                           IoPriority priority = IoPriority::Interactive);
+
+    /**
+     * @brief Returns true if the client was handed out by this pool
+     */
+    bool owns(afc_client_t client) const;
+
+    /*
+        Held in shared mode for the duration of a single AFC call on a
+        pooled client, shutdown() takes it exclusively
+    */
+    std::shared_lock<std::shared_mutex> lockForOperation() const
+    {
+        return std::shared_lock<std::shared_mutex>(m_operationMutex);
+    }
+
+    /*
+        Called by bulk transfers before every chunk. Blocks while interactive
+        requests run or foreground requests wait, for at most
+        BULK_MAX_PAUSE_MS so bulk keeps a share of the link.
+    */
+    void pauseBulkTransfer();
+
+    // Class the client was checked out with, nullopt if it isn't checked out
+    std::optional<IoPriority> priorityOf(afc_client_t client) const;
+
+    // True while foreground waiters find every connection taken
+    bool foregroundStarved() const;
+
+    void shutdown();
+    bool isShutdown() const { return m_shutdown.load(); }
+
+    int capacity() const { return m_capacity; }
+    int busyCount() const;
+    int idleCount() const;
+    Stats stats() const;
+
+private:
+    friend class AfcClientLease;
+
+    struct Waiter {
+        IoPriority priority;
+        std::chrono::steady_clock::time_point deadline;
+        uint64_t sequence;
+    };
+
+    // How long each class may wait before it overtakes the ones above it
+    static constexpr std::array<int, IO_PRIORITY_COUNT> DEADLINE_BUDGET_MS = {
+        0, 100, 2000};
+    static constexpr int BULK_MAX_PAUSE_MS = 250;
+
+    void release(afc_client_t client, bool broken);
+    afc_client_t openClient();
+
+    // All of these expect m_mutex to be held
+    bool hasSlotFor(IoPriority priority) const;
+    bool isNextInLine(std::list<Waiter>::const_iterator waiter) const;
+    bool foregroundBusy() const;
+    bool foregroundStarvedLocked() const;
+    int bulkShare() const { return m_capacity > 1 ? m_capacity - 1 : 1; }
+
+    idevice_t m_device;
+    const int m_capacity;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_available;
+    std::vector<afc_client_t> m_idle;
+    std::unordered_map<afc_client_t, IoPriority> m_busy;
+    // every client ever handed out, kept so owns() stays true after shutdown
+    std::unordered_set<afc_client_t> m_known;
+    int m_opening = 0;
+
+    mutable std::shared_mutex m_operationMutex;
+    std::atomic<bool> m_shutdown{false};
+
+    std::list<Waiter> m_waiters;
+    uint64_t m_nextSequence = 0;
+    int m_foregroundWaiting = 0;
+    // Checked out or being opened, per class
+    std::array<int, IO_PRIORITY_COUNT> m_held{};
+
+    uint64_t m_checkouts = 0;
+    uint64_t m_connectionsOpened = 0;
+    uint64_t m_waits = 0;
+    std::array<ClassStats, IO_PRIORITY_COUNT> m_classStats{};
+    uint64_t m_bulkPauses = 0;
+    std::chrono::nanoseconds m_bulkPaused{0};
+};
+
+#endif // AFCCLIENTPOOL_H
@@ -0,0 +1,190 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afcdirectorylister.h"
+#include "afcmetadatacache.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <thread>
+
+AFCFileTree AfcDirectoryLister::list(iDescriptorDevice *device,
+                                     const std::string &path,
+                                     std::optional<afc_client_t> altAfc,
+                                     int maxLanes)
+{
+    AFCFileTree result;
+    result.currentPath = path;
+    result.success = false;
+
+    if (!device)
+        return result;
+
+    AfcMetadataCache *cache = ServiceManager::metadataCacheFor(device, altAfc);
+    if (cache && cache->lookupDirectory(path, result))
+        return result;
+
+    /*
+        Only the default namespace can be served by the pool, a caller that
+        already holds a pooled lease keeps using it as the first lane
+    */
+    const bool defaultNamespace = !altAfc || *altAfc == device->afcClient;
+    const bool canUsePool =
+        device->afcPool &&
+        (defaultNamespace || device->afcPool->owns(*altAfc));
+
+    AfcClientLease primaryLease;
+    std::optional<afc_client_t> primary = altAfc;
+    if (defaultNamespace && device->afcPool) {
+        // Callers may be on the GUI thread, fall back to the shared client
+        primaryLease = ServiceManager::acquireAfcClient(
+            device, PRIMARY_ACQUIRE_TIMEOUT_MS);
+        if (primaryLease)
+            primary = primaryLease.client();
+    }
+
+    char **dirs = nullptr;
+    if (ServiceManager::safeAfcReadDirectory(device, path.c_str(), &dirs,
+                                             primary) != AFC_E_SUCCESS ||
+        !dirs) {
+        return result;
+    }
+
+    std::string prefix = path;
+    if (prefix.empty() || prefix.back() != '/')
+        prefix += "/";
+
+    std::vector<std::string> fullPaths;
+    for (int i = 0; dirs[i]; i++) {
+        if (strcmp(dirs[i], ".") == 0 || strcmp(dirs[i], "..") == 0)
+            continue;
+        MediaEntry entry;
+        entry.name = dirs[i];
+        fullPaths.push_back(prefix + entry.name);
+        result.entries.push_back(std::move(entry));
+    }
+    afc_dictionary_free(dirs);
+
+    const size_t count = result.entries.size();
+    const size_t wantedLanes = std::clamp<size_t>(
+        (count + ENTRIES_PER_LANE - 1) / ENTRIES_PER_LANE, 1,
+        std::max(maxLanes, 1));
+
+    // Never wait for extra lanes, whatever is idle right now is good enough
+    std::vector<AfcClientLease> extraLeases;
+    if (canUsePool) {
+        while (extraLeases.size() + 1 < wantedLanes) {
+            AfcClientLease lease = ServiceManager::acquireAfcClient(device, 0);
+            if (!lease)
+                break;
+            extraLeases.push_back(std::move(lease));
+        }
+    }
+
+    std::atomic<size_t> next{0};
+    auto worker = [&](std::optional<afc_client_t> afc) {
+        size_t i;
+        while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count) {
+            statEntry(device, fullPaths[i], result.entries[i], afc);
+        }
+    };
+
+    std::vector<std::thread> lanes;
+    lanes.reserve(extraLeases.size());
+    for (const AfcClientLease &lease : extraLeases) {
+        lanes.emplace_back(worker, lease.altAfc());
+    }
+    worker(primary);
+    for (std::thread &lane : lanes) {
+        lane.join();
+    }
+
+    result.success = true;
+    if (cache)
+        cache->storeDirectory(path, result);
+    return result;
+}
+
+void AfcDirectoryLister::statEntry(iDescriptorDevice *device,
+                                   const std::string &fullPath,
+                                   MediaEntry &entry,
+                                   std::optional<afc_client_t> afc)
+{
+    char **info = nullptr;
+    if (ServiceManager::safeAfcGetFileInfo(device, fullPath.c_str(), &info,
+                                           afc) == AFC_E_SUCCESS &&
+        info) {
+        parse_afc_file_info(info, entry);
+        afc_dictionary_free(info);
+    }
+
+    if (entry.isSymlink) {
+        /* symlinks that can be listed are treated as directories */
+        char **contents = nullptr;
+        if (ServiceManager::safeAfcReadDirectory(device, fullPath.c_str(),
+                                                 &contents,
+                                                 afc) == AFC_E_SUCCESS) {
+            entry.isDir = true;
+            if (contents)
+                afc_dictionary_free(contents);
+        }
+    }
+}
+
+AfcDirectoryLister::BenchmarkResult
+AfcDirectoryLister::benchmark(iDescriptorDevice *device,
+                              const std::string &path)
+{
+    BenchmarkResult bench;
+    if (!device)
+        return bench;
+
+    QElapsedTimer timer;
+    {
+        AfcClientLease lease = ServiceManager::acquireAfcClient(device);
+        timer.start();
+        AFCFileTree serial =
+            ServiceManager::safeGetFileTree(device, path, lease.altAfc());
+        bench.serialMs = timer.elapsed();
+        if (!serial.success) {
+            qWarning() << "Listing benchmark failed for" << path.c_str();
+            return bench;
+        }
+        bench.entries = serial.entries.size();
+    }
+
+    // Make sure the parallel run goes to the device as well
+    ServiceManager::invalidateAfcMetadata(device, path);
+    timer.restart();
+    AFCFileTree parallel = list(device, path);
+    bench.parallelMs = timer.elapsed();
+    bench.lanes = static_cast<int>(std::min<size_t>(
+        AFC_POOL_CAPACITY,
+        std::max<size_t>(1, (bench.entries + ENTRIES_PER_LANE - 1) /
+                                ENTRIES_PER_LANE)));
+
+    qDebug() << "Listing benchmark" << path.c_str() << "entries:"
+             << bench.entries << "serial:" << bench.serialMs
+             << "ms parallel:" << bench.parallelMs << "ms (up to"
+             << bench.lanes << "lanes)";
+    return bench;
+}
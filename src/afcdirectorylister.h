@@ -0,0 +1,73 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCDIRECTORYLISTER_H
+#define AFCDIRECTORYLISTER_H
+
+#include "iDescriptor.h"
+#include <QtGlobal>
+#include <optional>
+#include <string>
+
+/**
+ * @brief Lists a device directory with the per-entry stats spread over
+ * several AFC connections
+ *
+ * AFC answers one request at a time per connection, so get_file_tree pays a
+ * full USB round trip for every entry it stats. The lister reads the
+ * directory once and then stats the entries on up to maxLanes connections
+ * checked out of the device's AfcClientPool, keeping that many requests in
+ * flight. Entries come back in the order the device listed them.
+ *
+ * Clients that are not part of the pool (afc2, house arrest) only get a
+ * single lane, which behaves like get_file_tree. Listings of the default
+ * namespace go through the device's AfcMetadataCache.
+ */
+class AfcDirectoryLister
+{
+public:
+    struct BenchmarkResult {
+        size_t entries = 0;
+        int lanes = 0;
+        qint64 serialMs = -1;
+        qint64 parallelMs = -1;
+    };
+
+    static AFCFileTree list(iDescriptorDevice *device, const std::string &path,
+                            std::optional<afc_client_t> altAfc = std::nullopt,
+                            int maxLanes = AFC_POOL_CAPACITY);
+
+    /*
+        Times get_file_tree against list() on the same directory and logs
+        both, DeviceBenchmark runs it on device connect
+    */
+    static BenchmarkResult benchmark(iDescriptorDevice *device,
+                                     const std::string &path);
+
+private:
+    // Below this many entries per lane extra connections don't pay off
+    static constexpr size_t ENTRIES_PER_LANE = 8;
+    static constexpr int PRIMARY_ACQUIRE_TIMEOUT_MS = 500;
+
+    static void statEntry(iDescriptorDevice *device,
+                          const std::string &fullPath, MediaEntry &entry,
+                          std::optional<afc_client_t> afc);
+};
+
+#endif // AFCDIRECTORYLISTER_H
@@ -18,9 +18,11 @@
  */
 
 #include "afcexplorerwidget.h"
+#include "afcfilereader.h"
 #include "exportmanager.h"
 #include "iDescriptor-ui.h"
 #include "iDescriptor.h"
+#include "importmanager.h"
 #include "mediapreviewdialog.h"
 #include "servicemanager.h"
 #include "settingsmanager.h"
@@ -33,6 +35,7 @@
 #include <QInputDialog>
 #include <QMenu>
 #include <QMessageBox>
+#include <QProgressDialog>
 #include <QPushButton>
 #include <QRegularExpression>
 #include <QScrollBar>
@@ -206,8 +209,20 @@ void AfcExplorerWidget::loadPath(const QString &path)
     updateAddressBar(path);
     updateNavigationButtons();
 
-    AFCFileTree tree =
-        ServiceManager::safeGetFileTree(m_device, path.toStdString(), m_afc);
+    // Listing runs on the device's I/O thread, a newer request wins
+    m_pendingListing.cancel();
+    const quint64 generation = ++m_listingGeneration;
+    m_pendingListing =
+        ServiceManager::Async::readDirectory(m_device, path, m_afc);
+    m_pendingListing.then(this, [this, generation](const AFCFileTree &tree) {
+        if (generation == m_listingGeneration) {
+            populateFileList(tree);
+        }
+    });
+}
+
+void AfcExplorerWidget::populateFileList(const AFCFileTree &tree)
+{
     if (!tree.success) {
         showErrorState();
         return;
@@ -256,56 +271,29 @@ void AfcExplorerWidget::onFileListContextMenu(const QPoint &pos)
         return;
 
     bool isDir = item->data(Qt::UserRole).toBool();
-    if (isDir)
-        return; // TODO: Implement directory export later - Only export files
-                // for now
 
     QMenu menu;
     QAction *exportAction = menu.addAction("Export");
     QAction *openAction = menu.addAction("Open");
-    QAction *openNativeAction = menu.addAction("Open Externally");
+    // Directories can be exported and opened, but not handed to other apps
+    QAction *openNativeAction =
+        isDir ? nullptr : menu.addAction("Open Externally");
     QAction *selectedAction =
         menu.exec(m_fileList->viewport()->mapToGlobal(pos));
     if (selectedAction == exportAction) {
         QList<QListWidgetItem *> selectedItems = m_fileList->selectedItems();
-        QList<QListWidgetItem *> filesToExport;
         if (selectedItems.isEmpty())
-            filesToExport.append(item); // fallback: just the clicked one
-        else {
-            for (QListWidgetItem *selItem : selectedItems) {
-                if (!selItem->data(Qt::UserRole).toBool())
-                    filesToExport.append(selItem);
-            }
-        }
-        if (filesToExport.isEmpty())
-            return;
+            selectedItems.append(item); // fallback: just the clicked one
 
         QString dir =
             QFileDialog::getExistingDirectory(this, "Select Export Directory");
         if (dir.isEmpty())
             return;
 
-        // Convert to ExportItem list
-        QList<ExportItem> exportItems;
-        QString currPath = "/";
-        if (!m_history.isEmpty())
-            currPath = m_history.top();
-        if (!currPath.endsWith("/"))
-            currPath += "/";
-
-        for (QListWidgetItem *selItem : filesToExport) {
-            QString fileName = selItem->text();
-            QString devicePath =
-                currPath == "/" ? "/" + fileName : currPath + fileName;
-            exportItems.append(ExportItem(devicePath, fileName));
-        }
-
-        // Start export with singleton - manager will show its own dialog
-        ExportManager::sharedInstance()->startExport(m_device, exportItems, dir,
-                                                     m_afc);
+        startExportOf(selectedItems, dir);
     } else if (selectedAction == openAction) {
         onItemDoubleClicked(item);
-    } else if (selectedAction == openNativeAction) {
+    } else if (openNativeAction && selectedAction == openNativeAction) {
         QString fileName = item->text();
         QString currPath = "/";
         if (!m_history.isEmpty())
@@ -325,39 +313,46 @@ void AfcExplorerWidget::onExportClicked()
     if (selectedItems.isEmpty())
         return;
 
-    // Only files (not directories) - TODO: Implement directory export later
-    QList<QListWidgetItem *> filesToExport;
-    for (QListWidgetItem *item : selectedItems) {
-        if (!item->data(Qt::UserRole).toBool())
-            filesToExport.append(item);
-    }
-    if (filesToExport.isEmpty())
-        return;
-
     // Ask user for a directory to save all files
     QString dir =
         QFileDialog::getExistingDirectory(this, "Select Export Directory");
     if (dir.isEmpty())
         return;
 
-    // Convert to ExportItem list
-    QList<ExportItem> exportItems;
+    startExportOf(selectedItems, dir);
+}
+
+void AfcExplorerWidget::startExportOf(const QList<QListWidgetItem *> &items,
+                                      const QString &dir)
+{
     QString currPath = "/";
     if (!m_history.isEmpty())
         currPath = m_history.top();
     if (!currPath.endsWith("/"))
         currPath += "/";
 
-    for (QListWidgetItem *item : filesToExport) {
+    // Directories are exported with everything below them
+    QList<ExportItem> files;
+    QStringList directories;
+    for (QListWidgetItem *item : items) {
         QString fileName = item->text();
         QString devicePath =
             currPath == "/" ? "/" + fileName : currPath + fileName;
-        exportItems.append(ExportItem(devicePath, fileName));
+        if (item->data(Qt::UserRole).toBool())
+            directories.append(devicePath);
+        else
+            files.append(ExportItem(devicePath, fileName));
     }
 
     // Start export with singleton - manager will show its own dialog
-    ExportManager::sharedInstance()->startExport(m_device, exportItems, dir,
-                                                 m_afc);
+    ExportManager *manager = ExportManager::sharedInstance();
+    if (directories.isEmpty()) {
+        manager->startExport(m_device, files, dir, m_afc,
+                             ExportManager::optionsFromSettings());
+    } else {
+        manager->startTreeExport(m_device, files, directories, dir, m_afc,
+                                 ExportManager::optionsFromSettings());
+    }
 }
 
 void AfcExplorerWidget::exportSelectedFile(QListWidgetItem *item,
@@ -407,31 +402,24 @@ int AfcExplorerWidget::exportFileToPath(afc_client_t afc,
                                         const char *device_path,
                                         const char *local_path)
 {
-    uint64_t handle = 0;
-    if (ServiceManager::safeAfcFileOpen(m_device, device_path, AFC_FOPEN_RDONLY,
-                                        &handle, m_afc) != AFC_E_SUCCESS) {
+    AfcFileReader reader(m_device, QString::fromUtf8(device_path), m_afc);
+    if (reader.open() != AFC_E_SUCCESS) {
         qDebug() << "Failed to open file on device:" << device_path;
         return -1;
     }
     FILE *out = fopen(local_path, "wb");
     if (!out) {
         qDebug() << "Failed to open local file:" << local_path;
-        afc_file_close(afc, handle);
         return -1;
     }
 
-    char buffer[4096];
-    uint32_t bytes_read = 0;
-    while (ServiceManager::safeAfcFileRead(m_device, handle, buffer,
-                                           sizeof(buffer), &bytes_read,
-                                           m_afc) == AFC_E_SUCCESS &&
-           bytes_read > 0) {
-        fwrite(buffer, 1, bytes_read, out);
+    QByteArray chunk;
+    while (reader.next(chunk)) {
+        fwrite(chunk.constData(), 1, chunk.size(), out);
     }
 
     fclose(out);
-    ServiceManager::safeAfcFileClose(m_device, handle, m_afc);
-    return 0;
+    return reader.error() == AFC_E_SUCCESS ? 0 : -1;
 }
 
 // should be disabled if there is an error loading afc
@@ -444,63 +432,59 @@ void AfcExplorerWidget::onImportClicked()
     QString currPath = "/";
     if (!m_history.isEmpty())
         currPath = m_history.top();
+    const QString listedPath = currPath;
     if (!currPath.endsWith("/"))
         currPath += "/";
 
-    // Import each file
+    QList<ImportItem> importItems;
     for (const QString &localPath : fileNames) {
-        QFileInfo fi(localPath);
-        QString devicePath = currPath + fi.fileName();
-        int result = importFileToDevice(m_afc, devicePath.toStdString().c_str(),
-                                        localPath.toStdString().c_str());
-        if (result == 0)
-            qDebug() << "Imported" << localPath << "to" << devicePath;
-        else
-            qDebug() << "Failed to import" << localPath;
-    }
-
-    // Refresh file list
-    loadPath(currPath);
-}
-
-/*
-    FIXME : move to services
-*/
-int AfcExplorerWidget::importFileToDevice(afc_client_t afc,
-                                          const char *device_path,
-                                          const char *local_path)
-{
-    QFile in(local_path);
-    if (!in.open(QIODevice::ReadOnly)) {
-        qDebug() << "Failed to open local file for import:" << local_path;
-        return -1;
-    }
-
-    uint64_t handle = 0;
-    if (ServiceManager::safeAfcFileOpen(m_device, device_path, AFC_FOPEN_WRONLY,
-                                        &handle, m_afc) != AFC_E_SUCCESS) {
-        qDebug() << "Failed to open file on device for writing:" << device_path;
-        return -1;
+        importItems.append(
+            ImportItem(localPath, currPath + QFileInfo(localPath).fileName()));
     }
 
-    char buffer[4096];
-    qint64 bytesRead;
-    while ((bytesRead = in.read(buffer, sizeof(buffer))) > 0) {
-        uint32_t bytesWritten = 0;
-        if (ServiceManager::safeAfcFileWrite(
-                m_device, handle, buffer, static_cast<uint32_t>(bytesRead),
-                &bytesWritten, m_afc) != AFC_E_SUCCESS ||
-            bytesWritten != bytesRead) {
-            qDebug() << "Failed to write to device file:" << device_path;
-            ServiceManager::safeAfcFileClose(m_device, handle, m_afc);
-            in.close();
-            return -1;
-        }
+    // Uploads run in the background, the window stays responsive
+    ImportManager *manager = ImportManager::sharedInstance();
+    const QUuid jobId = manager->startImport(m_device, importItems, m_afc);
+    if (jobId.isNull()) {
+        return;
     }
 
-    ServiceManager::safeAfcFileClose(m_device, handle, m_afc);
-    in.close();
-    return 0;
+    auto *progress = new QProgressDialog("Importing files...", "Cancel", 0,
+                                         importItems.size(), this);
+    progress->setWindowTitle("Import");
+    progress->setAttribute(Qt::WA_DeleteOnClose);
+    progress->setMinimumDuration(500);
+    progress->setValue(0);
+
+    connect(progress, &QProgressDialog::canceled, manager,
+            [manager, jobId]() { manager->cancelImport(jobId); });
+    connect(manager, &ImportManager::importProgress, progress,
+            [progress, jobId](const QUuid &id, int completed, int total,
+                              const QString &fileName) {
+                if (id != jobId)
+                    return;
+                progress->setMaximum(total);
+                progress->setValue(completed);
+                progress->setLabelText(QString("Imported %1").arg(fileName));
+            });
+
+    auto finish = [this, progress, jobId, listedPath](const QUuid &id) {
+        if (id != jobId)
+            return;
+        progress->close();
+        // Refresh unless the user browsed elsewhere in the meantime
+        if (!m_history.isEmpty() && m_history.top() == listedPath)
+            loadPath(listedPath);
+    };
+    connect(manager, &ImportManager::importFinished, progress,
+            [finish](const QUuid &id, const ImportJobSummary &summary) {
+                if (summary.failedItems > 0) {
+                    qDebug() << "Import finished with" << summary.failedItems
+                             << "failed items";
+                }
+                finish(id);
+            });
+    connect(manager, &ImportManager::importCancelled, progress, finish);
 }
 
 void AfcExplorerWidget::setupFileExplorer()
@@ -732,15 +716,8 @@ void AfcExplorerWidget::updateButtonStates()
 {
     QList<QListWidgetItem *> selectedItems = m_fileList->selectedItems();
 
-    // Export is only enabled if non-directory items are selected
-    bool hasExportableFiles = false;
-    for (QListWidgetItem *item : selectedItems) {
-        if (!item->data(Qt::UserRole).toBool()) { // Not a directory
-            hasExportableFiles = true;
-            break;
-        }
-    }
-    m_exportBtn->setEnabled(hasExportableFiles);
+    // Directories export recursively, any selection is exportable
+    m_exportBtn->setEnabled(!selectedItems.isEmpty());
 }
 
 void AfcExplorerWidget::setErrorMessage(const QString &message)
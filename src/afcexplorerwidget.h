@@ -23,6 +23,7 @@
 #include "iDescriptor-ui.h"
 #include "iDescriptor.h"
 #include <QAction>
+#include <QFuture>
 #include <QHBoxLayout>
 #include <QInputDialog>
 #include <QLabel>
@@ -92,6 +93,8 @@ private:
     afc_client_t m_afc;
     QString m_errorMessage;
     QString m_root;
+    QFuture<AFCFileTree> m_pendingListing;
+    quint64 m_listingGeneration = 0;
 
     // Export system
     ExportManager *m_exportManager;
@@ -99,6 +102,7 @@ private:
 
     void setupFileExplorer();
     void loadPath(const QString &path);
+    void populateFileList(const AFCFileTree &tree);
     void updateAddressBar(const QString &path);
     void updateNavigationButtons();
     void setErrorMessage(const QString &message);
@@ -109,11 +113,11 @@ private:
 
     void setupContextMenu();
     void exportSelectedFile(QListWidgetItem *item);
+    void startExportOf(const QList<QListWidgetItem *> &items,
+                       const QString &dir);
     void exportSelectedFile(QListWidgetItem *item, const QString &directory);
     int exportFileToPath(afc_client_t afc, const char *device_path,
                          const char *local_path);
-    int importFileToDevice(afc_client_t afc, const char *device_path,
-                           const char *local_path);
     void updateNavStyles();
     void updateButtonStates();
     void goUp();
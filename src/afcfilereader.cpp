@@ -0,0 +1,217 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afcfilereader.h"
+#include "afctransfertuner.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+
+AfcFileReader::AfcFileReader(iDescriptorDevice *device, const QString &path,
+                             std::optional<afc_client_t> altAfc,
+                             uint32_t chunkSize, int depth)
+    : m_device(device), m_path(path.toUtf8()), m_afc(altAfc),
+      m_chunkSize(chunkSize ? std::max<uint32_t>(chunkSize, 4096)
+                            : AfcTransferTuner::bulkChunkSizeFor(device)),
+      m_tunedChunkSize(chunkSize == 0),
+      m_depth(static_cast<size_t>(std::max(depth, 1)))
+{
+}
+
+AfcFileReader::~AfcFileReader() { close(); }
+
+afc_error_t AfcFileReader::open(uint64_t offset)
+{
+    if (!m_device)
+        return AFC_E_INVALID_ARG;
+
+    if (!m_afc || *m_afc == m_device->afcClient) {
+        m_lease =
+            ServiceManager::acquireAfcClient(m_device, ACQUIRE_TIMEOUT_MS);
+        if (m_lease)
+            m_afc = m_lease.client();
+    }
+
+    afc_error_t err = ServiceManager::cachedStat(m_device, m_path.constData(),
+                                                 m_info, m_afc);
+    if (err != AFC_E_SUCCESS)
+        return err;
+    m_size = m_info.size;
+
+    err = ServiceManager::safeAfcFileOpen(m_device, m_path.constData(),
+                                          AFC_FOPEN_RDONLY, &m_handle, m_afc);
+    if (err != AFC_E_SUCCESS) {
+        qDebug() << "Could not open file" << m_path << "Error:" << err;
+        return err;
+    }
+    if (offset > 0) {
+        err = ServiceManager::safeAfcFileSeek(m_device, m_handle, offset,
+                                              SEEK_SET, m_afc);
+        if (err != AFC_E_SUCCESS) {
+            qDebug() << "Could not seek" << m_path << "to" << offset
+                     << "Error:" << err;
+            ServiceManager::safeAfcFileClose(m_device, m_handle, m_afc);
+            return err;
+        }
+        m_bytesDelivered = offset;
+    }
+    m_open = true;
+    m_bulk = m_device->afcPool && m_afc &&
+             m_device->afcPool->priorityOf(*m_afc) == IoPriority::Bulk;
+    m_thread = std::thread(&AfcFileReader::prefetchLoop, this);
+    return AFC_E_SUCCESS;
+}
+
+void AfcFileReader::prefetchLoop()
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_spaceAvailable.wait(lock, [this] {
+                return m_cancelled || m_ready.size() < m_depth;
+            });
+            if (m_cancelled)
+                break;
+        }
+
+        // Chunk boundaries are where bulk transfers get preempted
+        if (m_bulk)
+            m_device->afcPool->pauseBulkTransfer();
+
+        // Follow the tuner between chunks so long files adapt on the fly
+        if (m_tunedChunkSize)
+            m_chunkSize = AfcTransferTuner::bulkChunkSizeFor(m_device);
+
+        QByteArray chunk(m_chunkSize, Qt::Uninitialized);
+        uint32_t bytesRead = 0;
+        const auto start = std::chrono::steady_clock::now();
+        afc_error_t err =
+            ServiceManager::safeAfcFileRead(m_device, m_handle, chunk.data(),
+                                            m_chunkSize, &bytesRead, m_afc);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        if (err == AFC_E_SUCCESS && m_device->transferTuner)
+            m_device->transferTuner->recordTransfer(bytesRead, elapsed);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_deviceTime += elapsed;
+        if (err != AFC_E_SUCCESS) {
+            m_error = err;
+            m_lease.invalidate();
+        }
+        if (err != AFC_E_SUCCESS || bytesRead == 0) {
+            m_finished = true;
+            m_chunkReady.notify_all();
+            break;
+        }
+        chunk.truncate(bytesRead);
+        m_deviceBytes += bytesRead;
+        m_ready.push_back(std::move(chunk));
+        m_chunkReady.notify_all();
+    }
+}
+
+bool AfcFileReader::next(QByteArray &chunk)
+{
+    if (!m_open)
+        return false;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_ready.empty() && !m_finished && !m_cancelled) {
+        const auto start = std::chrono::steady_clock::now();
+        m_chunkReady.wait(lock, [this] {
+            return !m_ready.empty() || m_finished || m_cancelled;
+        });
+        m_consumerStall += std::chrono::steady_clock::now() - start;
+    }
+    if (m_cancelled || m_ready.empty())
+        return false;
+
+    chunk = std::move(m_ready.front());
+    m_ready.pop_front();
+    m_bytesDelivered += chunk.size();
+    m_spaceAvailable.notify_one();
+    return true;
+}
+
+QByteArray AfcFileReader::readAll()
+{
+    QByteArray data;
+    if (m_size > m_bytesDelivered)
+        data.reserve(static_cast<qsizetype>(m_size - m_bytesDelivered));
+
+    QByteArray chunk;
+    while (next(chunk)) {
+        data.append(chunk);
+    }
+    if (error() != AFC_E_SUCCESS || isCancelled())
+        return QByteArray();
+    return data;
+}
+
+void AfcFileReader::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cancelled = true;
+    m_spaceAvailable.notify_all();
+    m_chunkReady.notify_all();
+}
+
+void AfcFileReader::close()
+{
+    if (!m_open)
+        return;
+
+    cancel();
+    if (m_thread.joinable())
+        m_thread.join();
+    ServiceManager::safeAfcFileClose(m_device, m_handle, m_afc);
+    m_open = false;
+
+    if (m_deviceBytes >= 16 * 1024 * 1024) {
+        qDebug() << "AfcFileReader" << m_path << "read" << m_deviceBytes
+                 << "bytes at" << deviceThroughput() / (1024 * 1024)
+                 << "MB/s, consumer stalled"
+                 << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        m_consumerStall)
+                        .count()
+                 << "ms";
+    }
+    m_lease.release();
+}
+
+afc_error_t AfcFileReader::error() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+bool AfcFileReader::isCancelled() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_cancelled;
+}
+
+double AfcFileReader::deviceThroughput() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const double seconds =
+        std::chrono::duration<double>(m_deviceTime).count();
+    return seconds > 0 ? m_deviceBytes / seconds : 0.0;
+}
@@ -0,0 +1,121 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCFILEREADER_H
+#define AFCFILEREADER_H
+
+#include "iDescriptor.h"
+#include <QByteArray>
+#include <QString>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+/**
+ * @brief Sequential AFC file reader that keeps chunks prefetched
+ *
+ * A background thread keeps up to depth chunks read ahead of the consumer,
+ * so the USB link stays busy while the caller writes or decodes the current
+ * chunk. The file handle and client are only touched by that thread. Read
+ * timings feed the device's AfcTransferTuner.
+ *
+ * Passing the device's shared client (or nothing) checks out a pooled
+ * connection for the lifetime of the reader, any other altAfc is used as is.
+ * On a client leased as IoPriority::Bulk the prefetcher lets foreground work
+ * go first before every chunk.
+ */
+class AfcFileReader
+{
+public:
+    static constexpr int DEFAULT_DEPTH = 2;
+
+    // A chunkSize of 0 follows the device's AfcTransferTuner
+    AfcFileReader(iDescriptorDevice *device, const QString &path,
+                  std::optional<afc_client_t> altAfc = std::nullopt,
+                  uint32_t chunkSize = 0, int depth = DEFAULT_DEPTH);
+    ~AfcFileReader();
+
+    AfcFileReader(const AfcFileReader &) = delete;
+    AfcFileReader &operator=(const AfcFileReader &) = delete;
+
+    // Stats and opens the file, then starts prefetching from offset
+    afc_error_t open(uint64_t offset = 0);
+    uint64_t size() const { return m_size; }
+    const MediaEntry &info() const { return m_info; }
+
+    /*
+        Blocks until the next chunk is available. Returns false at the end of
+        the file, on a device error (see error()) or after cancel()
+    */
+    bool next(QByteArray &chunk);
+
+    // Reads the remaining data into one buffer, empty on error
+    QByteArray readAll();
+
+    void cancel();
+    void close();
+
+    afc_error_t error() const;
+    bool isCancelled() const;
+    // File offset up to which chunks were handed out
+    uint64_t bytesDelivered() const { return m_bytesDelivered; }
+
+    // Bytes per second spent in device reads
+    double deviceThroughput() const;
+    // Time the consumer spent waiting for the device
+    std::chrono::nanoseconds consumerStall() const { return m_consumerStall; }
+
+private:
+    static constexpr int ACQUIRE_TIMEOUT_MS = 2000;
+
+    void prefetchLoop();
+
+    iDescriptorDevice *m_device;
+    QByteArray m_path;
+    std::optional<afc_client_t> m_afc;
+    AfcClientLease m_lease;
+    uint32_t m_chunkSize;
+    bool m_tunedChunkSize;
+    size_t m_depth;
+    bool m_bulk = false;
+
+    MediaEntry m_info;
+    uint64_t m_size = 0;
+    uint64_t m_handle = 0;
+    bool m_open = false;
+
+    std::thread m_thread;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_chunkReady;
+    std::condition_variable m_spaceAvailable;
+    std::deque<QByteArray> m_ready;
+    bool m_finished = false;
+    bool m_cancelled = false;
+    afc_error_t m_error = AFC_E_SUCCESS;
+
+    uint64_t m_bytesDelivered = 0;
+    uint64_t m_deviceBytes = 0;
+    std::chrono::nanoseconds m_deviceTime{0};
+    std::chrono::nanoseconds m_consumerStall{0};
+};
+
+#endif // AFCFILEREADER_H
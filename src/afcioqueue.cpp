@@ -0,0 +1,68 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afcioqueue.h"
+
+AfcIoQueue::AfcIoQueue(const QString &name, QObject *parent) : QThread(parent)
+{
+    setObjectName(name);
+    start();
+}
+
+AfcIoQueue::~AfcIoQueue() { stop(); }
+
+void AfcIoQueue::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_shouldStop = true;
+        m_waitCondition.wakeAll();
+    }
+    if (QThread::currentThread() != this) {
+        wait();
+    }
+}
+
+int AfcIoQueue::pendingJobs() const
+{
+    QMutexLocker locker(&m_mutex);
+    return static_cast<int>(m_jobs.size());
+}
+
+void AfcIoQueue::run()
+{
+    while (true) {
+        std::function<void(bool)> job;
+        bool stopping = false;
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_jobs.empty() && !m_shouldStop) {
+                m_waitCondition.wait(&m_mutex);
+            }
+            if (m_jobs.empty()) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            stopping = m_shouldStop;
+        }
+        // Once stopping, queued jobs are only resolved as cancelled
+        job(stopping);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCIOQUEUE_H
+#define AFCIOQUEUE_H
+
+#include <QFuture>
+#include <QMutex>
+#include <QPromise>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+
+/**
+ * @brief Dedicated I/O thread for one device
+ *
+ * Jobs run in submission order on the device's own thread and report through
+ * a QPromise, so callers get a QFuture they can chain with .then() or watch
+ * with a QFutureWatcher instead of parking a pool thread on a USB round trip.
+ * Cancelling the future skips jobs that have not started yet, running jobs
+ * are expected to poll promise.isCanceled() between device requests.
+ */
+class AfcIoQueue : public QThread
+{
+public:
+    explicit AfcIoQueue(const QString &name, QObject *parent = nullptr);
+    ~AfcIoQueue() override;
+
+    template <typename T>
+    QFuture<T> submit(std::function<void(QPromise<T> &)> job)
+    {
+        auto promise = std::make_shared<QPromise<T>>();
+        QFuture<T> future = promise->future();
+        promise->start();
+
+        QMutexLocker locker(&m_mutex);
+        if (m_shouldStop) {
+            locker.unlock();
+            abandon(*promise);
+            return future;
+        }
+        m_jobs.push_back([promise, job](bool stopping) {
+            if (stopping || promise->isCanceled()) {
+                abandon(*promise);
+                return;
+            }
+            job(*promise);
+            promise->finish();
+        });
+        m_waitCondition.wakeOne();
+        return future;
+    }
+
+    // Cancels everything still queued and waits for the running job
+    void stop();
+
+    int pendingJobs() const;
+
+protected:
+    void run() override;
+
+private:
+    template <typename T> static void abandon(QPromise<T> &promise)
+    {
+        promise.future().cancel();
+        promise.finish();
+    }
+
+    bool m_shouldStop = false;
+    mutable QMutex m_mutex;
+    QWaitCondition m_waitCondition;
+    std::deque<std::function<void(bool)>> m_jobs;
+};
+
+#endif // AFCIOQUEUE_H
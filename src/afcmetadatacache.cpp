@@ -0,0 +1,230 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afcmetadatacache.h"
+#include <algorithm>
+#include <vector>
+
+AfcMetadataCache::AfcMetadataCache(std::chrono::milliseconds statTtl,
+                                   std::chrono::milliseconds directoryTtl,
+                                   size_t maxEntries)
+    : m_statTtl(statTtl), m_directoryTtl(directoryTtl),
+      m_maxEntries(maxEntries)
+{
+}
+
+std::string AfcMetadataCache::normalize(const std::string &path)
+{
+    std::string key;
+    key.reserve(path.size() + 1);
+    if (path.empty() || path.front() != '/')
+        key += '/';
+    for (char c : path) {
+        if (c == '/' && !key.empty() && key.back() == '/')
+            continue;
+        key += c;
+    }
+    while (key.size() > 1 && key.back() == '/')
+        key.pop_back();
+    return key;
+}
+
+std::string AfcMetadataCache::parentOf(const std::string &key)
+{
+    size_t slash = key.find_last_of('/');
+    if (slash == std::string::npos || slash == 0)
+        return "/";
+    return key.substr(0, slash);
+}
+
+bool AfcMetadataCache::lookupStat(const std::string &path, MediaEntry &entry)
+{
+    const std::string key = normalize(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_stats.find(key);
+    if (it == m_stats.end() || it->second.expires < Clock::now()) {
+        if (it != m_stats.end())
+            m_stats.erase(it);
+        m_statMisses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    entry = it->second.value;
+    m_statHits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void AfcMetadataCache::storeStat(const std::string &path,
+                                 const MediaEntry &entry)
+{
+    if (!entry.hasStat)
+        return;
+    const auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    storeStatLocked(normalize(path), entry, now);
+    trimLocked(now);
+}
+
+void AfcMetadataCache::storeStatLocked(const std::string &key,
+                                       const MediaEntry &entry,
+                                       Clock::time_point now)
+{
+    m_stats[key] = {entry, now + m_statTtl};
+}
+
+bool AfcMetadataCache::lookupDirectory(const std::string &path,
+                                       AFCFileTree &tree)
+{
+    const std::string key = normalize(path);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_directories.find(key);
+    if (it == m_directories.end() || it->second.expires < Clock::now()) {
+        if (it != m_directories.end())
+            m_directories.erase(it);
+        m_directoryMisses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    tree = it->second.value;
+    tree.currentPath = path;
+    m_directoryHits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void AfcMetadataCache::storeDirectory(const std::string &path,
+                                      const AFCFileTree &tree)
+{
+    if (!tree.success)
+        return;
+    const std::string key = normalize(path);
+    const std::string prefix = key == "/" ? key : key + "/";
+    const auto now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_directories[key] = {tree, now + m_directoryTtl};
+    for (const MediaEntry &entry : tree.entries) {
+        if (entry.hasStat)
+            storeStatLocked(prefix + entry.name, entry, now);
+    }
+    trimLocked(now);
+}
+
+void AfcMetadataCache::invalidate(const std::string &path)
+{
+    const std::string key = normalize(path);
+    const std::string prefix = key == "/" ? key : key + "/";
+    auto isAffected = [&](const std::string &candidate) {
+        return candidate == key || candidate.compare(0, prefix.size(),
+                                                     prefix) == 0;
+    };
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_stats.begin(); it != m_stats.end();) {
+        it = isAffected(it->first) ? m_stats.erase(it) : std::next(it);
+    }
+    for (auto it = m_directories.begin(); it != m_directories.end();) {
+        it = isAffected(it->first) ? m_directories.erase(it) : std::next(it);
+    }
+    m_directories.erase(parentOf(key));
+    m_invalidations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AfcMetadataCache::beginWrite(afc_client_t client, uint64_t handle,
+                                  const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_writeHandles[{client, handle}] = path;
+}
+
+void AfcMetadataCache::endWrite(afc_client_t client, uint64_t handle)
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_writeHandles.find({client, handle});
+        if (it == m_writeHandles.end())
+            return;
+        path = std::move(it->second);
+        m_writeHandles.erase(it);
+    }
+    invalidate(path);
+}
+
+void AfcMetadataCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.clear();
+    m_directories.clear();
+}
+
+void AfcMetadataCache::trimLocked(Clock::time_point now)
+{
+    if (m_stats.size() + m_directories.size() <= m_maxEntries)
+        return;
+
+    for (auto it = m_stats.begin(); it != m_stats.end();) {
+        it = it->second.expires < now ? m_stats.erase(it) : std::next(it);
+    }
+    for (auto it = m_directories.begin(); it != m_directories.end();) {
+        it = it->second.expires < now ? m_directories.erase(it)
+                                      : std::next(it);
+    }
+
+    const size_t count = m_stats.size() + m_directories.size();
+    if (count <= m_maxEntries)
+        return;
+
+    /*
+        Still over budget, evict the oldest entries. A tenth of the budget
+        goes at once so the next stores don't have to scan again.
+    */
+    std::vector<Clock::time_point> stored;
+    stored.reserve(count);
+    for (const auto &[key, slot] : m_stats)
+        stored.push_back(slot.expires - m_statTtl);
+    for (const auto &[key, slot] : m_directories)
+        stored.push_back(slot.expires - m_directoryTtl);
+    const size_t excess = count - m_maxEntries * 9 / 10;
+    std::nth_element(stored.begin(), stored.begin() + (excess - 1),
+                     stored.end());
+    const Clock::time_point cutoff = stored[excess - 1];
+
+    for (auto it = m_stats.begin(); it != m_stats.end();) {
+        it = it->second.expires - m_statTtl <= cutoff ? m_stats.erase(it)
+                                                       : std::next(it);
+    }
+    for (auto it = m_directories.begin(); it != m_directories.end();) {
+        it = it->second.expires - m_directoryTtl <= cutoff
+                 ? m_directories.erase(it)
+                 : std::next(it);
+    }
+}
+
+AfcMetadataCache::Stats AfcMetadataCache::stats() const
+{
+    Stats stats;
+    stats.statHits = m_statHits.load(std::memory_order_relaxed);
+    stats.statMisses = m_statMisses.load(std::memory_order_relaxed);
+    stats.directoryHits = m_directoryHits.load(std::memory_order_relaxed);
+    stats.directoryMisses = m_directoryMisses.load(std::memory_order_relaxed);
+    stats.invalidations = m_invalidations.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.statEntries = m_stats.size();
+    stats.directoryEntries = m_directories.size();
+    return stats;
+}
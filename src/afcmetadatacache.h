@@ -0,0 +1,109 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCMETADATACACHE_H
+#define AFCMETADATACACHE_H
+
+#include "iDescriptor.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Per-device cache of AFC stat replies and directory listings
+ *
+ * Paths are only meaningful inside one AFC namespace, so the cache is only
+ * consulted for the default media service (the device's afcClient and the
+ * pooled connections), see ServiceManager::metadataCacheFor. Entries expire
+ * after their TTL and are dropped early when the app writes to a path, both
+ * when the file is opened for writing and when it is closed again. Over
+ * maxEntries the oldest entries are evicted first.
+ */
+class AfcMetadataCache
+{
+public:
+    struct Stats {
+        uint64_t statHits = 0;
+        uint64_t statMisses = 0;
+        uint64_t directoryHits = 0;
+        uint64_t directoryMisses = 0;
+        uint64_t invalidations = 0;
+        size_t statEntries = 0;
+        size_t directoryEntries = 0;
+    };
+
+    explicit AfcMetadataCache(
+        std::chrono::milliseconds statTtl = std::chrono::seconds(60),
+        std::chrono::milliseconds directoryTtl = std::chrono::seconds(5),
+        size_t maxEntries = 100000);
+
+    bool lookupStat(const std::string &path, MediaEntry &entry);
+    void storeStat(const std::string &path, const MediaEntry &entry);
+
+    bool lookupDirectory(const std::string &path, AFCFileTree &tree);
+    // Also remembers the stats of every entry that carries one
+    void storeDirectory(const std::string &path, const AFCFileTree &tree);
+
+    // Drops the path, anything below it and the listing of its parent
+    void invalidate(const std::string &path);
+    /*
+        A file opened for writing; its stat may be cached again while the
+        write goes on, so closing the handle invalidates the path once more
+    */
+    void beginWrite(afc_client_t client, uint64_t handle,
+                    const std::string &path);
+    void endWrite(afc_client_t client, uint64_t handle);
+    void clear();
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    template <typename T> struct Slot {
+        T value;
+        Clock::time_point expires;
+    };
+
+    static std::string normalize(const std::string &path);
+    static std::string parentOf(const std::string &path);
+    void storeStatLocked(const std::string &key, const MediaEntry &entry,
+                         Clock::time_point now);
+    void trimLocked(Clock::time_point now);
+
+    const std::chrono::milliseconds m_statTtl;
+    const std::chrono::milliseconds m_directoryTtl;
+    const size_t m_maxEntries;
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::string, Slot<MediaEntry>> m_stats;
+    std::unordered_map<std::string, Slot<AFCFileTree>> m_directories;
+    std::map<std::pair<afc_client_t, uint64_t>, std::string> m_writeHandles;
+
+    std::atomic<uint64_t> m_statHits{0};
+    std::atomic<uint64_t> m_statMisses{0};
+    std::atomic<uint64_t> m_directoryHits{0};
+    std::atomic<uint64_t> m_directoryMisses{0};
+    std::atomic<uint64_t> m_invalidations{0};
+};
+
+#endif // AFCMETADATACACHE_H
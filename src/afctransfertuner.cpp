@@ -0,0 +1,142 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afctransfertuner.h"
+#include "iDescriptor.h"
+#include <QDebug>
+#include <algorithm>
+
+AfcTransferTuner::AfcTransferTuner(const std::string &label) : m_label(label)
+{
+}
+
+void AfcTransferTuner::recordRoundTrip(std::chrono::nanoseconds elapsed)
+{
+    const double us =
+        std::chrono::duration<double, std::micro>(elapsed).count();
+    if (us <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_params.roundTripSamples == 0) {
+        m_params.latencyUs = us;
+    } else if (us < m_params.latencyUs * 4) {
+        m_highLatencyRun = 0;
+        m_params.latencyUs += SMOOTHING * (us - m_params.latencyUs);
+    } else if (++m_highLatencyRun >= HIGH_LATENCY_RUN) {
+        // Every recent sample is this slow, e.g. USB gave way to Wi-Fi
+        m_highLatencyRun = 0;
+        m_params.latencyUs = us;
+    } else {
+        // Samples far above the average usually waited on a lock
+        return;
+    }
+    m_params.roundTripSamples++;
+    retuneLocked();
+}
+
+void AfcTransferTuner::recordTransfer(uint64_t bytes,
+                                      std::chrono::nanoseconds elapsed)
+{
+    if (bytes < MIN_TRANSFER_SAMPLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    double seconds = std::chrono::duration<double>(elapsed).count() -
+                     m_params.latencyUs / 1e6;
+    if (seconds <= 0)
+        return;
+
+    const double bandwidth = bytes / seconds;
+    if (m_params.transferSamples == 0) {
+        m_params.bandwidth = bandwidth;
+    } else {
+        m_params.bandwidth += SMOOTHING * (bandwidth - m_params.bandwidth);
+    }
+    m_params.transferSamples++;
+    retuneLocked();
+}
+
+uint32_t AfcTransferTuner::roundToPowerOfTwo(double bytes, uint32_t min,
+                                             uint32_t max)
+{
+    uint32_t size = min;
+    while (size < bytes && size < max)
+        size <<= 1;
+    return std::min(size, max);
+}
+
+void AfcTransferTuner::retuneLocked()
+{
+    if (m_params.roundTripSamples < MIN_SAMPLES ||
+        m_params.transferSamples < MIN_SAMPLES)
+        return;
+
+    const double latencySeconds = m_params.latencyUs / 1e6;
+    const uint32_t bulk = roundToPowerOfTwo(
+        m_params.bandwidth * latencySeconds * (1 - BULK_LATENCY_SHARE) /
+            BULK_LATENCY_SHARE,
+        256 * 1024, 8 * 1024 * 1024);
+    const uint32_t streaming =
+        roundToPowerOfTwo(m_params.bandwidth * STREAMING_REQUEST_SECONDS,
+                          64 * 1024, 1024 * 1024);
+
+    if (bulk != m_params.bulkChunkSize) {
+        qDebug() << "AFC transfer tuning for" << m_label.c_str()
+                 << "latency:" << m_params.latencyUs << "us bandwidth:"
+                 << m_params.bandwidth / (1024 * 1024)
+                 << "MB/s bulk chunk:" << bulk / 1024
+                 << "KB streaming chunk:" << streaming / 1024 << "KB";
+    }
+    m_params.bulkChunkSize = bulk;
+    m_params.streamingChunkSize = streaming;
+}
+
+AfcTransferTuner::Parameters AfcTransferTuner::parameters() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_params;
+}
+
+uint32_t AfcTransferTuner::bulkChunkSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_params.bulkChunkSize;
+}
+
+uint32_t AfcTransferTuner::streamingChunkSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_params.streamingChunkSize;
+}
+
+uint32_t AfcTransferTuner::bulkChunkSizeFor(const iDescriptorDevice *device)
+{
+    return device && device->transferTuner
+               ? device->transferTuner->bulkChunkSize()
+               : DEFAULT_BULK_CHUNK_SIZE;
+}
+
+uint32_t
+AfcTransferTuner::streamingChunkSizeFor(const iDescriptorDevice *device)
+{
+    return device && device->transferTuner
+               ? device->transferTuner->streamingChunkSize()
+               : DEFAULT_STREAMING_CHUNK_SIZE;
+}
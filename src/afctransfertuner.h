@@ -0,0 +1,95 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCTRANSFERTUNER_H
+#define AFCTRANSFERTUNER_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+struct iDescriptorDevice;
+
+/**
+ * @brief Picks AFC transfer chunk sizes from measured link behaviour
+ *
+ * Every request costs a fixed round trip on top of its payload, so the
+ * right chunk size depends on the link (USB 2, USB 3, Wi-Fi) and the
+ * device. The tuner keeps moving averages of the request latency (from
+ * payload-free requests such as stats) and of the bandwidth (from reads and
+ * writes), then sizes bulk chunks so the round trip stays a small fraction
+ * of each request and streaming chunks so one request stays short.
+ *
+ * Until enough samples came in the defaults below are used.
+ */
+class AfcTransferTuner
+{
+public:
+    static constexpr uint32_t DEFAULT_BULK_CHUNK_SIZE = 1024 * 1024;
+    static constexpr uint32_t DEFAULT_STREAMING_CHUNK_SIZE = 128 * 1024;
+
+    struct Parameters {
+        double latencyUs = 0;
+        double bandwidth = 0; // bytes per second
+        uint32_t bulkChunkSize = DEFAULT_BULK_CHUNK_SIZE;
+        uint32_t streamingChunkSize = DEFAULT_STREAMING_CHUNK_SIZE;
+        uint64_t roundTripSamples = 0;
+        uint64_t transferSamples = 0;
+    };
+
+    explicit AfcTransferTuner(const std::string &label);
+
+    // A request that moved bytes of payload and took elapsed overall
+    void recordTransfer(uint64_t bytes, std::chrono::nanoseconds elapsed);
+    // A request without meaningful payload, e.g. a stat
+    void recordRoundTrip(std::chrono::nanoseconds elapsed);
+
+    Parameters parameters() const;
+    uint32_t bulkChunkSize() const;
+    uint32_t streamingChunkSize() const;
+
+    // Defaults for devices without a tuner
+    static uint32_t bulkChunkSizeFor(const iDescriptorDevice *device);
+    static uint32_t streamingChunkSizeFor(const iDescriptorDevice *device);
+
+private:
+    // Smaller transfers say more about latency than bandwidth
+    static constexpr uint64_t MIN_TRANSFER_SAMPLE = 64 * 1024;
+    static constexpr uint64_t MIN_SAMPLES = 4;
+    static constexpr double SMOOTHING = 0.2;
+    // Round trips far above the average are taken as lock waits, unless
+    // this many come in a row: then the link itself got slower
+    static constexpr int HIGH_LATENCY_RUN = 3;
+    // Keep the round trip under 5% of a bulk request
+    static constexpr double BULK_LATENCY_SHARE = 0.05;
+    // One streaming request should take about this long
+    static constexpr double STREAMING_REQUEST_SECONDS = 0.02;
+
+    void retuneLocked();
+    static uint32_t roundToPowerOfTwo(double bytes, uint32_t min,
+                                      uint32_t max);
+
+    std::string m_label;
+    mutable std::mutex m_mutex;
+    Parameters m_params;
+    int m_highLatencyRun = 0;
+};
+
+#endif // AFCTRANSFERTUNER_H
@@ -0,0 +1,252 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "afctreewalker.h"
+#include "afcmetadatacache.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+namespace
+{
+// A directory to list, or a batch of its entries to stat
+struct WorkItem {
+    std::string path;
+    std::string relativePath;
+    std::vector<std::string> names;
+};
+
+struct WalkLane {
+    std::mutex mutex;
+    std::deque<WorkItem> items;
+};
+
+std::string baseName(const std::string &path)
+{
+    const size_t end = path.find_last_not_of('/');
+    if (end == std::string::npos)
+        return std::string();
+    const size_t slash = path.rfind('/', end);
+    const size_t start = slash == std::string::npos ? 0 : slash + 1;
+    return path.substr(start, end - start + 1);
+}
+
+std::string joinPath(const std::string &parent, const std::string &name)
+{
+    if (parent.empty())
+        return name;
+    if (parent.back() == '/')
+        return parent + name;
+    return parent + "/" + name;
+}
+} // namespace
+
+AfcTreeWalker::Stats AfcTreeWalker::walk(iDescriptorDevice *device,
+                                         const std::vector<std::string> &roots,
+                                         const FileCallback &onFile,
+                                         std::optional<afc_client_t> altAfc,
+                                         int maxLanes,
+                                         const std::atomic<bool> *cancel)
+{
+    Stats stats;
+    if (!device || roots.empty())
+        return stats;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    AfcMetadataCache *cache = ServiceManager::metadataCacheFor(device, altAfc);
+
+    // The first lane waits for a connection, the others take idle ones only
+    std::vector<AfcClientLease> leases;
+    std::vector<std::optional<afc_client_t>> clients;
+    // The shared client reaches the namespace the pool serves
+    const bool defaultNamespace = !altAfc || *altAfc == device->afcClient;
+    if (!defaultNamespace || !device->afcPool) {
+        clients.push_back(altAfc);
+    } else {
+        for (int lane = 0; lane < std::max(maxLanes, 1); ++lane) {
+            // Bounded, export lanes of the same job may hold the bulk share
+            AfcClientLease lease = ServiceManager::acquireAfcClient(
+                device, lane == 0 ? FIRST_LANE_TIMEOUT_MS : 0,
+                IoPriority::Bulk);
+            if (!lease)
+                break;
+            clients.push_back(lease.altAfc());
+            leases.push_back(std::move(lease));
+        }
+        if (clients.empty())
+            clients.push_back(std::nullopt);
+    }
+    const int laneCount = static_cast<int>(clients.size());
+    stats.lanes = laneCount;
+
+    std::vector<std::unique_ptr<WalkLane>> lanes;
+    for (int lane = 0; lane < laneCount; ++lane) {
+        lanes.push_back(std::make_unique<WalkLane>());
+    }
+
+    // Directories queued or being listed, the walk is over at zero
+    std::atomic<size_t> pending{0};
+    std::atomic<size_t> directories{0};
+    std::atomic<size_t> files{0};
+    std::mutex idleMutex;
+    std::condition_variable idle;
+
+    for (size_t i = 0; i < roots.size(); ++i) {
+        pending++;
+        lanes[i % laneCount]->items.push_back(
+            {roots[i], baseName(roots[i]), {}});
+    }
+
+    auto takeWork = [&](int lane, WorkItem &out) {
+        {
+            std::lock_guard<std::mutex> lock(lanes[lane]->mutex);
+            if (!lanes[lane]->items.empty()) {
+                out = std::move(lanes[lane]->items.back());
+                lanes[lane]->items.pop_back();
+                return true;
+            }
+        }
+        for (int offset = 1; offset < laneCount; ++offset) {
+            WalkLane &victim = *lanes[(lane + offset) % laneCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty()) {
+                // Oldest entries are the shallowest, they carry the most work
+                out = std::move(victim.items.front());
+                victim.items.pop_front();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto push = [&](int lane, WorkItem item) {
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(lanes[lane]->mutex);
+            lanes[lane]->items.push_back(std::move(item));
+        }
+        idle.notify_one();
+    };
+
+    auto statEntries = [&](int lane, const WorkItem &batch) {
+        const std::optional<afc_client_t> &afc = clients[lane];
+        for (const std::string &name : batch.names) {
+            if (cancel && cancel->load())
+                break;
+
+            MediaEntry entry;
+            entry.name = name;
+            const std::string path = joinPath(batch.path, entry.name);
+            char **info = nullptr;
+            if (ServiceManager::safeAfcGetFileInfo(device, path.c_str(), &info,
+                                                   afc) != AFC_E_SUCCESS ||
+                !info) {
+                continue;
+            }
+            parse_afc_file_info(info, entry);
+            afc_dictionary_free(info);
+            if (cache)
+                cache->storeStat(path, entry);
+
+            const std::string relativePath =
+                joinPath(batch.relativePath, entry.name);
+            if (entry.isSymlink) {
+                continue;
+            } else if (entry.isDir) {
+                push(lane, {path, relativePath, {}});
+            } else {
+                files++;
+                onFile(path, relativePath, entry);
+            }
+        }
+    };
+
+    auto listDirectory = [&](int lane, const WorkItem &dir) {
+        char **names = nullptr;
+        if (ServiceManager::safeAfcReadDirectory(device, dir.path.c_str(),
+                                                 &names, clients[lane]) !=
+                AFC_E_SUCCESS ||
+            !names) {
+            qDebug() << "Tree walk could not list" << dir.path.c_str();
+            return;
+        }
+        directories++;
+
+        WorkItem batch{dir.path, dir.relativePath, {}};
+        for (int i = 0; names[i]; i++) {
+            if (strcmp(names[i], ".") == 0 || strcmp(names[i], "..") == 0)
+                continue;
+            batch.names.emplace_back(names[i]);
+            // Full batches go where idle lanes can steal them
+            if (laneCount > 1 && batch.names.size() == STAT_BATCH) {
+                push(lane, std::move(batch));
+                batch = WorkItem{dir.path, dir.relativePath, {}};
+            }
+        }
+        afc_dictionary_free(names);
+        statEntries(lane, batch);
+    };
+
+    auto runLane = [&](int lane) {
+        WorkItem item;
+        while (!(cancel && cancel->load())) {
+            if (takeWork(lane, item)) {
+                if (item.names.empty()) {
+                    listDirectory(lane, item);
+                } else {
+                    statEntries(lane, item);
+                }
+                if (--pending == 0)
+                    idle.notify_all();
+                continue;
+            }
+            if (pending.load() == 0)
+                break;
+            // Someone is still listing and may push more directories
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idle.wait_for(lock, std::chrono::milliseconds(IDLE_WAIT_MS));
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int lane = 1; lane < laneCount; ++lane) {
+        threads.emplace_back(runLane, lane);
+    }
+    runLane(0);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    stats.directories = directories.load();
+    stats.files = files.load();
+    stats.elapsedMs = timer.elapsed();
+    qDebug() << "Tree walk of" << roots.size() << "roots:" << stats.files
+             << "files in" << stats.directories << "directories on"
+             << stats.lanes << "lanes," << stats.elapsedMs << "ms";
+    return stats;
+}
@@ -0,0 +1,84 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef AFCTREEWALKER_H
+#define AFCTREEWALKER_H
+
+#include "iDescriptor.h"
+#include <QtGlobal>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Walks device directory trees on several AFC connections at once
+ *
+ * Every lane owns a deque of directories still to be listed. A lane works
+ * depth first off the back of its own deque and, once that runs dry, steals
+ * from the front of another lane's, so a single deep subtree doesn't leave
+ * the other connections idle. A large directory's entries are split into
+ * batches of stats that go on the same deque, so the other lanes can take
+ * part of a folder such as a full DCIM/100APPLE as well. Files are
+ * reported through the callback as
+ * soon as they are stat'ed, from whichever lane found them, which lets a
+ * consumer start on them while the walk is still running.
+ *
+ * Symlinks are reported neither as files nor followed, device trees contain
+ * loops through them. Stats of the default namespace go into the device's
+ * AfcMetadataCache on the way.
+ */
+class AfcTreeWalker
+{
+public:
+    /*
+        path is the absolute device path, relativePath starts with the name
+        of the root it was found under ("DCIM/100APPLE/IMG_0001.JPG")
+    */
+    using FileCallback = std::function<void(const std::string &path,
+                                            const std::string &relativePath,
+                                            const MediaEntry &entry)>;
+
+    struct Stats {
+        size_t directories = 0;
+        size_t files = 0;
+        int lanes = 0;
+        qint64 elapsedMs = 0;
+    };
+
+    static Stats walk(iDescriptorDevice *device,
+                      const std::vector<std::string> &roots,
+                      const FileCallback &onFile,
+                      std::optional<afc_client_t> altAfc = std::nullopt,
+                      int maxLanes = DEFAULT_LANES,
+                      const std::atomic<bool> *cancel = nullptr);
+
+    static constexpr int DEFAULT_LANES = 2;
+
+private:
+    // Entries per stat batch, one lane stats smaller directories alone
+    static constexpr size_t STAT_BATCH = 64;
+    // How long an idle lane sleeps before looking for work to steal again
+    static constexpr int IDLE_WAIT_MS = 2;
+    // Falls back to the shared client after that
+    static constexpr int FIRST_LANE_TIMEOUT_MS = 2000;
+};
+
+#endif // AFCTREEWALKER_H
@@ -18,6 +18,10 @@
  */
 
 #include "appcontext.h"
+#include "afcioqueue.h"
+#include "afcmetadatacache.h"
+#include "afctransfertuner.h"
+#include "devicebenchmark.h"
 #include "iDescriptor.h"
 #include "mainwindow.h"
 #include "settingsmanager.h"
@@ -105,8 +109,16 @@ void AppContext::addDevice(QString udid, idevice_connection_type conn_type,
             .afcClient = initResult.afcClient,
             .afc2Client = initResult.afc2Client,
             .mutex = new std::recursive_mutex(),
+            .afcPool = std::make_shared<AfcClientPool>(initResult.device,
+                                                       AFC_POOL_CAPACITY),
+            .afcMetadataCache = std::make_shared<AfcMetadataCache>(),
+            .ioQueue = std::make_shared<AfcIoQueue>(
+                QString("afc-io-%1").arg(udid)),
+            .transferTuner =
+                std::make_shared<AfcTransferTuner>(udid.toStdString()),
         };
         m_devices[device->udid] = device;
+        DeviceBenchmark::scheduleFor(device);
         if (addType == AddType::Regular) {
             SettingsManager::sharedInstance()->doIfEnabled(
                 SettingsManager::Setting::AutoRaiseWindow, []() {
@@ -172,8 +184,24 @@ void AppContext::removeDevice(QString _udid)
     emit deviceRemoved(udid);
     emit deviceChange();
 
+    // Async jobs may wait for the device mutex, drain them before taking it
+    if (device->ioQueue)
+        device->ioQueue->stop();
+
     std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
+    if (device->afcMetadataCache) {
+        const AfcMetadataCache::Stats stats = device->afcMetadataCache->stats();
+        qDebug() << "AFC metadata cache for" << _udid
+                 << "stat hits:" << stats.statHits
+                 << "misses:" << stats.statMisses
+                 << "listing hits:" << stats.directoryHits
+                 << "misses:" << stats.directoryMisses;
+    }
+
+    // Pooled connections must go before the idevice_t they were opened on
+    if (device->afcPool)
+        device->afcPool->shutdown();
     if (device->afcClient)
         afc_client_free(device->afcClient);
     if (device->afc2Client)
@@ -266,6 +294,10 @@ AppContext::~AppContext()
 {
     for (auto device : m_devices) {
         emit deviceRemoved(device->udid);
+        if (device->ioQueue)
+            device->ioQueue->stop();
+        if (device->afcPool)
+            device->afcPool->shutdown();
         if (device->afcClient)
             afc_client_free(device->afcClient);
         if (device->afc2Client)
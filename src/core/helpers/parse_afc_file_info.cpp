@@ -0,0 +1,44 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "../../iDescriptor.h"
+#include <cstdlib>
+#include <string.h>
+
+void parse_afc_file_info(char **info, MediaEntry &entry)
+{
+    if (!info)
+        return;
+
+    for (int i = 0; info[i] && info[i + 1]; i += 2) {
+        const char *key = info[i];
+        const char *value = info[i + 1];
+        if (strcmp(key, "st_ifmt") == 0) {
+            entry.isDir = strcmp(value, "S_IFDIR") == 0;
+            entry.isSymlink = strcmp(value, "S_IFLNK") == 0;
+        } else if (strcmp(key, "st_size") == 0) {
+            entry.size = strtoull(value, nullptr, 10);
+        } else if (strcmp(key, "st_mtime") == 0) {
+            entry.mtime = strtoull(value, nullptr, 10);
+        } else if (strcmp(key, "st_birthtime") == 0) {
+            entry.birthtime = strtoull(value, nullptr, 10);
+        }
+    }
+    entry.hasStat = true;
+}
@@ -41,41 +41,32 @@ AFCFileTree get_file_tree(afc_client_t afcClient, const std::string &path)
         if (entryName == "." || entryName == "..")
             continue;
 
-        char **info = NULL;
         std::string fullPath = path;
         if (fullPath.back() != '/')
             fullPath += "/";
         fullPath += entryName;
-        bool isDir = false;
+
+        MediaEntry entry;
+        entry.name = entryName;
+        char **info = NULL;
         if (afc_get_file_info(afcClient, fullPath.c_str(), &info) ==
                 AFC_E_SUCCESS &&
             info) {
-            if (entryName == "var") {
-                qDebug() << "File info for var:" << info[0] << info[1]
-                         << info[2] << info[3] << info[4] << info[5];
-            }
-            for (int j = 0; info[j]; j += 2) {
-                if (strcmp(info[j], "st_ifmt") == 0) {
-                    if (strcmp(info[j + 1], "S_IFDIR") == 0) {
-                        isDir = true;
-                    } else if (strcmp(info[j + 1], "S_IFLNK") == 0) {
-                        /*symlink*/
-                        char **dir_contents = NULL;
-                        if (afc_read_directory(afcClient, fullPath.c_str(),
-                                               &dir_contents) ==
-                            AFC_E_SUCCESS) {
-                            isDir = true;
-                            if (dir_contents) {
-                                afc_dictionary_free(dir_contents);
-                            }
-                        }
-                    }
-                    break;
+            parse_afc_file_info(info, entry);
+            afc_dictionary_free(info);
+        }
+        if (entry.isSymlink) {
+            /* symlinks that can be listed are treated as directories */
+            char **dir_contents = NULL;
+            if (afc_read_directory(afcClient, fullPath.c_str(),
+                                   &dir_contents) == AFC_E_SUCCESS) {
+                entry.isDir = true;
+                if (dir_contents) {
+                    afc_dictionary_free(dir_contents);
                 }
             }
-            afc_dictionary_free(info);
         }
-        result.entries.push_back({entryName, isDir});
+        result.entries.push_back(std::move(entry));
     }
     if (dirs) {
         afc_dictionary_free(dirs);
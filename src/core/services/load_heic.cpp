@@ -22,44 +22,75 @@
 #include <QDebug>
 #include <QImage>
 #include <QPixmap>
+#include <QThread>
 #include <libheif/heif.h>
+#include <vector>
 
-QPixmap load_heic(const QByteArray &imageData)
+namespace
 {
-    heif_context *ctx = heif_context_alloc();
-    if (!ctx) {
-        qWarning() << "Failed to allocate heif_context";
-        return QPixmap();
-    }
-
-    heif_error err = heif_context_read_from_memory(ctx, imageData.constData(),
-                                                   imageData.size(), nullptr);
-    if (err.code != heif_error_Ok) {
-        qWarning() << "Failed to read HEIC from memory:" << err.message;
-        heif_context_free(ctx);
-        return QPixmap();
+/*
+    Smallest thumbnail item that covers targetSize, nullptr if there is none.
+    The caller releases the returned handle.
+*/
+heif_image_handle *thumbnailFor(heif_image_handle *primary,
+                                const QSize &targetSize)
+{
+    const int count = heif_image_handle_get_number_of_thumbnails(primary);
+    if (count <= 0) {
+        return nullptr;
     }
+    std::vector<heif_item_id> ids(count);
+    heif_image_handle_get_list_of_thumbnail_IDs(primary, ids.data(), count);
 
-    heif_image_handle *handle;
-    err = heif_context_get_primary_image_handle(ctx, &handle);
-    if (err.code != heif_error_Ok) {
-        qWarning() << "Failed to get primary image handle:" << err.message;
-        heif_context_free(ctx);
-        return QPixmap();
+    heif_image_handle *best = nullptr;
+    qint64 bestArea = 0;
+    for (heif_item_id id : ids) {
+        heif_image_handle *candidate = nullptr;
+        if (heif_image_handle_get_thumbnail(primary, id, &candidate).code !=
+            heif_error_Ok) {
+            continue;
+        }
+        const QSize size(heif_image_handle_get_width(candidate),
+                         heif_image_handle_get_height(candidate));
+        const QSize fitted = size.scaled(targetSize, Qt::KeepAspectRatio);
+        const qint64 area = qint64(size.width()) * size.height();
+        if (fitted.width() <= size.width() &&
+            fitted.height() <= size.height() && (!best || area < bestArea)) {
+            if (best) {
+                heif_image_handle_release(best);
+            }
+            best = candidate;
+            bestArea = area;
+        } else {
+            heif_image_handle_release(candidate);
+        }
     }
+    return best;
+}
 
-    heif_image *img;
-    err = heif_decode_image(handle, &img, heif_colorspace_RGB,
-                            heif_chroma_interleaved_RGB, nullptr);
+QImage decodeHandle(heif_image_handle *handle)
+{
+    heif_image *img = nullptr;
+    heif_error err = heif_decode_image(handle, &img, heif_colorspace_RGB,
+                                       heif_chroma_interleaved_RGBA, nullptr);
     if (err.code != heif_error_Ok) {
         qWarning() << "Failed to decode HEIC image:" << err.message;
-        heif_image_handle_release(handle);
-        heif_context_free(ctx);
-        return QPixmap();
+        return QImage();
     }
+    return heif_image_to_qimage(img,
+                                heif_image_handle_has_alpha_channel(handle));
+}
+} // namespace
 
-    int width = heif_image_get_width(img, heif_channel_interleaved);
-    int height = heif_image_get_height(img, heif_channel_interleaved);
+/*
+    The QImage owns the libheif plane, so no copy or format conversion
+    follows. libheif fills the alpha of opaque images with 0xFF, which
+    already is premultiplied.
+*/
+QImage heif_image_to_qimage(heif_image *img, bool hasAlpha)
+{
+    const int width = heif_image_get_width(img, heif_channel_interleaved);
+    const int height = heif_image_get_height(img, heif_channel_interleaved);
     int stride;
     /*
      FIXME: use heif_image_get_plane_readonly2 in future, on ubuntu 24 it's not
@@ -67,21 +98,114 @@ QPixmap load_heic(const QByteArray &imageData)
     */
     const uint8_t *data =
         heif_image_get_plane_readonly(img, heif_channel_interleaved, &stride);
-
     if (!data) {
         qWarning() << "Failed to get image plane data";
         heif_image_release(img);
-        heif_image_handle_release(handle);
-        heif_context_free(ctx);
-        return QPixmap();
+        return QImage();
+    }
+
+    QImage result(
+        data, width, height, stride,
+        hasAlpha ? QImage::Format_RGBA8888
+                 : QImage::Format_RGBA8888_Premultiplied,
+        [](void *img) { heif_image_release(static_cast<heif_image *>(img)); },
+        img);
+    if (hasAlpha) {
+        result.convertTo(QImage::Format_RGBA8888_Premultiplied);
+    }
+    return result;
+}
+
+QImage load_heic_image(heif_context *ctx, const QSize &targetSize,
+                       bool thumbnailOnly)
+{
+    // Grid images decode their tiles in parallel
+    heif_context_set_max_decoding_threads(ctx, QThread::idealThreadCount());
+
+    heif_image_handle *handle;
+    heif_error err = heif_context_get_primary_image_handle(ctx, &handle);
+    if (err.code != heif_error_Ok) {
+        qWarning() << "Failed to get primary image handle:" << err.message;
+        return QImage();
     }
 
-    QImage qimg(data, width, height, stride, QImage::Format_RGB888);
-    QPixmap result = QPixmap::fromImage(qimg);
+    // iPhones store a ~320px thumbnail item next to the 48 tile primary
+    if (targetSize.isValid()) {
+        if (heif_image_handle *thumbnail = thumbnailFor(handle, targetSize)) {
+            heif_image_handle_release(handle);
+            handle = thumbnail;
+        } else if (thumbnailOnly) {
+            heif_image_handle_release(handle);
+            return QImage();
+        }
+    }
 
-    heif_image_release(img);
+    QImage result = decodeHandle(handle);
     heif_image_handle_release(handle);
-    heif_context_free(ctx);
 
+    if (!result.isNull() && targetSize.isValid() &&
+        (result.width() > targetSize.width() ||
+         result.height() > targetSize.height())) {
+        result = result.scaled(targetSize, Qt::KeepAspectRatio,
+                               Qt::SmoothTransformation);
+    }
     return result;
 }
+
+QByteArray heic_exif(heif_context *ctx)
+{
+    heif_image_handle *handle;
+    if (heif_context_get_primary_image_handle(ctx, &handle).code !=
+        heif_error_Ok) {
+        return QByteArray();
+    }
+
+    QByteArray exif;
+    heif_item_id id;
+    if (heif_image_handle_get_list_of_metadata_block_IDs(handle, "Exif", &id,
+                                                         1) == 1) {
+        QByteArray block(heif_image_handle_get_metadata_size(handle, id),
+                         Qt::Uninitialized);
+        if (block.size() > 4 &&
+            heif_image_handle_get_metadata(handle, id, block.data()).code ==
+                heif_error_Ok) {
+            // The block starts with the big-endian offset of the TIFF header
+            const quint32 offset =
+                (quint32(uchar(block[0])) << 24) |
+                (quint32(uchar(block[1])) << 16) |
+                (quint32(uchar(block[2])) << 8) | quint32(uchar(block[3]));
+            if (offset < quint32(block.size() - 4)) {
+                exif = block.mid(4 + offset);
+            }
+        }
+    }
+    heif_image_handle_release(handle);
+    return exif;
+}
+
+QImage load_heic_image(const QByteArray &imageData, const QSize &targetSize)
+{
+    heif_context *ctx = heif_context_alloc();
+    if (!ctx) {
+        qWarning() << "Failed to allocate heif_context";
+        return QImage();
+    }
+
+    heif_error err = heif_context_read_from_memory(ctx, imageData.constData(),
+                                                   imageData.size(), nullptr);
+    if (err.code != heif_error_Ok) {
+        qWarning() << "Failed to read HEIC from memory:" << err.message;
+        heif_context_free(ctx);
+        return QImage();
+    }
+
+    // The decoded image owns its plane and outlives the context
+    QImage result = load_heic_image(ctx, targetSize);
+    heif_context_free(ctx);
+    return result;
+}
+
+QPixmap load_heic(const QByteArray &imageData, const QSize &targetSize)
+{
+    return QPixmap::fromImage(load_heic_image(imageData, targetSize));
+}
@@ -0,0 +1,77 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "devicebenchmark.h"
+#include "afcdirectorylister.h"
+#include "afcioqueue.h"
+#include "importmanager.h"
+#include <QDebug>
+#include <QTemporaryFile>
+
+void DeviceBenchmark::scheduleFor(iDescriptorDevice *device)
+{
+    if (!device || !device->ioQueue)
+        return;
+
+    if (qEnvironmentVariableIsSet("IDESCRIPTOR_BENCHMARK_LISTING")) {
+        device->ioQueue->submit<void>(
+            [device](QPromise<void> &) { runListingBenchmark(device); });
+    }
+    if (qEnvironmentVariableIsSet("IDESCRIPTOR_BENCHMARK_IMPORT")) {
+        device->ioQueue->submit<void>(
+            [device](QPromise<void> &) { runImportBenchmark(device); });
+    }
+}
+
+void DeviceBenchmark::runListingBenchmark(iDescriptorDevice *device)
+{
+    QString path = qEnvironmentVariable("IDESCRIPTOR_BENCHMARK_LISTING");
+    if (path.isEmpty())
+        path = QString::fromLatin1(DEFAULT_LISTING_PATH);
+
+    AfcDirectoryLister::benchmark(device, path.toStdString());
+}
+
+void DeviceBenchmark::runImportBenchmark(iDescriptorDevice *device)
+{
+    int megabytes =
+        qEnvironmentVariableIntValue("IDESCRIPTOR_BENCHMARK_IMPORT");
+    if (megabytes <= 0)
+        megabytes = DEFAULT_IMPORT_MB;
+
+    QTemporaryFile scratch;
+    if (!scratch.open()) {
+        qWarning() << "Import benchmark: cannot create scratch file";
+        return;
+    }
+    // Not all zeros so nothing along the way can shortcut the payload
+    QByteArray chunk(1024 * 1024, Qt::Uninitialized);
+    for (int i = 0; i < chunk.size(); ++i)
+        chunk[i] = static_cast<char>((i * 131) ^ (i >> 8));
+    for (int i = 0; i < megabytes; ++i) {
+        if (scratch.write(chunk) != chunk.size()) {
+            qWarning() << "Import benchmark: cannot fill scratch file";
+            return;
+        }
+    }
+    scratch.close();
+
+    ImportManager::benchmark(device, scratch.fileName(),
+                             QString::fromLatin1(SCRATCH_DEVICE_PATH));
+}
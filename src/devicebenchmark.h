@@ -0,0 +1,51 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEVICEBENCHMARK_H
+#define DEVICEBENCHMARK_H
+
+#include "iDescriptor.h"
+
+/**
+ * @brief Developer benchmarks that run once per connected device
+ *
+ * Each benchmark is opt-in through an environment variable and runs as a
+ * job on the device's I/O thread, so it never blocks the GUI or a user's
+ * transfer and is drained like any other job when the device goes away.
+ * Uploads only touch their own scratch file and scratch path.
+ *
+ *   IDESCRIPTOR_BENCHMARK_LISTING=<path>  directory listing, /DCIM by default
+ *   IDESCRIPTOR_BENCHMARK_IMPORT=<MB>     upload timing, 32 MB by default
+ */
+class DeviceBenchmark
+{
+public:
+    static void scheduleFor(iDescriptorDevice *device);
+
+private:
+    static void runListingBenchmark(iDescriptorDevice *device);
+    static void runImportBenchmark(iDescriptorDevice *device);
+
+    static constexpr const char *DEFAULT_LISTING_PATH = "/DCIM";
+    static constexpr int DEFAULT_IMPORT_MB = 32;
+    static constexpr const char *SCRATCH_DEVICE_PATH =
+        "/.iDescriptor-benchmark";
+};
+
+#endif // DEVICEBENCHMARK_H
@@ -0,0 +1,413 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "embeddedthumbnailreader.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QTransform>
+#include <QtEndian>
+#include <cstdint>
+#include <cstring>
+#include <libheif/heif.h>
+
+namespace
+{
+// EXIF tags
+constexpr quint16 TAG_ORIENTATION = 0x0112;
+constexpr quint16 TAG_THUMBNAIL_OFFSET = 0x0201;
+constexpr quint16 TAG_THUMBNAIL_LENGTH = 0x0202;
+constexpr int IFD_ENTRY_SIZE = 12;
+
+// A TIFF structure as found in the EXIF segment, offsets are relative to it
+class TiffData
+{
+public:
+    explicit TiffData(const QByteArray &data) : m_data(data)
+    {
+        if (m_data.startsWith("II")) {
+            m_valid = true;
+            m_littleEndian = true;
+        } else if (m_data.startsWith("MM")) {
+            m_valid = true;
+        }
+        m_valid = m_valid && u16(2) == 42;
+    }
+
+    bool isValid() const { return m_valid; }
+    const QByteArray &data() const { return m_data; }
+
+    bool contains(quint64 offset, quint64 length) const
+    {
+        return offset + length <= static_cast<quint64>(m_data.size());
+    }
+
+    quint16 u16(quint32 offset) const
+    {
+        if (!contains(offset, 2))
+            return 0;
+        const uchar *p =
+            reinterpret_cast<const uchar *>(m_data.constData()) + offset;
+        return m_littleEndian ? qFromLittleEndian<quint16>(p)
+                              : qFromBigEndian<quint16>(p);
+    }
+
+    quint32 u32(quint32 offset) const
+    {
+        if (!contains(offset, 4))
+            return 0;
+        const uchar *p =
+            reinterpret_cast<const uchar *>(m_data.constData()) + offset;
+        return m_littleEndian ? qFromLittleEndian<quint32>(p)
+                              : qFromBigEndian<quint32>(p);
+    }
+
+    // SHORT and LONG values that fit into the entry itself
+    quint32 value(quint32 entry) const
+    {
+        constexpr quint16 TYPE_SHORT = 3;
+        return u16(entry + 2) == TYPE_SHORT ? u16(entry + 8) : u32(entry + 8);
+    }
+
+private:
+    QByteArray m_data;
+    bool m_valid = false;
+    bool m_littleEndian = false;
+};
+
+// Orientation values 2-8 as defined by EXIF, 1 is upright
+QImage applyExifOrientation(const QImage &image, quint32 orientation)
+{
+    QImage result = image;
+    int rotation = 0;
+    switch (orientation) {
+    case 2:
+        result = result.mirrored(true, false);
+        break;
+    case 3:
+        rotation = 180;
+        break;
+    case 4:
+        result = result.mirrored(false, true);
+        break;
+    case 5:
+        result = result.mirrored(false, true);
+        rotation = 90;
+        break;
+    case 6:
+        rotation = 90;
+        break;
+    case 7:
+        result = result.mirrored(true, false);
+        rotation = 90;
+        break;
+    case 8:
+        rotation = 270;
+        break;
+    default:
+        break;
+    }
+    if (rotation != 0) {
+        result = result.transformed(QTransform().rotate(rotation));
+    }
+    return result;
+}
+
+// Whether image can be scaled to fit size without enlarging it
+bool coversSize(const QSize &image, const QSize &size)
+{
+    const QSize fitted = image.scaled(size, Qt::KeepAspectRatio);
+    return fitted.width() <= image.width() &&
+           fitted.height() <= image.height();
+}
+} // namespace
+
+EmbeddedThumbnailReader::EmbeddedThumbnailReader(
+    iDescriptorDevice *device, const QString &path,
+    std::optional<afc_client_t> altAfc)
+    : m_device(device), m_path(path.toUtf8()), m_afc(altAfc)
+{
+}
+
+EmbeddedThumbnailReader::~EmbeddedThumbnailReader() { close(); }
+
+bool EmbeddedThumbnailReader::supports(const QString &path)
+{
+    return path.endsWith(".JPG", Qt::CaseInsensitive) ||
+           path.endsWith(".JPEG", Qt::CaseInsensitive) ||
+           path.endsWith(".HEIC", Qt::CaseInsensitive) ||
+           path.endsWith(".HEIF", Qt::CaseInsensitive);
+}
+
+QImage EmbeddedThumbnailReader::read(const QSize &size)
+{
+    const QString path = QString::fromUtf8(m_path);
+    if (!supports(path) || !open()) {
+        return QImage();
+    }
+
+    const bool heif = path.endsWith(".HEIC", Qt::CaseInsensitive) ||
+                      path.endsWith(".HEIF", Qt::CaseInsensitive);
+    const QImage preview = heif ? readHeifPreview(size) : readJpegPreview();
+    close();
+
+    if (preview.isNull()) {
+        qDebug() << "No usable embedded preview in" << path << "after"
+                 << m_bytesRead << "bytes";
+        return QImage();
+    }
+    if (!coversSize(preview.size(), size)) {
+        qDebug() << "Embedded preview of" << path << "is too small:"
+                 << preview.size();
+        return QImage();
+    }
+    qDebug() << "Embedded preview of" << path << "read with" << m_bytesRead
+             << "of" << m_size << "bytes";
+    return preview.scaled(size, Qt::KeepAspectRatio,
+                          Qt::SmoothTransformation);
+}
+
+bool EmbeddedThumbnailReader::open()
+{
+    if (m_open) {
+        return true;
+    }
+
+    MediaEntry info;
+    if (ServiceManager::cachedStat(m_device, m_path.constData(), info,
+                                   m_afc) != AFC_E_SUCCESS ||
+        info.size == 0) {
+        return false;
+    }
+    m_size = info.size;
+
+    if (ServiceManager::safeAfcFileOpen(m_device, m_path.constData(),
+                                        AFC_FOPEN_RDONLY, &m_handle,
+                                        m_afc) != AFC_E_SUCCESS ||
+        m_handle == 0) {
+        qDebug() << "Could not open" << m_path << "for its preview";
+        return false;
+    }
+    m_open = true;
+    return true;
+}
+
+void EmbeddedThumbnailReader::close()
+{
+    if (m_open) {
+        ServiceManager::safeAfcFileClose(m_device, m_handle, m_afc);
+        m_open = false;
+        m_handle = 0;
+    }
+}
+
+bool EmbeddedThumbnailReader::readAt(uint64_t offset, uint32_t length,
+                                     char *out)
+{
+    if (!m_open || offset > m_size || length > m_size - offset) {
+        return false;
+    }
+
+    uint64_t block = offset / BLOCK_SIZE;
+    while (length > 0) {
+        auto it = m_blocks.find(block);
+        if (it == m_blocks.end()) {
+            const uint64_t start = block * BLOCK_SIZE;
+            const uint32_t want = static_cast<uint32_t>(
+                qMin<uint64_t>(BLOCK_SIZE, m_size - start));
+            if (m_bytesRead + want > MAX_READ_BYTES) {
+                qDebug() << "Preview of" << m_path << "is past the read budget";
+                return false;
+            }
+            if (ServiceManager::safeAfcFileSeek(m_device, m_handle, start,
+                                                SEEK_SET,
+                                                m_afc) != AFC_E_SUCCESS) {
+                return false;
+            }
+
+            QByteArray data(want, Qt::Uninitialized);
+            uint32_t filled = 0;
+            while (filled < want) {
+                uint32_t got = 0;
+                if (ServiceManager::safeAfcFileRead(
+                        m_device, m_handle, data.data() + filled,
+                        want - filled, &got, m_afc) != AFC_E_SUCCESS ||
+                    got == 0) {
+                    return false;
+                }
+                filled += got;
+            }
+            m_bytesRead += want;
+            it = m_blocks.insert(block, data);
+        }
+
+        const uint64_t within = offset - block * BLOCK_SIZE;
+        const uint32_t count = static_cast<uint32_t>(
+            qMin<uint64_t>(length, it->size() - within));
+        std::memcpy(out, it->constData() + within, count);
+        out += count;
+        offset += count;
+        length -= count;
+        block++;
+    }
+    return true;
+}
+
+QByteArray EmbeddedThumbnailReader::readAt(uint64_t offset, uint32_t length)
+{
+    QByteArray data(length, Qt::Uninitialized);
+    if (!readAt(offset, length, data.data())) {
+        return QByteArray();
+    }
+    return data;
+}
+
+QImage EmbeddedThumbnailReader::readJpegPreview()
+{
+    if (readAt(0, 2) != QByteArray("\xFF\xD8", 2)) {
+        return QImage();
+    }
+
+    // Walk the marker segments up to the image data looking for APP1/EXIF
+    QByteArray exif;
+    uint64_t offset = 2;
+    while (exif.isEmpty()) {
+        const QByteArray marker = readAt(offset, 4);
+        if (marker.size() != 4 || static_cast<uchar>(marker[0]) != 0xFF) {
+            return QImage();
+        }
+        const uchar type = static_cast<uchar>(marker[1]);
+        // Start of scan or end of image, the preview would have come first
+        if (type == 0xDA || type == 0xD9) {
+            return QImage();
+        }
+        const quint16 length = qFromBigEndian<quint16>(
+            reinterpret_cast<const uchar *>(marker.constData()) + 2);
+        if (length < 2) {
+            return QImage();
+        }
+        if (type == 0xE1) {
+            const QByteArray segment = readAt(offset + 4, length - 2);
+            if (segment.startsWith(QByteArray("Exif\0\0", 6))) {
+                exif = segment.mid(6);
+            }
+        }
+        offset += 2 + length;
+    }
+
+    const TiffData tiff(exif);
+    if (!tiff.isValid()) {
+        return QImage();
+    }
+
+    // IFD0 describes the photo, IFD1 after it the embedded thumbnail
+    const quint32 ifd0 = tiff.u32(4);
+    const quint16 ifd0Count = tiff.u16(ifd0);
+    quint32 orientation = 1;
+    for (quint16 i = 0; i < ifd0Count; ++i) {
+        const quint32 entry = ifd0 + 2 + i * IFD_ENTRY_SIZE;
+        if (tiff.u16(entry) == TAG_ORIENTATION) {
+            orientation = tiff.value(entry);
+        }
+    }
+    const quint32 ifd1 = tiff.u32(ifd0 + 2 + ifd0Count * IFD_ENTRY_SIZE);
+    if (ifd1 == 0 || !tiff.contains(ifd1, 2)) {
+        return QImage();
+    }
+
+    quint32 thumbnailOffset = 0;
+    quint32 thumbnailLength = 0;
+    const quint16 ifd1Count = tiff.u16(ifd1);
+    for (quint16 i = 0; i < ifd1Count; ++i) {
+        const quint32 entry = ifd1 + 2 + i * IFD_ENTRY_SIZE;
+        const quint16 tag = tiff.u16(entry);
+        if (tag == TAG_THUMBNAIL_OFFSET) {
+            thumbnailOffset = tiff.value(entry);
+        } else if (tag == TAG_THUMBNAIL_LENGTH) {
+            thumbnailLength = tiff.value(entry);
+        }
+    }
+    if (thumbnailOffset == 0 || thumbnailLength == 0 ||
+        !tiff.contains(thumbnailOffset, thumbnailLength)) {
+        return QImage();
+    }
+
+    const QImage thumbnail = QImage::fromData(
+        tiff.data().mid(thumbnailOffset, thumbnailLength), "JPG");
+    if (thumbnail.isNull()) {
+        return QImage();
+    }
+    return applyExifOrientation(thumbnail, orientation);
+}
+
+QImage EmbeddedThumbnailReader::readHeifPreview(const QSize &size)
+{
+    // libheif pulls the meta box and later the thumbnail item's data through
+    // these, the primary image's tiles are never touched
+    static const heif_reader reader = {
+        1,
+        [](void *userdata) -> int64_t {
+            return static_cast<EmbeddedThumbnailReader *>(userdata)
+                ->m_heifPosition;
+        },
+        [](void *data, size_t length, void *userdata) -> int {
+            auto *self = static_cast<EmbeddedThumbnailReader *>(userdata);
+            if (length > UINT32_MAX ||
+                !self->readAt(self->m_heifPosition,
+                              static_cast<uint32_t>(length),
+                              static_cast<char *>(data))) {
+                return 1;
+            }
+            self->m_heifPosition += static_cast<int64_t>(length);
+            return 0;
+        },
+        [](int64_t position, void *userdata) -> int {
+            auto *self = static_cast<EmbeddedThumbnailReader *>(userdata);
+            if (position < 0 ||
+                static_cast<uint64_t>(position) > self->m_size) {
+                return 1;
+            }
+            self->m_heifPosition = position;
+            return 0;
+        },
+        [](int64_t targetSize, void *userdata) -> heif_reader_grow_status {
+            auto *self = static_cast<EmbeddedThumbnailReader *>(userdata);
+            return static_cast<uint64_t>(targetSize) <= self->m_size
+                       ? heif_reader_grow_status_size_reached
+                       : heif_reader_grow_status_size_beyond_eof;
+        },
+    };
+
+    heif_context *ctx = heif_context_alloc();
+    if (!ctx) {
+        return QImage();
+    }
+    m_heifPosition = 0;
+    const heif_error err =
+        heif_context_read_from_reader(ctx, &reader, this, nullptr);
+    if (err.code != heif_error_Ok) {
+        qDebug() << "Could not read HEIF structure of" << m_path << ":"
+                 << err.message;
+        heif_context_free(ctx);
+        return QImage();
+    }
+
+    const QImage result = load_heic_image(ctx, size, true);
+    heif_context_free(ctx);
+    return result;
+}
@@ -0,0 +1,96 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EMBEDDEDTHUMBNAILREADER_H
+#define EMBEDDEDTHUMBNAILREADER_H
+
+#include "iDescriptor.h"
+#include <QByteArray>
+#include <QImage>
+#include <QMap>
+#include <QSize>
+#include <QString>
+#include <optional>
+
+/**
+ * @brief Pulls the preview a camera embedded in a photo off the device
+ *
+ * JPEGs carry a small JPEG in the second IFD of their APP1/EXIF segment and
+ * HEIC files a thumbnail item next to the primary image, both found by
+ * reading a few KB around the file's header. The file is read with seeks
+ * and bounded reads in BLOCK_SIZE blocks, never more than MAX_READ_BYTES in
+ * total, instead of pulling the whole 3-15 MB photo over AFC.
+ *
+ * read() returns a null image when the file has no preview, the preview is
+ * smaller than asked for or it lies past the read budget; the caller then
+ * falls back to decoding the full file.
+ */
+class EmbeddedThumbnailReader
+{
+public:
+    static constexpr uint32_t BLOCK_SIZE = 64 * 1024;
+    static constexpr uint64_t MAX_READ_BYTES = 1024 * 1024;
+
+    EmbeddedThumbnailReader(iDescriptorDevice *device, const QString &path,
+                            std::optional<afc_client_t> altAfc = std::nullopt);
+    ~EmbeddedThumbnailReader();
+
+    EmbeddedThumbnailReader(const EmbeddedThumbnailReader &) = delete;
+    EmbeddedThumbnailReader &
+    operator=(const EmbeddedThumbnailReader &) = delete;
+
+    // Whether path has a format that can carry an embedded preview
+    static bool supports(const QString &path);
+
+    // Scaled to fit size and upright per the photo's EXIF orientation
+    QImage read(const QSize &size);
+
+    // Bytes transferred from the device so far
+    uint64_t bytesRead() const { return m_bytesRead; }
+
+private:
+    bool open();
+    void close();
+
+    /*
+        Copies length bytes at offset into out from the block cache, reading
+        missing blocks from the device. Fails past the end of the file or
+        the read budget.
+    */
+    bool readAt(uint64_t offset, uint32_t length, char *out);
+    QByteArray readAt(uint64_t offset, uint32_t length);
+
+    QImage readJpegPreview();
+    QImage readHeifPreview(const QSize &size);
+
+    iDescriptorDevice *m_device;
+    QByteArray m_path;
+    std::optional<afc_client_t> m_afc;
+
+    uint64_t m_handle = 0;
+    bool m_open = false;
+    uint64_t m_size = 0;
+    uint64_t m_bytesRead = 0;
+    // Block index to contents, the last block may be short
+    QMap<uint64_t, QByteArray> m_blocks;
+    // Read position of the libheif reader
+    int64_t m_heifPosition = 0;
+};
+
+#endif // EMBEDDEDTHUMBNAILREADER_H
@@ -0,0 +1,596 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "exportarchive.h"
+#include <QDateTime>
+#include <QDebug>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+constexpr quint64 NS_PER_SEC = 1000000000ULL;
+// Largest size the 11 octal digits of a ustar size field can hold
+constexpr quint64 USTAR_SIZE_LIMIT = 077777777777ULL;
+constexpr qint64 PADDING_CHUNK = 64 * 1024;
+
+quint32 updateCrc32(quint32 crc, QByteArrayView data)
+{
+    static const std::array<quint32, 256> table = []() {
+        std::array<quint32, 256> entries{};
+        for (quint32 i = 0; i < 256; ++i) {
+            quint32 c = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (char byte : data) {
+        crc = table[(crc ^ static_cast<quint8>(byte)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+void put16(QByteArray &out, quint16 value)
+{
+    out.append(static_cast<char>(value & 0xFF));
+    out.append(static_cast<char>(value >> 8));
+}
+
+void put32(QByteArray &out, quint32 value)
+{
+    put16(out, value & 0xFFFF);
+    put16(out, value >> 16);
+}
+
+void put64(QByteArray &out, quint64 value)
+{
+    put32(out, value & 0xFFFFFFFF);
+    put32(out, value >> 32);
+}
+
+// Zero padded octal with a trailing NUL, width includes the NUL
+void putOctal(char *field, int width, quint64 value)
+{
+    std::snprintf(field, width, "%0*llo", width - 1,
+                  static_cast<unsigned long long>(value));
+}
+
+QByteArray tarHeader(const QByteArray &name, quint64 size, quint64 mtime,
+                     char type)
+{
+    QByteArray header(512, '\0');
+    char *h = header.data();
+    std::memcpy(h, name.constData(), std::min<qsizetype>(name.size(), 100));
+    putOctal(h + 100, 8, 0644);
+    putOctal(h + 108, 8, 0);
+    putOctal(h + 116, 8, 0);
+    putOctal(h + 124, 12, size <= USTAR_SIZE_LIMIT ? size : 0);
+    putOctal(h + 136, 12, mtime);
+    std::memset(h + 148, ' ', 8);
+    h[156] = type;
+    std::memcpy(h + 257, "ustar", 6);
+    std::memcpy(h + 263, "00", 2);
+
+    unsigned int checksum = 0;
+    for (char byte : header) {
+        checksum += static_cast<unsigned char>(byte);
+    }
+    std::snprintf(h + 148, 8, "%06o", checksum);
+    return header;
+}
+
+// "<length> key=value\n", where length counts the whole record
+QByteArray paxRecord(const QByteArray &key, const QByteArray &value)
+{
+    const QByteArray body = " " + key + "=" + value + "\n";
+    qsizetype length = body.size();
+    while (QByteArray::number(length).size() + body.size() != length) {
+        length = QByteArray::number(length).size() + body.size();
+    }
+    return QByteArray::number(length) + body;
+}
+
+QByteArray paxTime(quint64 ns)
+{
+    return QByteArray::number(ns / NS_PER_SEC) + "." +
+           QByteArray::number(ns % NS_PER_SEC).rightJustified(9, '0');
+}
+
+QByteArray tarPadding(quint64 size)
+{
+    return QByteArray((512 - size % 512) % 512, '\0');
+}
+} // namespace
+
+std::unique_ptr<ExportArchive> ExportArchive::create(const QString &path,
+                                                     Format format)
+{
+    std::unique_ptr<ExportArchive> archive(new ExportArchive(path, format));
+    if (!archive->m_file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not create archive" << path << ":"
+                   << archive->m_file.errorString();
+        return nullptr;
+    }
+    if (format == Format::Zip && !archive->m_centralDirectory.open()) {
+        qWarning() << "Could not create the central directory spool for"
+                   << path << ":" << archive->m_centralDirectory.errorString();
+        return nullptr;
+    }
+    return archive;
+}
+
+QString ExportArchive::suffixFor(Format format)
+{
+    return format == Format::Zip ? QStringLiteral("zip")
+                                 : QStringLiteral("tar");
+}
+
+ExportArchive::ExportArchive(const QString &path, Format format)
+    : m_file(path), m_path(path), m_format(format)
+{
+}
+
+ExportArchive::~ExportArchive()
+{
+    if (!m_finished) {
+        discard();
+    }
+}
+
+QString ExportArchive::beginEntry(const QString &name, quint64 size,
+                                  quint64 mtimeNs, quint64 birthtimeNs)
+{
+    if (m_inEntry) {
+        endEntry();
+    }
+    if (!m_error.isEmpty() || m_finished) {
+        return QString();
+    }
+
+    const QString entryName = uniqueEntryName(name);
+    m_entryName = entryName;
+    m_entryOffset = m_file.pos();
+    m_entrySize = size;
+    m_entryWritten = 0;
+    m_entryOverflow = false;
+
+    const QByteArray encoded = entryName.toUtf8();
+    const bool ok = m_format == Format::Tar
+                        ? beginTarEntry(encoded, mtimeNs, birthtimeNs)
+                        : beginZipEntry(encoded, mtimeNs, birthtimeNs);
+    if (!ok) {
+        return QString();
+    }
+    m_inEntry = true;
+    return entryName;
+}
+
+bool ExportArchive::write(QByteArrayView data)
+{
+    if (!m_inEntry || !m_error.isEmpty()) {
+        return false;
+    }
+
+    // Tar headers carry the size up front, a file that grew since it was
+    // stat'ed is cut off there
+    const quint64 room = m_entrySize - m_entryWritten;
+    if (static_cast<quint64>(data.size()) > room) {
+        m_entryOverflow = true;
+        data = data.first(static_cast<qsizetype>(room));
+    }
+    if (data.isEmpty()) {
+        return true;
+    }
+
+    if (m_file.write(data.data(), data.size()) != data.size()) {
+        return fail(m_file.errorString());
+    }
+    if (m_format == Format::Zip) {
+        m_crc = updateCrc32(m_crc, data);
+    }
+    m_entryWritten += data.size();
+    return true;
+}
+
+bool ExportArchive::endEntry()
+{
+    if (!m_inEntry) {
+        return false;
+    }
+    m_inEntry = false;
+
+    const bool ok =
+        m_format == Format::Tar ? endTarEntry() : endZipEntry();
+    if (ok && m_entryWritten != m_entrySize) {
+        qWarning() << "Archive entry got" << m_entryWritten << "of"
+                   << m_entrySize << "bytes";
+    }
+    return ok && !m_entryOverflow && m_entryWritten == m_entrySize;
+}
+
+bool ExportArchive::abortEntry()
+{
+    if (!m_inEntry) {
+        return false;
+    }
+    m_inEntry = false;
+    m_entryNames.remove(nameKey(m_entryName));
+
+    // Everything from its headers on goes, the next entry starts there
+    if (!m_file.seek(m_entryOffset) || !m_file.resize(m_entryOffset)) {
+        return fail(m_file.errorString());
+    }
+    return true;
+}
+
+bool ExportArchive::addEntry(const QString &name, const QByteArray &data,
+                             quint64 mtimeNs)
+{
+    if (beginEntry(name, data.size(), mtimeNs, 0).isEmpty()) {
+        return false;
+    }
+    write(data);
+    return endEntry();
+}
+
+bool ExportArchive::finish()
+{
+    if (m_inEntry) {
+        endEntry();
+    }
+    if (!m_error.isEmpty() || m_finished) {
+        return false;
+    }
+
+    const bool trailerWritten =
+        m_format == Format::Tar
+            ? writeRaw(QByteArray(2 * TAR_BLOCK_SIZE, '\0'))
+            : writeZipCentralDirectory();
+    if (!trailerWritten) {
+        return false;
+    }
+    if (!m_file.commit()) {
+        return fail(m_file.errorString());
+    }
+    m_finished = true;
+    qDebug() << "Wrote archive" << m_path << "with" << entryCount()
+             << "entries";
+    return true;
+}
+
+void ExportArchive::discard()
+{
+    m_inEntry = false;
+    m_file.cancelWriting();
+}
+
+size_t ExportArchive::nameKey(const QString &name)
+{
+    return qHash(name);
+}
+
+QString ExportArchive::uniqueEntryName(const QString &name)
+{
+    if (!m_entryNames.contains(nameKey(name))) {
+        m_entryNames.insert(nameKey(name));
+        return name;
+    }
+
+    // Same numbering as exported files get next to an existing one
+    const int slash = name.lastIndexOf('/');
+    const QString directory = name.left(slash + 1);
+    const QString fileName = name.mid(slash + 1);
+    const int dot = fileName.lastIndexOf('.');
+    const QString baseName = dot > 0 ? fileName.left(dot) : fileName;
+    const QString suffix = dot > 0 ? fileName.mid(dot) : QString();
+
+    QString candidate;
+    int counter = 1;
+    do {
+        candidate =
+            directory + QString("%1_%2%3").arg(baseName).arg(counter).arg(
+                            suffix);
+        counter++;
+    } while (m_entryNames.contains(nameKey(candidate)));
+
+    m_entryNames.insert(nameKey(candidate));
+    return candidate;
+}
+
+bool ExportArchive::writeRaw(const QByteArray &data)
+{
+    if (!m_error.isEmpty()) {
+        return false;
+    }
+    if (m_file.write(data) != data.size()) {
+        return fail(m_file.errorString());
+    }
+    return true;
+}
+
+bool ExportArchive::fail(const QString &error)
+{
+    m_error = error;
+    qWarning() << "Archive" << m_path << "failed:" << error;
+    return false;
+}
+
+bool ExportArchive::beginTarEntry(const QByteArray &name, quint64 mtimeNs,
+                                  quint64 birthtimeNs)
+{
+    // A pax header in front of every entry keeps nanosecond times, the
+    // birth time and names or sizes ustar has no room for
+    QByteArray records;
+    if (name.size() > 100) {
+        records += paxRecord("path", name);
+    }
+    if (m_entrySize > USTAR_SIZE_LIMIT) {
+        records += paxRecord("size", QByteArray::number(m_entrySize));
+    }
+    if (mtimeNs > 0) {
+        records += paxRecord("mtime", paxTime(mtimeNs));
+    }
+    if (birthtimeNs > 0) {
+        records += paxRecord("LIBARCHIVE.creationtime", paxTime(birthtimeNs));
+    }
+
+    const quint64 mtime =
+        mtimeNs > 0 ? mtimeNs / NS_PER_SEC
+                    : QDateTime::currentSecsSinceEpoch();
+    QByteArray header;
+    if (!records.isEmpty()) {
+        const QByteArray paxName =
+            "PaxHeaders/" + name.mid(name.lastIndexOf('/') + 1).left(89);
+        header += tarHeader(paxName, records.size(), mtime, 'x');
+        header += records;
+        header += tarPadding(records.size());
+    }
+    header += tarHeader(name, m_entrySize, mtime, '0');
+    return writeRaw(header);
+}
+
+bool ExportArchive::endTarEntry()
+{
+    // The header promised m_entrySize bytes, keep the archive readable
+    quint64 missing = m_entrySize - m_entryWritten;
+    while (missing > 0) {
+        const qint64 padding =
+            std::min<quint64>(missing, static_cast<quint64>(PADDING_CHUNK));
+        if (!writeRaw(QByteArray(padding, '\0'))) {
+            return false;
+        }
+        missing -= padding;
+    }
+    return writeRaw(tarPadding(m_entrySize));
+}
+
+bool ExportArchive::beginZipEntry(const QByteArray &name, quint64 mtimeNs,
+                                  quint64 birthtimeNs)
+{
+    const qint64 mtime = mtimeNs > 0
+                             ? static_cast<qint64>(mtimeNs / NS_PER_SEC)
+                             : QDateTime::currentSecsSinceEpoch();
+    QDateTime local = QDateTime::fromSecsSinceEpoch(mtime);
+    // DOS times start in 1980
+    if (local.date().year() < 1980) {
+        local = QDateTime(QDate(1980, 1, 1), QTime(0, 0));
+    }
+
+    m_zipEntry = ZipEntry();
+    m_zipEntry.name = name;
+    m_zipEntry.offset = m_file.pos();
+    m_zipEntry.size = m_entrySize;
+    m_zipEntry.zip64 = m_entrySize >= ZIP32_LIMIT;
+    m_zipEntry.mtime = static_cast<quint32>(mtime);
+    m_zipEntry.dosDate = ((local.date().year() - 1980) << 9) |
+                         (local.date().month() << 5) | local.date().day();
+    m_zipEntry.dosTime = (local.time().hour() << 11) |
+                         (local.time().minute() << 5) |
+                         (local.time().second() / 2);
+    m_zipEntry.timestampFlags = birthtimeNs > 0 ? 0x05 : 0x01;
+    m_crc = 0;
+
+    // Extended timestamp, modification and creation time in Unix seconds
+    QByteArray extra;
+    put16(extra, 0x5455);
+    put16(extra, birthtimeNs > 0 ? 9 : 5);
+    extra.append(static_cast<char>(m_zipEntry.timestampFlags));
+    put32(extra, m_zipEntry.mtime);
+    if (birthtimeNs > 0) {
+        put32(extra, static_cast<quint32>(birthtimeNs / NS_PER_SEC));
+    }
+
+    m_zip64ExtraOffset = -1;
+    if (m_zipEntry.zip64) {
+        m_zip64ExtraOffset = m_zipEntry.offset + 30 + name.size() +
+                             extra.size() + 4;
+        put16(extra, 0x0001);
+        put16(extra, 16);
+        put64(extra, m_entrySize);
+        put64(extra, m_entrySize);
+    }
+
+    // Sizes are known from the stat, only the CRC is patched in afterwards,
+    // so no data descriptor is needed
+    const quint32 size32 =
+        m_zipEntry.zip64 ? 0xFFFFFFFFU : static_cast<quint32>(m_entrySize);
+    QByteArray header;
+    put32(header, 0x04034b50);
+    put16(header, m_zipEntry.zip64 ? 45 : 20);
+    // Names are UTF-8
+    put16(header, 0x0800);
+    // Stored
+    put16(header, 0);
+    put16(header, m_zipEntry.dosTime);
+    put16(header, m_zipEntry.dosDate);
+    put32(header, 0);
+    put32(header, size32);
+    put32(header, size32);
+    put16(header, name.size());
+    put16(header, extra.size());
+    header += name;
+    header += extra;
+    return writeRaw(header);
+}
+
+bool ExportArchive::endZipEntry()
+{
+    m_zipEntry.crc = m_crc;
+    m_zipEntry.size = m_entryWritten;
+
+    const qint64 end = m_file.pos();
+    QByteArray fields;
+    put32(fields, m_crc);
+    if (!m_zipEntry.zip64) {
+        put32(fields, static_cast<quint32>(m_entryWritten));
+        put32(fields, static_cast<quint32>(m_entryWritten));
+    }
+    if (!m_file.seek(m_zipEntry.offset + 14) || !writeRaw(fields)) {
+        return fail(m_file.errorString());
+    }
+    if (m_zipEntry.zip64) {
+        QByteArray sizes;
+        put64(sizes, m_entryWritten);
+        put64(sizes, m_entryWritten);
+        if (!m_file.seek(m_zip64ExtraOffset) || !writeRaw(sizes)) {
+            return fail(m_file.errorString());
+        }
+    }
+    if (!m_file.seek(end)) {
+        return fail(m_file.errorString());
+    }
+
+    // Spooled, so memory doesn't grow with the number of entries
+    const QByteArray record = zipCentralRecord(m_zipEntry);
+    if (m_centralDirectory.write(record) != record.size()) {
+        return fail(m_centralDirectory.errorString());
+    }
+    m_zipEntryCount++;
+    if (m_zipEntry.zip64 || m_zipEntry.offset >= ZIP32_LIMIT) {
+        m_anyZip64 = true;
+    }
+    return true;
+}
+
+QByteArray ExportArchive::zipCentralRecord(const ZipEntry &entry)
+{
+    const bool zip64Offset = entry.offset >= ZIP32_LIMIT;
+    QByteArray extra;
+    put16(extra, 0x5455);
+    put16(extra, 5);
+    extra.append(static_cast<char>(entry.timestampFlags));
+    put32(extra, entry.mtime);
+    if (entry.zip64 || zip64Offset) {
+        put16(extra, 0x0001);
+        put16(extra, (entry.zip64 ? 16 : 0) + (zip64Offset ? 8 : 0));
+        if (entry.zip64) {
+            put64(extra, entry.size);
+            put64(extra, entry.size);
+        }
+        if (zip64Offset) {
+            put64(extra, entry.offset);
+        }
+    }
+
+    const quint32 size32 =
+        entry.zip64 ? 0xFFFFFFFFU : static_cast<quint32>(entry.size);
+    const quint16 version = entry.zip64 || zip64Offset ? 45 : 20;
+    QByteArray record;
+    put32(record, 0x02014b50);
+    // Made by Unix, so the external attributes are file modes
+    put16(record, 0x0300 | version);
+    put16(record, version);
+    put16(record, 0x0800);
+    put16(record, 0);
+    put16(record, entry.dosTime);
+    put16(record, entry.dosDate);
+    put32(record, entry.crc);
+    put32(record, size32);
+    put32(record, size32);
+    put16(record, entry.name.size());
+    put16(record, extra.size());
+    put16(record, 0);
+    put16(record, 0);
+    put16(record, 0);
+    put32(record, 0100644U << 16);
+    put32(record, zip64Offset ? 0xFFFFFFFFU
+                              : static_cast<quint32>(entry.offset));
+    record += entry.name;
+    record += extra;
+    return record;
+}
+
+bool ExportArchive::writeZipCentralDirectory()
+{
+    const quint64 directoryOffset = m_file.pos();
+
+    if (!m_centralDirectory.seek(0)) {
+        return fail(m_centralDirectory.errorString());
+    }
+    QByteArray buffer;
+    while (!(buffer = m_centralDirectory.read(PADDING_CHUNK)).isEmpty()) {
+        if (!writeRaw(buffer)) {
+            return false;
+        }
+    }
+    if (!m_centralDirectory.atEnd()) {
+        return fail(m_centralDirectory.errorString());
+    }
+    buffer.clear();
+
+    const quint64 directoryEnd = m_file.pos() + buffer.size();
+    const quint64 directorySize = directoryEnd - directoryOffset;
+    const quint64 count = m_zipEntryCount;
+    if (m_anyZip64 || count >= 0xFFFF || directoryOffset >= ZIP32_LIMIT ||
+        directorySize >= ZIP32_LIMIT) {
+        // Zip64 end of central directory record and its locator
+        put32(buffer, 0x06064b50);
+        put64(buffer, 44);
+        put16(buffer, 0x0300 | 45);
+        put16(buffer, 45);
+        put32(buffer, 0);
+        put32(buffer, 0);
+        put64(buffer, count);
+        put64(buffer, count);
+        put64(buffer, directorySize);
+        put64(buffer, directoryOffset);
+
+        put32(buffer, 0x07064b50);
+        put32(buffer, 0);
+        put64(buffer, directoryEnd);
+        put32(buffer, 1);
+    }
+
+    put32(buffer, 0x06054b50);
+    put16(buffer, 0);
+    put16(buffer, 0);
+    put16(buffer, std::min<quint64>(count, 0xFFFF));
+    put16(buffer, std::min<quint64>(count, 0xFFFF));
+    put32(buffer, std::min(directorySize, ZIP32_LIMIT));
+    put32(buffer, std::min(directoryOffset, ZIP32_LIMIT));
+    put16(buffer, 0);
+    return writeRaw(buffer);
+}
@@ -0,0 +1,158 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORTARCHIVE_H
+#define EXPORTARCHIVE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QSaveFile>
+#include <QSet>
+#include <QString>
+#include <QTemporaryFile>
+#include <memory>
+
+/**
+ * @brief Writes exported files straight into a zip or tar archive
+ *
+ * Entries are streamed in as they come off the device, their data is
+ * never staged in memory or in temporary files. Media is already
+ * compressed, so zip entries are stored rather than deflated and tar is
+ * left uncompressed. Both formats keep the device's st_mtime and
+ * st_birthtime: tar through pax records with nanosecond precision, zip
+ * through the extended timestamp field next to the DOS time.
+ *
+ * Zip central directory records are spooled to a temporary file and
+ * copied behind the last entry by finish(). What stays in memory per entry
+ * is a hash of its name for numbering duplicates, so a colliding hash only
+ * costs a name an unneeded suffix.
+ *
+ * libzip assembles an archive in zip_close() by pulling every source at
+ * once, which doesn't fit entries that arrive one by one over AFC, so the
+ * formats are written here directly.
+ */
+class ExportArchive
+{
+public:
+    enum class Format { Zip, Tar };
+
+    // Returns nullptr if the file can't be created
+    static std::unique_ptr<ExportArchive> create(const QString &path,
+                                                 Format format);
+    static QString suffixFor(Format format);
+
+    // An archive that wasn't finished is discarded
+    ~ExportArchive();
+
+    ExportArchive(const ExportArchive &) = delete;
+    ExportArchive &operator=(const ExportArchive &) = delete;
+
+    /*
+        Starts an entry of exactly size bytes, times are nanoseconds since
+        the epoch as reported by AFC, 0 if unknown. Returns the name the
+        entry got, numbered like exported files if it was already taken,
+        or an empty string on error.
+    */
+    QString beginEntry(const QString &name, quint64 size, quint64 mtimeNs,
+                       quint64 birthtimeNs);
+    // Data past the declared size is dropped, false on write errors
+    bool write(QByteArrayView data);
+    /*
+        Closes the entry. A short entry is zero padded (tar) or has its
+        sizes corrected (zip), false if it didn't get exactly the declared
+        size.
+    */
+    bool endEntry();
+    // Cuts the open entry off the archive as if it was never begun
+    bool abortEntry();
+
+    // Small in-memory entry such as a checksum file
+    bool addEntry(const QString &name, const QByteArray &data,
+                  quint64 mtimeNs);
+
+    // Writes the trailer and moves the archive into place
+    bool finish();
+    // Drops the partially written archive
+    void discard();
+
+    QString path() const { return m_path; }
+    QString errorString() const { return m_error; }
+    Format format() const { return m_format; }
+    int entryCount() const { return m_entryNames.size(); }
+
+private:
+    ExportArchive(const QString &path, Format format);
+
+    struct ZipEntry {
+        QByteArray name;
+        quint32 crc = 0;
+        quint64 size = 0;
+        quint64 offset = 0;
+        quint16 dosTime = 0;
+        quint16 dosDate = 0;
+        quint32 mtime = 0;
+        // Times present in the local extended timestamp field
+        quint8 timestampFlags = 0;
+        bool zip64 = false;
+    };
+
+    QString uniqueEntryName(const QString &name);
+    static size_t nameKey(const QString &name);
+    bool writeRaw(const QByteArray &data);
+    bool fail(const QString &error);
+
+    bool beginTarEntry(const QByteArray &name, quint64 mtimeNs,
+                       quint64 birthtimeNs);
+    bool endTarEntry();
+    bool beginZipEntry(const QByteArray &name, quint64 mtimeNs,
+                       quint64 birthtimeNs);
+    bool endZipEntry();
+    static QByteArray zipCentralRecord(const ZipEntry &entry);
+    bool writeZipCentralDirectory();
+
+    static constexpr int TAR_BLOCK_SIZE = 512;
+    // Sizes from here on need the zip64 extension
+    static constexpr quint64 ZIP32_LIMIT = 0xFFFFFFFFULL;
+
+    QSaveFile m_file;
+    QString m_path;
+    Format m_format;
+    QString m_error;
+    bool m_finished = false;
+
+    QSet<size_t> m_entryNames;
+    bool m_inEntry = false;
+    QString m_entryName;
+    // Where the open entry's headers start
+    qint64 m_entryOffset = 0;
+    quint64 m_entrySize = 0;
+    quint64 m_entryWritten = 0;
+    bool m_entryOverflow = false;
+
+    // Zip bookkeeping for the central directory
+    QTemporaryFile m_centralDirectory;
+    quint64 m_zipEntryCount = 0;
+    bool m_anyZip64 = false;
+    ZipEntry m_zipEntry;
+    quint32 m_crc = 0;
+    // Where the zip64 sizes of the open entry's local header are
+    qint64 m_zip64ExtraOffset = -1;
+};
+
+#endif // EXPORTARCHIVE_H
@@ -0,0 +1,303 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "exportjournal.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QUrl>
+
+/*
+    One record per line, fields separated by tabs and percent-encoded:
+        V <version>
+        J <udid>
+        I <source path> <file name>     (one per item, in job order)
+        S <index> <output path> <size> <mtime>
+                                        item started, with the device
+                                        file's st_size and st_mtime
+        P <index> <offset> <size> <mtime>
+                                        bytes of the item already on disk
+        D <index> <bytes> <output path> item completed
+    A torn last line (crash mid-write) is ignored when loading.
+*/
+static const QByteArray JOURNAL_VERSION = "2";
+
+static QString journalFileName(const QString &prefix, const QString &suffix,
+                               const QString &udid,
+                               const QList<ExportItem> &items)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(udid.toUtf8());
+    for (const ExportItem &item : items) {
+        hash.addData(QByteArrayView("\n"));
+        hash.addData(item.sourcePathOnDevice.toUtf8());
+    }
+    return prefix + QString::fromLatin1(hash.result().toHex().left(16)) +
+           suffix;
+}
+
+static QByteArray field(const QString &value)
+{
+    return QUrl::toPercentEncoding(value);
+}
+
+std::unique_ptr<ExportJournal>
+ExportJournal::openOrCreate(const QString &destinationDir, const QString &udid,
+                            const QList<ExportItem> &items)
+{
+    const QString path = QDir(destinationDir)
+                             .filePath(journalFileName(FILE_PREFIX, FILE_SUFFIX,
+                                                       udid, items));
+
+    if (QFile::exists(path)) {
+        std::unique_ptr<ExportJournal> journal = load(path);
+        bool sameJob = journal && journal->m_udid == udid &&
+                       journal->m_items.size() == items.size();
+        for (int i = 0; sameJob && i < items.size(); ++i) {
+            sameJob = journal->m_items.at(i).sourcePathOnDevice ==
+                      items.at(i).sourcePathOnDevice;
+        }
+        if (sameJob) {
+            qDebug() << "Resuming export from journal" << path
+                     << "completed items:" << journal->completedCount();
+            journal->m_resumed = true;
+            return journal;
+        }
+        qWarning() << "Discarding unusable export journal" << path;
+        QFile::remove(path);
+    }
+
+    std::unique_ptr<ExportJournal> journal(new ExportJournal());
+    journal->m_path = path;
+    journal->m_udid = udid;
+    journal->m_items = items;
+    if (!journal->openForAppend()) {
+        return nullptr;
+    }
+
+    QMutexLocker locker(&journal->m_mutex);
+    journal->writeLineLocked("V\t" + JOURNAL_VERSION);
+    journal->writeLineLocked("J\t" + field(udid));
+    for (const ExportItem &item : items) {
+        journal->writeLineLocked("I\t" + field(item.sourcePathOnDevice) +
+                                 "\t" + field(item.suggestedFileName));
+    }
+    journal->m_file.flush();
+    return journal;
+}
+
+std::unique_ptr<ExportJournal> ExportJournal::load(const QString &journalPath)
+{
+    std::unique_ptr<ExportJournal> journal(new ExportJournal());
+    journal->m_path = journalPath;
+    if (!journal->parse() || !journal->openForAppend()) {
+        return nullptr;
+    }
+    return journal;
+}
+
+bool ExportJournal::parse()
+{
+    QFile in(m_path);
+    if (!in.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = in.readAll();
+    QList<QByteArray> lines = data.split('\n');
+    // Whatever follows the last newline was torn by a crash
+    lines.removeLast();
+
+    bool versionOk = false;
+    for (const QByteArray &line : lines) {
+        const QList<QByteArray> fields = line.split('\t');
+        if (fields.size() < 2) {
+            continue;
+        }
+        const QByteArray &type = fields.at(0);
+        if (type == "V") {
+            versionOk = fields.at(1) == JOURNAL_VERSION;
+        } else if (type == "J") {
+            m_udid = QUrl::fromPercentEncoding(fields.at(1));
+        } else if (type == "I" && fields.size() >= 3) {
+            m_items.append(ExportItem(QUrl::fromPercentEncoding(fields.at(1)),
+                                      QUrl::fromPercentEncoding(fields.at(2))));
+        } else if (fields.size() >= 3) {
+            bool ok = false;
+            const int index = fields.at(1).toInt(&ok);
+            if (!ok || index < 0 || index >= m_items.size()) {
+                continue;
+            }
+            if (type == "S" && fields.size() >= 5) {
+                m_partials[index] = {QUrl::fromPercentEncoding(fields.at(2)),
+                                     0, fields.at(3).toULongLong(),
+                                     fields.at(4).toULongLong()};
+            } else if (type == "P" && fields.size() >= 5 &&
+                       m_partials.contains(index)) {
+                Partial &partial = m_partials[index];
+                partial.offset = fields.at(2).toLongLong();
+                partial.sourceSize = fields.at(3).toULongLong();
+                partial.sourceMtime = fields.at(4).toULongLong();
+            } else if (type == "D" && fields.size() >= 4) {
+                m_completed[index] = QUrl::fromPercentEncoding(fields.at(3));
+                m_partials.remove(index);
+            }
+        }
+    }
+
+    // Start the next record on a fresh line after a torn write
+    m_needsNewline = !data.isEmpty() && !data.endsWith('\n');
+    return versionOk && !m_udid.isEmpty();
+}
+
+bool ExportJournal::openForAppend()
+{
+    m_file.setFileName(m_path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Could not open export journal" << m_path << ":"
+                   << m_file.errorString();
+        return false;
+    }
+    if (m_needsNewline) {
+        m_file.write("\n");
+        m_needsNewline = false;
+    }
+    m_lastFlush.start();
+    return true;
+}
+
+ExportJournal::~ExportJournal()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_file.isOpen()) {
+        flushProgressLocked();
+        m_file.close();
+    }
+}
+
+bool ExportJournal::isCompleted(int index) const
+{
+    QString outputPath;
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_completed.constFind(index);
+        if (it == m_completed.constEnd()) {
+            return false;
+        }
+        outputPath = it.value();
+    }
+    // Deleted or moved since, copy it again
+    return QFileInfo::exists(outputPath);
+}
+
+int ExportJournal::completedCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_completed.size();
+}
+
+std::optional<ExportJournal::Partial> ExportJournal::partial(int index) const
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_partials.constFind(index);
+    if (it == m_partials.constEnd()) {
+        return std::nullopt;
+    }
+    return it.value();
+}
+
+void ExportJournal::writeLineLocked(const QByteArray &line)
+{
+    if (m_file.isOpen()) {
+        m_file.write(line + '\n');
+    }
+}
+
+void ExportJournal::beginItem(int index, const QString &outputPath,
+                              quint64 sourceSize, quint64 sourceMtime)
+{
+    QMutexLocker locker(&m_mutex);
+    m_partials[index] = {outputPath, 0, sourceSize, sourceMtime};
+    m_dirtyProgress.remove(index);
+    writeLineLocked("S\t" + QByteArray::number(index) + "\t" +
+                    field(outputPath) + "\t" +
+                    QByteArray::number(sourceSize) + "\t" +
+                    QByteArray::number(sourceMtime));
+    m_file.flush();
+}
+
+void ExportJournal::recordProgress(int index, qint64 offset)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_partials.find(index);
+    if (it == m_partials.end()) {
+        return;
+    }
+    it->offset = offset;
+    m_dirtyProgress.insert(index);
+    if (m_lastFlush.elapsed() >= FLUSH_INTERVAL_MS) {
+        flushProgressLocked();
+    }
+}
+
+void ExportJournal::completeItem(int index, qint64 bytes,
+                                 const QString &outputPath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_partials.remove(index);
+    m_dirtyProgress.remove(index);
+    m_completed[index] = outputPath;
+    writeLineLocked("D\t" + QByteArray::number(index) + "\t" +
+                    QByteArray::number(bytes) + "\t" + field(outputPath));
+    if (m_lastFlush.elapsed() >= FLUSH_INTERVAL_MS) {
+        flushProgressLocked();
+    }
+}
+
+void ExportJournal::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    flushProgressLocked();
+}
+
+void ExportJournal::flushProgressLocked()
+{
+    for (int index : std::as_const(m_dirtyProgress)) {
+        auto it = m_partials.constFind(index);
+        if (it != m_partials.constEnd()) {
+            writeLineLocked("P\t" + QByteArray::number(index) + "\t" +
+                            QByteArray::number(it->offset) + "\t" +
+                            QByteArray::number(it->sourceSize) + "\t" +
+                            QByteArray::number(it->sourceMtime));
+        }
+    }
+    m_dirtyProgress.clear();
+    if (m_file.isOpen()) {
+        m_file.flush();
+    }
+    m_lastFlush.restart();
+}
+
+void ExportJournal::remove()
+{
+    QMutexLocker locker(&m_mutex);
+    m_file.close();
+    QFile::remove(m_path);
+    m_dirtyProgress.clear();
+}
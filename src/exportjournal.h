@@ -0,0 +1,111 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORTJOURNAL_H
+#define EXPORTJOURNAL_H
+
+#include "exportmanager.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <memory>
+#include <optional>
+
+/**
+ * @brief Append-only record of an export job kept next to its destination
+ *
+ * The journal lists the job's items, then logs when an item starts (with its
+ * output path), how far the in-flight file got and when it completed. Each
+ * job gets its own file named after a hash of the device and its items, so
+ * running the same export again, even after a restart, finds it and skips
+ * or resumes what was already copied.
+ *
+ * Start records are flushed right away. Progress and completion records are
+ * buffered and flushed at most once per FLUSH_INTERVAL_MS, so the copy loop
+ * only pays for a map update. Losing the tail of the journal is harmless, an
+ * item without a completion record is resumed from its file size on disk.
+ */
+class ExportJournal
+{
+public:
+    struct Partial {
+        QString outputPath;
+        qint64 offset = 0;
+        // The device file as it was when the item started (st_size and
+        // st_mtime), a partial copy of anything else must not be resumed
+        quint64 sourceSize = 0;
+        quint64 sourceMtime = 0;
+    };
+
+    static std::unique_ptr<ExportJournal>
+    openOrCreate(const QString &destinationDir, const QString &udid,
+                 const QList<ExportItem> &items);
+
+    static std::unique_ptr<ExportJournal> load(const QString &journalPath);
+
+    ~ExportJournal();
+
+    bool isResumed() const { return m_resumed; }
+
+    // Completed and its output is still where the job left it
+    bool isCompleted(int index) const;
+    int completedCount() const;
+    std::optional<Partial> partial(int index) const;
+
+    void beginItem(int index, const QString &outputPath, quint64 sourceSize,
+                   quint64 sourceMtime);
+    void recordProgress(int index, qint64 offset);
+    void completeItem(int index, qint64 bytes, const QString &outputPath);
+    void flush();
+
+    // The job is done, the journal is no longer needed
+    void remove();
+
+private:
+    static constexpr qint64 FLUSH_INTERVAL_MS = 1000;
+    static constexpr const char *FILE_PREFIX = ".idescriptor-export-";
+    static constexpr const char *FILE_SUFFIX = ".journal";
+
+    ExportJournal() = default;
+
+    bool parse();
+    bool openForAppend();
+    void writeLineLocked(const QByteArray &line);
+    void flushProgressLocked();
+
+    QString m_path;
+    QString m_udid;
+    QList<ExportItem> m_items;
+    bool m_resumed = false;
+    bool m_needsNewline = false;
+
+    mutable QMutex m_mutex;
+    QFile m_file;
+    // Output path of every completed item
+    QHash<int, QString> m_completed;
+    QHash<int, Partial> m_partials;
+    QSet<int> m_dirtyProgress;
+    QElapsedTimer m_lastFlush;
+};
+
+#endif // EXPORTJOURNAL_H
@@ -18,14 +18,40 @@
  */
 
 #include "exportmanager.h"
+#include "afcdirectorylister.h"
+#include "afcfilereader.h"
+#include "afctreewalker.h"
+#include "exportjournal.h"
+#include "exportmanifest.h"
 #include "exportprogressdialog.h"
+#include "exporttranscoder.h"
 #include "servicemanager.h"
+#include "settingsmanager.h"
+#include "streamhasher.h"
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QMutexLocker>
+#include <QSaveFile>
+#include <QScopeGuard>
 #include <QStandardPaths>
 #include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <thread>
+
+/*
+    The shared client reaches the same namespace the pool serves, jobs given
+    it run on pooled bulk lanes like jobs given no client at all
+*/
+static std::optional<afc_client_t>
+poolableClient(iDescriptorDevice *device, std::optional<afc_client_t> altAfc)
+{
+    if (altAfc && *altAfc == device->afcClient)
+        return std::nullopt;
+    return altAfc;
+}
 
 ExportManager *ExportManager::sharedInstance()
 {
@@ -60,7 +86,8 @@ ExportManager::~ExportManager()
 QUuid ExportManager::startExport(iDescriptorDevice *device,
                                  const QList<ExportItem> &items,
                                  const QString &destinationPath,
-                                 std::optional<afc_client_t> altAfc)
+                                 std::optional<afc_client_t> altAfc,
+                                 const ExportOptions &options)
 {
     if (!device || !device->mutex) {
         qWarning() << "Invalid device provided to ExportManager";
@@ -88,10 +115,97 @@ QUuid ExportManager::startExport(iDescriptorDevice *device,
     job->device = device;
     job->items = items;
     job->destinationPath = destinationPath;
-    job->altAfc = altAfc;
+    job->altAfc = poolableClient(device, altAfc);
+    job->options = options;
+    job->laneCount = SettingsManager::sharedInstance()->exportLanes();
+    // Lets a disconnect or restart continue where this job stopped
+    if (!options.archive) {
+        job->journal = ExportJournal::openOrCreate(
+            destinationPath, QString::fromStdString(device->udid), items);
+    }
+    if (options.sync && !options.archive) {
+        job->manifest = ExportManifest::open(
+            destinationPath, QString::fromStdString(device->udid));
+    }
+    return launchJob(job);
+}
+
+QUuid ExportManager::startTreeExport(iDescriptorDevice *device,
+                                     const QList<ExportItem> &files,
+                                     const QStringList &directories,
+                                     const QString &destinationPath,
+                                     std::optional<afc_client_t> altAfc,
+                                     const ExportOptions &options)
+{
+    if (!device || !device->mutex) {
+        qWarning() << "Invalid device provided to ExportManager";
+        return QUuid();
+    }
+
+    if (files.isEmpty() && directories.isEmpty()) {
+        qWarning() << "No items provided for export";
+        return QUuid();
+    }
+
+    QDir destDir(destinationPath);
+    if (!destDir.exists() && !destDir.mkpath(".")) {
+        qWarning() << "Could not create destination directory:"
+                   << destinationPath;
+        return QUuid();
+    }
+
+    auto job = new ExportJob();
+    job->jobId = QUuid::createUuid();
+    job->device = device;
+    job->items = files;
+    job->treeRoots = directories;
+    job->walking = !directories.isEmpty();
+    job->destinationPath = destinationPath;
+    job->altAfc = poolableClient(device, altAfc);
+    job->options = options;
+    job->laneCount = SettingsManager::sharedInstance()->exportLanes();
+    // No journal, the item list is only known once the walk is done
+    if (options.sync && !options.archive) {
+        job->manifest = ExportManifest::open(
+            destinationPath, QString::fromStdString(device->udid));
+    }
+    return launchJob(job);
+}
+
+QUuid ExportManager::launchJob(ExportJob *job)
+{
+    if (job->options.archive) {
+        ExportOptions &options = job->options;
+        if (options.sync || options.verify || options.convertHeic ||
+            options.convertHevc) {
+            qDebug() << "Sync, verification and conversion don't apply to"
+                        " archive exports";
+        }
+        options.sync = false;
+        options.verify = false;
+        options.convertHeic = false;
+        options.convertHevc = false;
+
+        const QString name =
+            QString("iDescriptor-export-%1.%2")
+                .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"))
+                .arg(ExportArchive::suffixFor(*options.archive));
+        const QString archivePath =
+            generateUniqueOutputPath(QDir(job->destinationPath).filePath(name));
+        job->archive = ExportArchive::create(archivePath, *options.archive);
+        releaseOutputPath(archivePath);
+        if (!job->archive) {
+            delete job;
+            return QUuid();
+        }
+    }
+    if (job->options.convertHeic || job->options.convertHevc) {
+        job->transcoder = std::make_unique<ExportTranscoder>();
+    }
     job->watcher = new QFutureWatcher<void>(this);
 
     const QUuid jobId = job->jobId;
+    const int knownItems = job->items.size();
 
     connect(job->watcher, &QFutureWatcher<void>::finished, this,
             [this, jobId]() { cleanupJob(jobId); });
@@ -102,7 +216,7 @@ QUuid ExportManager::startExport(iDescriptorDevice *device,
         m_activeJobs[jobId] = job;
     }
 
-    emit exportStarted(jobId, items.size(), destinationPath);
+    emit exportStarted(jobId, knownItems, job->destinationPath);
 
     // The manager now shows its own dialog
     m_exportProgressDialog->showForJob(jobId);
@@ -112,11 +226,28 @@ QUuid ExportManager::startExport(iDescriptorDevice *device,
         QtConcurrent::run([this, jobPtr]() { executeExportJob(jobPtr); });
     jobPtr->watcher->setFuture(jobPtr->future);
 
-    qDebug() << "Started export job" << jobId << "for" << items.size()
-             << "items";
+    qDebug() << "Started export job" << jobId << "for" << knownItems
+             << "items and" << job->treeRoots.size() << "directories";
     return jobId;
 }
 
+ExportOptions ExportManager::optionsFromSettings()
+{
+    SettingsManager *settings = SettingsManager::sharedInstance();
+    ExportOptions options;
+    options.checksumFile = settings->exportChecksumFile();
+    options.verify = settings->verifyExports();
+    options.convertHeic = settings->convertHeicOnExport();
+    options.convertHevc = settings->convertHevcOnExport();
+    const QString destination = settings->exportDestinationType();
+    if (destination == "zip") {
+        options.archive = ExportArchive::Format::Zip;
+    } else if (destination == "tar") {
+        options.archive = ExportArchive::Format::Tar;
+    }
+    return options;
+}
+
 void ExportManager::cancelExport(const QUuid &jobId)
 {
     QMutexLocker locker(&m_jobsMutex);
@@ -146,68 +277,434 @@ void ExportManager::executeExportJob(ExportJob *job)
     summary.totalItems = job->items.size();
     summary.destinationPath = job->destinationPath;
 
+    // Every lane needs its own pooled connection, alternative clients (afc2,
+    // house arrest) are not pooled and export on a single lane
+    // Archives take one entry at a time, so they are written by one lane
+    int laneCount = std::max(job->laneCount, 1);
+    if (job->altAfc || job->archive) {
+        laneCount = 1;
+    } else if (!job->walking) {
+        laneCount = std::min(laneCount, static_cast<int>(job->items.size()));
+    }
+
     qDebug() << "Executing export job" << job->jobId << "with"
-             << job->items.size() << "items";
+             << job->items.size() << "items on up to" << laneCount
+             << "lanes";
 
-    for (int i = 0; i < job->items.size(); ++i) {
-        // Check for cancellation
-        if (job->cancelRequested.load()) {
-            summary.wasCancelled = true;
-            qDebug() << "Export job" << job->jobId << "was cancelled";
-            emit exportCancelled(job->jobId);
-            return;
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    if (job->manifest && !job->items.isEmpty()) {
+        job->unchanged = findUnchangedItems(job);
+    }
+
+    // Files found by the walker are queued while the lanes already copy
+    std::thread walker;
+    if (job->walking) {
+        walker = std::thread([this, job]() { walkTrees(job); });
+    }
+
+    /*
+        Lanes pull the next item from a shared index, so a lane stuck on a
+        large video doesn't hold up the small files behind it. Results are
+        parked until all earlier items are done and published in item order.
+    */
+    QMutex resultsMutex;
+    QMap<int, ExportResult> pendingResults;
+    int nextToPublish = 0;
+    QList<ExportResult> hashedResults;
+    QList<ExportLaneStats> laneStats(laneCount);
+    for (int lane = 0; lane < laneCount; ++lane) {
+        laneStats[lane].lane = lane;
+    }
+    qint64 lastStatsEmitMs = 0;
+
+    auto publishLocked = [&]() {
+        while (pendingResults.contains(nextToPublish)) {
+            const ExportResult result = pendingResults.take(nextToPublish);
+            if (result.skipped) {
+                summary.skippedItems++;
+            }
+            if (result.success) {
+                summary.successfulItems++;
+                summary.totalBytesTransferred += result.bytesTransferred;
+                if (!result.sha256.isEmpty()) {
+                    hashedResults.append(result);
+                }
+            } else {
+                summary.failedItems++;
+            }
+            nextToPublish++;
+            QString fileName;
+            int knownItems;
+            {
+                QMutexLocker itemsLocker(&job->itemsMutex);
+                fileName = job->items.at(nextToPublish - 1).suggestedFileName;
+                knownItems = job->items.size();
+            }
+            emit exportProgress(job->jobId, nextToPublish, knownItems,
+                                fileName);
+            emit itemExported(job->jobId, result);
         }
+        if (elapsed.elapsed() - lastStatsEmitMs >= LANE_STATS_INTERVAL_MS) {
+            lastStatsEmitMs = elapsed.elapsed();
+            emit laneStatsUpdated(job->jobId, laneStats);
+        }
+    };
 
-        const ExportItem &item = job->items.at(i);
+    auto runLane = [&](int lane) {
+        AfcClientLease lease;
+        std::optional<afc_client_t> afc = job->altAfc;
+        if (!afc) {
+            // The first lane waits for a connection, the others only take
+            // idle ones so the export never starves the rest of the app.
+            // The wait stays cancellable, other jobs may hold the bulk share
+            if (lane == 0) {
+                lease = ServiceManager::acquireAfcClient(
+                    job->device, job->cancelRequested, IoPriority::Bulk);
+            } else {
+                lease = ServiceManager::acquireAfcClient(job->device, 0,
+                                                         IoPriority::Bulk);
+            }
+            // Reported as cancelled once the lanes are joined
+            if (!lease && (lane != 0 || job->cancelRequested.load()))
+                return;
+            afc = lease.altAfc();
+        }
 
-        emit exportProgress(job->jobId, i + 1, job->items.size(),
-                            item.suggestedFileName);
+        int index;
+        ExportItem item;
+        bool unchanged;
+        while (takeNextItem(job, index, item, unchanged)) {
+            // Give the connection to a preview or player that can't get one
+            if (lease.shouldYield()) {
+                lease.yield();
+                afc = lease.altAfc();
+            }
+            {
+                QMutexLocker locker(&resultsMutex);
+                laneStats[lane].currentFileName = item.suggestedFileName;
+            }
 
-        ExportResult result =
-            exportSingleItem(job->device, item, job->destinationPath,
-                             job->altAfc, job->cancelRequested, job->jobId);
+            QElapsedTimer busy;
+            busy.start();
+            ExportResult result;
+            if (unchanged ||
+                (job->journal && job->journal->isCompleted(index))) {
+                result.sourceFilePath = item.sourcePathOnDevice;
+                result.success = true;
+                result.skipped = true;
+            } else if (job->archive) {
+                result = exportItemToArchive(job, item, afc);
+            } else {
+                result = exportSingleItem(job, item, afc, index);
+            }
 
-        if (result.success) {
-            summary.successfulItems++;
-            summary.totalBytesTransferred += result.bytesTransferred;
-        } else {
-            summary.failedItems++;
+            QMutexLocker locker(&resultsMutex);
+            ExportLaneStats &stats = laneStats[lane];
+            stats.currentFileName.clear();
+            stats.itemsCompleted++;
+            stats.bytesTransferred += result.bytesTransferred;
+            stats.busyMs += busy.elapsed();
+            pendingResults.insert(index, result);
+            publishLocked();
         }
+    };
 
-        emit itemExported(job->jobId, result);
+    std::vector<std::thread> extraLanes;
+    for (int lane = 1; lane < laneCount; ++lane) {
+        extraLanes.emplace_back(runLane, lane);
+    }
+    runLane(0);
+    for (std::thread &lane : extraLanes) {
+        lane.join();
+    }
+    if (walker.joinable()) {
+        walker.join();
+    }
+    summary.totalItems = job->items.size();
 
-        // Check for cancellation again after potentially long file operation
+    // Conversions may still be running behind the last transfers
+    if (job->transcoder) {
         if (job->cancelRequested.load()) {
-            summary.wasCancelled = true;
-            qDebug() << "Export job" << job->jobId
-                     << "was cancelled during execution";
-            emit exportCancelled(job->jobId);
-            return;
+            job->transcoder->cancel();
+        }
+        job->transcoder->waitForDone();
+        summary.convertedItems = job->transcoder->convertedCount();
+        qDebug() << "Converted" << summary.convertedItems << "items,"
+                 << job->transcoder->failedCount() << "failed, CPU time"
+                 << job->transcoder->busyMs() << "ms";
+    }
+
+    emit laneStatsUpdated(job->jobId, laneStats);
+
+    // The digests are of the device files, converted outputs differ
+    if (!job->convertedOutputs.isEmpty()) {
+        hashedResults.removeIf([job](const ExportResult &result) {
+            return job->convertedOutputs.contains(result.outputFilePath);
+        });
+    }
+
+    if (job->options.checksumFile && !hashedResults.isEmpty() &&
+        !job->cancelRequested.load()) {
+        writeChecksumFile(job, hashedResults);
+    }
+
+    // A cancelled archive would end in a cut off entry, drop it
+    if (job->archive) {
+        if (job->cancelRequested.load()) {
+            job->archive->discard();
+        } else if (!job->archive->finish()) {
+            qWarning() << "Could not finish archive" << job->archive->path()
+                       << ":" << job->archive->errorString();
+            summary.failedItems += summary.successfulItems;
+            summary.successfulItems = 0;
         }
     }
 
+    // Whatever was copied counts for the next sync, even if the job failed
+    if (job->manifest) {
+        job->manifest->save();
+    }
+
+    // Keep the journal around while anything is left to resume
+    if (job->journal) {
+        if (!job->cancelRequested.load() && summary.failedItems == 0) {
+            job->journal->remove();
+        } else {
+            job->journal->flush();
+        }
+    }
+
+    if (job->cancelRequested.load()) {
+        summary.wasCancelled = true;
+        qDebug() << "Export job" << job->jobId
+                 << "was cancelled during execution";
+        emit exportCancelled(job->jobId);
+        return;
+    }
+
     qDebug() << "Export job" << job->jobId
              << "completed - Success:" << summary.successfulItems
              << "Failed:" << summary.failedItems
-             << "Bytes:" << summary.totalBytesTransferred;
+             << "Skipped:" << summary.skippedItems
+             << "Bytes:" << summary.totalBytesTransferred << "in"
+             << elapsed.elapsed() << "ms ("
+             << summary.totalBytesTransferred /
+                    (1024.0 * 1024.0 *
+                     std::max<qint64>(elapsed.elapsed(), 1) / 1000.0)
+             << "MB/s)";
+    if (job->device->afcPool) {
+        const AfcClientPool::Stats pool = job->device->afcPool->stats();
+        const char *names[] = {"interactive", "streaming", "bulk"};
+        for (int cls = 0; cls < IO_PRIORITY_COUNT; ++cls) {
+            const AfcClientPool::ClassStats &io = pool.classes[cls];
+            qDebug() << "  I/O" << names[cls] << "checkouts:" << io.checkouts
+                     << "waits:" << io.waits << "max wait:"
+                     << std::chrono::duration_cast<std::chrono::milliseconds>(
+                            io.maxWait)
+                            .count()
+                     << "ms";
+        }
+        qDebug() << "  bulk chunks paused for foreground work:"
+                 << pool.bulkPauses << "("
+                 << std::chrono::duration_cast<std::chrono::milliseconds>(
+                        pool.bulkPaused)
+                        .count()
+                 << "ms)";
+    }
+    qint64 laneBusyMs = 0;
+    for (const ExportLaneStats &stats : laneStats) {
+        qDebug() << "  lane" << stats.lane << "items:" << stats.itemsCompleted
+                 << "bytes:" << stats.bytesTransferred
+                 << "busy:" << stats.busyMs << "ms";
+        laneBusyMs += stats.busyMs;
+    }
+    // Share of the lanes' busy time the copy path spent hashing
+    const qint64 hashMs = job->hashNs.load() / 1000000;
+    qDebug() << "  hashing:" << hashMs << "ms ("
+             << 100.0 * hashMs / std::max<qint64>(laneBusyMs, 1)
+             << "% of lane time), verification:"
+             << job->verifyNs.load() / 1000000 << "ms";
 
     emit exportFinished(job->jobId, summary);
 }
 
-ExportResult ExportManager::exportSingleItem(iDescriptorDevice *device,
+bool ExportManager::takeNextItem(ExportJob *job, int &index, ExportItem &item,
+                                 bool &unchanged)
+{
+    QMutexLocker locker(&job->itemsMutex);
+    while (!job->cancelRequested.load()) {
+        if (job->nextItem < job->items.size()) {
+            index = job->nextItem++;
+            item = job->items.at(index);
+            unchanged = job->unchanged.contains(index);
+            return true;
+        }
+        if (!job->walking) {
+            return false;
+        }
+        // Timed so a cancelled job doesn't wait for the walker to notice
+        job->itemsAdded.wait(&job->itemsMutex, ITEM_WAIT_MS);
+    }
+    return false;
+}
+
+void ExportManager::walkTrees(ExportJob *job)
+{
+    std::vector<std::string> roots;
+    for (const QString &root : std::as_const(job->treeRoots)) {
+        roots.push_back(root.toStdString());
+    }
+
+    AfcTreeWalker::walk(
+        job->device, roots,
+        [job](const std::string &path, const std::string &relativePath,
+              const MediaEntry &entry) {
+            const QString devicePath = QString::fromStdString(path);
+            QMutexLocker locker(&job->itemsMutex);
+            if (job->manifest &&
+                job->manifest->isUpToDate(devicePath, entry)) {
+                job->unchanged.insert(job->items.size());
+            }
+            job->items.append(
+                ExportItem(devicePath, QString::fromStdString(relativePath)));
+            job->itemsAdded.wakeOne();
+        },
+        job->altAfc, AfcTreeWalker::DEFAULT_LANES, &job->cancelRequested);
+
+    QMutexLocker locker(&job->itemsMutex);
+    job->walking = false;
+    job->itemsAdded.wakeAll();
+}
+
+void ExportManager::writeChecksumFile(ExportJob *job,
+                                      const QList<ExportResult> &results)
+{
+    const QDir destDir(job->destinationPath);
+    const QString fileName =
+        QString("iDescriptor-export-%1.sha256")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss"));
+
+    // Same layout as sha256sum, so `sha256sum -c` can check the export
+    QByteArray checksums;
+    for (const ExportResult &result : results) {
+        // Archive results already name their entry
+        const QString name =
+            job->archive ? result.outputFilePath
+                         : destDir.relativeFilePath(result.outputFilePath);
+        checksums += result.sha256 + "  " + name.toUtf8() + "\n";
+    }
+
+    // Goes into the archive, so it checks the files once extracted
+    if (job->archive) {
+        const quint64 now = QDateTime::currentSecsSinceEpoch() * 1000000000ULL;
+        if (!job->archive->addEntry(fileName, checksums, now)) {
+            qWarning() << "Could not add checksums to"
+                       << job->archive->path();
+            return;
+        }
+        qDebug() << "Added" << results.size() << "checksums to"
+                 << job->archive->path();
+        return;
+    }
+
+    const QString path = destDir.filePath(fileName);
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write checksum file" << path << ":"
+                   << out.errorString();
+        return;
+    }
+    out.write(checksums);
+    if (!out.commit()) {
+        qWarning() << "Could not write checksum file" << path << ":"
+                   << out.errorString();
+        return;
+    }
+    qDebug() << "Wrote" << results.size() << "checksums to" << path;
+}
+
+QSet<int> ExportManager::findUnchangedItems(ExportJob *job)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Items the destination never got can't be unchanged, skip their stats
+    QHash<QString, QList<int>> byDirectory;
+    int candidates = 0;
+    for (int i = 0; i < job->items.size(); ++i) {
+        const QString &path = job->items.at(i).sourcePathOnDevice;
+        if (!job->manifest->lookup(path)) {
+            continue;
+        }
+        byDirectory[path.left(path.lastIndexOf('/'))].append(i);
+        candidates++;
+    }
+
+    QSet<int> unchanged;
+    for (auto it = byDirectory.constBegin(); it != byDirectory.constEnd();
+         ++it) {
+        if (job->cancelRequested.load()) {
+            break;
+        }
+        const QList<int> &indexes = it.value();
+
+        // One listing stats the whole directory over several connections
+        if (indexes.size() >= SYNC_LISTING_THRESHOLD) {
+            const std::string dir =
+                it.key().isEmpty() ? "/" : it.key().toStdString();
+            const AFCFileTree tree =
+                AfcDirectoryLister::list(job->device, dir, job->altAfc);
+            if (tree.success) {
+                QHash<QString, const MediaEntry *> stats;
+                stats.reserve(tree.entries.size());
+                for (const MediaEntry &entry : tree.entries) {
+                    stats.insert(QString::fromStdString(entry.name), &entry);
+                }
+                for (int index : indexes) {
+                    const QString &path =
+                        job->items.at(index).sourcePathOnDevice;
+                    const MediaEntry *stat =
+                        stats.value(path.mid(path.lastIndexOf('/') + 1));
+                    if (stat && job->manifest->isUpToDate(path, *stat)) {
+                        unchanged.insert(index);
+                    }
+                }
+                continue;
+            }
+        }
+
+        for (int index : indexes) {
+            const QString &path = job->items.at(index).sourcePathOnDevice;
+            MediaEntry stat;
+            if (ServiceManager::cachedStat(job->device,
+                                           path.toUtf8().constData(), stat,
+                                           job->altAfc) == AFC_E_SUCCESS &&
+                job->manifest->isUpToDate(path, stat)) {
+                unchanged.insert(index);
+            }
+        }
+    }
+
+    qDebug() << "Sync check of" << job->items.size() << "items ("
+             << candidates << "previously exported) took" << timer.elapsed()
+             << "ms," << unchanged.size() << "unchanged";
+    return unchanged;
+}
+
+ExportResult ExportManager::exportSingleItem(ExportJob *job,
                                              const ExportItem &item,
-                                             const QString &destinationDir,
                                              std::optional<afc_client_t> altAfc,
-                                             std::atomic<bool> &cancelRequested,
-                                             const QUuid &jobId)
+                                             int index)
 {
+    iDescriptorDevice *device = job->device;
+    ExportJournal *journal = job->journal.get();
+    ExportManifest *manifest = job->manifest.get();
+
     ExportResult result;
     result.sourceFilePath = item.sourcePathOnDevice;
 
-    // Generate output path
-    QString outputPath = QDir(destinationDir).filePath(item.suggestedFileName);
-    outputPath = generateUniqueOutputPath(outputPath);
-    result.outputFilePath = outputPath;
     QDateTime modificationTime;
     QDateTime birthTime;
     // Get file size first
@@ -220,58 +717,117 @@ ExportResult ExportManager::exportSingleItem(iDescriptorDevice *device,
     //   "st_birthtime": 1754987735633715011
     // }
 
-    plist_t info = nullptr;
-    afc_error_t infoResult = ServiceManager::safeAfcGetFileInfoPlist(
-        device, item.sourcePathOnDevice.toUtf8().constData(), &info, altAfc);
-    quint64 totalFileSize = 0;
-    if (infoResult != AFC_E_SUCCESS || !info) {
+    // Usually answered from the metadata cache filled while browsing
+    MediaEntry fileInfo;
+    afc_error_t infoResult = ServiceManager::cachedStat(
+        device, item.sourcePathOnDevice.toUtf8().constData(), fileInfo, altAfc);
+    if (infoResult != AFC_E_SUCCESS) {
         qDebug() << "File info retrieval failed for" << item.sourcePathOnDevice;
         return result;
     }
 
-    PlistNavigator fileInfo = PlistNavigator(info);
-
-    bool valid = fileInfo["st_size"].valid();
-    if (!valid) {
-        qDebug() << "File size info not valid for" << item.sourcePathOnDevice;
-        if (info)
-            plist_free(info);
-        return result;
-    }
-
-    totalFileSize = fileInfo["st_size"].getUInt();
+    quint64 totalFileSize = fileInfo.size;
 
-    valid = fileInfo["st_mtime"].valid();
-    if (!valid) {
+    if (fileInfo.mtime == 0) {
         qDebug() << "File modification time info not valid for"
                  << item.sourcePathOnDevice;
-        if (info)
-            plist_free(info);
         return result;
     }
-
-    uint64_t modTimeNs = fileInfo["st_mtime"].getUInt();
     // The timestamp from the device is in nanoseconds, convert to seconds
-    modificationTime = QDateTime::fromSecsSinceEpoch(modTimeNs / 1000000000);
+    modificationTime =
+        QDateTime::fromSecsSinceEpoch(fileInfo.mtime / 1000000000);
 
-    valid = fileInfo["st_birthtime"].valid();
-    if (!valid) {
+    if (fileInfo.birthtime == 0) {
         qDebug() << "File birth time info not valid for"
                  << item.sourcePathOnDevice;
-        if (info)
-            plist_free(info);
         return result;
     }
-    uint64_t birthTimeNs = fileInfo["st_birthtime"].getUInt();
-    birthTime = QDateTime::fromSecsSinceEpoch(birthTimeNs / 1000000000);
+    birthTime = QDateTime::fromSecsSinceEpoch(fileInfo.birthtime / 1000000000);
 
-    plist_free(info);
+    std::optional<ExportTranscoder::Kind> convertKind;
+    if (job->transcoder) {
+        convertKind = ExportTranscoder::kindFor(job->options,
+                                                item.suggestedFileName);
+    }
+
+    // Pick up a file an earlier run of this job left half-copied
+    QString outputPath;
+    // A converted copy from the last sync that the new conversion replaces
+    QString replacedOutput;
+    qint64 resumeOffset = 0;
+    if (journal) {
+        if (auto partial = journal->partial(index)) {
+            const QFileInfo local(partial->outputPath);
+            if (local.exists() && reserveOutputPath(partial->outputPath)) {
+                outputPath = partial->outputPath;
+                // A device file that changed since starts over, appending
+                // to what the old version left would corrupt the copy
+                if (partial->sourceSize == totalFileSize &&
+                    partial->sourceMtime == fileInfo.mtime &&
+                    static_cast<quint64>(local.size()) <= totalFileSize) {
+                    resumeOffset = local.size();
+                } else {
+                    qDebug() << item.sourcePathOnDevice
+                             << "changed since the last run, restarting it";
+                }
+            }
+        }
+    }
+    if (outputPath.isEmpty() && manifest) {
+        if (auto entry = manifest->lookup(item.sourcePathOnDevice)) {
+            // Changed since the last sync, replace that copy instead of
+            // adding a numbered duplicate next to it
+            const QString previous = manifest->absoluteOutputPath(*entry);
+            const bool previousConverted =
+                convertKind &&
+                QFileInfo(previous).suffix().compare(
+                    QFileInfo(item.suggestedFileName).suffix(),
+                    Qt::CaseInsensitive) != 0;
+            if (reserveOutputPath(previous)) {
+                if (previousConverted) {
+                    // The original is copied next to it under its own
+                    // name and converted over it, so the old .jpg never
+                    // holds HEIC bytes
+                    replacedOutput = previous;
+                    outputPath = generateUniqueOutputPath(
+                        QFileInfo(previous).dir().filePath(
+                            QFileInfo(item.suggestedFileName).fileName()));
+                } else {
+                    outputPath = previous;
+                }
+            }
+        } else {
+            // Adopt a copy exported before the destination had a manifest
+            const QString candidate =
+                QDir(job->destinationPath).filePath(item.suggestedFileName);
+            const QFileInfo local(candidate);
+            if (local.exists() &&
+                static_cast<quint64>(local.size()) == totalFileSize &&
+                reserveOutputPath(candidate)) {
+                manifest->record(item.sourcePathOnDevice, fileInfo, candidate);
+                releaseOutputPath(candidate);
+                result.outputFilePath = candidate;
+                result.success = true;
+                result.skipped = true;
+                return result;
+            }
+        }
+    }
+    if (outputPath.isEmpty()) {
+        outputPath = generateUniqueOutputPath(
+            QDir(job->destinationPath).filePath(item.suggestedFileName));
+    }
+    auto releasePath =
+        qScopeGuard([this, outputPath]() { releaseOutputPath(outputPath); });
+    auto releaseReplaced = qScopeGuard([this, replacedOutput]() {
+        if (!replacedOutput.isEmpty())
+            releaseOutputPath(replacedOutput);
+    });
+    result.outputFilePath = outputPath;
 
-    // Open file on device
-    uint64_t handle = 0;
-    afc_error_t openResult = ServiceManager::safeAfcFileOpen(
-        device, item.sourcePathOnDevice.toUtf8().constData(), AFC_FOPEN_RDONLY,
-        &handle, altAfc);
+    // Device reads run ahead on the reader's thread while we write to disk
+    AfcFileReader reader(device, item.sourcePathOnDevice, altAfc);
+    afc_error_t openResult = reader.open(resumeOffset);
 
     if (openResult != AFC_E_SUCCESS) {
         result.errorMessage =
@@ -281,60 +837,115 @@ ExportResult ExportManager::exportSingleItem(iDescriptorDevice *device,
         return result;
     }
 
-    // Open local output file
+    // The digest covers the whole file, including what an earlier run wrote
+    StreamHasher hasher;
+    if (resumeOffset > 0 && !hasher.addFile(outputPath, resumeOffset)) {
+        result.errorMessage =
+            QString("Failed to read partial file: %1").arg(outputPath);
+        return result;
+    }
+
+    // Tree exports recreate the directory layout below the destination
+    if (item.suggestedFileName.contains('/')) {
+        QDir().mkpath(QFileInfo(outputPath).absolutePath());
+    }
+
+    // Open local output file, appending when resuming
     QFile outputFile(outputPath);
-    if (!outputFile.open(QIODevice::WriteOnly)) {
+    const QIODevice::OpenMode mode =
+        resumeOffset > 0 ? QIODevice::WriteOnly | QIODevice::Append
+                         : QIODevice::WriteOnly;
+    if (!outputFile.open(mode)) {
         result.errorMessage = QString("Failed to create local file: %1 (%2)")
                                   .arg(outputPath)
                                   .arg(outputFile.errorString());
-        ServiceManager::safeAfcFileClose(device, handle, altAfc);
         return result;
     }
+    if (resumeOffset > 0) {
+        qDebug() << "Resuming" << item.sourcePathOnDevice << "at"
+                 << resumeOffset << "of" << totalFileSize << "bytes";
+    }
+    if (journal) {
+        journal->beginItem(index, outputPath, totalFileSize, fileInfo.mtime);
+    }
 
-    char buffer[8192];
-    uint32_t bytesRead = 0;
-    quint64 totalBytes = 0;
+    // Photos to convert stay in memory so the converter needn't read them
+    // back, as long as the transcoder's budget allows
+    qint64 reservedMemory = 0;
+    if (convertKind == ExportTranscoder::Kind::HeicToJpeg &&
+        resumeOffset == 0 &&
+        totalFileSize <= static_cast<quint64>(IN_MEMORY_CONVERT_LIMIT) &&
+        job->transcoder->reserveMemory(totalFileSize)) {
+        reservedMemory = totalFileSize;
+    }
+    auto releaseMemory = qScopeGuard([&]() {
+        if (reservedMemory > 0)
+            job->transcoder->releaseMemory(reservedMemory);
+    });
+    QByteArray payload;
+    if (reservedMemory > 0) {
+        payload.reserve(reservedMemory);
+    }
 
-    while (true) {
+    QByteArray chunk;
+    quint64 totalBytes = resumeOffset;
+
+    while (reader.next(chunk)) {
         // Check for cancellation during file copy
-        if (cancelRequested.load()) {
+        if (job->cancelRequested.load()) {
+            reader.close();
             outputFile.close();
             outputFile.remove(); // Clean up partial file
-            ServiceManager::safeAfcFileClose(device, handle, altAfc);
             result.errorMessage = "Export cancelled by user";
             return result;
         }
 
-        afc_error_t readResult = ServiceManager::safeAfcFileRead(
-            device, handle, buffer, sizeof(buffer), &bytesRead, altAfc);
-
-        if (readResult != AFC_E_SUCCESS || bytesRead == 0) {
-            break; // End of file or error
-        }
-
-        qint64 bytesWritten = outputFile.write(buffer, bytesRead);
-        if (bytesWritten != bytesRead) {
+        qint64 bytesWritten = outputFile.write(chunk);
+        if (bytesWritten != chunk.size()) {
             result.errorMessage =
                 QString("Write error: only wrote %1 of %2 bytes")
                     .arg(bytesWritten)
-                    .arg(bytesRead);
+                    .arg(chunk.size());
+            reader.close();
             outputFile.close();
             outputFile.remove(); // Clean up partial file
-            ServiceManager::safeAfcFileClose(device, handle, altAfc);
             return result;
         }
 
-        totalBytes += bytesRead;
+        // Hashed while the reader already fetches the next chunk
+        hasher.addData(chunk);
+        if (reservedMemory > 0) {
+            payload.append(chunk);
+        }
+        totalBytes += chunk.size();
+        if (journal) {
+            journal->recordProgress(index, totalBytes);
+        }
+        emit fileTransferProgress(job->jobId, item.suggestedFileName,
+                                  totalBytes, totalFileSize);
+    }
 
-        // Emit progress update every 64KB or at end of file
-        if (totalBytes % (64 * 1024) == 0 || totalBytes == totalFileSize) {
-            emit fileTransferProgress(jobId, item.suggestedFileName, totalBytes,
-                                      totalFileSize);
+    if (reader.error() != AFC_E_SUCCESS) {
+        result.errorMessage =
+            QString("Read error on device: %1 (AFC error: %2)")
+                .arg(item.sourcePathOnDevice)
+                .arg(static_cast<int>(reader.error()));
+        reader.close();
+        outputFile.close();
+        if (journal) {
+            // Keep what we have, the next run continues from here
+            journal->recordProgress(index, totalBytes);
+            journal->flush();
+        } else {
+            outputFile.remove(); // Clean up partial file
         }
+        return result;
     }
 
     outputFile.close();
-    ServiceManager::safeAfcFileClose(device, handle, altAfc);
+    reader.close();
+    result.sha256 = hasher.hexResult();
+    job->hashNs += hasher.elapsedNs();
 
     // reopen is required for timestamps
     QFile reopen(outputPath);
@@ -358,14 +969,190 @@ ExportResult ExportManager::exportSingleItem(iDescriptorDevice *device,
         return result;
     }
 
+    if (job->options.verify && !result.sha256.isEmpty()) {
+        // Only the local copy is read again, the device side was hashed
+        // as it streamed in
+        QElapsedTimer verifyTimer;
+        verifyTimer.start();
+        const QByteArray localDigest = StreamHasher::hashFile(outputPath);
+        job->verifyNs += verifyTimer.nsecsElapsed();
+        if (localDigest != result.sha256) {
+            result.errorMessage =
+                QString("Verification failed for %1: SHA-256 %2, expected %3")
+                    .arg(outputPath)
+                    .arg(QString::fromLatin1(localDigest))
+                    .arg(QString::fromLatin1(result.sha256));
+            QFile::remove(outputPath);
+            return result;
+        }
+        result.verified = true;
+    }
+
+    if (convertKind) {
+        // The converted file replaces the original once it is written
+        ExportTranscoder::Task task;
+        task.kind = *convertKind;
+        task.sourcePath = outputPath;
+        task.targetPath =
+            replacedOutput.isEmpty()
+                ? generateUniqueOutputPath(
+                      ExportTranscoder::targetPathFor(outputPath, *convertKind))
+                : replacedOutput;
+        task.data = std::move(payload);
+        task.reservedBytes = reservedMemory;
+        task.modificationTime = modificationTime;
+        releaseMemory.dismiss();
+        releaseReplaced.dismiss();
+
+        /*
+            The result describes the file as copied. Whether it gets
+            replaced is only known once the task ran, so the journal only
+            marks the item done from here and a crash in between converts
+            it on the next run.
+        */
+        const QString targetPath = task.targetPath;
+        const QString devicePath = item.sourcePathOnDevice;
+        job->transcoder->submit(
+            std::move(task), [this, job, journal, manifest, index, devicePath,
+                              fileInfo, outputPath, targetPath,
+                              totalBytes](ExportTranscoder::Outcome outcome) {
+                const bool converted =
+                    outcome == ExportTranscoder::Outcome::Converted;
+                const QString finalPath = converted ? targetPath : outputPath;
+                if (converted) {
+                    QMutexLocker locker(&job->convertedMutex);
+                    job->convertedOutputs.insert(outputPath);
+                }
+                if (manifest) {
+                    manifest->record(devicePath, fileInfo, finalPath);
+                }
+                // Tasks dropped by a cancel still have to be converted
+                if (journal && (converted || !job->cancelRequested.load())) {
+                    journal->completeItem(index, totalBytes, finalPath);
+                }
+                releaseOutputPath(targetPath);
+            });
+    } else {
+        if (manifest) {
+            manifest->record(item.sourcePathOnDevice, fileInfo, outputPath);
+        }
+        if (journal) {
+            journal->completeItem(index, totalBytes, outputPath);
+        }
+    }
+    result.success = true;
+    result.bytesTransferred = totalBytes - resumeOffset;
+    return result;
+}
+
+ExportResult
+ExportManager::exportItemToArchive(ExportJob *job, const ExportItem &item,
+                                   std::optional<afc_client_t> altAfc)
+{
+    ExportArchive *archive = job->archive.get();
+
+    ExportResult result;
+    result.sourceFilePath = item.sourcePathOnDevice;
+
+    // The entry header needs the size and times before any data
+    MediaEntry fileInfo;
+    afc_error_t infoResult = ServiceManager::cachedStat(
+        job->device, item.sourcePathOnDevice.toUtf8().constData(), fileInfo,
+        altAfc);
+    if (infoResult != AFC_E_SUCCESS) {
+        result.errorMessage =
+            QString("Failed to get file info: %1 (AFC error: %2)")
+                .arg(item.sourcePathOnDevice)
+                .arg(static_cast<int>(infoResult));
+        return result;
+    }
+
+    AfcFileReader reader(job->device, item.sourcePathOnDevice, altAfc);
+    afc_error_t openResult = reader.open();
+    if (openResult != AFC_E_SUCCESS) {
+        result.errorMessage =
+            QString("Failed to open file on device: %1 (AFC error: %2)")
+                .arg(item.sourcePathOnDevice)
+                .arg(static_cast<int>(openResult));
+        return result;
+    }
+
+    const QString entryName =
+        archive->beginEntry(item.suggestedFileName, fileInfo.size,
+                            fileInfo.mtime, fileInfo.birthtime);
+    if (entryName.isEmpty()) {
+        result.errorMessage = QString("Failed to write archive %1: %2")
+                                  .arg(archive->path())
+                                  .arg(archive->errorString());
+        return result;
+    }
+    result.outputFilePath = entryName;
+
+    StreamHasher hasher;
+    QByteArray chunk;
+    quint64 totalBytes = 0;
+    while (reader.next(chunk)) {
+        if (job->cancelRequested.load()) {
+            reader.close();
+            archive->abortEntry();
+            result.errorMessage = "Export cancelled by user";
+            result.outputFilePath.clear();
+            return result;
+        }
+        if (!archive->write(chunk)) {
+            reader.close();
+            archive->endEntry();
+            result.errorMessage = QString("Failed to write archive %1: %2")
+                                      .arg(archive->path())
+                                      .arg(archive->errorString());
+            return result;
+        }
+        hasher.addData(chunk);
+        totalBytes += chunk.size();
+        emit fileTransferProgress(job->jobId, item.suggestedFileName,
+                                  totalBytes, fileInfo.size);
+    }
+    reader.close();
+
+    // A cut off read leaves nothing behind, a zero padded entry would
+    // pass for the file
+    if (reader.error() != AFC_E_SUCCESS) {
+        archive->abortEntry();
+        result.errorMessage =
+            QString("Read error on device: %1 (AFC error: %2), it was left "
+                    "out of the archive")
+                .arg(item.sourcePathOnDevice)
+                .arg(static_cast<int>(reader.error()));
+        result.outputFilePath.clear();
+        return result;
+    }
+    const bool complete = archive->endEntry();
+    if (!complete) {
+        result.errorMessage =
+            QString("%1 changed size while exporting, %2 is incomplete in "
+                    "the archive")
+                .arg(item.sourcePathOnDevice)
+                .arg(entryName);
+        return result;
+    }
+
+    result.sha256 = hasher.hexResult();
+    job->hashNs += hasher.elapsedNs();
     result.success = true;
     result.bytesTransferred = totalBytes;
     return result;
 }
 
-QString ExportManager::generateUniqueOutputPath(const QString &basePath) const
+QString ExportManager::generateUniqueOutputPath(const QString &basePath)
 {
-    if (!QFile::exists(basePath)) {
+    // Lanes pick names concurrently, a path stays taken until its item is done
+    QMutexLocker locker(&m_outputPathsMutex);
+    auto isTaken = [this](const QString &path) {
+        return QFile::exists(path) || m_reservedOutputPaths.contains(path);
+    };
+
+    if (!isTaken(basePath)) {
+        m_reservedOutputPaths.insert(basePath);
         return basePath;
     }
 
@@ -384,11 +1171,28 @@ QString ExportManager::generateUniqueOutputPath(const QString &basePath) const
         }
         uniquePath = QDir(directory).filePath(newName);
         counter++;
-    } while (QFile::exists(uniquePath) && counter < 10000);
+    } while (isTaken(uniquePath) && counter < 10000);
 
+    m_reservedOutputPaths.insert(uniquePath);
     return uniquePath;
 }
 
+bool ExportManager::reserveOutputPath(const QString &path)
+{
+    QMutexLocker locker(&m_outputPathsMutex);
+    if (m_reservedOutputPaths.contains(path)) {
+        return false;
+    }
+    m_reservedOutputPaths.insert(path);
+    return true;
+}
+
+void ExportManager::releaseOutputPath(const QString &path)
+{
+    QMutexLocker locker(&m_outputPathsMutex);
+    m_reservedOutputPaths.remove(path);
+}
+
 QString ExportManager::extractFileName(const QString &devicePath) const
 {
     int lastSlash = devicePath.lastIndexOf('/');
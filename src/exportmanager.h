@@ -20,20 +20,27 @@
 #ifndef EXPORTMANAGER_H
 #define EXPORTMANAGER_H
 
+#include "exportarchive.h"
 #include "iDescriptor.h"
 #include <QFuture>
 #include <QFutureWatcher>
 #include <QMap>
 #include <QMutex>
 #include <QObject>
+#include <QSet>
 #include <QString>
+#include <QStringList>
 #include <QUuid>
+#include <QWaitCondition>
 #include <atomic>
 #include <memory>
 #include <optional>
 
 // Forward declaration
+class ExportJournal;
+class ExportManifest;
 class ExportProgressDialog;
+class ExportTranscoder;
 
 struct ExportItem {
     QString sourcePathOnDevice;
@@ -46,12 +53,48 @@ struct ExportItem {
     }
 };
 
+struct ExportOptions {
+    /*
+        Only copy files that are new or changed since the last sync export
+        to the same destination, tracked by an ExportManifest there
+    */
+    bool sync = false;
+    // Write a sha256sum compatible checksum file next to the exported files
+    bool checksumFile = false;
+    // Read every exported file back and compare it to the streamed digest
+    bool verify = false;
+    // Convert while exporting, see ExportTranscoder
+    bool convertHeic = false;
+    bool convertHevc = false;
+    /*
+        Write everything into one archive in the destination instead of
+        loose files. Archives are written front to back, so they can't be
+        resumed, synced, verified or converted.
+    */
+    std::optional<ExportArchive::Format> archive;
+};
+
 struct ExportResult {
     QString sourceFilePath;
     QString outputFilePath;
     bool success = false;
     QString errorMessage;
     qint64 bytesTransferred = 0;
+    // Lowercase hex SHA-256 of the device file, empty for skipped items
+    QByteArray sha256;
+    // The local copy was read back and matched sha256
+    bool verified = false;
+    // Already exported by an earlier run or unchanged since the last sync
+    bool skipped = false;
+};
+
+struct ExportLaneStats {
+    int lane = 0;
+    QString currentFileName;
+    int itemsCompleted = 0;
+    qint64 bytesTransferred = 0;
+    // Time spent exporting items, excludes waiting for work
+    qint64 busyMs = 0;
 };
 
 struct ExportJobSummary {
@@ -59,6 +102,9 @@ struct ExportJobSummary {
     int totalItems = 0;
     int successfulItems = 0;
     int failedItems = 0;
+    // Counted in successfulItems as well
+    int skippedItems = 0;
+    int convertedItems = 0;
     qint64 totalBytesTransferred = 0;
     QString destinationPath;
     bool wasCancelled = false;
@@ -78,7 +124,23 @@ public:
 
     QUuid startExport(iDescriptorDevice *device, const QList<ExportItem> &items,
                       const QString &destinationPath,
-                      std::optional<afc_client_t> altAfc = std::nullopt);
+                      std::optional<afc_client_t> altAfc = std::nullopt,
+                      const ExportOptions &options = ExportOptions());
+
+    /*
+        Exports files and whole directory trees. Directories are walked on the
+        device while the first files already copy, their files keep their
+        path below the selected directory in the destination.
+    */
+    QUuid startTreeExport(iDescriptorDevice *device,
+                          const QList<ExportItem> &files,
+                          const QStringList &directories,
+                          const QString &destinationPath,
+                          std::optional<afc_client_t> altAfc = std::nullopt,
+                          const ExportOptions &options = ExportOptions());
+
+    // Checksum and verification options as configured in the settings
+    static ExportOptions optionsFromSettings();
 
     void cancelExport(const QUuid &jobId);
 
@@ -103,6 +165,10 @@ signals:
 
     void exportCancelled(const QUuid &jobId);
 
+    // Throttled snapshot of every transfer lane of a job
+    void laneStatsUpdated(const QUuid &jobId,
+                          const QList<ExportLaneStats> &lanes);
+
 private:
     // Private constructor for singleton pattern
     explicit ExportManager(QObject *parent = nullptr);
@@ -111,24 +177,78 @@ private:
     struct ExportJob {
         QUuid jobId;
         iDescriptorDevice *device = nullptr;
+        // Grows while the walker runs, guarded by itemsMutex from then on
         QList<ExportItem> items;
+        QStringList treeRoots;
+        QMutex itemsMutex;
+        QWaitCondition itemsAdded;
+        int nextItem = 0;
+        bool walking = false;
+        // Items the sync manifest already has an identical copy of
+        QSet<int> unchanged;
         QString destinationPath;
         std::optional<afc_client_t> altAfc;
+        ExportOptions options;
+        int laneCount = 1;
+        std::unique_ptr<ExportJournal> journal;
+        // Only set for sync exports
+        std::unique_ptr<ExportManifest> manifest;
+        // Only set when converting
+        std::unique_ptr<ExportTranscoder> transcoder;
+        // Exported originals the transcoder replaced, guarded by
+        // convertedMutex
+        QSet<QString> convertedOutputs;
+        QMutex convertedMutex;
+        // Only set for archive exports
+        std::unique_ptr<ExportArchive> archive;
         std::atomic<bool> cancelRequested{false};
+        // Time spent hashing on the copy path and in verification reads
+        std::atomic<qint64> hashNs{0};
+        std::atomic<qint64> verifyNs{0};
         QFuture<void> future;
         QFutureWatcher<void> *watcher = nullptr;
     };
 
+    QUuid launchJob(ExportJob *job);
     void executeExportJob(ExportJob *job);
 
-    ExportResult exportSingleItem(iDescriptorDevice *device,
-                                  const ExportItem &item,
-                                  const QString &destinationDir,
+    // Blocks while the walker may still add items, false once none are left
+    bool takeNextItem(ExportJob *job, int &index, ExportItem &item,
+                      bool &unchanged);
+    void walkTrees(ExportJob *job);
+    static constexpr unsigned long ITEM_WAIT_MS = 100;
+
+    // Larger photos are converted from the exported file instead of memory
+    static constexpr qint64 IN_MEMORY_CONVERT_LIMIT = 64LL * 1024 * 1024;
+
+    /*
+        Sync exports: stats every item in one pass, listing a directory at
+        once when it holds enough of the items, and returns the indexes the
+        manifest already has an identical copy of
+    */
+    QSet<int> findUnchangedItems(ExportJob *job);
+
+    // Fewer items than this in a directory are stat'ed one by one
+    static constexpr int SYNC_LISTING_THRESHOLD = 16;
+
+    // How often lanes publish ExportLaneStats
+    static constexpr qint64 LANE_STATS_INTERVAL_MS = 250;
+
+    ExportResult exportSingleItem(ExportJob *job, const ExportItem &item,
                                   std::optional<afc_client_t> altAfc,
-                                  std::atomic<bool> &cancelRequested,
-                                  const QUuid &jobId);
+                                  int index);
+
+    // Streams the item into the job's archive instead of a file of its own
+    ExportResult exportItemToArchive(ExportJob *job, const ExportItem &item,
+                                     std::optional<afc_client_t> altAfc);
 
-    QString generateUniqueOutputPath(const QString &basePath) const;
+    void writeChecksumFile(ExportJob *job, const QList<ExportResult> &results);
+
+    // Reserves the returned path until releaseOutputPath
+    QString generateUniqueOutputPath(const QString &basePath);
+    // Reserves an exact path, false if another item holds it
+    bool reserveOutputPath(const QString &path);
+    void releaseOutputPath(const QString &path);
 
     QString extractFileName(const QString &devicePath) const;
 
@@ -138,6 +258,9 @@ private:
     mutable QMutex m_jobsMutex;
     QMap<QUuid, ExportJob *> m_activeJobs;
 
+    QMutex m_outputPathsMutex;
+    QSet<QString> m_reservedOutputPaths;
+
     // Manager owns the dialog
     ExportProgressDialog *m_exportProgressDialog;
 };
@@ -0,0 +1,166 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "exportmanifest.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QUrl>
+
+/*
+    One record per line, fields separated by tabs and percent-encoded:
+        V <version>
+        U <udid>
+        F <device path> <size> <mtime> <output path>
+*/
+static const QByteArray MANIFEST_VERSION = "1";
+
+static QByteArray field(const QString &value)
+{
+    return QUrl::toPercentEncoding(value);
+}
+
+std::unique_ptr<ExportManifest>
+ExportManifest::open(const QString &destinationDir, const QString &udid)
+{
+    const QByteArray hash =
+        QCryptographicHash::hash(udid.toUtf8(), QCryptographicHash::Sha1)
+            .toHex()
+            .left(16);
+
+    std::unique_ptr<ExportManifest> manifest(new ExportManifest());
+    manifest->m_destinationDir = destinationDir;
+    manifest->m_udid = udid;
+    manifest->m_path = QDir(destinationDir)
+                           .filePath(QString(FILE_PREFIX) +
+                                     QString::fromLatin1(hash) + FILE_SUFFIX);
+
+    if (QFile::exists(manifest->m_path) && !manifest->parse()) {
+        qWarning() << "Ignoring unreadable export manifest" << manifest->m_path;
+        manifest->m_entries.clear();
+    }
+    qDebug() << "Export manifest" << manifest->m_path << "has"
+             << manifest->m_entries.size() << "entries";
+    return manifest;
+}
+
+bool ExportManifest::parse()
+{
+    QFile in(m_path);
+    if (!in.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    bool versionOk = false;
+    bool udidOk = false;
+    const QList<QByteArray> lines = in.readAll().split('\n');
+    m_entries.reserve(lines.size());
+    for (const QByteArray &line : lines) {
+        const QList<QByteArray> fields = line.split('\t');
+        const QByteArray &type = fields.at(0);
+        if (type == "V" && fields.size() >= 2) {
+            versionOk = fields.at(1) == MANIFEST_VERSION;
+        } else if (type == "U" && fields.size() >= 2) {
+            udidOk = QUrl::fromPercentEncoding(fields.at(1)) == m_udid;
+        } else if (type == "F" && fields.size() >= 5) {
+            Entry entry;
+            entry.size = fields.at(2).toULongLong();
+            entry.mtime = fields.at(3).toULongLong();
+            entry.outputPath = QUrl::fromPercentEncoding(fields.at(4));
+            m_entries.insert(QUrl::fromPercentEncoding(fields.at(1)), entry);
+        }
+    }
+    return versionOk && udidOk;
+}
+
+std::optional<ExportManifest::Entry>
+ExportManifest::lookup(const QString &devicePath) const
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.constFind(devicePath);
+    if (it == m_entries.constEnd()) {
+        return std::nullopt;
+    }
+    return it.value();
+}
+
+bool ExportManifest::isUpToDate(const QString &devicePath,
+                                const MediaEntry &stat) const
+{
+    if (!stat.hasStat) {
+        return false;
+    }
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.constFind(devicePath);
+    return it != m_entries.constEnd() && it->size == stat.size &&
+           it->mtime == stat.mtime;
+}
+
+void ExportManifest::record(const QString &devicePath, const MediaEntry &stat,
+                            const QString &outputPath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.insert(devicePath,
+                     {stat.size, stat.mtime,
+                      QDir(m_destinationDir).relativeFilePath(outputPath)});
+    m_dirty = true;
+}
+
+QString ExportManifest::absoluteOutputPath(const Entry &entry) const
+{
+    return QDir(m_destinationDir).filePath(entry.outputPath);
+}
+
+int ExportManifest::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
+
+bool ExportManifest::save()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_dirty) {
+        return true;
+    }
+
+    QSaveFile out(m_path);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write export manifest" << m_path << ":"
+                   << out.errorString();
+        return false;
+    }
+    out.write("V\t" + MANIFEST_VERSION + "\n");
+    out.write("U\t" + field(m_udid) + "\n");
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        out.write("F\t" + field(it.key()) + "\t" +
+                  QByteArray::number(it->size) + "\t" +
+                  QByteArray::number(it->mtime) + "\t" +
+                  field(it->outputPath) + "\n");
+    }
+    if (!out.commit()) {
+        qWarning() << "Could not write export manifest" << m_path << ":"
+                   << out.errorString();
+        return false;
+    }
+    m_dirty = false;
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORTMANIFEST_H
+#define EXPORTMANIFEST_H
+
+#include "iDescriptor.h"
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <memory>
+#include <optional>
+
+/**
+ * @brief Index of what a destination directory already holds from a device
+ *
+ * Sync exports keep one manifest per device in the destination, mapping each
+ * exported device path to the size and mtime it had and the file it was
+ * written to. Deciding whether an item needs copying is then a hash lookup
+ * against the stats of a single listing pass, the exported files themselves
+ * are never probed. Deleting the manifest forces a full export.
+ *
+ * The manifest is rewritten atomically by save(), a crash loses at most the
+ * entries of the interrupted run, which the export journal covers.
+ */
+class ExportManifest
+{
+public:
+    struct Entry {
+        quint64 size = 0;
+        // Nanoseconds since epoch, as reported by AFC
+        quint64 mtime = 0;
+        // Relative to the destination directory
+        QString outputPath;
+    };
+
+    static std::unique_ptr<ExportManifest> open(const QString &destinationDir,
+                                                const QString &udid);
+
+    std::optional<Entry> lookup(const QString &devicePath) const;
+    // Whether the copy in the destination matches the device file's stat
+    bool isUpToDate(const QString &devicePath, const MediaEntry &stat) const;
+    void record(const QString &devicePath, const MediaEntry &stat,
+                const QString &outputPath);
+
+    QString absoluteOutputPath(const Entry &entry) const;
+    int size() const;
+
+    bool save();
+
+private:
+    static constexpr const char *FILE_PREFIX = ".idescriptor-manifest-";
+    static constexpr const char *FILE_SUFFIX = ".tsv";
+
+    ExportManifest() = default;
+
+    bool parse();
+
+    QString m_path;
+    QString m_destinationDir;
+    QString m_udid;
+
+    mutable QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    bool m_dirty = false;
+};
+
+#endif // EXPORTMANIFEST_H
@@ -53,6 +53,8 @@ ExportProgressDialog::ExportProgressDialog(ExportManager *exportManager,
             &ExportProgressDialog::onExportFinished);
     connect(m_exportManager, &ExportManager::exportCancelled, this,
             &ExportProgressDialog::onExportCancelled);
+    connect(m_exportManager, &ExportManager::laneStatsUpdated, this,
+            &ExportProgressDialog::onLaneStatsUpdated);
 
     // Setup transfer rate timer
     m_transferRateTimer = new QTimer(this);
@@ -71,7 +73,7 @@ void ExportProgressDialog::setupUI()
 {
     setWindowTitle("Exporting Files");
     setModal(true);
-    setFixedSize(480, 280);
+    setFixedSize(480, 360);
     setWindowFlags(Qt::Dialog | Qt::WindowTitleHint | Qt::CustomizeWindowHint);
 
     m_mainLayout = new QVBoxLayout(this);
@@ -125,6 +127,15 @@ void ExportProgressDialog::setupUI()
     m_timeRemainingLabel->setAlignment(Qt::AlignCenter);
     m_mainLayout->addWidget(m_timeRemainingLabel);
 
+    // Per-lane breakdown, only shown when the job runs on several lanes
+    m_laneStatsLabel = new QLabel();
+    m_laneStatsLabel->setAlignment(Qt::AlignCenter);
+    QFont laneFont = m_laneStatsLabel->font();
+    laneFont.setPointSize(laneFont.pointSize() - 1);
+    m_laneStatsLabel->setFont(laneFont);
+    m_laneStatsLabel->setVisible(false);
+    m_mainLayout->addWidget(m_laneStatsLabel);
+
     // Add stretch before buttons
     m_mainLayout->addStretch();
 
@@ -218,6 +229,7 @@ void ExportProgressDialog::showForJob(const QUuid &jobId)
     m_totalBytesTransferred = 0;
     m_lastBytesTransferred = 0;
     m_completedItems = 0;
+    m_laneCount = 1;
 
     // Reset UI
     m_progressBar->setValue(0);
@@ -226,6 +238,8 @@ void ExportProgressDialog::showForJob(const QUuid &jobId)
     m_statsLabel->setText("0 of 0 items");
     m_transferRateLabel->clear();
     m_timeRemainingLabel->clear();
+    m_laneStatsLabel->clear();
+    m_laneStatsLabel->setVisible(false);
     m_cancelButton->setVisible(true);
     m_closeButton->setVisible(false);
     m_openDirButton->setVisible(false);
@@ -262,12 +276,20 @@ void ExportProgressDialog::onExportProgress(const QUuid &jobId, int currentItem,
     if (jobId != m_currentJobId)
         return;
 
+    // Tree exports keep discovering items while they run
+    m_totalItems = totalItems;
+
     // Update current file
     m_currentFileLabel->setText(currentFileName);
 
     // Update stats
     m_statsLabel->setText(
         QString("%1 of %2 items").arg(currentItem).arg(totalItems));
+
+    // Several files are in flight at once, track items instead of bytes
+    if (m_laneCount > 1 && totalItems > 0) {
+        m_progressBar->setValue((currentItem * 100) / totalItems);
+    }
 }
 
 void ExportProgressDialog::onFileTransferProgress(const QUuid &jobId,
@@ -279,9 +301,11 @@ void ExportProgressDialog::onFileTransferProgress(const QUuid &jobId,
         return;
 
     // Update progress bar based on current file transfer
-    int progress =
-        totalFileSize > 0 ? (bytesTransferred * 100) / totalFileSize : 0;
-    m_progressBar->setValue(progress);
+    if (m_laneCount <= 1) {
+        int progress =
+            totalFileSize > 0 ? (bytesTransferred * 100) / totalFileSize : 0;
+        m_progressBar->setValue(progress);
+    }
 
     // Update transfer info
     QString transferInfo = QString("%1 / %2")
@@ -328,6 +352,14 @@ void ExportProgressDialog::onExportFinished(const QUuid &jobId,
         m_titleLabel->setText("Export Completed with Errors");
     }
 
+    if (summary.skippedItems > 0) {
+        message += QString(", %1 already up to date")
+                       .arg(summary.skippedItems);
+    }
+    if (summary.convertedItems > 0) {
+        message += QString(", %1 converted").arg(summary.convertedItems);
+    }
+
     m_statusLabel->setText(message);
     m_transferRateLabel->setText(
         QString("Total: %1")
@@ -363,6 +395,35 @@ void ExportProgressDialog::onExportCancelled(const QUuid &jobId)
     m_closeButton->setFocus();
 }
 
+void ExportProgressDialog::onLaneStatsUpdated(
+    const QUuid &jobId, const QList<ExportLaneStats> &lanes)
+{
+    if (jobId != m_currentJobId)
+        return;
+
+    m_laneCount = lanes.size();
+    if (m_laneCount <= 1) {
+        m_laneStatsLabel->setVisible(false);
+        return;
+    }
+
+    QStringList lines;
+    for (const ExportLaneStats &stats : lanes) {
+        const qint64 bytesPerSecond =
+            stats.busyMs > 0 ? (stats.bytesTransferred * 1000) / stats.busyMs
+                             : 0;
+        lines << QString("Lane %1: %2 items, %3 %4")
+                     .arg(stats.lane + 1)
+                     .arg(stats.itemsCompleted)
+                     .arg(formatTransferRate(bytesPerSecond))
+                     .arg(stats.currentFileName.isEmpty()
+                              ? QString("(idle)")
+                              : stats.currentFileName);
+    }
+    m_laneStatsLabel->setText(lines.join("\n"));
+    m_laneStatsLabel->setVisible(true);
+}
+
 void ExportProgressDialog::onCancelClicked()
 {
     int reply = QMessageBox::question(
@@ -20,6 +20,7 @@
 #ifndef EXPORTPROGRESSDIALOG_H
 #define EXPORTPROGRESSDIALOG_H
 
+#include "exportmanager.h"
 #include <QDateTime>
 #include <QDialog>
 #include <QLabel>
@@ -59,6 +60,8 @@ private slots:
     void onItemExported(const QUuid &jobId, const ExportResult &result);
     void onExportFinished(const QUuid &jobId, const ExportJobSummary &summary);
     void onExportCancelled(const QUuid &jobId);
+    void onLaneStatsUpdated(const QUuid &jobId,
+                            const QList<ExportLaneStats> &lanes);
     void onCancelClicked();
     void onOpenDirectoryClicked();
     void updateTransferRate();
@@ -81,6 +84,7 @@ private:
     QLabel *m_statsLabel;
     QLabel *m_transferRateLabel;
     QLabel *m_timeRemainingLabel;
+    QLabel *m_laneStatsLabel;
     QPushButton *m_cancelButton;
     QPushButton *m_closeButton;
     QPushButton *m_openDirButton;
@@ -88,6 +92,7 @@ private:
     QString m_destinationPath;
     int m_totalItems = 0;
     int m_completedItems = 0;
+    int m_laneCount = 1;
     qint64 m_totalBytesTransferred = 0;
     QTimer *m_transferRateTimer;
     qint64 m_lastBytesTransferred = 0;
@@ -0,0 +1,531 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "exporttranscoder.h"
+#include "exportmanager.h"
+#include "iDescriptor.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QThread>
+#include <algorithm>
+#include <libheif/heif.h>
+#include <string.h>
+#include <vector>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+/*
+    The pixels come out of libheif already rotated, so the copied Exif must
+    not ask viewers to rotate them again. Sets the IFD0 orientation to 1.
+*/
+static void resetExifOrientation(QByteArray &tiff)
+{
+    if (tiff.size() < 8)
+        return;
+    const bool littleEndian = tiff.startsWith("II");
+    if (!littleEndian && !tiff.startsWith("MM"))
+        return;
+    auto *data = reinterpret_cast<uchar *>(tiff.data());
+    auto read = [&](qsizetype at, int bytes) {
+        quint32 value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            const int shift = 8 * (littleEndian ? i : bytes - 1 - i);
+            value |= quint32(data[at + i]) << shift;
+        }
+        return value;
+    };
+
+    const quint32 ifd = read(4, 4);
+    if (ifd > quint32(tiff.size() - 2))
+        return;
+    const quint32 count = read(ifd, 2);
+    for (quint32 i = 0; i < count; ++i) {
+        const qsizetype entry = ifd + 2 + 12 * qsizetype(i);
+        if (entry + 12 > tiff.size())
+            return;
+        // Orientation, a SHORT stored in the entry itself
+        if (read(entry, 2) == 0x0112 && read(entry + 2, 2) == 3) {
+            data[entry + 8] = littleEndian ? 1 : 0;
+            data[entry + 9] = littleEndian ? 0 : 1;
+            return;
+        }
+    }
+}
+
+// Inserts an APP1 Exif segment after the SOI and JFIF APP0 markers
+static QByteArray withExif(const QByteArray &jpeg, const QByteArray &tiff)
+{
+    static const QByteArray header("Exif\0\0", 6);
+    const qsizetype length = 2 + header.size() + tiff.size();
+    // A segment can't be larger, such an Exif block is left out
+    if (tiff.isEmpty() || length > 0xFFFF || !jpeg.startsWith("\xFF\xD8"))
+        return jpeg;
+
+    qsizetype at = 2;
+    if (jpeg.size() > 6 && uchar(jpeg[2]) == 0xFF && uchar(jpeg[3]) == 0xE0)
+        at = 4 + ((uchar(jpeg[4]) << 8) | uchar(jpeg[5]));
+    if (at > jpeg.size())
+        return jpeg;
+
+    QByteArray segment;
+    segment.reserve(2 + length);
+    segment.append('\xFF').append('\xE1');
+    segment.append(char(length >> 8)).append(char(length & 0xFF));
+    segment.append(header).append(tiff);
+
+    QByteArray result = jpeg;
+    result.insert(at, segment);
+    return result;
+}
+
+// Rotation of phone videos lives in the display matrix, not in the frames
+static void copyDisplayMatrix(const AVStream *from, AVStream *to)
+{
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(60, 31, 102)
+    const AVPacketSideData *matrix = av_packet_side_data_get(
+        from->codecpar->coded_side_data, from->codecpar->nb_coded_side_data,
+        AV_PKT_DATA_DISPLAYMATRIX);
+    if (!matrix)
+        return;
+    AVPacketSideData *copy = av_packet_side_data_new(
+        &to->codecpar->coded_side_data, &to->codecpar->nb_coded_side_data,
+        AV_PKT_DATA_DISPLAYMATRIX, matrix->size, 0);
+    if (copy)
+        memcpy(copy->data, matrix->data, matrix->size);
+#else
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    size_t size = 0;
+#else
+    int size = 0;
+#endif
+    const uint8_t *matrix =
+        av_stream_get_side_data(from, AV_PKT_DATA_DISPLAYMATRIX, &size);
+    if (!matrix)
+        return;
+    uint8_t *copy =
+        av_stream_new_side_data(to, AV_PKT_DATA_DISPLAYMATRIX, size);
+    if (copy)
+        memcpy(copy, matrix, size);
+#endif
+}
+
+ExportTranscoder::ExportTranscoder(int jpegQuality)
+    : m_jpegQuality(jpegQuality)
+{
+    // Keep two cores for the transfer lanes and the UI
+    m_pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 2));
+}
+
+ExportTranscoder::~ExportTranscoder() { m_pool.waitForDone(); }
+
+std::optional<ExportTranscoder::Kind>
+ExportTranscoder::kindFor(const ExportOptions &options, const QString &fileName)
+{
+    const QString suffix = QFileInfo(fileName).suffix().toLower();
+    if (options.convertHeic && (suffix == "heic" || suffix == "heif")) {
+        return Kind::HeicToJpeg;
+    }
+    if (options.convertHevc &&
+        (suffix == "mov" || suffix == "mp4" || suffix == "m4v")) {
+        // Whether it actually is HEVC is only known once it's opened
+        return Kind::HevcToH264;
+    }
+    return std::nullopt;
+}
+
+QString ExportTranscoder::targetPathFor(const QString &sourcePath, Kind kind)
+{
+    const QFileInfo info(sourcePath);
+    return QDir(info.path())
+        .filePath(info.completeBaseName() +
+                  (kind == Kind::HeicToJpeg ? ".jpg" : ".mp4"));
+}
+
+bool ExportTranscoder::reserveMemory(qint64 bytes)
+{
+    qint64 current = m_reservedBytes.load();
+    do {
+        if (current + bytes > MEMORY_BUDGET) {
+            return false;
+        }
+    } while (!m_reservedBytes.compare_exchange_weak(current, current + bytes));
+    return true;
+}
+
+void ExportTranscoder::releaseMemory(qint64 bytes) { m_reservedBytes -= bytes; }
+
+void ExportTranscoder::submit(Task task, std::function<void(Outcome)> done)
+{
+    m_pool.start([this, task = std::move(task), done = std::move(done)]() {
+        QThread::currentThread()->setPriority(QThread::LowPriority);
+
+        QElapsedTimer timer;
+        timer.start();
+        // Cancelled jobs still run their tasks, as no-ops, so every
+        // callback fires and every reservation is released
+        const Outcome outcome =
+            m_cancelled.load() ? Outcome::NotNeeded : run(task);
+        m_busyNs += timer.nsecsElapsed();
+        releaseMemory(task.reservedBytes);
+
+        if (outcome == Outcome::Converted) {
+            m_converted++;
+        } else if (outcome == Outcome::Failed) {
+            m_failed++;
+        }
+        if (done) {
+            done(outcome);
+        }
+    });
+}
+
+void ExportTranscoder::cancel() { m_cancelled = true; }
+
+void ExportTranscoder::waitForDone() { m_pool.waitForDone(); }
+
+ExportTranscoder::Outcome ExportTranscoder::run(const Task &task) const
+{
+    // Replacing an earlier export, convert next to it so a failure keeps it
+    Task staged = task;
+    const bool replacing = QFile::exists(task.targetPath);
+    if (replacing) {
+        staged.targetPath = task.targetPath + ".converting";
+    }
+
+    const Outcome outcome = staged.kind == Kind::HeicToJpeg
+                                ? heicToJpeg(staged)
+                                : hevcToH264(staged);
+    if (outcome != Outcome::Converted) {
+        QFile::remove(staged.targetPath);
+        if (outcome == Outcome::Failed) {
+            qWarning() << "Could not convert" << task.sourcePath
+                       << "- keeping the original";
+        }
+        return outcome;
+    }
+
+    if (replacing) {
+        if (!QFile::remove(task.targetPath)) {
+            qWarning() << "Could not replace" << task.targetPath
+                       << "- keeping the original";
+            QFile::remove(staged.targetPath);
+            return Outcome::Failed;
+        }
+        if (!QFile::rename(staged.targetPath, task.targetPath)) {
+            qWarning() << "Could not move the conversion to"
+                       << task.targetPath << "- it was left at"
+                       << staged.targetPath;
+            return Outcome::Failed;
+        }
+    }
+
+    if (task.modificationTime.isValid()) {
+        QFile converted(task.targetPath);
+        converted.open(QIODevice::ReadOnly);
+        converted.setFileTime(task.modificationTime,
+                              QFileDevice::FileModificationTime);
+    }
+    QFile::remove(task.sourcePath);
+    return outcome;
+}
+
+ExportTranscoder::Outcome ExportTranscoder::heicToJpeg(const Task &task) const
+{
+    QByteArray data = task.data;
+    if (data.isEmpty()) {
+        QFile in(task.sourcePath);
+        if (!in.open(QIODevice::ReadOnly)) {
+            return Outcome::Failed;
+        }
+        data = in.readAll();
+    }
+
+    heif_context *ctx = heif_context_alloc();
+    if (!ctx) {
+        return Outcome::Failed;
+    }
+    auto freeContext = qScopeGuard([ctx]() { heif_context_free(ctx); });
+    if (heif_context_read_from_memory(ctx, data.constData(), data.size(),
+                                      nullptr)
+            .code != heif_error_Ok) {
+        return Outcome::Failed;
+    }
+
+    const QImage image = load_heic_image(ctx, QSize());
+    if (image.isNull()) {
+        return Outcome::Failed;
+    }
+
+    // QImage writes no Exif, capture date, location and camera are carried
+    // over from the HEIF
+    QByteArray jpeg;
+    QBuffer buffer(&jpeg);
+    buffer.open(QIODevice::WriteOnly);
+    if (!image.save(&buffer, "JPEG", m_jpegQuality)) {
+        return Outcome::Failed;
+    }
+    QByteArray exif = heic_exif(ctx);
+    resetExifOrientation(exif);
+
+    QSaveFile out(task.targetPath);
+    if (!out.open(QIODevice::WriteOnly) ||
+        out.write(withExif(jpeg, exif)) < 0 || !out.commit()) {
+        return Outcome::Failed;
+    }
+    return Outcome::Converted;
+}
+
+ExportTranscoder::Outcome ExportTranscoder::hevcToH264(const Task &task) const
+{
+    const QByteArray inPath = task.sourcePath.toUtf8();
+    const QByteArray outPath = task.targetPath.toUtf8();
+
+    AVFormatContext *in = nullptr;
+    if (avformat_open_input(&in, inPath.constData(), nullptr, nullptr) < 0) {
+        return Outcome::Failed;
+    }
+    auto closeInput = qScopeGuard([&in]() { avformat_close_input(&in); });
+    if (avformat_find_stream_info(in, nullptr) < 0) {
+        return Outcome::Failed;
+    }
+
+    const int videoIndex =
+        av_find_best_stream(in, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (videoIndex < 0 ||
+        in->streams[videoIndex]->codecpar->codec_id != AV_CODEC_ID_HEVC) {
+        return Outcome::NotNeeded;
+    }
+    AVStream *inVideo = in->streams[videoIndex];
+
+    const AVCodec *decoder = avcodec_find_decoder(AV_CODEC_ID_HEVC);
+    const AVCodec *encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+    if (!decoder || !encoder) {
+        qWarning() << "FFmpeg has no HEVC decoder or H.264 encoder";
+        return Outcome::Failed;
+    }
+
+    AVCodecContext *dec = avcodec_alloc_context3(decoder);
+    auto freeDecoder = qScopeGuard([&dec]() { avcodec_free_context(&dec); });
+    if (!dec || avcodec_parameters_to_context(dec, inVideo->codecpar) < 0) {
+        return Outcome::Failed;
+    }
+    dec->pkt_timebase = inVideo->time_base;
+    if (avcodec_open2(dec, decoder, nullptr) < 0) {
+        return Outcome::Failed;
+    }
+
+    AVFormatContext *out = nullptr;
+    if (avformat_alloc_output_context2(&out, nullptr, "mp4",
+                                       outPath.constData()) < 0 ||
+        !out) {
+        return Outcome::Failed;
+    }
+    auto freeOutput = qScopeGuard([&out]() {
+        if (!(out->oformat->flags & AVFMT_NOFILE))
+            avio_closep(&out->pb);
+        avformat_free_context(out);
+    });
+
+    AVCodecContext *enc = avcodec_alloc_context3(encoder);
+    auto freeEncoder = qScopeGuard([&enc]() { avcodec_free_context(&enc); });
+    if (!enc) {
+        return Outcome::Failed;
+    }
+    enc->width = dec->width;
+    enc->height = dec->height;
+    enc->sample_aspect_ratio = dec->sample_aspect_ratio;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = inVideo->time_base;
+    enc->framerate = av_guess_frame_rate(in, inVideo, nullptr);
+    if (out->oformat->flags & AVFMT_GLOBALHEADER)
+        enc->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    // libx264 settings, encoders that don't know them leave them unused
+    AVDictionary *encoderOptions = nullptr;
+    av_dict_set(&encoderOptions, "preset", "veryfast", 0);
+    av_dict_set(&encoderOptions, "crf", "20", 0);
+    const int opened = avcodec_open2(enc, encoder, &encoderOptions);
+    av_dict_free(&encoderOptions);
+    if (opened < 0) {
+        return Outcome::Failed;
+    }
+
+    // Video is re-encoded, audio is copied as it is
+    std::vector<int> streamMap(in->nb_streams, -1);
+    for (unsigned int i = 0; i < in->nb_streams; ++i) {
+        AVStream *inStream = in->streams[i];
+        const bool isVideo = static_cast<int>(i) == videoIndex;
+        if (!isVideo && inStream->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+            continue;
+
+        AVStream *outStream = avformat_new_stream(out, nullptr);
+        if (!outStream) {
+            return Outcome::Failed;
+        }
+        if (isVideo) {
+            if (avcodec_parameters_from_context(outStream->codecpar, enc) < 0)
+                return Outcome::Failed;
+            outStream->time_base = enc->time_base;
+            copyDisplayMatrix(inStream, outStream);
+        } else {
+            if (avcodec_parameters_copy(outStream->codecpar,
+                                        inStream->codecpar) < 0)
+                return Outcome::Failed;
+            outStream->codecpar->codec_tag = 0;
+            outStream->time_base = inStream->time_base;
+        }
+        av_dict_copy(&outStream->metadata, inStream->metadata, 0);
+        streamMap[i] = outStream->index;
+    }
+    // Creation date and location
+    av_dict_copy(&out->metadata, in->metadata, 0);
+
+    if (!(out->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&out->pb, outPath.constData(), AVIO_FLAG_WRITE) < 0) {
+        return Outcome::Failed;
+    }
+    if (avformat_write_header(out, nullptr) < 0) {
+        return Outcome::Failed;
+    }
+    AVStream *outVideo = out->streams[streamMap[videoIndex]];
+
+    AVPacket *packet = av_packet_alloc();
+    AVPacket *encoded = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *converted = av_frame_alloc();
+    SwsContext *sws = nullptr;
+    auto freeBuffers = qScopeGuard([&]() {
+        av_packet_free(&packet);
+        av_packet_free(&encoded);
+        av_frame_free(&frame);
+        av_frame_free(&converted);
+        sws_freeContext(sws);
+    });
+    if (!packet || !encoded || !frame || !converted) {
+        return Outcome::Failed;
+    }
+
+    bool ok = true;
+    auto drainEncoder = [&]() {
+        while (ok) {
+            const int ret = avcodec_receive_packet(enc, encoded);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return;
+            if (ret < 0) {
+                ok = false;
+                return;
+            }
+            av_packet_rescale_ts(encoded, enc->time_base, outVideo->time_base);
+            encoded->stream_index = outVideo->index;
+            if (av_interleaved_write_frame(out, encoded) < 0)
+                ok = false;
+        }
+    };
+
+    // A null source flushes the encoder
+    auto encodeFrame = [&](AVFrame *source) {
+        AVFrame *input = source;
+        if (source && source->format != AV_PIX_FMT_YUV420P) {
+            // 10-bit HDR and other layouts H.264 players can't handle
+            sws = sws_getCachedContext(
+                sws, source->width, source->height,
+                static_cast<AVPixelFormat>(source->format), enc->width,
+                enc->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, nullptr,
+                nullptr, nullptr);
+            av_frame_unref(converted);
+            converted->format = AV_PIX_FMT_YUV420P;
+            converted->width = enc->width;
+            converted->height = enc->height;
+            if (!sws || av_frame_get_buffer(converted, 0) < 0) {
+                ok = false;
+                return;
+            }
+            sws_scale(sws, source->data, source->linesize, 0, source->height,
+                      converted->data, converted->linesize);
+            input = converted;
+        }
+        if (input) {
+            input->pts = source->best_effort_timestamp;
+            input->pict_type = AV_PICTURE_TYPE_NONE;
+        }
+        if (avcodec_send_frame(enc, input) < 0) {
+            ok = false;
+            return;
+        }
+        drainEncoder();
+    };
+
+    auto drainDecoder = [&]() {
+        while (ok) {
+            const int ret = avcodec_receive_frame(dec, frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+                return;
+            if (ret < 0) {
+                ok = false;
+                return;
+            }
+            encodeFrame(frame);
+            av_frame_unref(frame);
+        }
+    };
+
+    while (ok && !m_cancelled.load() && av_read_frame(in, packet) >= 0) {
+        const int index = packet->stream_index;
+        if (index == videoIndex) {
+            const int ret = avcodec_send_packet(dec, packet);
+            av_packet_unref(packet);
+            // A damaged packet costs a frame, not the whole file
+            if (ret < 0 && ret != AVERROR_INVALIDDATA)
+                ok = false;
+            drainDecoder();
+        } else if (index < static_cast<int>(streamMap.size()) &&
+                   streamMap[index] >= 0) {
+            AVStream *outStream = out->streams[streamMap[index]];
+            av_packet_rescale_ts(packet, in->streams[index]->time_base,
+                                 outStream->time_base);
+            packet->stream_index = outStream->index;
+            packet->pos = -1;
+            if (av_interleaved_write_frame(out, packet) < 0)
+                ok = false;
+        } else {
+            av_packet_unref(packet);
+        }
+    }
+
+    if (m_cancelled.load())
+        ok = false;
+    if (ok) {
+        avcodec_send_packet(dec, nullptr);
+        drainDecoder();
+        encodeFrame(nullptr);
+    }
+    if (ok && av_write_trailer(out) < 0)
+        ok = false;
+    return ok ? Outcome::Converted : Outcome::Failed;
+}
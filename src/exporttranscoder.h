@@ -0,0 +1,106 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EXPORTTRANSCODER_H
+#define EXPORTTRANSCODER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
+#include <optional>
+
+struct ExportOptions;
+
+/**
+ * @brief CPU stage of an export job, converting files as lanes finish them
+ *
+ * Lanes hand over every downloaded file that needs converting and move on to
+ * the next device read right away; submit() never blocks. The work runs on a
+ * small pool of low priority threads that leaves cores for the transfer
+ * lanes and the UI. Photos small enough to fit the memory budget travel in
+ * memory and are never read back from disk, videos are converted from the
+ * freshly written (and still cached) file.
+ *
+ * A converted file replaces the original, a file that fails to convert is
+ * kept as exported.
+ */
+class ExportTranscoder
+{
+public:
+    enum class Kind { HeicToJpeg, HevcToH264 };
+    enum class Outcome { Converted, NotNeeded, Failed };
+
+    struct Task {
+        Kind kind = Kind::HeicToJpeg;
+        // The exported original, removed once converted
+        QString sourcePath;
+        // An existing file here is only replaced once the conversion worked
+        QString targetPath;
+        // Original contents when they fit the memory budget
+        QByteArray data;
+        // Claimed with reserveMemory, released once the task is done
+        qint64 reservedBytes = 0;
+        QDateTime modificationTime;
+    };
+
+    explicit ExportTranscoder(int jpegQuality = DEFAULT_JPEG_QUALITY);
+    ~ExportTranscoder();
+
+    // What an item needs under these options, nullopt to leave it alone
+    static std::optional<Kind> kindFor(const ExportOptions &options,
+                                       const QString &fileName);
+    static QString targetPathFor(const QString &sourcePath, Kind kind);
+
+    // Claims room for an in-memory payload, false when the budget is spent
+    bool reserveMemory(qint64 bytes);
+    void releaseMemory(qint64 bytes);
+
+    // done runs on a pool thread
+    void submit(Task task, std::function<void(Outcome)> done);
+
+    // Drops tasks that did not start yet, their originals stay as exported
+    void cancel();
+    void waitForDone();
+
+    int convertedCount() const { return m_converted.load(); }
+    int failedCount() const { return m_failed.load(); }
+    qint64 busyMs() const { return m_busyNs.load() / 1000000; }
+
+    static constexpr int DEFAULT_JPEG_QUALITY = 92;
+
+private:
+    static constexpr qint64 MEMORY_BUDGET = 256LL * 1024 * 1024;
+
+    Outcome run(const Task &task) const;
+    Outcome heicToJpeg(const Task &task) const;
+    Outcome hevcToH264(const Task &task) const;
+
+    QThreadPool m_pool;
+    const int m_jpegQuality;
+    std::atomic<qint64> m_reservedBytes{0};
+    std::atomic<int> m_converted{0};
+    std::atomic<int> m_failed{0};
+    std::atomic<qint64> m_busyNs{0};
+    std::atomic<bool> m_cancelled{false};
+};
+
+#endif // EXPORTTRANSCODER_H
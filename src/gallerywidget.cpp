@@ -18,11 +18,13 @@
  */
 
 #include "gallerywidget.h"
+#include "afcdirectorylister.h"
 #include "exportmanager.h"
 #include "iDescriptor.h"
 #include "mediapreviewdialog.h"
 #include "photomodel.h"
 #include "servicemanager.h"
+#include "settingsmanager.h"
 #include <QComboBox>
 #include <QDebug>
 #include <QFileDialog>
@@ -35,6 +37,7 @@
 #include <QMessageBox>
 #include <QPushButton>
 #include <QRegularExpression>
+#include <QScrollBar>
 #include <QStackedWidget>
 #include <QStandardItemModel>
 #include <QStandardPaths>
@@ -54,6 +57,8 @@ GalleryWidget::GalleryWidget(iDescriptorDevice *device, QWidget *parent)
       m_albumListView(nullptr), m_photoGalleryWidget(nullptr),
       m_listView(nullptr), m_backButton(nullptr)
 {
+    m_coverCache =
+        ThumbnailDiskCache::forDevice(QString::fromStdString(device->udid));
 }
 /*Load is called when the tab is active*/
 void GalleryWidget::load()
@@ -64,6 +69,21 @@ void GalleryWidget::load()
     m_loaded = true;
 
     setupUI();
+
+    // Dates and types for every asset in one download instead of a stat
+    // per file, albums opened before it arrives fall back to stats
+    auto *watcher =
+        new QFutureWatcher<std::shared_ptr<PhotoLibraryIndex>>(this);
+    connect(watcher,
+            &QFutureWatcher<std::shared_ptr<PhotoLibraryIndex>>::finished,
+            this, [this, watcher]() {
+                m_libraryIndex = watcher->result();
+                watcher->deleteLater();
+                if (m_libraryIndex && m_model) {
+                    m_model->setLibraryIndex(m_libraryIndex);
+                }
+            });
+    watcher->setFuture(PhotoLibraryIndex::loadAsync(m_device));
 }
 
 void GalleryWidget::setupUI()
@@ -239,8 +259,11 @@ void GalleryWidget::onExportSelected()
     qDebug() << "Starting export of selected files:" << exportItems.size()
              << "items to" << exportDir;
 
+    ExportOptions options = ExportManager::optionsFromSettings();
+    options.sync = SettingsManager::sharedInstance()->syncExports();
     ExportManager::sharedInstance()->startExport(m_device, exportItems,
-                                                 exportDir);
+                                                 exportDir, std::nullopt,
+                                                 options);
 }
 
 void GalleryWidget::onExportAll()
@@ -287,8 +310,11 @@ void GalleryWidget::onExportAll()
              << "items to" << exportDir;
 
     // Start export and the manager will show its own dialog
+    ExportOptions options = ExportManager::optionsFromSettings();
+    options.sync = SettingsManager::sharedInstance()->syncExports();
     ExportManager::sharedInstance()->startExport(m_device, exportItems,
-                                                 exportDir);
+                                                 exportDir, std::nullopt,
+                                                 options);
 }
 
 QString GalleryWidget::selectExportDirectory()
@@ -396,16 +422,60 @@ void GalleryWidget::setupPhotoGalleryView()
                 auto *previewDialog = new MediaPreviewDialog(
                     m_device, m_device->afcClient, filePath, this);
                 previewDialog->setAttribute(Qt::WA_DeleteOnClose);
+                previewDialog->setNavigation(m_model, index);
                 previewDialog->show();
             });
 
     connect(m_listView, &QListView::customContextMenuRequested, this,
             &GalleryWidget::onPhotoContextMenu);
+
+    // Thumbnails load for what is on screen, keep the model posted. The
+    // range changes on every relayout (new album, sort, resize).
+    connect(m_listView->verticalScrollBar(), &QScrollBar::valueChanged, this,
+            &GalleryWidget::updateVisibleRange);
+    connect(m_listView->verticalScrollBar(), &QScrollBar::rangeChanged, this,
+            &GalleryWidget::updateVisibleRange);
+}
+
+void GalleryWidget::updateVisibleRange()
+{
+    if (!m_model)
+        return;
+
+    const int count = m_model->rowCount();
+    if (count == 0) {
+        m_model->setVisibleRange(-1, -1);
+        return;
+    }
+
+    // Items flow left to right and top to bottom, so their positions only
+    // grow and both edges of the viewport can be binary searched
+    auto firstRowNotAbove = [this, count](auto isAbove) {
+        int low = 0;
+        int high = count;
+        while (low < high) {
+            const int mid = low + (high - low) / 2;
+            if (isAbove(m_listView->visualRect(m_model->index(mid, 0))))
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return low;
+    };
+
+    const int height = m_listView->viewport()->height();
+    const int first =
+        firstRowNotAbove([](const QRect &rect) { return rect.bottom() < 0; });
+    const int last = firstRowNotAbove([height](const QRect &rect) {
+                         return rect.top() < height;
+                     }) -
+                     1;
+    m_model->setVisibleRange(first, qMax(first, last));
 }
 
 void GalleryWidget::loadAlbumList()
 {
-    AFCFileTree dcimTree = ServiceManager::safeGetFileTree(m_device, "/DCIM");
+    AFCFileTree dcimTree = AfcDirectoryLister::list(m_device, "/DCIM");
 
     if (!dcimTree.success) {
         qDebug() << "Failed to read DCIM directory";
@@ -438,7 +508,7 @@ void GalleryWidget::loadAlbumList()
             item->setIcon(QIcon::fromTheme("folder"));
             albumModel->appendRow(item);
 
-            loadAlbumThumbnailAsync(fullPath, item);
+            loadAlbumThumbnailAsync(fullPath, entry.mtime, item);
         }
     }
 
@@ -452,6 +522,7 @@ void GalleryWidget::onAlbumSelected(const QString &albumPath)
     // Create model if not exists
     if (!m_model) {
         m_model = new PhotoModel(m_device, getCurrentFilterType(), this);
+        m_model->setLibraryIndex(m_libraryIndex);
         m_listView->setModel(m_model);
 
         // Update export button states based on selection
@@ -497,75 +568,84 @@ void GalleryWidget::setControlsEnabled(bool enabled)
 }
 
 /*
-    FIXME: this needs to be refactored once we
-    figure out how to query Photos.sqlite
-    Check out:
-    https://github.com/ScottKjr3347/iOS_Local_PL_Photos.sqlite_Queries
+    First photo the device lists in the album. Names are enough to tell, so
+    this is a single directory read instead of a stat per file.
 */
-QIcon GalleryWidget::loadAlbumThumbnail(const QString &albumPath)
+static QString findAlbumCover(iDescriptorDevice *device,
+                              const QString &albumPath,
+                              std::optional<afc_client_t> altAfc)
 {
-    // Get album directory contents
-    AFCFileTree albumTree =
-        ServiceManager::safeGetFileTree(m_device, albumPath.toStdString());
-
-    if (!albumTree.success) {
+    char **names = nullptr;
+    if (ServiceManager::safeAfcReadDirectory(device,
+                                             albumPath.toUtf8().constData(),
+                                             &names, altAfc) != AFC_E_SUCCESS ||
+        !names) {
         qDebug() << "Failed to read album directory:" << albumPath;
-        return QIcon();
+        return QString();
     }
 
-    // Find the first image file
-    QString firstImagePath;
-    for (const MediaEntry &entry : albumTree.entries) {
-        QString fileName = QString::fromStdString(entry.name);
-
-        if (!entry.isDir && (fileName.endsWith(".JPG", Qt::CaseInsensitive) ||
-                             fileName.endsWith(".PNG", Qt::CaseInsensitive) ||
-                             fileName.endsWith(".HEIC", Qt::CaseInsensitive))) {
-            firstImagePath = albumPath + "/" + fileName;
+    QString cover;
+    for (int i = 0; names[i]; i++) {
+        const QString name = QString::fromUtf8(names[i]);
+        if (!name.startsWith('.') &&
+            (name.endsWith(".JPG", Qt::CaseInsensitive) ||
+             name.endsWith(".JPEG", Qt::CaseInsensitive) ||
+             name.endsWith(".PNG", Qt::CaseInsensitive) ||
+             name.endsWith(".HEIC", Qt::CaseInsensitive))) {
+            cover = albumPath + "/" + name;
             break;
         }
     }
+    afc_dictionary_free(names);
+    return cover;
+}
 
-    if (firstImagePath.isEmpty()) {
-        qDebug() << "No images found in album:" << albumPath;
-        return QIcon();
-    }
-
-    // Load the thumbnail using ServiceManager
-    QByteArray imageData = ServiceManager::safeReadAfcFileToByteArray(
-        m_device, firstImagePath.toUtf8().constData());
+// Runs on a worker thread for every album
+QIcon GalleryWidget::loadAlbumThumbnail(const QString &albumPath,
+                                        quint64 mtime, const QSize &size)
+{
+    AfcClientLease lease = ServiceManager::acquireAfcClient(m_device);
+    const QString coverPath =
+        findAlbumCover(m_device, albumPath, lease.altAfc());
+    // The thumbnail loader checks out a connection of its own
+    lease.release();
 
-    if (imageData.isEmpty()) {
-        qDebug() << "Could not read image data for thumbnail:"
-                 << firstImagePath;
+    if (coverPath.isEmpty()) {
+        qDebug() << "No images found in album:" << albumPath;
         return QIcon();
     }
 
-    QPixmap thumbnail;
-
-    if (firstImagePath.endsWith(".HEIC", Qt::CaseInsensitive)) {
-        qDebug() << "Loading HEIC thumbnail from:" << firstImagePath;
-        thumbnail = load_heic(imageData);
-    } else {
-        // Load regular image formats
-        if (!thumbnail.loadFromData(imageData)) {
-            qDebug() << "Could not decode image data for thumbnail:"
-                     << firstImagePath;
-            return QIcon();
-        }
-    }
-
+    // Same path as the gallery's thumbnails: the embedded preview when
+    // there is one, a decode at the target size otherwise
+    const QPixmap thumbnail =
+        PhotoModel::loadThumbnailFromDevice(m_device, coverPath, size);
     if (thumbnail.isNull()) {
-        qDebug() << "Failed to load thumbnail from:" << firstImagePath;
+        qDebug() << "Failed to load thumbnail from:" << coverPath;
         return QIcon();
     }
 
+    if (m_coverCache && mtime != 0) {
+        m_coverCache->insert(albumPath, size, mtime, thumbnail.toImage());
+    }
     return QIcon(thumbnail);
 }
 
 void GalleryWidget::loadAlbumThumbnailAsync(const QString &albumPath,
+                                            quint64 mtime,
                                             QStandardItem *item)
 {
+    const QSize size = m_albumListView->iconSize();
+
+    // The folder's mtime moves when photos are added or removed, so a
+    // cover cached for it is still the album's first photo
+    if (m_coverCache && mtime != 0) {
+        const QImage cached = m_coverCache->lookup(albumPath, size, mtime);
+        if (!cached.isNull()) {
+            item->setIcon(QIcon(QPixmap::fromImage(cached)));
+            return;
+        }
+    }
+
     // Create a future watcher to handle the async result
     auto *watcher = new QFutureWatcher<QIcon>(this);
 
@@ -580,8 +660,10 @@ void GalleryWidget::loadAlbumThumbnailAsync(const QString &albumPath,
     });
 
     // Start the async operation
-    QFuture<QIcon> future = QtConcurrent::run(
-        [this, albumPath]() { return loadAlbumThumbnail(albumPath); });
+    QFuture<QIcon> future =
+        QtConcurrent::run([this, albumPath, mtime, size]() {
+            return loadAlbumThumbnail(albumPath, mtime, size);
+        });
 
     watcher->setFuture(future);
 }
@@ -619,6 +701,7 @@ void GalleryWidget::onPhotoContextMenu(const QPoint &pos)
         auto *previewDialog = new MediaPreviewDialog(
             m_device, m_device->afcClient, filePath, this);
         previewDialog->setAttribute(Qt::WA_DeleteOnClose);
+        previewDialog->setNavigation(m_model, index);
         previewDialog->show();
     });
 
@@ -21,8 +21,10 @@
 #define GALLERYWIDGET_H
 
 #include "iDescriptor.h"
+#include "photolibraryindex.h"
 #include "photomodel.h"
 #include <QWidget>
+#include <memory>
 
 QT_BEGIN_NAMESPACE
 class QListView;
@@ -55,6 +57,7 @@ private slots:
     void onExportAll();
     void onAlbumSelected(const QString &albumPath);
     void onBackToAlbums();
+    void updateVisibleRange();
 
 private:
     void setupUI();
@@ -64,8 +67,11 @@ private:
     void loadAlbumList();
     void setControlsEnabled(bool enabled);
     QString selectExportDirectory();
-    QIcon loadAlbumThumbnail(const QString &albumPath);
-    void loadAlbumThumbnailAsync(const QString &albumPath, QStandardItem *item);
+    // mtime is the album folder's, it keys the cover in m_coverCache
+    QIcon loadAlbumThumbnail(const QString &albumPath, quint64 mtime,
+                             const QSize &size);
+    void loadAlbumThumbnailAsync(const QString &albumPath, quint64 mtime,
+                                 QStandardItem *item);
     void onPhotoContextMenu(const QPoint &pos);
     PhotoModel::FilterType getCurrentFilterType() const;
 
@@ -86,6 +92,11 @@ private:
     QWidget *m_photoGalleryWidget;
     QListView *m_listView;
     PhotoModel *m_model;
+    // Loaded in the background when the tab opens, null until then or if
+    // the device's Photos.sqlite can't be read
+    std::shared_ptr<const PhotoLibraryIndex> m_libraryIndex;
+    // Album covers of earlier sessions, may be null
+    std::shared_ptr<ThumbnailDiskCache> m_coverCache;
 
     // Control widgets
     QComboBox *m_sortComboBox;
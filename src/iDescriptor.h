@@ -18,6 +18,7 @@
  */
 
 #pragma once
+#include "afcclientpool.h"
 #include <QDebug>
 #include <QImage>
 #include <QJsonObject>
@@ -33,6 +34,7 @@
 #ifdef ENABLE_RECOVERY_DEVICE_SUPPORT
 #include <libirecovery.h>
 #endif
+#include <memory>
 #include <mutex>
 #include <pugixml.hpp>
 #include <string>
@@ -45,6 +47,9 @@
     "© 2025 The iDescriptor Project contributors. See AUTHORS for details."
 #define AFC2_SERVICE_NAME "com.apple.afc2"
 #define RECOVERY_CLIENT_CONNECTION_TRIES 3
+// Number of com.apple.afc connections each device may keep open at once, bulk
+// transfers get all but one of them
+#define AFC_POOL_CAPACITY 5
 #define APPLE_VENDOR_ID 0x05ac
 #define REPO_URL "https://github.com/iDescriptor/iDescriptor"
 #define SPONSORS_JSON_URL                                                      \
@@ -176,6 +181,10 @@ struct DeviceInfo {
     unsigned int parsedDeviceVersion;
 };
 
+class AfcIoQueue;
+class AfcMetadataCache;
+class AfcTransferTuner;
+
 struct iDescriptorDevice {
     std::string udid;
     idevice_connection_type conn_type;
@@ -185,6 +194,14 @@ struct iDescriptorDevice {
     afc_client_t afc2Client;
     bool is_iPhone;
     std::recursive_mutex *mutex;
+    // Extra AFC connections for concurrent consumers, see AfcClientPool
+    std::shared_ptr<AfcClientPool> afcPool;
+    // Stat and listing cache for the default AFC namespace
+    std::shared_ptr<AfcMetadataCache> afcMetadataCache;
+    // Runs ServiceManager::Async jobs off the caller's thread
+    std::shared_ptr<AfcIoQueue> ioQueue;
+    // Measured link latency/bandwidth and the chunk sizes derived from them
+    std::shared_ptr<AfcTransferTuner> transferTuner;
 };
 
 struct iDescriptorInitDeviceResult {
@@ -306,7 +323,14 @@ std::string parse_recovery_mode(irecv_mode productType);
 
 struct MediaEntry {
     std::string name;
-    bool isDir;
+    bool isDir = false;
+    bool isSymlink = false;
+    // Filled from afc_get_file_info when hasStat is set
+    bool hasStat = false;
+    uint64_t size = 0;
+    // Nanoseconds since epoch, as reported by AFC
+    uint64_t mtime = 0;
+    uint64_t birthtime = 0;
 };
 
 struct AFCFileTree {
@@ -318,6 +342,9 @@ struct AFCFileTree {
 AFCFileTree get_file_tree(afc_client_t afcClient,
                           const std::string &path = "/");
 
+// Fills type, size and timestamps of entry from an afc_get_file_info reply
+void parse_afc_file_info(char **info, MediaEntry &entry);
+
 bool detect_jailbroken(afc_client_t afc);
 
 void get_device_info_xml(const char *udid, lockdownd_client_t client,
@@ -437,10 +464,27 @@ struct NetworkDevice {
     }
 };
 
-QPixmap load_heic(const QByteArray &data);
-
-QByteArray read_afc_file_to_byte_array(afc_client_t afcClient,
-                                       const char *path);
+/*
+    With a valid targetSize the smallest thumbnail item covering it is
+    decoded when the file has one, and the result is scaled down to fit
+    targetSize, never up. Images come out as RGBA8888_Premultiplied.
+*/
+QPixmap load_heic(const QByteArray &data, const QSize &targetSize = QSize());
+// Thread-safe variant for workers, QPixmap is only usable on the GUI thread
+QImage load_heic_image(const QByteArray &data,
+                       const QSize &targetSize = QSize());
+struct heif_context;
+// Same for a context the caller read, thumbnailOnly never decodes the primary
+QImage load_heic_image(heif_context *ctx, const QSize &targetSize,
+                       bool thumbnailOnly = false);
+// Exif of the primary image as a TIFF structure, empty if it has none
+QByteArray heic_exif(heif_context *ctx);
+struct heif_image;
+/*
+    Wraps an image decoded to interleaved RGBA without a copy, the QImage
+    takes ownership and releases it. Null if it has no such plane.
+*/
+QImage heif_image_to_qimage(heif_image *image, bool hasAlpha);
 
 bool isDarkMode();
 
@@ -0,0 +1,427 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "importmanager.h"
+#include "afcclientpool.h"
+#include "afctransfertuner.h"
+#include "servicemanager.h"
+#include "settingsmanager.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+ImportManager *ImportManager::sharedInstance()
+{
+    static ImportManager self;
+    return &self;
+}
+
+ImportManager::ImportManager(QObject *parent) : QObject(parent) {}
+
+ImportManager::~ImportManager()
+{
+    QMutexLocker locker(&m_jobsMutex);
+    for (auto jobPtr : m_activeJobs) {
+        jobPtr->cancelRequested = true;
+    }
+
+    for (auto jobPtr : m_activeJobs) {
+        if (jobPtr->future.isRunning()) {
+            jobPtr->future.waitForFinished();
+        }
+        delete jobPtr;
+    }
+    m_activeJobs.clear();
+}
+
+QUuid ImportManager::startImport(iDescriptorDevice *device,
+                                 const QList<ImportItem> &items,
+                                 std::optional<afc_client_t> altAfc)
+{
+    if (!device || !device->mutex) {
+        qWarning() << "Invalid device provided to ImportManager";
+        return QUuid();
+    }
+
+    if (items.isEmpty()) {
+        qWarning() << "No items provided for import";
+        return QUuid();
+    }
+
+    auto job = new ImportJob();
+    job->jobId = QUuid::createUuid();
+    job->device = device;
+    job->items = items;
+    // The shared client is the default namespace, which the pool serves
+    if (altAfc && *altAfc != device->afcClient) {
+        job->altAfc = altAfc;
+    }
+    job->laneCount = SettingsManager::sharedInstance()->exportLanes();
+    job->watcher = new QFutureWatcher<void>(this);
+
+    const QUuid jobId = job->jobId;
+
+    connect(job->watcher, &QFutureWatcher<void>::finished, this,
+            [this, jobId]() { cleanupJob(jobId); });
+
+    {
+        QMutexLocker locker(&m_jobsMutex);
+        m_activeJobs[jobId] = job;
+    }
+
+    emit importStarted(jobId, items.size());
+
+    job->future = QtConcurrent::run([this, job]() { executeImportJob(job); });
+    job->watcher->setFuture(job->future);
+
+    qDebug() << "Started import job" << jobId << "for" << items.size()
+             << "items";
+    return jobId;
+}
+
+void ImportManager::cancelImport(const QUuid &jobId)
+{
+    QMutexLocker locker(&m_jobsMutex);
+    auto it = m_activeJobs.find(jobId);
+    if (it != m_activeJobs.end()) {
+        it.value()->cancelRequested = true;
+        qDebug() << "Cancellation requested for import job" << jobId;
+    }
+}
+
+bool ImportManager::isImporting() const
+{
+    QMutexLocker locker(&m_jobsMutex);
+    return !m_activeJobs.isEmpty();
+}
+
+bool ImportManager::isJobRunning(const QUuid &jobId) const
+{
+    QMutexLocker locker(&m_jobsMutex);
+    return m_activeJobs.contains(jobId);
+}
+
+void ImportManager::executeImportJob(ImportJob *job)
+{
+    ImportJobSummary summary;
+    summary.jobId = job->jobId;
+    summary.totalItems = job->items.size();
+
+    // Alternative clients (afc2, house arrest) are not pooled
+    const int laneCount =
+        job->altAfc ? 1
+                    : std::clamp(job->laneCount, 1,
+                                 static_cast<int>(job->items.size()));
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    std::atomic<int> nextItem{0};
+    QMutex summaryMutex;
+    int completedItems = 0;
+
+    auto runLane = [&](int lane) {
+        AfcClientLease lease;
+        std::optional<afc_client_t> afc = job->altAfc;
+        if (!afc) {
+            // Same policy as exports: only the first lane waits
+            if (lane == 0) {
+                lease = ServiceManager::acquireAfcClient(
+                    job->device, job->cancelRequested, IoPriority::Bulk);
+            } else {
+                lease = ServiceManager::acquireAfcClient(job->device, 0,
+                                                         IoPriority::Bulk);
+            }
+            if (!lease && (lane != 0 || job->cancelRequested.load()))
+                return;
+            afc = lease.altAfc();
+        }
+
+        int index;
+        while (!job->cancelRequested.load() &&
+               (index = nextItem.fetch_add(1)) < job->items.size()) {
+            if (lease.shouldYield()) {
+                lease.yield();
+                afc = lease.altAfc();
+            }
+            const ImportItem &item = job->items.at(index);
+            const ImportResult result = importSingleItem(job, item, afc);
+
+            QMutexLocker locker(&summaryMutex);
+            if (result.success) {
+                summary.successfulItems++;
+                summary.totalBytesTransferred += result.bytesTransferred;
+            } else {
+                summary.failedItems++;
+            }
+            completedItems++;
+            emit importProgress(job->jobId, completedItems, job->items.size(),
+                                QFileInfo(item.localPath).fileName());
+            emit itemImported(job->jobId, result);
+        }
+    };
+
+    std::vector<std::thread> extraLanes;
+    for (int lane = 1; lane < laneCount; ++lane) {
+        extraLanes.emplace_back(runLane, lane);
+    }
+    runLane(0);
+    for (std::thread &lane : extraLanes) {
+        lane.join();
+    }
+
+    if (job->cancelRequested.load()) {
+        summary.wasCancelled = true;
+        qDebug() << "Import job" << job->jobId << "was cancelled";
+        emit importCancelled(job->jobId);
+        return;
+    }
+
+    qDebug() << "Import job" << job->jobId
+             << "completed - Success:" << summary.successfulItems
+             << "Failed:" << summary.failedItems
+             << "Bytes:" << summary.totalBytesTransferred << "in"
+             << elapsed.elapsed() << "ms ("
+             << summary.totalBytesTransferred /
+                    (1024.0 * 1024.0 *
+                     std::max<qint64>(elapsed.elapsed(), 1) / 1000.0)
+             << "MB/s) on" << laneCount << "lanes";
+
+    emit importFinished(job->jobId, summary);
+}
+
+ImportResult ImportManager::importSingleItem(ImportJob *job,
+                                             const ImportItem &item,
+                                             std::optional<afc_client_t> altAfc)
+{
+    ImportResult result;
+    result.localFilePath = item.localPath;
+    result.devicePath = item.destinationPathOnDevice;
+
+    const QString fileName = QFileInfo(item.localPath).fileName();
+    const QByteArray devicePath = item.destinationPathOnDevice.toUtf8();
+
+    qint64 written = 0;
+    bool deviceFileOpened = false;
+    const afc_error_t uploadResult = uploadFile(
+        job->device, item.localPath, devicePath.constData(), altAfc,
+        &job->cancelRequested,
+        [&](qint64 bytes, qint64 total) {
+            written = bytes;
+            emit fileTransferProgress(job->jobId, fileName, bytes, total);
+        },
+        &deviceFileOpened);
+
+    if (uploadResult != AFC_E_SUCCESS) {
+        result.errorMessage =
+            uploadResult == AFC_E_OP_INTERRUPTED
+                ? QString("Import cancelled by user")
+                : QString("Failed to import %1 to %2 (AFC error: %3)")
+                      .arg(item.localPath)
+                      .arg(item.destinationPathOnDevice)
+                      .arg(static_cast<int>(uploadResult));
+        // Don't leave a truncated file behind on the device. A file we
+        // never opened is still intact and may not even be ours.
+        if (deviceFileOpened) {
+            ServiceManager::safeAfcRemovePath(job->device,
+                                              devicePath.constData(), altAfc);
+        }
+        return result;
+    }
+
+    result.success = true;
+    result.bytesTransferred = written;
+    return result;
+}
+
+afc_error_t
+ImportManager::uploadFile(iDescriptorDevice *device, const QString &localPath,
+                          const char *devicePath,
+                          std::optional<afc_client_t> altAfc,
+                          const std::atomic<bool> *cancel,
+                          const std::function<void(qint64, qint64)> &progress,
+                          bool *deviceFileOpened)
+{
+    if (deviceFileOpened) {
+        *deviceFileOpened = false;
+    }
+
+    QFile in(localPath);
+    if (!in.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open local file for import:" << localPath;
+        return AFC_E_IO_ERROR;
+    }
+    const qint64 totalSize = in.size();
+
+    // Chunks are written straight out of the page cache, falling back to a
+    // read buffer for files that can't be mapped
+    const uchar *mapped = totalSize > 0 ? in.map(0, totalSize) : nullptr;
+    QByteArray buffer;
+
+    uint64_t handle = 0;
+    afc_error_t result = ServiceManager::safeAfcFileOpen(
+        device, devicePath, AFC_FOPEN_WRONLY, &handle, altAfc);
+    if (result != AFC_E_SUCCESS) {
+        qDebug() << "Failed to open file on device for writing:" << devicePath;
+        return result;
+    }
+    if (deviceFileOpened) {
+        *deviceFileOpened = true;
+    }
+
+    // Uploads on a bulk lease step aside for foreground work between chunks
+    AfcClientPool *pool = device->afcPool.get();
+    const bool bulk = pool && altAfc &&
+                      pool->priorityOf(*altAfc) == IoPriority::Bulk;
+
+    qint64 offset = 0;
+    while (offset < totalSize) {
+        if (cancel && cancel->load()) {
+            result = AFC_E_OP_INTERRUPTED;
+            break;
+        }
+        if (bulk) {
+            pool->pauseBulkTransfer();
+        }
+
+        // Re-read every chunk, the tuner adapts while the upload runs
+        const qint64 chunkSize =
+            std::min<qint64>(AfcTransferTuner::bulkChunkSizeFor(device),
+                             totalSize - offset);
+        const char *data;
+        if (mapped) {
+            data = reinterpret_cast<const char *>(mapped) + offset;
+        } else {
+            buffer.resize(chunkSize);
+            if (in.read(buffer.data(), chunkSize) != chunkSize) {
+                result = AFC_E_IO_ERROR;
+                break;
+            }
+            data = buffer.constData();
+        }
+
+        uint32_t bytesWritten = 0;
+        const auto start = std::chrono::steady_clock::now();
+        result = ServiceManager::safeAfcFileWrite(
+            device, handle, data, static_cast<uint32_t>(chunkSize),
+            &bytesWritten, altAfc);
+        if (result == AFC_E_SUCCESS && bytesWritten != chunkSize) {
+            result = AFC_E_WRITE_ERROR;
+        }
+        if (result != AFC_E_SUCCESS) {
+            qDebug() << "Failed to write to device file:" << devicePath;
+            break;
+        }
+        if (device->transferTuner) {
+            device->transferTuner->recordTransfer(
+                bytesWritten, std::chrono::steady_clock::now() - start);
+        }
+
+        offset += chunkSize;
+        if (progress) {
+            progress(offset, totalSize);
+        }
+    }
+
+    ServiceManager::safeAfcFileClose(device, handle, altAfc);
+    return result;
+}
+
+ImportManager::BenchmarkResult
+ImportManager::benchmark(iDescriptorDevice *device, const QString &localPath,
+                         const QString &devicePath)
+{
+    BenchmarkResult benchmark;
+    benchmark.bytes = QFileInfo(localPath).size();
+
+    // Both runs share one connection so only the write path differs
+    AfcClientLease lease = ServiceManager::acquireAfcClient(device, 2000);
+    if (!lease) {
+        qWarning() << "Import benchmark: no AFC connection available";
+        return benchmark;
+    }
+    const std::optional<afc_client_t> afc = lease.altAfc();
+
+    const QByteArray legacyPath = (devicePath + ".benchmark-legacy").toUtf8();
+    const QByteArray pipelinedPath = (devicePath + ".benchmark").toUtf8();
+
+    // What AfcExplorerWidget::importFileToDevice used to do
+    QElapsedTimer timer;
+    timer.start();
+    QFile in(localPath);
+    uint64_t handle = 0;
+    if (in.open(QIODevice::ReadOnly) &&
+        ServiceManager::safeAfcFileOpen(device, legacyPath.constData(),
+                                        AFC_FOPEN_WRONLY, &handle,
+                                        afc) == AFC_E_SUCCESS) {
+        char buffer[4096];
+        qint64 bytesRead;
+        bool ok = true;
+        while (ok && (bytesRead = in.read(buffer, sizeof(buffer))) > 0) {
+            uint32_t bytesWritten = 0;
+            ok = ServiceManager::safeAfcFileWrite(
+                     device, handle, buffer, static_cast<uint32_t>(bytesRead),
+                     &bytesWritten, afc) == AFC_E_SUCCESS;
+        }
+        ServiceManager::safeAfcFileClose(device, handle, afc);
+        if (ok) {
+            benchmark.legacyMs = timer.elapsed();
+        }
+    }
+    ServiceManager::safeAfcRemovePath(device, legacyPath.constData(), afc);
+
+    timer.restart();
+    if (uploadFile(device, localPath, pipelinedPath.constData(), afc, nullptr,
+                   nullptr) == AFC_E_SUCCESS) {
+        benchmark.pipelinedMs = timer.elapsed();
+    }
+    ServiceManager::safeAfcRemovePath(device, pipelinedPath.constData(), afc);
+
+    auto rate = [&benchmark](qint64 ms) {
+        return benchmark.bytes / (1024.0 * 1024.0 *
+                                  std::max<qint64>(ms, 1) / 1000.0);
+    };
+    qDebug() << "Import benchmark for" << localPath << "(" << benchmark.bytes
+             << "bytes ): 4 KB loop" << benchmark.legacyMs << "ms ("
+             << rate(benchmark.legacyMs) << "MB/s), pipelined"
+             << benchmark.pipelinedMs << "ms (" << rate(benchmark.pipelinedMs)
+             << "MB/s)";
+    return benchmark;
+}
+
+void ImportManager::cleanupJob(const QUuid &jobId)
+{
+    QMutexLocker locker(&m_jobsMutex);
+    auto it = m_activeJobs.find(jobId);
+    if (it != m_activeJobs.end()) {
+        if (it.value()->watcher) {
+            it.value()->watcher->deleteLater();
+        }
+
+        delete it.value();
+        m_activeJobs.erase(it);
+        qDebug() << "Cleaned up import job" << jobId;
+    }
+}
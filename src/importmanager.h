@@ -0,0 +1,160 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMPORTMANAGER_H
+#define IMPORTMANAGER_H
+
+#include "iDescriptor.h"
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QMap>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QUuid>
+#include <atomic>
+#include <functional>
+#include <optional>
+
+struct ImportItem {
+    QString localPath;
+    QString destinationPathOnDevice;
+
+    ImportItem() = default;
+    ImportItem(const QString &local, const QString &devicePath)
+        : localPath(local), destinationPathOnDevice(devicePath)
+    {
+    }
+};
+
+struct ImportResult {
+    QString localFilePath;
+    QString devicePath;
+    bool success = false;
+    QString errorMessage;
+    qint64 bytesTransferred = 0;
+};
+
+struct ImportJobSummary {
+    QUuid jobId;
+    int totalItems = 0;
+    int successfulItems = 0;
+    int failedItems = 0;
+    qint64 totalBytesTransferred = 0;
+    bool wasCancelled = false;
+};
+
+/**
+ * @brief Uploads local files to the device in the background
+ *
+ * The counterpart of ExportManager. Jobs run off the GUI thread, several
+ * files go up at once on pooled AFC connections (as many as the
+ * "Parallel Transfers" setting allows), and each file is written in chunks
+ * sized by the device's AfcTransferTuner straight out of a memory map of the
+ * local file, so no copy is made on our side.
+ */
+class ImportManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    static ImportManager *sharedInstance();
+
+    ImportManager(const ImportManager &) = delete;
+    ImportManager &operator=(const ImportManager &) = delete;
+
+    QUuid startImport(iDescriptorDevice *device, const QList<ImportItem> &items,
+                      std::optional<afc_client_t> altAfc = std::nullopt);
+
+    void cancelImport(const QUuid &jobId);
+
+    bool isImporting() const;
+
+    bool isJobRunning(const QUuid &jobId) const;
+
+    struct BenchmarkResult {
+        qint64 bytes = 0;
+        qint64 legacyMs = -1;
+        qint64 pipelinedMs = -1;
+    };
+
+    /*
+        Uploads localPath next to devicePath once with the old 4 KB buffered
+        loop and once with uploadFile(), logs both and removes the uploads.
+        DeviceBenchmark runs it against a scratch file on device connect.
+    */
+    static BenchmarkResult benchmark(iDescriptorDevice *device,
+                                     const QString &localPath,
+                                     const QString &devicePath);
+
+signals:
+    void importStarted(const QUuid &jobId, int totalItems);
+
+    void importProgress(const QUuid &jobId, int completedItems, int totalItems,
+                        const QString &currentFileName);
+
+    void fileTransferProgress(const QUuid &jobId, const QString &fileName,
+                              qint64 bytesTransferred, qint64 totalFileSize);
+
+    void itemImported(const QUuid &jobId, const ImportResult &result);
+
+    void importFinished(const QUuid &jobId, const ImportJobSummary &summary);
+
+    void importCancelled(const QUuid &jobId);
+
+private:
+    explicit ImportManager(QObject *parent = nullptr);
+    ~ImportManager();
+
+    struct ImportJob {
+        QUuid jobId;
+        iDescriptorDevice *device = nullptr;
+        QList<ImportItem> items;
+        std::optional<afc_client_t> altAfc;
+        int laneCount = 1;
+        std::atomic<bool> cancelRequested{false};
+        QFuture<void> future;
+        QFutureWatcher<void> *watcher = nullptr;
+    };
+
+    void executeImportJob(ImportJob *job);
+
+    ImportResult importSingleItem(ImportJob *job, const ImportItem &item,
+                                  std::optional<afc_client_t> altAfc);
+
+    /*
+        Writes a local file to devicePath, reporting the bytes written so far
+        after every chunk. Stops with AFC_E_OP_INTERRUPTED when cancel is set.
+        deviceFileOpened (optional) tells whether devicePath was opened, and
+        so truncated, before the upload stopped.
+    */
+    static afc_error_t
+    uploadFile(iDescriptorDevice *device, const QString &localPath,
+               const char *devicePath, std::optional<afc_client_t> altAfc,
+               const std::atomic<bool> *cancel,
+               const std::function<void(qint64, qint64)> &progress,
+               bool *deviceFileOpened = nullptr);
+
+    void cleanupJob(const QUuid &jobId);
+
+    mutable QMutex m_jobsMutex;
+    QMap<QUuid, ImportJob *> m_activeJobs;
+};
+
+#endif // IMPORTMANAGER_H
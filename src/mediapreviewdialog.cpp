@@ -36,6 +36,7 @@
 #include <QPushButton>
 #include <QResizeEvent>
 #include <QScreen>
+#include <QScrollBar>
 #include <QSlider>
 #include <QTimer>
 #include <QVBoxLayout>
@@ -60,9 +61,15 @@ MediaPreviewDialog::MediaPreviewDialog(iDescriptorDevice *device,
       m_timeLabel(nullptr), m_volumeSlider(nullptr), m_volumeLabel(nullptr),
       m_progressTimer(nullptr), m_loadingLabel(nullptr), m_statusLabel(nullptr),
       m_zoomInBtn(nullptr), m_zoomOutBtn(nullptr), m_zoomResetBtn(nullptr),
-      m_fitToWindowBtn(nullptr), m_zoomFactor(1.0), m_isRepeatEnabled(true),
-      m_isDraggingTimeline(false), m_videoDuration(0), m_afcClient(afcClient)
+      m_fitToWindowBtn(nullptr), m_previousBtn(nullptr), m_nextBtn(nullptr),
+      m_zoomFactor(1.0), m_tileClock(0), m_inViewSince(0), m_tileBytes(0),
+      m_tilesShown(false), m_peakBytes(0), m_imageGeneration(0), m_step(1),
+      m_previewCache(PreviewCache::forDevice(device)),
+      m_isRepeatEnabled(true), m_isDraggingTimeline(false), m_videoDuration(0),
+      m_afcClient(afcClient)
 {
+    m_tilePool.setMaxThreadCount(TILE_THREADS);
+
     setWindowTitle(QFileInfo(filePath).fileName() + " - iDescriptor");
 
     // Make dialog fullscreen
@@ -89,6 +96,14 @@ MediaPreviewDialog::~MediaPreviewDialog()
     if (m_isVideo) {
         MediaStreamerManager::sharedInstance()->releaseStreamer(m_filePath);
     }
+
+    // Running tile decodes post back to this dialog
+    m_tilePool.clear();
+    m_tilePool.waitForDone();
+    if (m_peakBytes > 0) {
+        qDebug() << "Preview of" << m_filePath << "peaked at"
+                 << m_peakBytes / (1024 * 1024) << "MB of image data";
+    }
 }
 
 void MediaPreviewDialog::setupUI()
@@ -130,6 +145,10 @@ void MediaPreviewDialog::setupImageView()
     m_imageView->setRenderHint(QPainter::Antialiasing);
     m_imageView->setVisible(false);
     m_mainLayout->addWidget(m_imageView);
+    connect(m_imageView->horizontalScrollBar(), &QScrollBar::valueChanged,
+            this, &MediaPreviewDialog::updateTiles);
+    connect(m_imageView->verticalScrollBar(), &QScrollBar::valueChanged, this,
+            &MediaPreviewDialog::updateTiles);
 
     // Controls layout
     m_controlsLayout = new QHBoxLayout();
@@ -139,12 +158,19 @@ void MediaPreviewDialog::setupImageView()
     m_zoomOutBtn = new QPushButton("Zoom Out", this);
     m_zoomResetBtn = new QPushButton("100%", this);
     m_fitToWindowBtn = new QPushButton("Fit to Window", this);
+    m_previousBtn = new QPushButton("Previous", this);
+    m_nextBtn = new QPushButton("Next", this);
+    // Until there is a model to step through
+    m_previousBtn->setVisible(false);
+    m_nextBtn->setVisible(false);
 
     m_controlsLayout->addWidget(m_zoomInBtn);
     m_controlsLayout->addWidget(m_zoomOutBtn);
     m_controlsLayout->addWidget(m_zoomResetBtn);
     m_controlsLayout->addWidget(m_fitToWindowBtn);
     m_controlsLayout->addStretch();
+    m_controlsLayout->addWidget(m_previousBtn);
+    m_controlsLayout->addWidget(m_nextBtn);
 
     m_mainLayout->addLayout(m_controlsLayout);
 
@@ -157,6 +183,11 @@ void MediaPreviewDialog::setupImageView()
             &MediaPreviewDialog::zoomReset);
     connect(m_fitToWindowBtn, &QPushButton::clicked, this,
             &MediaPreviewDialog::fitToWindow);
+    connect(m_previousBtn, &QPushButton::clicked, this,
+            [this]() { showRow(m_index.row() - 1); });
+    connect(m_nextBtn, &QPushButton::clicked, this,
+            [this]() { showRow(m_index.row() + 1); });
+    m_imageView->installEventFilter(this);
 }
 
 void MediaPreviewDialog::setupVideoView()
@@ -211,22 +242,40 @@ void MediaPreviewDialog::loadMedia()
 
 void MediaPreviewDialog::loadImage()
 {
-    auto future = QtConcurrent::run(
-        [this]() { return PhotoModel::loadImage(m_device, m_filePath); });
+    const int generation = ++m_imageGeneration;
+
+    // Stepped onto a prefetched neighbour
+    if (const std::optional<PreviewCache::Preview> preview =
+            m_previewCache->cached(m_filePath)) {
+        onImageLoaded(preview->source, preview->screenImage);
+        return;
+    }
 
-    auto *watcher = new QFutureWatcher<QPixmap>(this);
-    connect(watcher, &QFutureWatcher<QPixmap>::finished, this,
-            [this, watcher]() {
-                QPixmap pixmap = watcher->result();
-                if (!pixmap.isNull()) {
-                    m_originalPixmap = pixmap;
-                    onImageLoaded();
+    /*
+        The first decode goes as far as the screen's resolution, the rest
+        comes in tiles when zooming in
+    */
+    auto *watcher = new QFutureWatcher<PreviewCache::Preview>(this);
+    connect(watcher, &QFutureWatcher<PreviewCache::Preview>::finished, this,
+            [this, watcher, generation]() {
+                const PreviewCache::Preview preview = watcher->result();
+                watcher->deleteLater();
+                // Stepped on to another photo meanwhile
+                if (generation != m_imageGeneration) {
+                    return;
+                }
+                if (!preview.isNull()) {
+                    onImageLoaded(preview.source, preview.screenImage);
                 } else {
                     onImageLoadFailed();
                 }
-                watcher->deleteLater();
             });
-    watcher->setFuture(future);
+    watcher->setFuture(m_previewCache->load(m_filePath, screenPixelSize()));
+}
+
+QSize MediaPreviewDialog::screenPixelSize() const
+{
+    return screen()->size() * screen()->devicePixelRatio();
 }
 
 void MediaPreviewDialog::loadVideo()
@@ -249,29 +298,287 @@ void MediaPreviewDialog::loadVideo()
         QString("Playing: %1").arg(QFileInfo(m_filePath).fileName()));
 }
 
-void MediaPreviewDialog::onImageLoaded()
+void MediaPreviewDialog::setNavigation(PhotoModel *model,
+                                       const QModelIndex &index)
+{
+    m_model = model;
+    m_index = index;
+    if (m_previousBtn) {
+        m_previousBtn->setVisible(model != nullptr);
+        m_nextBtn->setVisible(model != nullptr);
+    }
+    if (!model) {
+        return;
+    }
+    showPlaceholder(model->cachedThumbnail(index));
+    // Loaded already, e.g. straight from the cache
+    if (m_source) {
+        prefetchNeighbours();
+    }
+}
+
+void MediaPreviewDialog::showRow(int row)
+{
+    if (!m_model || !m_index.isValid() || row < 0 ||
+        row >= m_model->rowCount()) {
+        return;
+    }
+    const QModelIndex index = m_model->index(row, 0);
+    const QString filePath = m_model->getFilePath(index);
+    if (filePath.isEmpty()) {
+        return;
+    }
+    m_step = row >= m_index.row() ? 1 : -1;
+
+    // Images and videos are laid out differently, a new dialog takes over
+    if (m_isVideo || isVideoFile(filePath)) {
+        auto *dialog = new MediaPreviewDialog(m_device, m_afcClient, filePath,
+                                              parentWidget());
+        dialog->setAttribute(Qt::WA_DeleteOnClose);
+        dialog->setNavigation(m_model, index);
+        dialog->show();
+        close();
+        return;
+    }
+
+    m_index = index;
+    m_filePath = filePath;
+    setWindowTitle(QFileInfo(filePath).fileName() + " - iDescriptor");
+    resetImage();
+    showPlaceholder(m_model->cachedThumbnail(index));
+    loadImage();
+}
+
+void MediaPreviewDialog::resetImage()
+{
+    // Loads and tiles check the generation, bumped by loadImage()
+    m_tilePool.clear();
+    m_pendingTiles.clear();
+    for (const Tile &tile : std::as_const(m_tiles)) {
+        m_imageScene->removeItem(tile.item);
+        delete tile.item;
+    }
+    m_tiles.clear();
+    m_tileBytes = 0;
+    m_tilesShown = false;
+
+    m_source.reset();
+    m_imageSize = QSize();
+    if (m_pixmapItem) {
+        m_pixmapItem->setPixmap(QPixmap());
+        m_pixmapItem->setTransform(QTransform());
+    }
+    m_loadingLabel->setText("Loading...");
+    m_statusLabel->setText(QString("Loading %1...")
+                               .arg(QFileInfo(m_filePath).fileName()));
+}
+
+void MediaPreviewDialog::prefetchNeighbours()
+{
+    if (!m_model || !m_index.isValid()) {
+        return;
+    }
+
+    // The shown photo first so it is kept, then two ahead and one back
+    QStringList paths;
+    if (m_source) {
+        paths.append(m_filePath);
+    }
+    const int row = m_index.row();
+    for (int next : {row + m_step, row + 2 * m_step, row - m_step}) {
+        if (next < 0 || next >= m_model->rowCount()) {
+            continue;
+        }
+        const QModelIndex index = m_model->index(next, 0);
+        if (m_model->getFileType(index) == PhotoInfo::Image) {
+            paths.append(m_model->getFilePath(index));
+        }
+    }
+    m_previewCache->prefetch(paths, screenPixelSize());
+}
+
+void MediaPreviewDialog::showPlaceholder(const QPixmap &thumbnail)
 {
+    if (m_isVideo || m_source || thumbnail.isNull()) {
+        return;
+    }
+
+    m_imageSize = thumbnail.size();
+    m_imageScene->setSceneRect(QRectF(QPointF(0, 0), m_imageSize));
+    setBasePixmap(thumbnail);
     m_loadingLabel->hide();
     m_imageView->setVisible(true);
+    fitToWindow();
+    m_statusLabel->setText(QString("Loading %1...")
+                               .arg(QFileInfo(m_filePath).fileName()));
+}
 
-    // Add pixmap to scene
-    m_pixmapItem = m_imageScene->addPixmap(m_originalPixmap);
-    m_imageScene->setSceneRect(m_originalPixmap.rect());
+void MediaPreviewDialog::onImageLoaded(
+    std::shared_ptr<TiledImageSource> source, const QImage &screenImage)
+{
+    m_source = std::move(source);
+    m_loadingLabel->hide();
+    m_imageView->setVisible(true);
+
+    m_imageSize = m_source->size();
+    m_imageScene->setSceneRect(QRectF(QPointF(0, 0), m_imageSize));
+    setBasePixmap(QPixmap::fromImage(screenImage));
+    recordMemory();
 
     // Fit to window initially
     fitToWindow();
+    prefetchNeighbours();
+}
 
-    // Update status
-    m_statusLabel->setText(QString("Image: %1 (%2x%3)")
-                               .arg(QFileInfo(m_filePath).fileName())
-                               .arg(m_originalPixmap.width())
-                               .arg(m_originalPixmap.height()));
+void MediaPreviewDialog::setBasePixmap(const QPixmap &pixmap)
+{
+    if (!m_pixmapItem) {
+        m_pixmapItem = m_imageScene->addPixmap(pixmap);
+        m_pixmapItem->setTransformationMode(Qt::SmoothTransformation);
+    } else {
+        m_pixmapItem->setPixmap(pixmap);
+    }
+    m_pixmapItem->setTransform(
+        QTransform::fromScale(qreal(m_imageSize.width()) / pixmap.width(),
+                              qreal(m_imageSize.height()) / pixmap.height()));
+}
+
+void MediaPreviewDialog::updateTiles()
+{
+    if (!m_source || !m_pixmapItem || !m_imageView->isVisible()) {
+        return;
+    }
+
+    // Tiles only pay off once the base pixmap is drawn magnified
+    const qreal devicePixelsPerBasePixel = m_zoomFactor *
+                                           m_pixmapItem->transform().m11() *
+                                           m_imageView->devicePixelRatioF();
+    const bool show = devicePixelsPerBasePixel > 1.01;
+    if (show != m_tilesShown) {
+        m_tilesShown = show;
+        for (const Tile &tile : std::as_const(m_tiles)) {
+            tile.item->setVisible(show);
+        }
+    }
+
+    // Tiles scrolled out of view before a worker got to them are dropped
+    m_tilePool.clear();
+    for (auto it = m_pendingTiles.begin(); it != m_pendingTiles.end();) {
+        it = it.value()->load() ? std::next(it) : m_pendingTiles.erase(it);
+    }
+    if (!show) {
+        return;
+    }
+
+    const QRect visible =
+        m_imageView->mapToScene(m_imageView->viewport()->rect())
+            .boundingRect()
+            .toAlignedRect()
+            .intersected(QRect(QPoint(0, 0), m_imageSize));
+    if (visible.isEmpty()) {
+        return;
+    }
+
+    m_inViewSince = ++m_tileClock;
+    for (int row = 0; row < m_source->rows(); row++) {
+        for (int column = 0; column < m_source->columns(); column++) {
+            if (!m_source->tileRect(column, row).intersects(visible)) {
+                continue;
+            }
+            const quint64 key = tileKey(column, row);
+            auto tile = m_tiles.find(key);
+            if (tile != m_tiles.end()) {
+                tile->lastUsed = m_tileClock;
+                continue;
+            }
+            if (m_pendingTiles.contains(key)) {
+                continue;
+            }
+
+            auto started = std::make_shared<std::atomic<bool>>(false);
+            m_pendingTiles.insert(key, started);
+            m_tilePool.start([this, source = m_source, started, column, row,
+                              generation = m_imageGeneration]() {
+                started->store(true);
+                const QImage tile = source->decodeTile(column, row);
+                QMetaObject::invokeMethod(
+                    this,
+                    [this, generation, column, row, tile]() {
+                        onTileDecoded(generation, column, row, tile);
+                    },
+                    Qt::QueuedConnection);
+            });
+        }
+    }
+}
+
+void MediaPreviewDialog::onTileDecoded(int generation, int column, int row,
+                                       const QImage &tile)
+{
+    if (generation != m_imageGeneration) {
+        return;
+    }
+    const quint64 key = tileKey(column, row);
+    m_pendingTiles.remove(key);
+    if (tile.isNull() || !m_source || m_tiles.contains(key)) {
+        return;
+    }
+
+    QGraphicsPixmapItem *item =
+        m_imageScene->addPixmap(QPixmap::fromImage(tile));
+    item->setPos(m_source->tileRect(column, row).topLeft());
+    item->setZValue(1);
+    item->setVisible(m_tilesShown);
+
+    Tile entry;
+    entry.item = item;
+    entry.bytes = tile.sizeInBytes();
+    entry.lastUsed = ++m_tileClock;
+    m_tiles.insert(key, entry);
+    m_tileBytes += entry.bytes;
+
+    recordMemory();
+    evictTiles();
+}
+
+void MediaPreviewDialog::evictTiles()
+{
+    while (m_tileBytes > MAX_TILE_BYTES) {
+        auto oldest = m_tiles.end();
+        for (auto it = m_tiles.begin(); it != m_tiles.end(); ++it) {
+            if (it->lastUsed < m_inViewSince &&
+                (oldest == m_tiles.end() || it->lastUsed < oldest->lastUsed)) {
+                oldest = it;
+            }
+        }
+        // Everything left is in view
+        if (oldest == m_tiles.end()) {
+            return;
+        }
+        m_imageScene->removeItem(oldest->item);
+        delete oldest->item;
+        m_tileBytes -= oldest->bytes;
+        m_tiles.erase(oldest);
+    }
+}
+
+void MediaPreviewDialog::recordMemory()
+{
+    // The cache holds the shown photo's source too, unless it was evicted
+    qint64 bytes = m_tileBytes + m_previewCache->bytes();
+    if (m_pixmapItem) {
+        const QPixmap base = m_pixmapItem->pixmap();
+        bytes += qint64(base.width()) * base.height() * base.depth() / 8;
+    }
+    m_peakBytes = qMax(m_peakBytes, bytes);
 }
 
 void MediaPreviewDialog::onImageLoadFailed()
 {
     m_loadingLabel->setText("Failed to load image");
     m_statusLabel->setText("Error loading image");
+    // The user may still step on
+    prefetchNeighbours();
 }
 
 void MediaPreviewDialog::wheelEvent(QWheelEvent *event)
@@ -314,6 +621,16 @@ void MediaPreviewDialog::keyPressEvent(QKeyEvent *event)
             fitToWindow();
             event->accept();
             return;
+        case Qt::Key_Left:
+        case Qt::Key_PageUp:
+            showRow(m_index.row() - 1);
+            event->accept();
+            return;
+        case Qt::Key_Right:
+        case Qt::Key_PageDown:
+            showRow(m_index.row() + 1);
+            event->accept();
+            return;
         }
     }
 
@@ -340,6 +657,14 @@ void MediaPreviewDialog::keyPressEvent(QKeyEvent *event)
             }
             event->accept();
             return;
+        case Qt::Key_PageUp:
+            showRow(m_index.row() - 1);
+            event->accept();
+            return;
+        case Qt::Key_PageDown:
+            showRow(m_index.row() + 1);
+            event->accept();
+            return;
         case Qt::Key_Right:
             // Seek forward 10 seconds
             if (m_videoDuration > 0) {
@@ -368,9 +693,9 @@ void MediaPreviewDialog::resizeEvent(QResizeEvent *event)
 
     // Auto-fit when window is resized if we're close to fit-to-window size
     if (!m_isVideo && m_imageView && m_imageView->isVisible() &&
-        !m_originalPixmap.isNull()) {
+        !m_imageSize.isEmpty()) {
         const QSize viewSize = m_imageView->viewport()->size();
-        const QSize pixmapSize = m_originalPixmap.size();
+        const QSize pixmapSize = m_imageSize;
         const double fitScale =
             qMin(static_cast<double>(viewSize.width()) / pixmapSize.width(),
                  static_cast<double>(viewSize.height()) / pixmapSize.height());
@@ -388,20 +713,21 @@ void MediaPreviewDialog::zoomOut() { zoom(1.0 / 1.25); }
 
 void MediaPreviewDialog::zoomReset()
 {
-    if (m_imageView && m_originalPixmap.isNull() == false) {
+    if (m_imageView && !m_imageSize.isEmpty()) {
         m_imageView->resetTransform();
         m_zoomFactor = 1.0;
         updateZoomStatus();
+        updateTiles();
     }
 }
 
 void MediaPreviewDialog::fitToWindow()
 {
-    if (!m_imageView || m_originalPixmap.isNull())
+    if (!m_imageView || m_imageSize.isEmpty())
         return;
 
     const QSize viewSize = m_imageView->viewport()->size();
-    const QSize pixmapSize = m_originalPixmap.size();
+    const QSize pixmapSize = m_imageSize;
 
     const double scaleX =
         static_cast<double>(viewSize.width()) / pixmapSize.width();
@@ -413,6 +739,7 @@ void MediaPreviewDialog::fitToWindow()
     m_imageView->scale(scale, scale);
     m_zoomFactor = scale;
     updateZoomStatus();
+    updateTiles();
 }
 
 void MediaPreviewDialog::zoom(double factor)
@@ -423,6 +750,7 @@ void MediaPreviewDialog::zoom(double factor)
     m_imageView->scale(factor, factor);
     m_zoomFactor *= factor;
     updateZoomStatus();
+    updateTiles();
 }
 
 // void MediaPreviewDialog::updateZoomStatus()
@@ -438,11 +766,12 @@ void MediaPreviewDialog::zoom(double factor)
 
 void MediaPreviewDialog::updateZoomStatus()
 {
-    if (!m_isVideo && !m_originalPixmap.isNull()) {
+    // The placeholder's size means nothing to the user
+    if (!m_isVideo && m_source) {
         m_statusLabel->setText(QString("Image: %1 (%2x%3) - Zoom: %4%")
                                    .arg(QFileInfo(m_filePath).fileName())
-                                   .arg(m_originalPixmap.width())
-                                   .arg(m_originalPixmap.height())
+                                   .arg(m_imageSize.width())
+                                   .arg(m_imageSize.height())
                                    .arg(qRound(m_zoomFactor * 100)));
     }
 }
@@ -742,6 +1071,27 @@ void MediaPreviewDialog::onVolumeChanged(int value)
     }
 }
 
+bool MediaPreviewDialog::eventFilter(QObject *watched, QEvent *event)
+{
+    // The view pans with the arrow keys, they step through photos only
+    // while the image fits horizontally
+    if (watched == m_imageView && event->type() == QEvent::KeyPress &&
+        m_model) {
+        const int key = static_cast<QKeyEvent *>(event)->key();
+        const QScrollBar *bar = m_imageView->horizontalScrollBar();
+        const bool canPan = bar->maximum() > bar->minimum();
+        if ((key == Qt::Key_Left || key == Qt::Key_Right) && !canPan) {
+            showRow(m_index.row() + (key == Qt::Key_Right ? 1 : -1));
+            return true;
+        }
+        if (key == Qt::Key_PageUp || key == Qt::Key_PageDown) {
+            showRow(m_index.row() + (key == Qt::Key_PageDown ? 1 : -1));
+            return true;
+        }
+    }
+    return QDialog::eventFilter(watched, event);
+}
+
 bool MediaPreviewDialog::event(QEvent *event)
 {
     // FIXME: lets implement this on all dialogs
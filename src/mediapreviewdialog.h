@@ -22,27 +22,41 @@
 
 #include "iDescriptor-ui.h"
 #include "iDescriptor.h"
+#include "previewcache.h"
+#include "tiledimagesource.h"
 #include <QCoreApplication>
 #include <QDialog>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsScene>
 #include <QGraphicsView>
 #include <QHBoxLayout>
+#include <QHash>
 #include <QLabel>
 #include <QMediaPlayer>
+#include <QPersistentModelIndex>
+#include <QPointer>
 #include <QPushButton>
 #include <QSlider>
+#include <QThreadPool>
 #include <QTimer>
 #include <QVBoxLayout>
 #include <QVideoWidget>
 #include <QtGlobal>
+#include <atomic>
 #include <libimobiledevice/afc.h>
+#include <memory>
+
+class PhotoModel;
 
 /**
  * @brief A dialog for previewing images and videos from iOS devices
  *
  * Features:
- * - Image viewing with zoom and pan using QGraphicsView
+ * - Image viewing with zoom and pan using QGraphicsView: a thumbnail
+ *   first, then a decode at screen size, then full resolution tiles of
+ *   the zoomed-in area only
+ * - Stepping through a PhotoModel's photos, with the neighbours decoded
+ *   ahead (see PreviewCache)
  * - Video streaming with timeline scrubbing support
  * - Asynchronous loading from device
  * - Proper memory management
@@ -57,14 +71,23 @@ public:
                                 QWidget *parent = nullptr);
     ~MediaPreviewDialog();
 
+    // Shown scaled up until the image itself is decoded
+    void showPlaceholder(const QPixmap &thumbnail);
+    /*
+        Lets Left/Right, Page Up/Down and the Previous/Next buttons step
+        through the model in its current order, starting at index
+    */
+    void setNavigation(PhotoModel *model, const QModelIndex &index);
+
 protected:
     void wheelEvent(QWheelEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
     bool event(QEvent *event) override; // handle ShortcutOverride
+    // Arrow keys of the image view when there is nothing to pan
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private slots:
-    void onImageLoaded();
     void onImageLoadFailed();
     void zoomIn();
     void zoomOut();
@@ -92,6 +115,21 @@ private:
     void loadMedia();
     void loadImage();
     void loadVideo();
+    void showRow(int row);
+    // Drops the shown image, its tiles and the loads still under way
+    void resetImage();
+    void prefetchNeighbours();
+    QSize screenPixelSize() const;
+    void onImageLoaded(std::shared_ptr<TiledImageSource> source,
+                       const QImage &screenImage);
+    // Stretched over the whole image, scene coordinates are image pixels
+    void setBasePixmap(const QPixmap &pixmap);
+    // Requests the tiles in view once the base pixmap gets magnified
+    void updateTiles();
+    void onTileDecoded(int generation, int column, int row,
+                       const QImage &tile);
+    void evictTiles();
+    void recordMemory();
     void zoom(double factor);
     void updateZoomStatus();
     void updateVideoTimeDisplay();
@@ -136,10 +174,47 @@ private:
     QPushButton *m_zoomOutBtn;
     QPushButton *m_zoomResetBtn;
     QPushButton *m_fitToWindowBtn;
+    QPushButton *m_previousBtn;
+    QPushButton *m_nextBtn;
 
     // State
     double m_zoomFactor;
-    QPixmap m_originalPixmap;
+    // Full resolution, the placeholder's size until the image is loaded
+    QSize m_imageSize;
+    std::shared_ptr<TiledImageSource> m_source;
+
+    struct Tile {
+        QGraphicsPixmapItem *item = nullptr;
+        qint64 bytes = 0;
+        // Larger is more recently in view
+        quint64 lastUsed = 0;
+    };
+    static constexpr qint64 MAX_TILE_BYTES = 128LL * 1024 * 1024;
+    static constexpr int TILE_THREADS = 2;
+    static quint64 tileKey(int column, int row)
+    {
+        return (quint64(quint32(row)) << 32) | quint32(column);
+    }
+    QHash<quint64, Tile> m_tiles;
+    // Queued or decoding, the flag is set once a worker picked it up
+    QHash<quint64, std::shared_ptr<std::atomic<bool>>> m_pendingTiles;
+    QThreadPool m_tilePool;
+    quint64 m_tileClock;
+    // Tiles used at or after this are in view and aren't evicted
+    quint64 m_inViewSince;
+    qint64 m_tileBytes;
+    bool m_tilesShown;
+    // Decoded image data held at once: previews, base pixmap and tiles
+    qint64 m_peakBytes;
+    // Bumped per shown photo, stale loads and tiles are ignored
+    int m_imageGeneration;
+
+    // Navigation
+    QPointer<PhotoModel> m_model;
+    QPersistentModelIndex m_index;
+    // Direction of the last step, prefetching favours it
+    int m_step;
+    std::shared_ptr<PreviewCache> m_previewCache;
 
     // Video state
     bool m_isRepeatEnabled;
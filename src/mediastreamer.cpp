@@ -20,6 +20,7 @@
 #include "mediastreamer.h"
 #include <QtGlobal>
 
+#include "afctransfertuner.h"
 #include "iDescriptor.h"
 #include "servicemanager.h"
 #include <QDebug>
@@ -28,6 +29,7 @@
 #include <QMutexLocker>
 #include <QTcpSocket>
 #include <QTimer>
+#include <chrono>
 #include <libimobiledevice/afc.h>
 #include <memory>
 
@@ -276,12 +278,22 @@ void MediaStreamer::streamFileRange(QTcpSocket *socket, qint64 startByte,
     context->bytesRemaining = endByte - startByte + 1;
     context->afcHandle = 0;
 
+    // Range requests arrive while the gallery or an export may be busy, use a
+    // pooled connection when one is free right away instead of queueing
+    // behind them on the shared client
+    if (m_afcClient == m_device->afcClient) {
+        context->lease = ServiceManager::acquireAfcClient(
+            m_device, 0, IoPriority::Streaming);
+    }
+    context->afc = context->lease ? context->lease.altAfc()
+                                  : std::optional<afc_client_t>(m_afcClient);
+
     qDebug() << "m_filepath" << m_filePath;
     // Open file on device using ServiceManager
     const QByteArray pathBytes = m_filePath.toUtf8();
     afc_error_t openResult = ServiceManager::safeAfcFileOpen(
         m_device, pathBytes.constData(), AFC_FOPEN_RDONLY, &context->afcHandle,
-        m_afcClient);
+        context->afc);
 
     if (openResult != AFC_E_SUCCESS || context->afcHandle == 0) {
         qWarning() << "Failed to open file on device:" << m_filePath;
@@ -293,11 +305,11 @@ void MediaStreamer::streamFileRange(QTcpSocket *socket, qint64 startByte,
     // Seek to start position if needed
     if (startByte > 0) {
         afc_error_t seekResult = ServiceManager::safeAfcFileSeek(
-            m_device, context->afcHandle, startByte, SEEK_SET, m_afcClient);
+            m_device, context->afcHandle, startByte, SEEK_SET, context->afc);
         if (seekResult != AFC_E_SUCCESS) {
             qWarning() << "Failed to seek in file:" << m_filePath;
             ServiceManager::safeAfcFileClose(m_device, context->afcHandle,
-                                             m_afcClient);
+                                             context->afc);
             delete context;
             socket->disconnectFromHost();
             return;
@@ -351,28 +363,17 @@ qint64 MediaStreamer::getFileSize()
     }
 
     // Get file info from device using ServiceManager
-    char **info = nullptr;
+    MediaEntry info;
     const QByteArray pathBytes = m_filePath.toUtf8();
-    afc_error_t result = ServiceManager::safeAfcGetFileInfo(
-        m_device, pathBytes.constData(), &info, m_afcClient);
+    afc_error_t result = ServiceManager::cachedStat(
+        m_device, pathBytes.constData(), info, m_afcClient);
 
-    if (result != AFC_E_SUCCESS || !info) {
+    if (result != AFC_E_SUCCESS) {
         qWarning() << "Failed to get file info for:" << m_filePath;
         return -1;
     }
 
-    qint64 fileSize = -1;
-    for (int i = 0; info[i]; i += 2) {
-        if (strcmp(info[i], "st_size") == 0) {
-            bool ok;
-            fileSize = QString(info[i + 1]).toLongLong(&ok);
-            if (!ok)
-                fileSize = -1;
-            break;
-        }
-    }
-
-    afc_dictionary_free(info);
+    const qint64 fileSize = static_cast<qint64>(info.size);
 
     if (fileSize > 0) {
         m_cachedFileSize = fileSize;
@@ -423,16 +424,22 @@ void MediaStreamer::streamNextChunk(StreamingContext *context)
         return;
     }
 
-    const int CHUNK_SIZE = 64 * 1024; // 64KB chunks
+    // Sized so one read stays short on this link, see AfcTransferTuner
+    const qint64 chunkSize = AfcTransferTuner::streamingChunkSizeFor(m_device);
     const uint32_t bytesToRead = static_cast<uint32_t>(
-        qMin(static_cast<qint64>(CHUNK_SIZE), context->bytesRemaining));
+        qMin(chunkSize, context->bytesRemaining));
 
     auto buffer = std::make_unique<char[]>(bytesToRead);
     uint32_t bytesRead = 0;
 
+    const auto start = std::chrono::steady_clock::now();
     afc_error_t readResult = ServiceManager::safeAfcFileRead(
         m_device, context->afcHandle, buffer.get(), bytesToRead, &bytesRead,
-        m_afcClient);
+        context->afc);
+    if (readResult == AFC_E_SUCCESS && m_device->transferTuner) {
+        m_device->transferTuner->recordTransfer(
+            bytesRead, std::chrono::steady_clock::now() - start);
+    }
 
     if (readResult != AFC_E_SUCCESS || bytesRead == 0) {
         qWarning() << "AFC read error or EOF during streaming";
@@ -490,7 +497,7 @@ void MediaStreamer::cleanupStreamingContext(StreamingContext *context)
 
     if (context->afcHandle != 0) {
         ServiceManager::safeAfcFileClose(context->device, context->afcHandle,
-                                         m_afcClient);
+                                         context->afc);
         context->afcHandle = 0;
     }
 
@@ -26,6 +26,7 @@
 #include <QTcpServer>
 #include <QUrl>
 #include <libimobiledevice/afc.h>
+#include <optional>
 
 QT_BEGIN_NAMESPACE
 class QTcpSocket;
@@ -89,6 +90,9 @@ private:
         qint64 endByte;
         qint64 bytesRemaining;
         uint64_t afcHandle;
+        // Dedicated connection for this range when the pool had one free
+        AfcClientLease lease;
+        std::optional<afc_client_t> afc;
     };
 
     HttpRequest parseHttpRequest(const QByteArray &requestData);
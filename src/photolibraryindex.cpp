@@ -0,0 +1,184 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "photolibraryindex.h"
+#include "afcfilereader.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QTemporaryDir>
+#include <QtConcurrent/QtConcurrent>
+
+std::shared_ptr<PhotoLibraryIndex>
+PhotoLibraryIndex::load(iDescriptorDevice *device)
+{
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qWarning() << "Could not create a directory for Photos.sqlite";
+        return nullptr;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QString dbPath = dir.filePath("Photos.sqlite");
+    if (!download(device, PHOTOS_DB_PATH, dbPath)) {
+        qDebug() << "Photos.sqlite is not available on this device";
+        return nullptr;
+    }
+    // Recent changes sit in the WAL until iOS checkpoints it, SQLite
+    // replays it when it finds it next to the database
+    download(device, QString(PHOTOS_DB_PATH) + "-wal", dbPath + "-wal");
+    const qint64 downloadMs = timer.restart();
+
+    std::shared_ptr<PhotoLibraryIndex> index(new PhotoLibraryIndex());
+    if (!index->parse(dbPath)) {
+        return nullptr;
+    }
+    qDebug() << "Photo library index:" << index->size()
+             << "assets, downloaded in" << downloadMs << "ms, parsed in"
+             << timer.elapsed() << "ms";
+    return index;
+}
+
+QFuture<std::shared_ptr<PhotoLibraryIndex>>
+PhotoLibraryIndex::loadAsync(iDescriptorDevice *device)
+{
+    return QtConcurrent::run([device]() { return load(device); });
+}
+
+QDateTime PhotoLibraryIndex::dateCreated(int row) const
+{
+    const qint64 ms = m_dates.at(row);
+    return ms != 0 ? QDateTime::fromMSecsSinceEpoch(ms, Qt::UTC)
+                   : QDateTime();
+}
+
+bool PhotoLibraryIndex::download(iDescriptorDevice *device,
+                                 const QString &devicePath,
+                                 const QString &localPath)
+{
+    // Photos.sqlite runs to a hundred MB, thumbnail loads go first
+    AfcClientLease lease = ServiceManager::acquireAfcClient(
+        device, ACQUIRE_TIMEOUT_MS, IoPriority::Bulk);
+    AfcFileReader reader(device, devicePath, lease.altAfc());
+    if (reader.open() != AFC_E_SUCCESS) {
+        return false;
+    }
+    QFile out(localPath);
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write" << localPath;
+        return false;
+    }
+
+    QByteArray chunk;
+    while (reader.next(chunk)) {
+        if (out.write(chunk) != chunk.size()) {
+            qWarning() << "Could not write" << localPath;
+            return false;
+        }
+    }
+    return reader.error() == AFC_E_SUCCESS;
+}
+
+bool PhotoLibraryIndex::parse(const QString &databasePath)
+{
+    // Connections are per thread, the name only has to be unique
+    const QString connection =
+        QString("photolibrary-%1").arg(reinterpret_cast<quintptr>(this));
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection);
+        db.setDatabaseName(databasePath);
+        if (!db.open()) {
+            qWarning() << "Could not open Photos.sqlite:"
+                       << db.lastError().text();
+        } else {
+            ok = readAssets(db);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(connection);
+    return ok;
+}
+
+bool PhotoLibraryIndex::readAssets(QSqlDatabase &db)
+{
+    const QStringList tables = db.tables();
+    const QString table = tables.contains("ZASSET")          ? "ZASSET"
+                          : tables.contains("ZGENERICASSET") ? "ZGENERICASSET"
+                                                             : QString();
+    if (table.isEmpty()) {
+        qWarning() << "Photos.sqlite has no asset table";
+        return false;
+    }
+
+    // Optional columns come and go between iOS versions
+    const QSqlRecord columns = db.record(table);
+    auto column = [&columns](const char *name, const char *fallback) {
+        return columns.contains(name) ? QString(name) : QString(fallback);
+    };
+    QString sql = QString("SELECT ZDIRECTORY, ZFILENAME, ZDATECREATED, ZKIND, "
+                          "%1, %2, %3 FROM %4")
+                      .arg(column("ZWIDTH", "0"), column("ZHEIGHT", "0"),
+                           column("ZDURATION", "0"), table);
+    if (columns.contains("ZTRASHEDSTATE")) {
+        sql += " WHERE ZTRASHEDSTATE = 0";
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec(sql)) {
+        qWarning() << "Could not read" << table << ":"
+                   << query.lastError().text();
+        return false;
+    }
+
+    auto toMs = [](const QVariant &value) -> qint64 {
+        if (value.isNull())
+            return 0;
+        return qRound64((value.toDouble() + CORE_DATA_EPOCH_OFFSET) * 1000.0);
+    };
+
+    while (query.next()) {
+        const QString directory = query.value(0).toString();
+        const QString fileName = query.value(1).toString();
+        if (directory.isEmpty() || fileName.isEmpty()) {
+            continue;
+        }
+
+        const int row = m_paths.size();
+        const QString path = "/" + directory + "/" + fileName;
+        m_paths.append(path);
+        m_dates.append(toMs(query.value(2)));
+        // ZKIND 1 is video, everything else displays as an image
+        m_types.append(query.value(3).toInt() == 1 ? MediaType::Video
+                                                   : MediaType::Image);
+        m_widths.append(query.value(4).toUInt());
+        m_heights.append(query.value(5).toUInt());
+        m_durations.append(query.value(6).toFloat());
+
+        m_byPath.insert(path, row);
+    }
+    return true;
+}
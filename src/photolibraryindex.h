@@ -0,0 +1,96 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PHOTOLIBRARYINDEX_H
+#define PHOTOLIBRARYINDEX_H
+
+#include "iDescriptor.h"
+#include <QDateTime>
+#include <QFuture>
+#include <QHash>
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <memory>
+
+class QSqlDatabase;
+
+/**
+ * @brief In-memory copy of the device's photo library catalogue
+ *
+ * Photos.sqlite and its WAL are pulled over AFC once and read locally, so
+ * the gallery knows every asset's path, capture date, media type,
+ * dimensions and duration without stat'ing files on the device. Assets are
+ * stored column by column and addressed by row; lookups by path go through
+ * a hash built while loading.
+ *
+ * The schema is the Core Data one iOS uses, assets live in ZASSET
+ * (ZGENERICASSET before iOS 14).
+ */
+class PhotoLibraryIndex
+{
+public:
+    enum class MediaType : quint8 { Image, Video };
+
+    // Downloads and parses the catalogue, nullptr if that fails
+    static std::shared_ptr<PhotoLibraryIndex>
+    load(iDescriptorDevice *device);
+    static QFuture<std::shared_ptr<PhotoLibraryIndex>>
+    loadAsync(iDescriptorDevice *device);
+
+    int size() const { return m_paths.size(); }
+
+    // Row of a device path such as /DCIM/100APPLE/IMG_0001.HEIC, -1 if absent
+    int find(const QString &path) const { return m_byPath.value(path, -1); }
+    QString path(int row) const { return m_paths.at(row); }
+    QDateTime dateCreated(int row) const;
+    MediaType mediaType(int row) const { return m_types.at(row); }
+    QSize dimensions(int row) const
+    {
+        return QSize(m_widths.at(row), m_heights.at(row));
+    }
+    // Seconds, 0 for images
+    double duration(int row) const { return m_durations.at(row); }
+
+private:
+    static constexpr const char *PHOTOS_DB_PATH = "/PhotoData/Photos.sqlite";
+    // Core Data stores dates as seconds since 2001-01-01 UTC
+    static constexpr qint64 CORE_DATA_EPOCH_OFFSET = 978307200;
+    static constexpr int ACQUIRE_TIMEOUT_MS = 2000;
+
+    PhotoLibraryIndex() = default;
+
+    static bool download(iDescriptorDevice *device, const QString &devicePath,
+                         const QString &localPath);
+    bool parse(const QString &databasePath);
+    bool readAssets(QSqlDatabase &db);
+
+    // One entry per asset, all indexed by row
+    QStringList m_paths;
+    QList<qint64> m_dates; // ms since the epoch, 0 if unknown
+    QList<MediaType> m_types;
+    QList<quint32> m_widths;
+    QList<quint32> m_heights;
+    QList<float> m_durations;
+
+    QHash<QString, int> m_byPath;
+};
+
+#endif // PHOTOLIBRARYINDEX_H
@@ -18,9 +18,12 @@
  */
 
 #include "photomodel.h"
+#include "embeddedthumbnailreader.h"
 #include "iDescriptor.h"
 #include "mediastreamermanager.h"
 #include "servicemanager.h"
+#include "videothumbnailer.h"
+#include <QCoreApplication>
 #include <QDebug>
 #include <QEventLoop>
 #include <QIcon>
@@ -28,18 +31,15 @@
 #include <QImageReader>
 #include <QMediaPlayer>
 #include <QPixmap>
+#include <QPointer>
 #include <QRegularExpression>
 #include <QSemaphore>
 #include <QTimer>
 #include <QVideoFrame>
 #include <QVideoSink>
 #include <QtConcurrent/QtConcurrent>
-extern "C" {
-#include <libavcodec/avcodec.h>
-#include <libavformat/avformat.h>
-#include <libavutil/imgutils.h>
-#include <libswscale/swscale.h>
-}
+#include <algorithm>
+#include <iterator>
 
 // Limit concurrent video thumbnail generation to 2 to prevent resource
 // exhaustion
@@ -52,6 +52,14 @@ PhotoModel::PhotoModel(iDescriptorDevice *device, FilterType filterType,
 {
     // 350 MB cache for thumbnails
     m_thumbnailCache.setMaxCost(350 * 1024 * 1024);
+    m_diskCache =
+        ThumbnailDiskCache::forDevice(QString::fromStdString(device->udid));
+
+    m_scheduler = new ThumbnailScheduler(
+        ThumbnailScheduler::DEFAULT_MAX_IN_FLIGHT,
+        ThumbnailScheduler::DEFAULT_PREFETCH_MARGIN, this);
+    connect(m_scheduler, &ThumbnailScheduler::thumbnailReady, this,
+            &PhotoModel::onThumbnailReady);
 
     connect(this, &PhotoModel::thumbnailNeedsToBeLoaded, this,
             &PhotoModel::requestThumbnail, Qt::QueuedConnection);
@@ -59,16 +67,8 @@ PhotoModel::PhotoModel(iDescriptorDevice *device, FilterType filterType,
 
 void PhotoModel::clear()
 {
-    // Clean up any active watchers
-    for (auto *watcher : m_activeLoaders.values()) {
-        if (watcher) {
-            watcher->cancel();
-            watcher->waitForFinished();
-            watcher->deleteLater();
-        }
-    }
-    m_activeLoaders.clear();
-    m_loadingPaths.clear();
+    stopDateResolver();
+    m_scheduler->clear();
     m_thumbnailCache.clear();
 }
 
@@ -82,302 +82,10 @@ QPixmap PhotoModel::generateVideoThumbnailFFmpeg(iDescriptorDevice *device,
                                                  const QString &filePath,
                                                  const QSize &requestedSize)
 {
-    QPixmap thumbnail;
-
-    uint64_t fileHandle = 0;
-
-    afc_error_t openResult = ServiceManager::safeAfcFileOpen(
-        device, filePath.toUtf8().constData(), AFC_FOPEN_RDONLY, &fileHandle);
-
-    if (openResult != AFC_E_SUCCESS || fileHandle == 0) {
-        qWarning() << "Failed to open video file for thumbnail:" << filePath;
-        return {};
-    }
-
-    // Get file size
-    char **fileInfo = nullptr;
-    afc_error_t infoResult = ServiceManager::safeAfcGetFileInfo(
-        device, filePath.toUtf8().constData(), &fileInfo);
-
-    uint64_t fileSize = 0;
-    if (infoResult == AFC_E_SUCCESS && fileInfo) {
-        for (int i = 0; fileInfo[i]; i += 2) {
-            if (strcmp(fileInfo[i], "st_size") == 0) {
-                fileSize = strtoull(fileInfo[i + 1], nullptr, 10);
-                break;
-            }
-        }
-        afc_dictionary_free(fileInfo);
-    }
-
-    if (fileSize == 0) {
-        ServiceManager::safeAfcFileClose(device, fileHandle);
-        qWarning() << "Invalid video file size for thumbnail:" << filePath;
-        return {};
-    }
-
-    // Create custom AVIOContext for reading from device on-demand
-    AVFormatContext *formatCtx = avformat_alloc_context();
-    if (!formatCtx) {
-        ServiceManager::safeAfcFileClose(device, fileHandle);
-        qWarning() << "Failed to allocate format context";
-        return {};
-    }
-
-    // Context for streaming read from device
-    struct StreamContext {
-        iDescriptorDevice *device;
-        uint64_t fileHandle;
-        uint64_t fileSize;
-        uint64_t currentPos;
-    };
-
-    StreamContext *streamCtx =
-        new StreamContext{device, fileHandle, fileSize, 0};
-
-    // Custom read function that reads from device on-demand
-    auto readPacket = [](void *opaque, uint8_t *buf, int bufSize) -> int {
-        StreamContext *ctx = static_cast<StreamContext *>(opaque);
-
-        if (ctx->currentPos >= ctx->fileSize) {
-            return AVERROR_EOF;
-        }
-
-        uint32_t toRead =
-            std::min(static_cast<uint32_t>(bufSize),
-                     static_cast<uint32_t>(ctx->fileSize - ctx->currentPos));
-        uint32_t bytesRead = 0;
-
-        afc_error_t result = ServiceManager::safeAfcFileRead(
-            ctx->device, ctx->fileHandle, reinterpret_cast<char *>(buf), toRead,
-            &bytesRead);
-
-        if (result != AFC_E_SUCCESS || bytesRead == 0) {
-            return AVERROR(EIO);
-        }
-
-        ctx->currentPos += bytesRead;
-        return static_cast<int>(bytesRead);
-    };
-
-    // Custom seek function using AFC seek
-    auto seekPacket = [](void *opaque, int64_t offset, int whence) -> int64_t {
-        StreamContext *ctx = static_cast<StreamContext *>(opaque);
-
-        if (whence == AVSEEK_SIZE) {
-            return static_cast<int64_t>(ctx->fileSize);
-        }
-
-        int64_t newPos = 0;
-        int seekWhence = SEEK_SET;
-
-        if (whence == SEEK_SET) {
-            newPos = offset;
-            seekWhence = SEEK_SET;
-        } else if (whence == SEEK_CUR) {
-            newPos = static_cast<int64_t>(ctx->currentPos) + offset;
-            seekWhence = SEEK_SET;
-        } else if (whence == SEEK_END) {
-            newPos = static_cast<int64_t>(ctx->fileSize) + offset;
-            seekWhence = SEEK_SET;
-        } else {
-            return -1;
-        }
-
-        if (newPos < 0 || newPos > static_cast<int64_t>(ctx->fileSize)) {
-            return -1;
-        }
-
-        // Use AFC seek
-        afc_error_t result = ServiceManager::safeAfcFileSeek(
-            ctx->device, ctx->fileHandle, newPos, seekWhence);
-
-        if (result != AFC_E_SUCCESS) {
-            return -1;
-        }
-
-        ctx->currentPos = static_cast<uint64_t>(newPos);
-        return newPos;
-    };
-
-    const int avioBufferSize = 32768; // 32KB buffer for streaming
-    unsigned char *avioBuffer =
-        static_cast<unsigned char *>(av_malloc(avioBufferSize));
-    if (!avioBuffer) {
-        delete streamCtx;
-        ServiceManager::safeAfcFileClose(device, fileHandle);
-        avformat_free_context(formatCtx);
-        return {};
-    }
-
-    AVIOContext *avioCtx =
-        avio_alloc_context(avioBuffer, avioBufferSize, 0, streamCtx, readPacket,
-                           nullptr, seekPacket);
-
-    if (!avioCtx) {
-        av_free(avioBuffer);
-        delete streamCtx;
-        ServiceManager::safeAfcFileClose(device, fileHandle);
-        avformat_free_context(formatCtx);
-        return {};
-    }
-
-    formatCtx->pb = avioCtx;
-    formatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
-
-    // Open input
-    if (avformat_open_input(&formatCtx, nullptr, nullptr, nullptr) < 0) {
-        qWarning() << "Failed to open video format";
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        avformat_free_context(formatCtx);
-        return {};
-    }
-
-    // Find stream info
-    if (avformat_find_stream_info(formatCtx, nullptr) < 0) {
-        qWarning() << "Failed to find stream info";
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    // Find video stream
-    int videoStreamIndex = -1;
-    const AVCodec *codec = nullptr;
-    AVCodecParameters *codecParams = nullptr;
-
-    for (unsigned int i = 0; i < formatCtx->nb_streams; i++) {
-        if (formatCtx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
-            videoStreamIndex = i;
-            codecParams = formatCtx->streams[i]->codecpar;
-            codec = avcodec_find_decoder(codecParams->codec_id);
-            break;
-        }
-    }
-
-    if (videoStreamIndex == -1 || !codec) {
-        qWarning() << "No video stream found";
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    // Allocate codec context
-    AVCodecContext *codecCtx = avcodec_alloc_context3(codec);
-    if (!codecCtx) {
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    if (avcodec_parameters_to_context(codecCtx, codecParams) < 0) {
-        avcodec_free_context(&codecCtx);
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    // Open codec
-    if (avcodec_open2(codecCtx, codec, nullptr) < 0) {
-        avcodec_free_context(&codecCtx);
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    // Allocate frame
-    AVFrame *frame = av_frame_alloc();
-    AVPacket *packet = av_packet_alloc();
-
-    if (!frame || !packet) {
-        if (frame)
-            av_frame_free(&frame);
-        if (packet)
-            av_packet_free(&packet);
-        avcodec_free_context(&codecCtx);
-        avformat_close_input(&formatCtx);
-        av_free(avioCtx->buffer);
-        avio_context_free(&avioCtx);
-        return {};
-    }
-
-    // Read frames until we get a valid one
-    bool frameDecoded = false;
-    while (av_read_frame(formatCtx, packet) >= 0) {
-        if (packet->stream_index == videoStreamIndex) {
-            if (avcodec_send_packet(codecCtx, packet) >= 0) {
-                if (avcodec_receive_frame(codecCtx, frame) >= 0) {
-                    frameDecoded = true;
-                    av_packet_unref(packet);
-                    break;
-                }
-            }
-        }
-        av_packet_unref(packet);
-    }
-
-    if (frameDecoded) {
-        // Convert frame to RGB24
-        SwsContext *swsCtx =
-            sws_getContext(frame->width, frame->height,
-                           static_cast<AVPixelFormat>(frame->format),
-                           frame->width, frame->height, AV_PIX_FMT_RGB24,
-                           SWS_BILINEAR, nullptr, nullptr, nullptr);
-
-        if (swsCtx) {
-            AVFrame *rgbFrame = av_frame_alloc();
-            if (rgbFrame) {
-                rgbFrame->format = AV_PIX_FMT_RGB24;
-                rgbFrame->width = frame->width;
-                rgbFrame->height = frame->height;
-
-                if (av_frame_get_buffer(rgbFrame, 0) >= 0) {
-                    sws_scale(swsCtx, frame->data, frame->linesize, 0,
-                              frame->height, rgbFrame->data,
-                              rgbFrame->linesize);
-
-                    // Convert to QImage
-                    QImage img(rgbFrame->data[0], rgbFrame->width,
-                               rgbFrame->height, rgbFrame->linesize[0],
-                               QImage::Format_RGB888);
-
-                    // Create a deep copy since AVFrame will be freed
-                    QImage imgCopy = img.copy();
-
-                    // Scale to requested size
-                    thumbnail = QPixmap::fromImage(
-                        imgCopy.scaled(requestedSize, Qt::KeepAspectRatio,
-                                       Qt::SmoothTransformation));
-                }
-
-                av_frame_free(&rgbFrame);
-            }
-
-            sws_freeContext(swsCtx);
-        }
-    }
-
-    // Cleanup
-    av_frame_free(&frame);
-    av_packet_free(&packet);
-    avcodec_free_context(&codecCtx);
-    avformat_close_input(&formatCtx);
-
-    // Close the AFC file handle
-    ServiceManager::safeAfcFileClose(device, fileHandle);
-
-    // Free AVIO context and stream context
-    av_free(avioCtx->buffer);
-    avio_context_free(&avioCtx);
-    delete streamCtx;
-
-    return thumbnail;
+    // A few large reads per clip, keep them off the shared client
+    AfcClientLease lease = ServiceManager::acquireAfcClient(device);
+    VideoThumbnailer thumbnailer(device, filePath, lease.altAfc());
+    return QPixmap::fromImage(thumbnailer.read(requestedSize));
 }
 
 int PhotoModel::rowCount(const QModelIndex &parent) const
@@ -409,9 +117,33 @@ QVariant PhotoModel::data(const QModelIndex &index, int role) const
             return QIcon(*cached);
         }
 
+        // Undated rows may still move, they are loaded once they settle
+        if (!info.dateResolved) {
+            if (info.fileType == PhotoInfo::Video) {
+                return QIcon(":/resources/icons/video-x-generic.png");
+            }
+            return QIcon(
+                ":/resources/icons/MaterialSymbolsLightImageOutlineSharp.png");
+        }
+
+        // Thumbnails from earlier sessions, decoding one from the mapped pack
+        // is much cheaper than reading the photo off the device. Rows dated
+        // by the library index get their mtime from the first load job
+        if (m_diskCache && info.mtime != 0) {
+            const QImage stored = m_diskCache->lookup(
+                info.filePath, m_thumbnailSize, info.mtime);
+            if (!stored.isNull()) {
+                QPixmap *pixmap = new QPixmap(QPixmap::fromImage(stored));
+                const QIcon icon(*pixmap);
+                m_thumbnailCache.insert(info.filePath, pixmap,
+                                        pixmap->width() * pixmap->height() *
+                                            4);
+                return icon;
+            }
+        }
+
         // Prevent duplicate requests
-        if (m_loadingPaths.contains(info.filePath) ||
-            m_activeLoaders.contains(info.filePath)) {
+        if (m_scheduler->isPending(info.filePath)) {
             qDebug() << "Already loading:" << info.fileName;
             // Return appropriate placeholder based on file type
             if (info.fileName.endsWith(".MOV", Qt::CaseInsensitive) ||
@@ -424,12 +156,10 @@ QVariant PhotoModel::data(const QModelIndex &index, int role) const
             }
         }
 
-        // Start async loading for both images and videos
-        if (!m_loadingPaths.contains(info.filePath)) {
-            qDebug() << "Starting load for:" << info.fileName;
-            emit const_cast<PhotoModel *>(this)->thumbnailNeedsToBeLoaded(
-                index.row());
-        }
+        // Queue async loading for both images and videos
+        qDebug() << "Requesting load for:" << info.fileName;
+        emit const_cast<PhotoModel *>(this)->thumbnailNeedsToBeLoaded(
+            index.row());
 
         // Return placeholder while loading
         if (info.fileName.endsWith(".MOV", Qt::CaseInsensitive) ||
@@ -443,8 +173,21 @@ QVariant PhotoModel::data(const QModelIndex &index, int role) const
         }
     }
 
-    case Qt::ToolTipRole:
-        return QString("Photo: %1").arg(info.fileName);
+    case Qt::ToolTipRole: {
+        QString tip = QString("Photo: %1").arg(info.fileName);
+        if (info.dimensions.isValid() && !info.dimensions.isEmpty()) {
+            tip += QString("\n%1 × %2")
+                       .arg(info.dimensions.width())
+                       .arg(info.dimensions.height());
+        }
+        if (info.duration > 0) {
+            const int seconds = qRound(info.duration);
+            tip += QString("\n%1:%2")
+                       .arg(seconds / 60)
+                       .arg(seconds % 60, 2, 10, QChar('0'));
+        }
+        return tip;
+    }
 
     default:
         return QVariant();
@@ -459,48 +202,23 @@ void PhotoModel::requestThumbnail(int index)
     PhotoInfo &info = m_photos[index];
     info.thumbnailRequested = true;
 
-    if (m_loadingPaths.contains(info.filePath))
+    if (m_scheduler->isPending(info.filePath) ||
+        m_thumbnailCache.contains(info.filePath))
         return;
 
-    m_loadingPaths.insert(info.filePath);
-
-    auto *watcher = new QFutureWatcher<QPixmap>();
-    m_activeLoaders[info.filePath] = watcher;
-
-    connect(watcher, &QFutureWatcher<QPixmap>::finished, this,
-            [this, watcher, filePath = info.filePath]() {
-                qDebug() << "Thumbnail load finished for:" << filePath;
-                QPixmap thumbnail = watcher->result();
-
-                m_loadingPaths.remove(filePath);
-                m_activeLoaders.remove(filePath);
-                if (!thumbnail.isNull()) {
-                    int cost = thumbnail.width() * thumbnail.height() * 4;
-                    m_thumbnailCache.insert(filePath, new QPixmap(thumbnail),
-                                            cost);
-
-                    for (int i = 0; i < m_photos.size(); ++i) {
-                        if (m_photos[i].filePath == filePath) {
-                            QModelIndex idx = createIndex(i, 0);
-                            emit dataChanged(idx, idx, {Qt::DecorationRole});
-                            break;
-                        }
-                    }
-                } else {
-                    qDebug() << "Failed to load thumbnail for:"
-                             << QFileInfo(filePath).fileName();
-                }
-
-                watcher->deleteLater();
-            });
-
     bool isVideo = info.fileName.endsWith(".MOV", Qt::CaseInsensitive) ||
                    info.fileName.endsWith(".MP4", Qt::CaseInsensitive) ||
                    info.fileName.endsWith(".M4V", Qt::CaseInsensitive);
 
-    QFuture<QPixmap> future;
+    ThumbnailScheduler::Job job;
     if (isVideo) {
-        future = QtConcurrent::run([this, info]() {
+        job = [this, info, diskCache = m_diskCache]() mutable
+            -> ThumbnailScheduler::Result {
+            if (QPixmap stored = storedThumbnail(diskCache.get(), info);
+                !stored.isNull()) {
+                return {stored, info.mtime};
+            }
+
             // Acquire semaphore FIRST to limit concurrent video processing
             qDebug() << "Waiting for semaphore for:" << info.fileName;
             m_videoThumbnailSemaphore.acquire();
@@ -513,16 +231,96 @@ void PhotoModel::requestThumbnail(int index)
             // Release semaphore
             qDebug() << "Releasing semaphore for:" << info.fileName;
             m_videoThumbnailSemaphore.release();
-            return thumbnail;
-        });
+            if (diskCache && info.mtime != 0 && !thumbnail.isNull()) {
+                diskCache->insert(info.filePath, m_thumbnailSize, info.mtime,
+                                  thumbnail.toImage());
+            }
+            return {thumbnail, info.mtime};
+        };
     } else {
-        future = QtConcurrent::run([info, this]() {
-            return loadThumbnailFromDevice(m_device, info.filePath,
-                                           m_thumbnailSize);
-        });
+        job = [info, this, diskCache = m_diskCache]() mutable
+            -> ThumbnailScheduler::Result {
+            if (QPixmap stored = storedThumbnail(diskCache.get(), info);
+                !stored.isNull()) {
+                return {stored, info.mtime};
+            }
+            QPixmap thumbnail = loadThumbnailFromDevice(
+                m_device, info.filePath, m_thumbnailSize);
+            if (diskCache && info.mtime != 0 && !thumbnail.isNull()) {
+                diskCache->insert(info.filePath, m_thumbnailSize, info.mtime,
+                                  thumbnail.toImage());
+            }
+            return {thumbnail, info.mtime};
+        };
+    }
+
+    m_scheduler->request(info.filePath, index, std::move(job));
+}
+
+QPixmap PhotoModel::storedThumbnail(ThumbnailDiskCache *diskCache,
+                                    PhotoInfo &info) const
+{
+    if (!diskCache) {
+        return QPixmap();
+    }
+    if (info.mtime == 0) {
+        MediaEntry entry;
+        if (ServiceManager::cachedStat(m_device,
+                                       info.filePath.toUtf8().constData(),
+                                       entry) != AFC_E_SUCCESS) {
+            return QPixmap();
+        }
+        info.mtime = entry.mtime;
+    }
+    const QImage stored =
+        diskCache->lookup(info.filePath, m_thumbnailSize, info.mtime);
+    return stored.isNull() ? QPixmap() : QPixmap::fromImage(stored);
+}
+
+void PhotoModel::onThumbnailReady(const QString &filePath, int row,
+                                  const QPixmap &thumbnail, quint64 mtime)
+{
+    int cost = thumbnail.width() * thumbnail.height() * 4;
+    m_thumbnailCache.insert(filePath, new QPixmap(thumbnail), cost);
+
+    // The row is where the request was made, unless the model changed since
+    if (row < 0 || row >= m_photos.size() ||
+        m_photos[row].filePath != filePath) {
+        row = -1;
+        for (int i = 0; i < m_photos.size(); ++i) {
+            if (m_photos[i].filePath == filePath) {
+                row = i;
+                break;
+            }
+        }
     }
 
-    watcher->setFuture(future);
+    // Keep the mtime the job stat'ed, so the disk cache answers this row
+    // on the GUI thread once the memory cache let go of it
+    if (mtime != 0) {
+        if (row >= 0 && m_photos[row].mtime == 0) {
+            m_photos[row].mtime = mtime;
+        }
+        const qsizetype allIndex = m_allIndex.value(filePath, -1);
+        if (allIndex >= 0 && m_allPhotos[allIndex].mtime == 0) {
+            m_allPhotos[allIndex].mtime = mtime;
+        }
+    }
+
+    if (row >= 0) {
+        QModelIndex idx = createIndex(row, 0);
+        emit dataChanged(idx, idx, {Qt::DecorationRole});
+    }
+}
+
+void PhotoModel::setVisibleRange(int first, int last)
+{
+    m_scheduler->setVisibleRange(first, last);
+}
+
+ThumbnailScheduler::Metrics PhotoModel::thumbnailMetrics() const
+{
+    return m_scheduler->metrics();
 }
 
 // Static function that runs in worker thread
@@ -530,9 +328,22 @@ QPixmap PhotoModel::loadThumbnailFromDevice(iDescriptorDevice *device,
                                             const QString &filePath,
                                             const QSize &size)
 {
+    AfcClientLease lease = ServiceManager::acquireAfcClient(device);
+
+    // Most photos carry a preview near their start, a few KB instead of
+    // the whole file
+    if (EmbeddedThumbnailReader::supports(filePath)) {
+        EmbeddedThumbnailReader embedded(device, filePath, lease.altAfc());
+        const QImage preview = embedded.read(size);
+        if (!preview.isNull()) {
+            return QPixmap::fromImage(preview);
+        }
+    }
+
     // Load from device using ServiceManager
     QByteArray imageData = ServiceManager::safeReadAfcFileToByteArray(
-        device, filePath.toUtf8().constData());
+        device, filePath.toUtf8().constData(), lease.altAfc());
+    lease.release();
 
     if (imageData.isEmpty()) {
         qDebug() << "Could not read from device:" << filePath;
@@ -541,10 +352,7 @@ QPixmap PhotoModel::loadThumbnailFromDevice(iDescriptorDevice *device,
 
     if (filePath.endsWith(".HEIC", Qt::CaseInsensitive)) {
         qDebug() << "Loading HEIC image from data for:" << filePath;
-        QPixmap img = load_heic(imageData);
-        return img.isNull() ? QPixmap()
-                            : img.scaled(size, Qt::KeepAspectRatio,
-                                         Qt::SmoothTransformation);
+        return load_heic(imageData, size);
     }
 
     // Use QImageReader for efficient, low-memory scaled loading
@@ -556,6 +364,8 @@ QPixmap PhotoModel::loadThumbnailFromDevice(iDescriptorDevice *device,
         // This is the key optimization: it decodes a smaller image directly,
         // saving a massive amount of memory.
         reader.setScaledSize(size);
+        // Upright like the embedded previews
+        reader.setAutoTransform(true);
         QImage image = reader.read();
         if (!image.isNull()) {
             return QPixmap::fromImage(image);
@@ -575,43 +385,45 @@ QPixmap PhotoModel::loadThumbnailFromDevice(iDescriptorDevice *device,
     return {};
 }
 
-QPixmap PhotoModel::loadImage(iDescriptorDevice *device,
-                              const QString &filePath)
+QPixmap PhotoModel::cachedThumbnail(const QModelIndex &index) const
 {
-    QByteArray imageData = ServiceManager::safeReadAfcFileToByteArray(
-        device, filePath.toUtf8().constData());
-
-    if (imageData.isEmpty()) {
-        qDebug() << "Could not read from device:" << filePath;
-        return QPixmap(); // Return empty pixmap on error
+    if (!index.isValid() || index.row() >= m_photos.size()) {
+        return QPixmap();
     }
+    const PhotoInfo &info = m_photos.at(index.row());
 
-    if (filePath.endsWith(".HEIC")) {
-        qDebug() << "Loading HEIC image from data for:" << filePath;
-        QPixmap img = load_heic(imageData);
-        return img.isNull() ? QPixmap() : img;
+    if (QPixmap *cached = m_thumbnailCache.object(info.filePath)) {
+        return *cached;
     }
-
-    QPixmap original;
-    if (!original.loadFromData(imageData)) {
-        qDebug() << "Could not decode image data for:" << filePath;
-        return QPixmap();
+    if (m_diskCache && info.mtime != 0) {
+        const QImage stored =
+            m_diskCache->lookup(info.filePath, m_thumbnailSize, info.mtime);
+        if (!stored.isNull()) {
+            return QPixmap::fromImage(stored);
+        }
     }
-
-    return original;
+    return QPixmap();
 }
 
 void PhotoModel::populatePhotoPaths()
 {
-    // TODO:beginResetModel called on PhotoModel(0x600002d12a40) without calling
-    // endResetModel first
+    // A new listing replaces whatever the previous one is still resolving
+    stopDateResolver();
+    m_generation++;
+
+    beginResetModel();
+    m_scheduler->dropQueued();
+    m_allPhotos.clear();
+    m_allIndex.clear();
+    m_photos.clear();
+    m_exposedCount = 0;
+    endResetModel();
+
     if (m_albumPath.isEmpty()) {
         qDebug() << "No album path set, skipping population";
         return;
     }
 
-    m_allPhotos.clear();
-
     QByteArray albumPathBytes = m_albumPath.toUtf8();
     const char *albumPathCStr = albumPathBytes.constData();
 
@@ -658,7 +470,22 @@ void PhotoModel::populatePhotoPaths()
                 info.fileName = fileName;
                 info.thumbnailRequested = false;
                 info.fileType = determineFileType(fileName);
-                info.dateTime = extractDateTimeFromFile(info.filePath);
+                // The library index knows most files, the rest are stat'ed
+                // in the background, see resolveDates()
+                const int asset = m_libraryIndex
+                                      ? m_libraryIndex->find(info.filePath)
+                                      : -1;
+                if (asset >= 0) {
+                    // The catalogue knows the kind, not just the suffix
+                    info.fileType = m_libraryIndex->mediaType(asset) ==
+                                            PhotoLibraryIndex::MediaType::Video
+                                        ? PhotoInfo::Video
+                                        : PhotoInfo::Image;
+                    info.dateTime = m_libraryIndex->dateCreated(asset);
+                    info.dimensions = m_libraryIndex->dimensions(asset);
+                    info.duration = m_libraryIndex->duration(asset);
+                    info.dateResolved = true;
+                }
 
                 m_allPhotos.append(info);
             }
@@ -666,11 +493,262 @@ void PhotoModel::populatePhotoPaths()
         afc_dictionary_free(files);
     }
 
-    // Apply initial filtering and sorting, which will also reset the model
-    applyFilterAndSort();
+    /*
+        Rows show up before any date is known. Undated rows sort by name,
+        which follows capture order in DCIM, and are resolved top down so
+        what is on screen settles first.
+    */
+    sortPhotos(m_allPhotos);
+    m_allIndex.reserve(m_allPhotos.size());
+    for (qsizetype i = 0; i < m_allPhotos.size(); ++i) {
+        m_allIndex.insert(m_allPhotos.at(i).filePath, i);
+    }
+
+    qDebug() << "Listed" << m_allPhotos.size() << "media files in"
+             << m_albumPath << (m_libraryIndex ? "with" : "without")
+             << "the library index";
+    insertNextBatch(m_generation);
+    resolveDates();
+}
+
+void PhotoModel::insertNextBatch(int generation)
+{
+    if (generation != m_generation || m_exposedCount >= m_allPhotos.size())
+        return;
 
-    qDebug() << "Loaded" << m_allPhotos.size() << "media files from device";
-    qDebug() << "After filtering:" << m_photos.size() << "items shown";
+    const qsizetype end =
+        qMin<qsizetype>(m_exposedCount + INSERT_BATCH, m_allPhotos.size());
+    QList<PhotoInfo> batch;
+    QHash<QString, ResolvedDate> resolved;
+    for (qsizetype i = m_exposedCount; i < end; ++i) {
+        const PhotoInfo &info = m_allPhotos.at(i);
+        if (!matchesFilter(info))
+            continue;
+        batch.append(info);
+        if (info.dateResolved) {
+            resolved.insert(info.filePath, {info.dateTime, info.mtime,
+                                            info.dimensions, info.duration});
+        }
+    }
+    m_exposedCount = end;
+
+    if (!batch.isEmpty()) {
+        // m_allPhotos was sorted when listed, so appending keeps the order
+        const qsizetype first = m_photos.size();
+        beginInsertRows(QModelIndex(), first, first + batch.size() - 1);
+        m_photos.append(batch);
+        endInsertRows();
+
+        // Unless dates arrived for these rows before they were shown
+        auto inOrder = [this](const PhotoInfo &a, const PhotoInfo &b) {
+            return lessThan(a, b);
+        };
+        if (!resolved.isEmpty() &&
+            !std::is_sorted(m_photos.begin() + qMax<qsizetype>(0, first - 1),
+                            m_photos.end(), inOrder)) {
+            resortRows(resolved);
+        }
+    }
+
+    if (m_exposedCount < m_allPhotos.size()) {
+        // Let the view lay out and paint this batch first
+        QTimer::singleShot(0, this, [this, generation]() {
+            insertNextBatch(generation);
+        });
+    } else {
+        qDebug() << "Showing" << m_photos.size() << "of" << m_allPhotos.size()
+                 << "items";
+    }
+}
+
+void PhotoModel::resolveDates()
+{
+    QStringList paths;
+    for (const PhotoInfo &info : std::as_const(m_allPhotos)) {
+        if (!info.dateResolved) {
+            paths.append(info.filePath);
+        }
+    }
+    if (paths.isEmpty())
+        return;
+
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    m_resolveCancelled = cancelled;
+    /*
+        The worker is never waited for, it may sit in acquireAfcClient or
+        yield() for a while after a cancel. It only reaches the model
+        through a QPointer checked on the GUI thread, which is where the
+        model gets deleted.
+    */
+    m_dateResolver = QtConcurrent::run([model = QPointer<PhotoModel>(this),
+                                        device = m_device, paths,
+                                        generation = m_generation,
+                                        cancelled]() {
+        // Background metadata, thumbnail loads for the screen go first
+        AfcClientLease lease = ServiceManager::acquireAfcClient(
+            device, RESOLVE_ACQUIRE_TIMEOUT_MS, IoPriority::Bulk);
+
+        auto post = [model, generation](QHash<QString, ResolvedDate> batch) {
+            QMetaObject::invokeMethod(
+                qApp,
+                [model, generation, batch = std::move(batch)]() {
+                    if (model) {
+                        model->applyResolvedDates(generation, batch);
+                    }
+                },
+                Qt::QueuedConnection);
+        };
+
+        QHash<QString, ResolvedDate> batch;
+        qsizetype batchSize = FIRST_RESOLVE_BATCH;
+        for (const QString &path : paths) {
+            if (cancelled->load())
+                return;
+            if (lease && lease.shouldYield()) {
+                lease.yield(RESOLVE_ACQUIRE_TIMEOUT_MS);
+                if (cancelled->load())
+                    return;
+            }
+
+            ResolvedDate resolved;
+            resolved.dateTime = extractDateTimeFromFile(
+                device, path, resolved.mtime, lease.altAfc());
+            batch.insert(path, resolved);
+            if (batch.size() >= batchSize) {
+                post(std::move(batch));
+                batch.clear();
+                batchSize = RESOLVE_BATCH;
+            }
+        }
+        if (!batch.isEmpty()) {
+            post(std::move(batch));
+        }
+    });
+}
+
+void PhotoModel::stopDateResolver()
+{
+    // Not joined, stale batches are dropped by their generation
+    if (m_resolveCancelled) {
+        m_resolveCancelled->store(true);
+    }
+}
+
+void PhotoModel::applyResolvedDates(int generation,
+                                    const QHash<QString, ResolvedDate> &dates)
+{
+    if (generation != m_generation)
+        return;
+
+    // First answer wins, so a row's mtime (the disk cache key) stays put
+    QHash<QString, ResolvedDate> applied;
+    for (auto it = dates.constBegin(); it != dates.constEnd(); ++it) {
+        const qsizetype index = m_allIndex.value(it.key(), -1);
+        if (index < 0 || m_allPhotos.at(index).dateResolved)
+            continue;
+        PhotoInfo &info = m_allPhotos[index];
+        info.dateTime = it->dateTime;
+        info.mtime = it->mtime;
+        info.dimensions = it->dimensions;
+        info.duration = it->duration;
+        info.dateResolved = true;
+        applied.insert(it.key(), it.value());
+    }
+    if (!applied.isEmpty()) {
+        resortRows(applied);
+    }
+}
+
+void PhotoModel::setLibraryIndex(
+    std::shared_ptr<const PhotoLibraryIndex> index)
+{
+    m_libraryIndex = std::move(index);
+    if (!m_libraryIndex)
+        return;
+
+    QHash<QString, ResolvedDate> dates;
+    for (const PhotoInfo &info : std::as_const(m_allPhotos)) {
+        const int asset =
+            info.dateResolved ? -1 : m_libraryIndex->find(info.filePath);
+        if (asset < 0)
+            continue;
+        // The mtime keys the disk cache and only comes from a stat
+        dates.insert(info.filePath, {m_libraryIndex->dateCreated(asset), 0,
+                                     m_libraryIndex->dimensions(asset),
+                                     m_libraryIndex->duration(asset)});
+    }
+    if (!dates.isEmpty()) {
+        qDebug() << "Library index resolved" << dates.size()
+                 << "pending dates";
+        applyResolvedDates(m_generation, dates);
+        // Stat only what the index doesn't know
+        stopDateResolver();
+        resolveDates();
+    }
+}
+
+void PhotoModel::resortRows(const QHash<QString, ResolvedDate> &dates)
+{
+    emit layoutAboutToBeChanged({}, QAbstractItemModel::VerticalSortHint);
+
+    // Selection and current item follow their photos
+    const QModelIndexList oldPersistent = persistentIndexList();
+    QStringList persistentPaths;
+    persistentPaths.reserve(oldPersistent.size());
+    for (const QModelIndex &index : oldPersistent) {
+        persistentPaths.append(m_photos.at(index.row()).filePath);
+    }
+    const QSet<QString> persistentSet(persistentPaths.begin(),
+                                      persistentPaths.end());
+
+    // The untouched rows stay sorted, merge the updated ones back in
+    QList<PhotoInfo> kept;
+    QList<PhotoInfo> moved;
+    kept.reserve(m_photos.size());
+    for (PhotoInfo &info : m_photos) {
+        auto it = dates.constFind(info.filePath);
+        if (it == dates.constEnd()) {
+            kept.append(std::move(info));
+            continue;
+        }
+        info.dateTime = it->dateTime;
+        info.mtime = it->mtime;
+        info.dimensions = it->dimensions;
+        info.duration = it->duration;
+        info.dateResolved = true;
+        moved.append(std::move(info));
+    }
+    sortPhotos(moved);
+    m_photos.clear();
+    m_photos.reserve(kept.size() + moved.size());
+    std::merge(std::make_move_iterator(kept.begin()),
+               std::make_move_iterator(kept.end()),
+               std::make_move_iterator(moved.begin()),
+               std::make_move_iterator(moved.end()),
+               std::back_inserter(m_photos),
+               [this](const PhotoInfo &a, const PhotoInfo &b) {
+                   return lessThan(a, b);
+               });
+
+    if (!oldPersistent.isEmpty()) {
+        QHash<QString, int> rows;
+        for (int i = 0; i < m_photos.size(); ++i) {
+            if (persistentSet.contains(m_photos.at(i).filePath)) {
+                rows.insert(m_photos.at(i).filePath, i);
+            }
+        }
+        QModelIndexList newPersistent;
+        newPersistent.reserve(persistentPaths.size());
+        for (const QString &path : std::as_const(persistentPaths)) {
+            newPersistent.append(createIndex(rows.value(path), 0));
+        }
+        changePersistentIndexList(oldPersistent, newPersistent);
+    }
+
+    emit layoutChanged({}, QAbstractItemModel::VerticalSortHint);
+
+    // Queued rows point into the old order, the view asks again on repaint
+    m_scheduler->dropQueued();
 }
 
 // Sorting and filtering methods
@@ -694,6 +772,9 @@ void PhotoModel::applyFilterAndSort()
 {
     beginResetModel();
 
+    // Queued rows point into the old order
+    m_scheduler->dropQueued();
+
     // int i = 0;
     // Filter photos
     m_photos.clear();
@@ -709,6 +790,8 @@ void PhotoModel::applyFilterAndSort()
 
     // Sort photos
     sortPhotos(m_photos);
+    // Everything is shown now, a pending batch insert stops
+    m_exposedCount = m_allPhotos.size();
 
     endResetModel();
 
@@ -716,15 +799,31 @@ void PhotoModel::applyFilterAndSort()
              << m_allPhotos.size() << "items";
 }
 
+bool PhotoModel::lessThan(const PhotoInfo &a, const PhotoInfo &b) const
+{
+    // Rows without a date yet go last either way, by name among themselves
+    if (a.dateTime.isValid() != b.dateTime.isValid()) {
+        return a.dateTime.isValid();
+    }
+    if (a.dateTime != b.dateTime) {
+        if (m_sortOrder == NewestFirst) {
+            return a.dateTime > b.dateTime;
+        } else {
+            return a.dateTime < b.dateTime;
+        }
+    }
+    if (m_sortOrder == NewestFirst) {
+        return a.fileName > b.fileName;
+    } else {
+        return a.fileName < b.fileName;
+    }
+}
+
 void PhotoModel::sortPhotos(QList<PhotoInfo> &photos) const
 {
     std::sort(photos.begin(), photos.end(),
               [this](const PhotoInfo &a, const PhotoInfo &b) {
-                  if (m_sortOrder == NewestFirst) {
-                      return a.dateTime > b.dateTime;
-                  } else {
-                      return a.dateTime < b.dateTime;
-                  }
+                  return lessThan(a, b);
               });
 }
 
@@ -790,49 +889,27 @@ QStringList PhotoModel::getFilteredFilePaths() const
 }
 
 // Helper methods
-QDateTime PhotoModel::extractDateTimeFromFile(const QString &filePath) const
-{
-    plist_t info = nullptr;
-    afc_error_t afc_err = ServiceManager::safeAfcGetFileInfoPlist(
-        m_device, filePath.toUtf8().constData(), &info);
-
-    if (afc_err == AFC_E_SUCCESS && info) {
-        plist_t birthtime_node = plist_dict_get_item(info, "st_birthtime");
-        if (birthtime_node &&
-            plist_get_node_type(birthtime_node) == PLIST_UINT) {
-            uint64_t birthtime_ns = 0;
-            plist_get_uint_val(birthtime_node, &birthtime_ns);
-
-            // Convert nanoseconds since epoch to QDateTime
-            // The timestamp appears to be in nanoseconds since Unix epoch
-            uint64_t seconds = birthtime_ns / 1000000000ULL;
-            QDateTime dateTime =
-                QDateTime::fromSecsSinceEpoch(seconds, Qt::UTC);
-
-            plist_free(info);
-            if (dateTime.isValid()) {
-                return dateTime;
-            }
-        }
-
-        // Fallback to st_mtime (modification time) if birthtime not available
-        plist_t mtime_node = plist_dict_get_item(info, "st_mtime");
-        if (mtime_node && plist_get_node_type(mtime_node) == PLIST_UINT) {
-            uint64_t mtime_ns = 0;
-            plist_get_uint_val(mtime_node, &mtime_ns);
-
-            // Convert nanoseconds since epoch to QDateTime
-            uint64_t seconds = mtime_ns / 1000000000ULL;
+QDateTime
+PhotoModel::extractDateTimeFromFile(iDescriptorDevice *device,
+                                    const QString &filePath, quint64 &mtime,
+                                    std::optional<afc_client_t> altAfc)
+{
+    mtime = 0;
+    MediaEntry entry;
+    if (ServiceManager::cachedStat(device, filePath.toUtf8().constData(),
+                                   entry, altAfc) == AFC_E_SUCCESS) {
+        mtime = entry.mtime;
+        // Timestamps are nanoseconds since the Unix epoch, prefer the
+        // creation time and fall back to st_mtime (modification time)
+        for (uint64_t timeNs : {entry.birthtime, entry.mtime}) {
+            if (timeNs == 0)
+                continue;
             QDateTime dateTime =
-                QDateTime::fromSecsSinceEpoch(seconds, Qt::UTC);
-
-            plist_free(info);
+                QDateTime::fromSecsSinceEpoch(timeNs / 1000000000ULL, Qt::UTC);
             if (dateTime.isValid()) {
                 return dateTime;
             }
         }
-
-        plist_free(info);
     }
 
     // Final fallback: try to extract date from filename pattern like
@@ -21,20 +21,38 @@
 #define PHOTOMODEL_H
 
 #include "iDescriptor.h"
+#include "photolibraryindex.h"
+#include "thumbnaildiskcache.h"
+#include "thumbnailscheduler.h"
 #include <QAbstractListModel>
 #include <QCache>
 #include <QCryptographicHash>
 #include <QDateTime>
-#include <QFutureWatcher>
+#include <QFuture>
 #include <QPixmap>
 #include <QSemaphore>
 #include <QSize>
 #include <QStandardPaths>
+#include <atomic>
+#include <memory>
+#include <optional>
 
 struct PhotoInfo {
     QString filePath;
     QString fileName;
     QDateTime dateTime;
+    /*
+        st_mtime in nanoseconds, 0 if unknown; keys the thumbnail disk cache.
+        Only ever taken from a stat, files dated by the library index get it
+        when their thumbnail is loaded.
+    */
+    quint64 mtime = 0;
+    // Set once the date is known, from the library index or a background
+    // stat (see PhotoModel::resolveDates)
+    bool dateResolved = false;
+    // Only known for files in the photo library index
+    QSize dimensions;
+    double duration = 0;
     bool thumbnailRequested = false;
 
     enum FileType { Image, Video };
@@ -79,32 +97,68 @@ public:
     QStringList getAllFilePaths() const;
     QStringList getFilteredFilePaths() const;
 
-    static QPixmap loadImage(iDescriptorDevice *device,
-                             const QString &filePath);
+    // Thumbnail already in memory or on disk, null if there is none yet
+    QPixmap cachedThumbnail(const QModelIndex &index) const;
     // Static helper methods
     static QPixmap loadThumbnailFromDevice(iDescriptorDevice *device,
                                            const QString &filePath,
                                            const QSize &size);
     void clear();
+
+    // Rows on screen, thumbnail loads outside them and a margin are dropped
+    void setVisibleRange(int first, int last);
+    ThumbnailScheduler::Metrics thumbnailMetrics() const;
+
+    /*
+        Files the index knows get their dates from it instead of a stat;
+        rows still waiting for theirs are filled in right away and the
+        background stats go on for the rest only
+    */
+    void setLibraryIndex(std::shared_ptr<const PhotoLibraryIndex> index);
 signals:
     void thumbnailNeedsToBeLoaded(int index);
     void exportRequested(const QStringList &filePaths);
 
 private slots:
     void requestThumbnail(int index);
+    void onThumbnailReady(const QString &filePath, int row,
+                          const QPixmap &thumbnail, quint64 mtime);
 
 private:
+    // Rows inserted per event loop turn while an album is listed
+    static constexpr int INSERT_BATCH = 500;
+    // Dates posted back per batch, the first one small so the top settles
+    static constexpr int FIRST_RESOLVE_BATCH = 32;
+    static constexpr int RESOLVE_BATCH = 128;
+    static constexpr int RESOLVE_ACQUIRE_TIMEOUT_MS = 2000;
+
+    struct ResolvedDate {
+        QDateTime dateTime;
+        quint64 mtime = 0;
+        QSize dimensions;
+        double duration = 0;
+    };
+
     // Data members
     iDescriptorDevice *m_device;
     QString m_albumPath;
     QList<PhotoInfo> m_allPhotos; // All photos from device
     QList<PhotoInfo> m_photos;    // Currently filtered/sorted photos
+    QHash<QString, qsizetype> m_allIndex; // filePath -> m_allPhotos index
+    // Leading part of m_allPhotos already offered to m_photos
+    qsizetype m_exposedCount = 0;
+    // Bumped per listing, stale batches and dates are ignored
+    int m_generation = 0;
+    QFuture<void> m_dateResolver;
+    std::shared_ptr<std::atomic<bool>> m_resolveCancelled;
 
     // Thumbnail management
     QSize m_thumbnailSize;
     mutable QCache<QString, QPixmap> m_thumbnailCache;
-    mutable QHash<QString, QFutureWatcher<QPixmap> *> m_activeLoaders;
-    mutable QSet<QString> m_loadingPaths;
+    ThumbnailScheduler *m_scheduler;
+    // Shared with the other models of this device, may be null
+    std::shared_ptr<ThumbnailDiskCache> m_diskCache;
+    std::shared_ptr<const PhotoLibraryIndex> m_libraryIndex;
 
     // Sorting and filtering
     SortOrder m_sortOrder;
@@ -112,12 +166,30 @@ private:
 
     // Helper methods
     void populatePhotoPaths();
+    void insertNextBatch(int generation);
+    void resolveDates();
+    void stopDateResolver();
+    void applyResolvedDates(int generation,
+                            const QHash<QString, ResolvedDate> &dates);
+    // Moves the rows whose dates changed, without resetting the model
+    void resortRows(const QHash<QString, ResolvedDate> &dates);
+    bool lessThan(const PhotoInfo &a, const PhotoInfo &b) const;
     void applyFilterAndSort();
     void sortPhotos(QList<PhotoInfo> &photos) const;
     bool matchesFilter(const PhotoInfo &info) const;
 
-    QDateTime extractDateTimeFromFile(const QString &filePath) const;
+    // Runs on the date resolver's thread
+    static QDateTime
+    extractDateTimeFromFile(iDescriptorDevice *device, const QString &filePath,
+                            quint64 &mtime,
+                            std::optional<afc_client_t> altAfc = std::nullopt);
     PhotoInfo::FileType determineFileType(const QString &fileName) const;
+    /*
+        Runs in thumbnail jobs: the disk cached thumbnail of info, stat'ing
+        the file first when its mtime isn't known yet (info.mtime is set)
+    */
+    QPixmap storedThumbnail(ThumbnailDiskCache *diskCache,
+                            PhotoInfo &info) const;
 
     static QPixmap generateVideoThumbnailFFmpeg(iDescriptorDevice *device,
                                                 const QString &filePath,
@@ -0,0 +1,217 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "previewcache.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QMutexLocker>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+namespace
+{
+/*
+    Prefetches of all devices run one at a time. The pool isn't owned by a
+    cache, whose last reference may be dropped by one of its jobs.
+*/
+QThreadPool *prefetchPool()
+{
+    static QThreadPool *pool = [] {
+        auto *pool = new QThreadPool();
+        pool->setMaxThreadCount(1);
+        return pool;
+    }();
+    return pool;
+}
+} // namespace
+
+std::shared_ptr<PreviewCache>
+PreviewCache::forDevice(iDescriptorDevice *device)
+{
+    static QMutex registryMutex;
+    static QHash<iDescriptorDevice *, std::weak_ptr<PreviewCache>> registry;
+
+    QMutexLocker locker(&registryMutex);
+    if (std::shared_ptr<PreviewCache> cache = registry.value(device).lock())
+        return cache;
+
+    std::shared_ptr<PreviewCache> cache(new PreviewCache(device));
+    cache->m_self = cache;
+    registry.insert(device, cache);
+    return cache;
+}
+
+PreviewCache::PreviewCache(iDescriptorDevice *device) : m_device(device) {}
+
+PreviewCache::Preview PreviewCache::loadPreview(iDescriptorDevice *device,
+                                                const QString &path,
+                                                const QSize &screenSize,
+                                                IoPriority priority)
+{
+    AfcClientLease lease =
+        ServiceManager::acquireAfcClient(device, -1, priority);
+    const QByteArray data = ServiceManager::safeReadAfcFileToByteArray(
+        device, path.toUtf8().constData(), lease.altAfc());
+    lease.release();
+    if (data.isEmpty()) {
+        qDebug() << "Could not read from device:" << path;
+        return Preview();
+    }
+
+    Preview preview;
+    preview.source = TiledImageSource::create(data, path);
+    if (preview.source) {
+        preview.screenImage = preview.source->decodeScaled(screenSize);
+    }
+    return preview;
+}
+
+std::optional<PreviewCache::Preview> PreviewCache::cached(const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(path);
+    if (it == m_entries.end()) {
+        return std::nullopt;
+    }
+    it->lastUsed = ++m_clock;
+    return it->preview;
+}
+
+QFuture<PreviewCache::Preview> PreviewCache::load(const QString &path,
+                                                  const QSize &screenSize)
+{
+    // Held until the job is registered, so it can't finish before that
+    QMutexLocker locker(&m_mutex);
+    m_foreground.insert(path);
+    m_wanted.insert(path);
+    // A queued prefetch would wait behind the others and then for a Bulk
+    // connection, so it is only joined once it runs
+    auto running = m_loading.constFind(path);
+    if (running != m_loading.cend() && !m_queued.remove(path)) {
+        return *running;
+    }
+
+    QFuture<Preview> future = QtConcurrent::run(
+        [weak = m_self, device = m_device, path, screenSize]() {
+            const Preview preview = loadPreview(device, path, screenSize,
+                                                IoPriority::Interactive);
+            if (std::shared_ptr<PreviewCache> self = weak.lock()) {
+                self->finish(path, preview);
+            }
+            return preview;
+        });
+    m_loading.insert(path, future);
+    return future;
+}
+
+void PreviewCache::prefetch(const QStringList &paths, const QSize &screenSize)
+{
+    QMutexLocker locker(&m_mutex);
+    m_wanted = QSet<QString>(paths.cbegin(), paths.cend()) | m_foreground;
+
+    for (const QString &path : paths) {
+        auto entry = m_entries.find(path);
+        if (entry != m_entries.end()) {
+            // Neighbours stay ahead of what was viewed before
+            entry->lastUsed = ++m_clock;
+            continue;
+        }
+        if (m_loading.contains(path)) {
+            continue;
+        }
+
+        QFuture<Preview> future = QtConcurrent::run(
+            prefetchPool(),
+            [weak = m_self, device = m_device, path, screenSize]() {
+                if (std::shared_ptr<PreviewCache> self = weak.lock()) {
+                    QMutexLocker locker(&self->m_mutex);
+                    // Taken over by a foreground load()
+                    if (!self->m_queued.remove(path)) {
+                        return Preview();
+                    }
+                    // Stepped past before its turn came
+                    if (!self->m_wanted.contains(path)) {
+                        self->m_loading.remove(path);
+                        return Preview();
+                    }
+                } else {
+                    return Preview();
+                }
+
+                const Preview preview =
+                    loadPreview(device, path, screenSize, IoPriority::Bulk);
+                if (std::shared_ptr<PreviewCache> self = weak.lock()) {
+                    self->finish(path, preview);
+                }
+                return preview;
+            });
+        m_loading.insert(path, future);
+        m_queued.insert(path);
+    }
+}
+
+qint64 PreviewCache::bytes() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bytes;
+}
+
+void PreviewCache::finish(const QString &path, const Preview &preview)
+{
+    QMutexLocker locker(&m_mutex);
+    m_loading.remove(path);
+    m_foreground.remove(path);
+    if (preview.isNull()) {
+        return;
+    }
+
+    Entry entry;
+    entry.preview = preview;
+    entry.bytes = preview.source->residentBytes() +
+                  preview.screenImage.sizeInBytes();
+    entry.lastUsed = ++m_clock;
+    auto old = m_entries.constFind(path);
+    if (old != m_entries.cend()) {
+        m_bytes -= old->bytes;
+    }
+    m_entries.insert(path, entry);
+    m_bytes += entry.bytes;
+    evict();
+}
+
+// Expects m_mutex to be held
+void PreviewCache::evict()
+{
+    while (m_bytes > MAX_BYTES && m_entries.size() > 1) {
+        // Previews nobody wants any more go first, oldest first
+        auto victim = m_entries.end();
+        bool victimWanted = true;
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            const bool wanted = m_wanted.contains(it.key());
+            if (victim == m_entries.end() || (victimWanted && !wanted) ||
+                (wanted == victimWanted &&
+                 it->lastUsed < victim->lastUsed)) {
+                victim = it;
+                victimWanted = wanted;
+            }
+        }
+        m_bytes -= victim->bytes;
+        m_entries.erase(victim);
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include "afcclientpool.h"
+#include "iDescriptor.h"
+#include "tiledimagesource.h"
+#include <QFuture>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <memory>
+#include <optional>
+
+/**
+ * @brief Decoded photos for MediaPreviewDialog, with its neighbours loaded
+ * ahead
+ *
+ * A preview is the photo's TiledImageSource plus its decode at screen
+ * size, which is all the dialog needs to show it. Previews are shared by
+ * path, kept least recently used within MAX_BYTES, and a load that is
+ * already running is joined instead of started again. A prefetch still
+ * waiting for its turn is not joined, the foreground load takes it over.
+ *
+ * prefetch() loads the photos around the one on screen in the background,
+ * one at a time on Bulk priority AFC connections, so stepping to the next
+ * photo finds it decoded. Prefetches that are no longer wanted by the time
+ * they'd start are skipped.
+ *
+ * All dialogs of a device share one instance, see forDevice().
+ */
+class PreviewCache
+{
+public:
+    struct Preview {
+        std::shared_ptr<TiledImageSource> source;
+        QImage screenImage;
+
+        bool isNull() const { return !source || screenImage.isNull(); }
+    };
+
+    static constexpr qint64 MAX_BYTES = 384LL * 1024 * 1024;
+
+    static std::shared_ptr<PreviewCache> forDevice(iDescriptorDevice *device);
+
+    PreviewCache(const PreviewCache &) = delete;
+    PreviewCache &operator=(const PreviewCache &) = delete;
+
+    std::optional<Preview> cached(const QString &path);
+    // Loads on an Interactive connection, a null preview on failure
+    QFuture<Preview> load(const QString &path, const QSize &screenSize);
+    // Nearest first, replaces the previous list
+    void prefetch(const QStringList &paths, const QSize &screenSize);
+
+    qint64 bytes() const;
+
+private:
+    struct Entry {
+        Preview preview;
+        qint64 bytes = 0;
+        // Larger is more recently used
+        quint64 lastUsed = 0;
+    };
+
+    explicit PreviewCache(iDescriptorDevice *device);
+
+    static Preview loadPreview(iDescriptorDevice *device, const QString &path,
+                               const QSize &screenSize, IoPriority priority);
+    // Called by the load jobs
+    void finish(const QString &path, const Preview &preview);
+    void evict();
+
+    iDescriptorDevice *m_device;
+    // Jobs hold this rather than the cache, they may outlive the dialogs
+    std::weak_ptr<PreviewCache> m_self;
+
+    mutable QMutex m_mutex;
+    QHash<QString, Entry> m_entries;
+    QHash<QString, QFuture<Preview>> m_loading;
+    // Prefetches in m_loading that did not start yet
+    QSet<QString> m_queued;
+    // Wanted by the last prefetch() or by a foreground load
+    QSet<QString> m_wanted;
+    QSet<QString> m_foreground;
+    qint64 m_bytes = 0;
+    quint64 m_clock = 0;
+};
+
+#endif // PREVIEWCACHE_H
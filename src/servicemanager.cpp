@@ -18,6 +18,35 @@
  */
 
 #include "servicemanager.h"
+#include "afcdirectorylister.h"
+#include "afcfilereader.h"
+#include "afcmetadatacache.h"
+#include "afctransfertuner.h"
+#include <chrono>
+
+AfcClientLease ServiceManager::acquireAfcClient(iDescriptorDevice *device,
+                                                int timeoutMs,
+                                                IoPriority priority)
+{
+    if (!device || !device->afcPool) {
+        return AfcClientLease();
+    }
+    return device->afcPool->acquire(timeoutMs, priority);
+}
+
+AfcClientLease ServiceManager::acquireAfcClient(iDescriptorDevice *device,
+                                                const std::atomic<bool> &cancel,
+                                                IoPriority priority)
+{
+    while (!cancel.load()) {
+        AfcClientLease lease =
+            acquireAfcClient(device, CANCEL_POLL_MS, priority);
+        if (lease || !device || !device->afcPool) {
+            return lease;
+        }
+    }
+    return AfcClientLease();
+}
 
 afc_error_t
 ServiceManager::safeAfcReadDirectory(iDescriptorDevice *device,
@@ -64,12 +93,22 @@ afc_error_t ServiceManager::safeAfcFileOpen(iDescriptorDevice *device,
                                             uint64_t *handle,
                                             std::optional<afc_client_t> altAfc)
 {
-    return executeAfcOperation(
+    if (mode != AFC_FOPEN_RDONLY) {
+        invalidateAfcMetadata(device, path, altAfc);
+    }
+    const afc_error_t result = executeAfcOperation(
         device,
         [path, mode, handle](afc_client_t client) {
             return afc_file_open(client, path, mode, handle);
         },
         altAfc);
+    if (mode != AFC_FOPEN_RDONLY && result == AFC_E_SUCCESS) {
+        if (AfcMetadataCache *cache = metadataCacheFor(device, altAfc)) {
+            cache->beginWrite(altAfc.value_or(device->afcClient), *handle,
+                              path);
+        }
+    }
+    return result;
 }
 
 afc_error_t ServiceManager::safeAfcFileRead(iDescriptorDevice *device,
@@ -104,12 +143,17 @@ afc_error_t ServiceManager::safeAfcFileClose(iDescriptorDevice *device,
                                              uint64_t handle,
                                              std::optional<afc_client_t> altAfc)
 {
-    return executeAfcOperation(
+    const afc_error_t result = executeAfcOperation(
         device,
         [handle](afc_client_t client) {
             return afc_file_close(client, handle);
         },
         altAfc);
+    // Stats taken while the file was written are stale now
+    if (AfcMetadataCache *cache = metadataCacheFor(device, altAfc)) {
+        cache->endWrite(altAfc.value_or(device->afcClient), handle);
+    }
+    return result;
 }
 
 afc_error_t ServiceManager::safeAfcFileSeek(iDescriptorDevice *device,
@@ -137,17 +181,27 @@ afc_error_t ServiceManager::safeAfcFileTell(iDescriptorDevice *device,
         altAfc);
 }
 
+afc_error_t
+ServiceManager::safeAfcRemovePath(iDescriptorDevice *device, const char *path,
+                                  std::optional<afc_client_t> altAfc)
+{
+    invalidateAfcMetadata(device, path, altAfc);
+    return executeAfcOperation(
+        device,
+        [path](afc_client_t client) { return afc_remove_path(client, path); },
+        altAfc);
+}
+
 QByteArray
 ServiceManager::safeReadAfcFileToByteArray(iDescriptorDevice *device,
                                            const char *path,
                                            std::optional<afc_client_t> altAfc)
 {
-    return executeOperation<QByteArray>(
-        device,
-        [path](afc_client_t client) -> QByteArray {
-            return read_afc_file_to_byte_array(client, path);
-        },
-        altAfc);
+    AfcFileReader reader(device, QString::fromUtf8(path), altAfc);
+    if (reader.open() != AFC_E_SUCCESS) {
+        return QByteArray();
+    }
+    return reader.readAll();
 }
 
 AFCFileTree ServiceManager::safeGetFileTree(iDescriptorDevice *device,
@@ -160,4 +214,128 @@ AFCFileTree ServiceManager::safeGetFileTree(iDescriptorDevice *device,
             return get_file_tree(client, path.c_str());
         },
         altAfc);
-}
\ No newline at end of file
+}
+
+AfcMetadataCache *
+ServiceManager::metadataCacheFor(iDescriptorDevice *device,
+                                 const std::optional<afc_client_t> &altAfc)
+{
+    if (!device || !device->afcMetadataCache) {
+        return nullptr;
+    }
+    if (altAfc && *altAfc != device->afcClient &&
+        !isPooledClient(device, altAfc)) {
+        return nullptr;
+    }
+    return device->afcMetadataCache.get();
+}
+
+afc_error_t ServiceManager::cachedStat(iDescriptorDevice *device,
+                                       const char *path, MediaEntry &entry,
+                                       std::optional<afc_client_t> altAfc)
+{
+    AfcMetadataCache *cache = metadataCacheFor(device, altAfc);
+    if (cache && cache->lookupStat(path, entry)) {
+        return AFC_E_SUCCESS;
+    }
+
+    char **info = nullptr;
+    const auto start = std::chrono::steady_clock::now();
+    afc_error_t err = safeAfcGetFileInfo(device, path, &info, altAfc);
+    if (device->transferTuner && err == AFC_E_SUCCESS) {
+        device->transferTuner->recordRoundTrip(
+            std::chrono::steady_clock::now() - start);
+    }
+    if (err != AFC_E_SUCCESS || !info) {
+        return err != AFC_E_SUCCESS ? err : AFC_E_UNKNOWN_ERROR;
+    }
+    parse_afc_file_info(info, entry);
+    afc_dictionary_free(info);
+
+    if (cache) {
+        cache->storeStat(path, entry);
+    }
+    return AFC_E_SUCCESS;
+}
+
+void ServiceManager::invalidateAfcMetadata(iDescriptorDevice *device,
+                                           const std::string &path,
+                                           std::optional<afc_client_t> altAfc)
+{
+    if (AfcMetadataCache *cache = metadataCacheFor(device, altAfc)) {
+        cache->invalidate(path);
+    }
+}
+
+std::optional<afc_client_t>
+ServiceManager::Async::clientFor(iDescriptorDevice *device,
+                                 std::optional<afc_client_t> altAfc,
+                                 AfcClientLease &lease)
+{
+    if (altAfc && *altAfc != device->afcClient) {
+        return altAfc;
+    }
+    lease = acquireAfcClient(device, ACQUIRE_TIMEOUT_MS);
+    return lease ? lease.altAfc() : altAfc;
+}
+
+QFuture<MediaEntry>
+ServiceManager::Async::stat(iDescriptorDevice *device, const QString &path,
+                            std::optional<afc_client_t> altAfc)
+{
+    const QByteArray pathBytes = path.toUtf8();
+    return submit<MediaEntry>(
+        device, [device, pathBytes, altAfc](QPromise<MediaEntry> &promise) {
+            MediaEntry entry;
+            AfcClientLease lease;
+            cachedStat(device, pathBytes.constData(), entry,
+                       clientFor(device, altAfc, lease));
+            promise.addResult(entry);
+        });
+}
+
+QFuture<AFCFileTree>
+ServiceManager::Async::readDirectory(iDescriptorDevice *device,
+                                     const QString &path,
+                                     std::optional<afc_client_t> altAfc)
+{
+    const std::string pathString = path.toStdString();
+    return submit<AFCFileTree>(
+        device, [device, pathString, altAfc](QPromise<AFCFileTree> &promise) {
+            promise.addResult(
+                AfcDirectoryLister::list(device, pathString, altAfc));
+        });
+}
+
+QFuture<QByteArray>
+ServiceManager::Async::readFile(iDescriptorDevice *device, const QString &path,
+                                std::optional<afc_client_t> altAfc)
+{
+    return submit<QByteArray>(device, [device, path, altAfc](
+                                          QPromise<QByteArray> &promise) {
+        AfcFileReader reader(device, path, altAfc);
+        if (reader.open() != AFC_E_SUCCESS || reader.size() == 0) {
+            promise.addResult(QByteArray());
+            return;
+        }
+
+        QByteArray data;
+        data.reserve(static_cast<qsizetype>(reader.size()));
+        promise.setProgressRange(0, 100);
+
+        QByteArray chunk;
+        while (reader.next(chunk)) {
+            if (promise.isCanceled()) {
+                return;
+            }
+            data.append(chunk);
+            promise.setProgressValue(
+                static_cast<int>(data.size() * 100 / reader.size()));
+        }
+        if (reader.error() != AFC_E_SUCCESS) {
+            qDebug() << "AFC Error: Read failed for file" << path;
+            data.clear();
+        }
+        promise.addResult(data);
+    });
+}
@@ -20,8 +20,10 @@
 #ifndef SERVICEMANAGER_H
 #define SERVICEMANAGER_H
 
+#include "afcioqueue.h"
 #include "iDescriptor.h"
 #include <QDebug>
+#include <atomic>
 #include <functional>
 #include <libimobiledevice/afc.h>
 #include <mutex>
@@ -34,10 +36,38 @@
  * crashes when devices are unplugged during active operations. It uses a
  * per-device recursive mutex to ensure that device cleanup waits for all
  * operations to complete.
+ *
+ * Clients checked out of the device's AfcClientPool (see acquireAfcClient)
+ * can be passed as altAfc, operations on them skip the device-wide mutex and
+ * only synchronize with the pool shutting down.
  */
 class ServiceManager
 {
 public:
+    /**
+     * @brief Check out a dedicated AFC connection from the device's pool
+     * @param timeoutMs How long to wait for a free connection, -1 waits
+     * forever
+     * @param priority Scheduling class, see AfcClientPool
+     * @return An invalid lease if the device has no pool or none became
+     * available, use lease.altAfc() to fall back to the shared client
+     */
+    static AfcClientLease
+    acquireAfcClient(iDescriptorDevice *device, int timeoutMs = -1,
+                     IoPriority priority = IoPriority::Interactive);
+    /**
+     * @brief Waits for a connection like acquireAfcClient(device, -1), but
+     * gives up once cancel is set
+     *
+     * The wait is split into CANCEL_POLL_MS attempts with cancel checked in
+     * between. An invalid lease with cancel set means the caller was
+     * cancelled before a connection became free.
+     */
+    static AfcClientLease acquireAfcClient(iDescriptorDevice *device,
+                                           const std::atomic<bool> &cancel,
+                                           IoPriority priority);
+    static constexpr int CANCEL_POLL_MS = 250;
+
     template <typename T>
     static T executeOperation(iDescriptorDevice *device,
                               std::function<T(afc_client_t)> operation,
@@ -47,6 +77,14 @@ public:
             return T{}; // Return default-constructed value for the type
         }
 
+        if (isPooledClient(device, altAfc)) {
+            auto guard = device->afcPool->lockForOperation();
+            if (device->afcPool->isShutdown()) {
+                return T{};
+            }
+            return operation(*altAfc);
+        }
+
         std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
         // Double-check device is still valid after acquiring lock
@@ -74,6 +112,14 @@ public:
             return T{}; // Return default-constructed value for the type
         }
 
+        if (isPooledClient(device, altAfc)) {
+            auto guard = device->afcPool->lockForOperation();
+            if (device->afcPool->isShutdown()) {
+                return T{};
+            }
+            return operation();
+        }
+
         std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
         // Double-check device is still valid after acquiring lock
@@ -98,6 +144,14 @@ public:
             return failureValue;
         }
 
+        if (isPooledClient(device, altAfc)) {
+            auto guard = device->afcPool->lockForOperation();
+            if (device->afcPool->isShutdown()) {
+                return failureValue;
+            }
+            return operation();
+        }
+
         std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
         // Double-check device is still valid after acquiring lock
@@ -122,6 +176,14 @@ public:
             return;
         }
 
+        if (isPooledClient(device, altAfc)) {
+            auto guard = device->afcPool->lockForOperation();
+            if (!device->afcPool->isShutdown()) {
+                operation();
+            }
+            return;
+        }
+
         std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
         // Double-check device is still valid after acquiring lock
@@ -148,6 +210,14 @@ public:
                 return AFC_E_UNKNOWN_ERROR;
             }
 
+            if (isPooledClient(device, altAfc)) {
+                auto guard = device->afcPool->lockForOperation();
+                if (device->afcPool->isShutdown()) {
+                    return AFC_E_UNKNOWN_ERROR;
+                }
+                return operation(*altAfc);
+            }
+
             std::lock_guard<std::recursive_mutex> lock(*device->mutex);
 
             // Double-check device is still valid after acquiring lock
@@ -208,6 +278,9 @@ public:
     safeAfcFileTell(iDescriptorDevice *device, uint64_t handle,
                     uint64_t *position,
                     std::optional<afc_client_t> altAfc = std::nullopt);
+    static afc_error_t
+    safeAfcRemovePath(iDescriptorDevice *device, const char *path,
+                      std::optional<afc_client_t> altAfc = std::nullopt);
 
     // Utility functions
     static QByteArray safeReadAfcFileToByteArray(
@@ -216,6 +289,81 @@ public:
     static AFCFileTree
     safeGetFileTree(iDescriptorDevice *device, const std::string &path = "/",
                     std::optional<afc_client_t> altAfc = std::nullopt);
+
+    /**
+     * @brief Stat a path, answering from the device's metadata cache when
+     * possible
+     *
+     * Only the default AFC namespace is cached, other clients (afc2, house
+     * arrest) always go to the device.
+     */
+    static afc_error_t
+    cachedStat(iDescriptorDevice *device, const char *path, MediaEntry &entry,
+               std::optional<afc_client_t> altAfc = std::nullopt);
+
+    // Forget cached metadata for a path the app just changed on the device
+    static void
+    invalidateAfcMetadata(iDescriptorDevice *device, const std::string &path,
+                          std::optional<afc_client_t> altAfc = std::nullopt);
+
+    // nullptr when altAfc is not in the cached namespace
+    static AfcMetadataCache *
+    metadataCacheFor(iDescriptorDevice *device,
+                     const std::optional<afc_client_t> &altAfc);
+
+    /**
+     * @brief Non-blocking counterparts of the wrappers above
+     *
+     * Jobs run on the device's AfcIoQueue, using a pooled connection when one
+     * frees up in time. Cancelling the returned future drops queued jobs and
+     * stops readFile between chunks. Failures resolve the same way as the
+     * blocking calls (empty QByteArray, MediaEntry without hasStat, tree
+     * without success), a device without an I/O queue yields a cancelled
+     * future.
+     */
+    class Async
+    {
+    public:
+        static QFuture<MediaEntry>
+        stat(iDescriptorDevice *device, const QString &path,
+             std::optional<afc_client_t> altAfc = std::nullopt);
+        static QFuture<AFCFileTree>
+        readDirectory(iDescriptorDevice *device, const QString &path,
+                      std::optional<afc_client_t> altAfc = std::nullopt);
+        static QFuture<QByteArray>
+        readFile(iDescriptorDevice *device, const QString &path,
+                 std::optional<afc_client_t> altAfc = std::nullopt);
+
+    private:
+        static constexpr int ACQUIRE_TIMEOUT_MS = 2000;
+
+        template <typename T>
+        static QFuture<T> submit(iDescriptorDevice *device,
+                                 std::function<void(QPromise<T> &)> job)
+        {
+            if (!device || !device->ioQueue) {
+                QPromise<T> promise;
+                promise.start();
+                promise.future().cancel();
+                promise.finish();
+                return promise.future();
+            }
+            return device->ioQueue->submit<T>(std::move(job));
+        }
+
+        // Checks out a pooled client when altAfc is the default namespace
+        static std::optional<afc_client_t>
+        clientFor(iDescriptorDevice *device,
+                  std::optional<afc_client_t> altAfc, AfcClientLease &lease);
+    };
+
+private:
+    static bool isPooledClient(iDescriptorDevice *device,
+                               const std::optional<afc_client_t> &altAfc)
+    {
+        return altAfc && *altAfc && device->afcPool &&
+               device->afcPool->owns(*altAfc);
+    }
 };
 
 #endif // SERVICEMANAGER_H
@@ -168,6 +168,83 @@ void SettingsManager::setConnectionTimeout(int seconds)
     m_settings->sync();
 }
 
+int SettingsManager::exportLanes() const
+{
+    return m_settings->value("exportLanes", 3).toInt();
+}
+
+void SettingsManager::setExportLanes(int lanes)
+{
+    m_settings->setValue("exportLanes", lanes);
+    m_settings->sync();
+}
+
+bool SettingsManager::syncExports() const
+{
+    return m_settings->value("syncExports", false).toBool();
+}
+
+void SettingsManager::setSyncExports(bool enabled)
+{
+    m_settings->setValue("syncExports", enabled);
+    m_settings->sync();
+}
+
+bool SettingsManager::exportChecksumFile() const
+{
+    return m_settings->value("exportChecksumFile", false).toBool();
+}
+
+void SettingsManager::setExportChecksumFile(bool enabled)
+{
+    m_settings->setValue("exportChecksumFile", enabled);
+    m_settings->sync();
+}
+
+bool SettingsManager::verifyExports() const
+{
+    return m_settings->value("verifyExports", false).toBool();
+}
+
+void SettingsManager::setVerifyExports(bool enabled)
+{
+    m_settings->setValue("verifyExports", enabled);
+    m_settings->sync();
+}
+
+bool SettingsManager::convertHeicOnExport() const
+{
+    return m_settings->value("convertHeicOnExport", false).toBool();
+}
+
+void SettingsManager::setConvertHeicOnExport(bool enabled)
+{
+    m_settings->setValue("convertHeicOnExport", enabled);
+    m_settings->sync();
+}
+
+bool SettingsManager::convertHevcOnExport() const
+{
+    return m_settings->value("convertHevcOnExport", false).toBool();
+}
+
+void SettingsManager::setConvertHevcOnExport(bool enabled)
+{
+    m_settings->setValue("convertHevcOnExport", enabled);
+    m_settings->sync();
+}
+
+QString SettingsManager::exportDestinationType() const
+{
+    return m_settings->value("exportDestinationType", "folder").toString();
+}
+
+void SettingsManager::setExportDestinationType(const QString &type)
+{
+    m_settings->setValue("exportDestinationType", type);
+    m_settings->sync();
+}
+
 bool SettingsManager::showKeychainDialog() const
 {
     return m_settings->value("showKeychainDialog", true).toBool();
@@ -233,6 +310,13 @@ void SettingsManager::resetToDefaults()
     setUseUnsecureBackend(false);
     setTheme("System Default");
     setConnectionTimeout(30);
+    setExportLanes(3);
+    setSyncExports(false);
+    setExportChecksumFile(false);
+    setVerifyExports(false);
+    setConvertHeicOnExport(false);
+    setConvertHevcOnExport(false);
+    setExportDestinationType("folder");
     setShowKeychainDialog(true);
     setDefaultJailbrokenRootPassword("alpine");
 }
@@ -86,6 +86,32 @@ public:
     int connectionTimeout() const;
     void setConnectionTimeout(int seconds);
 
+    // Concurrent transfer lanes per export job
+    int exportLanes() const;
+    void setExportLanes(int lanes);
+
+    // Gallery exports only copy new or changed files
+    bool syncExports() const;
+    void setSyncExports(bool enabled);
+
+    // Write a SHA-256 checksum file with every export
+    bool exportChecksumFile() const;
+    void setExportChecksumFile(bool enabled);
+
+    // Read exported files back and compare their SHA-256
+    bool verifyExports() const;
+    void setVerifyExports(bool enabled);
+
+    // Convert HEIC photos to JPEG and HEVC videos to H.264 while exporting
+    bool convertHeicOnExport() const;
+    void setConvertHeicOnExport(bool enabled);
+    bool convertHevcOnExport() const;
+    void setConvertHevcOnExport(bool enabled);
+
+    // "folder", or "zip" / "tar" to export into a single archive
+    QString exportDestinationType() const;
+    void setExportDestinationType(const QString &type);
+
     bool showKeychainDialog() const;
     void setShowKeychainDialog(bool show);
 
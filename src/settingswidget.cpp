@@ -18,6 +18,7 @@
  */
 
 #include "settingswidget.h"
+#include "iDescriptor.h"
 #include "mainwindow.h"
 #include "settingsmanager.h"
 #include <QCheckBox>
@@ -120,6 +121,44 @@ void SettingsWidget::setupUI()
     timeoutLayout->addStretch();
     deviceLayout->addLayout(timeoutLayout);
 
+    // Parallel export lanes, each one uses its own AFC connection
+    auto *lanesLayout = new QHBoxLayout();
+    lanesLayout->addWidget(new QLabel("Parallel Transfers:"));
+    m_exportLanes = new QSpinBox();
+    m_exportLanes->setRange(1, AFC_POOL_CAPACITY - 1);
+    lanesLayout->addWidget(m_exportLanes);
+    lanesLayout->addStretch();
+    deviceLayout->addLayout(lanesLayout);
+
+    m_syncExports =
+        new QCheckBox("Only export new or changed photos (sync mode)");
+    deviceLayout->addWidget(m_syncExports);
+
+    m_exportChecksumFile =
+        new QCheckBox("Write a SHA-256 checksum file with exports");
+    deviceLayout->addWidget(m_exportChecksumFile);
+
+    m_verifyExports = new QCheckBox("Verify exported files after copying");
+    deviceLayout->addWidget(m_verifyExports);
+
+    m_convertHeic = new QCheckBox("Convert HEIC photos to JPEG when exporting");
+    deviceLayout->addWidget(m_convertHeic);
+
+    m_convertHevc =
+        new QCheckBox("Convert HEVC videos to H.264 when exporting");
+    deviceLayout->addWidget(m_convertHevc);
+
+    // Archives are streamed, the files are never written out on their own
+    auto *destinationLayout = new QHBoxLayout();
+    destinationLayout->addWidget(new QLabel("Export To:"));
+    m_exportDestination = new QComboBox();
+    m_exportDestination->addItem("Folder", "folder");
+    m_exportDestination->addItem("ZIP Archive", "zip");
+    m_exportDestination->addItem("TAR Archive", "tar");
+    destinationLayout->addWidget(m_exportDestination);
+    destinationLayout->addStretch();
+    deviceLayout->addLayout(destinationLayout);
+
     scrollLayout->addWidget(deviceGroup);
 
     // === SECURITY SETTINGS ===
@@ -242,6 +281,15 @@ void SettingsWidget::loadSettings()
     }
 
     m_connectionTimeout->setValue(sm->connectionTimeout());
+    m_exportLanes->setValue(sm->exportLanes());
+    m_syncExports->setChecked(sm->syncExports());
+    m_exportChecksumFile->setChecked(sm->exportChecksumFile());
+    m_verifyExports->setChecked(sm->verifyExports());
+    m_convertHeic->setChecked(sm->convertHeicOnExport());
+    m_convertHevc->setChecked(sm->convertHevcOnExport());
+    int destinationIndex =
+        m_exportDestination->findData(sm->exportDestinationType());
+    m_exportDestination->setCurrentIndex(qMax(destinationIndex, 0));
     m_useUnsecureBackend->setChecked(sm->useUnsecureBackend());
     m_defaultJailbrokenRootPassword->setText(
         sm->defaultJailbrokenRootPassword());
@@ -269,6 +317,21 @@ void SettingsWidget::connectSignals()
             this, &SettingsWidget::onSettingChanged);
     connect(m_connectionTimeout, QOverload<int>::of(&QSpinBox::valueChanged),
             this, &SettingsWidget::onSettingChanged);
+    connect(m_exportLanes, QOverload<int>::of(&QSpinBox::valueChanged), this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_syncExports, &QCheckBox::toggled, this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_exportChecksumFile, &QCheckBox::toggled, this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_verifyExports, &QCheckBox::toggled, this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_convertHeic, &QCheckBox::toggled, this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_convertHevc, &QCheckBox::toggled, this,
+            &SettingsWidget::onSettingChanged);
+    connect(m_exportDestination,
+            QOverload<int>::of(&QComboBox::currentIndexChanged), this,
+            &SettingsWidget::onSettingChanged);
 
     connect(m_iconSizeBaseMultiplier,
             QOverload<double>::of(&QDoubleSpinBox::valueChanged), this,
@@ -375,6 +438,14 @@ void SettingsWidget::saveSettings()
 
     sm->setTheme(m_themeCombo->currentText());
     sm->setConnectionTimeout(m_connectionTimeout->value());
+    sm->setExportLanes(m_exportLanes->value());
+    sm->setSyncExports(m_syncExports->isChecked());
+    sm->setExportChecksumFile(m_exportChecksumFile->isChecked());
+    sm->setVerifyExports(m_verifyExports->isChecked());
+    sm->setConvertHeicOnExport(m_convertHeic->isChecked());
+    sm->setConvertHevcOnExport(m_convertHevc->isChecked());
+    sm->setExportDestinationType(
+        m_exportDestination->currentData().toString());
     sm->setDefaultJailbrokenRootPassword(
         m_defaultJailbrokenRootPassword->text());
 
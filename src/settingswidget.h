@@ -62,6 +62,13 @@ private:
     QCheckBox *m_useUnsecureBackend;
     // Device Connection
     QSpinBox *m_connectionTimeout;
+    QSpinBox *m_exportLanes;
+    QCheckBox *m_syncExports;
+    QCheckBox *m_exportChecksumFile;
+    QCheckBox *m_verifyExports;
+    QCheckBox *m_convertHeic;
+    QCheckBox *m_convertHevc;
+    QComboBox *m_exportDestination;
 
     // Jailbroken
     QLineEdit *m_defaultJailbrokenRootPassword;
@@ -0,0 +1,94 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "streamhasher.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <algorithm>
+#include <openssl/evp.h>
+
+StreamHasher::StreamHasher() : m_ctx(EVP_MD_CTX_new())
+{
+    if (!m_ctx || EVP_DigestInit_ex(m_ctx, EVP_sha256(), nullptr) != 1) {
+        qWarning() << "Could not initialize SHA-256 context";
+        EVP_MD_CTX_free(m_ctx);
+        m_ctx = nullptr;
+    }
+}
+
+StreamHasher::~StreamHasher() { EVP_MD_CTX_free(m_ctx); }
+
+void StreamHasher::addData(QByteArrayView data)
+{
+    if (!m_ctx || !m_result.isEmpty() || data.isEmpty()) {
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    EVP_DigestUpdate(m_ctx, data.data(), data.size());
+    m_elapsedNs += timer.nsecsElapsed();
+    m_bytesHashed += data.size();
+}
+
+bool StreamHasher::addFile(const QString &path, qint64 length)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QByteArray buffer(FILE_BUFFER_SIZE, Qt::Uninitialized);
+    qint64 remaining = length < 0 ? file.size() : length;
+    while (remaining > 0) {
+        const qint64 read =
+            file.read(buffer.data(), std::min(remaining, FILE_BUFFER_SIZE));
+        if (read <= 0) {
+            return false;
+        }
+        addData(QByteArrayView(buffer.constData(), read));
+        remaining -= read;
+    }
+    return true;
+}
+
+QByteArray StreamHasher::hexResult()
+{
+    if (!m_ctx || !m_result.isEmpty()) {
+        return m_result;
+    }
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+    if (EVP_DigestFinal_ex(m_ctx, digest, &digestLength) != 1) {
+        return QByteArray();
+    }
+    m_result = QByteArray(reinterpret_cast<const char *>(digest),
+                          static_cast<int>(digestLength))
+                   .toHex();
+    return m_result;
+}
+
+QByteArray StreamHasher::hashFile(const QString &path)
+{
+    StreamHasher hasher;
+    if (!hasher.addFile(path)) {
+        return QByteArray();
+    }
+    return hasher.hexResult();
+}
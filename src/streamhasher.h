@@ -0,0 +1,69 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAMHASHER_H
+#define STREAMHASHER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QString>
+
+struct evp_md_ctx_st;
+
+/**
+ * @brief Incremental SHA-256 over data as it streams past
+ *
+ * Backed by OpenSSL's EVP interface, which picks the SHA extensions on x86
+ * and the ARMv8 crypto instructions where available. Hashing runs at
+ * several GB/s, well above AFC transfer rates, so its cost stays far below
+ * the transfer time. Time spent inside the hash is tracked to keep an eye
+ * on that.
+ */
+class StreamHasher
+{
+public:
+    StreamHasher();
+    ~StreamHasher();
+
+    StreamHasher(const StreamHasher &) = delete;
+    StreamHasher &operator=(const StreamHasher &) = delete;
+
+    void addData(QByteArrayView data);
+    // Hashes the first length bytes of a local file, all of it when -1
+    bool addFile(const QString &path, qint64 length = -1);
+
+    // Lowercase hex digest, no more data can be added afterwards
+    QByteArray hexResult();
+
+    qint64 bytesHashed() const { return m_bytesHashed; }
+    qint64 elapsedNs() const { return m_elapsedNs; }
+
+    // Digest of a whole local file, empty if it can't be read
+    static QByteArray hashFile(const QString &path);
+
+private:
+    static constexpr qint64 FILE_BUFFER_SIZE = 1024 * 1024;
+
+    evp_md_ctx_st *m_ctx = nullptr;
+    QByteArray m_result;
+    qint64 m_bytesHashed = 0;
+    qint64 m_elapsedNs = 0;
+};
+
+#endif // STREAMHASHER_H
@@ -0,0 +1,546 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "thumbnaildiskcache.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QSaveFile>
+#include <QScopeGuard>
+#include <QStandardPaths>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+void appendLe32(QByteArray &out, quint32 value)
+{
+    const quint32 le = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char *>(&le), sizeof(le));
+}
+
+void appendLe64(QByteArray &out, quint64 value)
+{
+    const quint64 le = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char *>(&le), sizeof(le));
+}
+
+// Sanity limits for records found while scanning
+constexpr quint32 MAX_KEY_LENGTH = 64 * 1024;
+constexpr quint32 MAX_DATA_LENGTH = 16 * 1024 * 1024;
+constexpr qint64 PACK_HEADER_SIZE = 8;
+} // namespace
+
+std::shared_ptr<ThumbnailDiskCache>
+ThumbnailDiskCache::forDevice(const QString &udid)
+{
+    static QMutex registryMutex;
+    static QHash<QString, std::weak_ptr<ThumbnailDiskCache>> registry;
+
+    QMutexLocker locker(&registryMutex);
+    if (std::shared_ptr<ThumbnailDiskCache> cache = registry.value(udid).lock())
+        return cache;
+
+    const QString dir =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+        "/thumbnails";
+    if (!QDir().mkpath(dir)) {
+        qWarning() << "Could not create thumbnail cache directory" << dir;
+        return nullptr;
+    }
+    const QString name =
+        QCryptographicHash::hash(udid.toUtf8(), QCryptographicHash::Sha1)
+            .toHex()
+            .left(16);
+    std::shared_ptr<ThumbnailDiskCache> cache(new ThumbnailDiskCache(
+        dir + "/" + name + ".pack", dir + "/" + name + ".idx"));
+    registry.insert(udid, cache);
+    return cache;
+}
+
+ThumbnailDiskCache::ThumbnailDiskCache(const QString &packPath,
+                                       const QString &indexPath)
+    : m_packPath(packPath), m_indexPath(indexPath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_usable = openPack();
+    qDebug() << "Thumbnail cache" << m_packPath << "holds" << m_entries.size()
+             << "thumbnails in" << m_packSize / 1024 << "KB";
+}
+
+ThumbnailDiskCache::~ThumbnailDiskCache()
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_usable) {
+        // Also persists the recency of this session's lookups
+        saveIndex();
+    }
+    if (m_hits + m_misses > 0) {
+        qDebug() << "Thumbnail cache" << m_packPath << "hits:" << m_hits
+                 << "misses:" << m_misses;
+    }
+    if (m_map) {
+        m_pack.unmap(m_map);
+    }
+    m_pack.close();
+}
+
+QString ThumbnailDiskCache::keyFor(const QString &devicePath,
+                                   const QSize &size)
+{
+    return devicePath + '|' + QString::number(size.width()) + 'x' +
+           QString::number(size.height());
+}
+
+QImage ThumbnailDiskCache::lookup(const QString &devicePath,
+                                  const QSize &size, quint64 mtime)
+{
+    if (mtime == 0) {
+        return QImage();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_usable) {
+        return QImage();
+    }
+    auto it = m_entries.find(keyFor(devicePath, size));
+    if (it == m_entries.end() || it->mtime != mtime) {
+        m_misses++;
+        return QImage();
+    }
+    if (!ensureMapped(it->offset + it->length)) {
+        m_misses++;
+        return QImage();
+    }
+
+    const QImage image = QImage::fromData(m_map + it->offset, it->length);
+    if (image.isNull()) {
+        // Damaged record, the next load replaces it
+        m_entries.erase(it);
+        m_misses++;
+        return QImage();
+    }
+    it->lastUsed = ++m_clock;
+    m_hits++;
+    return image;
+}
+
+void ThumbnailDiskCache::insert(const QString &devicePath, const QSize &size,
+                                quint64 mtime, const QImage &thumbnail)
+{
+    if (mtime == 0 || thumbnail.isNull()) {
+        return;
+    }
+
+    // Encode before taking the lock, lookups on the GUI thread wait for it
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    const bool alpha = thumbnail.hasAlphaChannel();
+    if (!thumbnail.save(&buffer, alpha ? "PNG" : "JPG",
+                        alpha ? -1 : JPEG_QUALITY)) {
+        return;
+    }
+
+    const QString key = keyFor(devicePath, size);
+    const QByteArray keyBytes = key.toUtf8();
+    QByteArray record;
+    record.reserve(RECORD_HEADER_SIZE + keyBytes.size() + data.size());
+    appendLe32(record, RECORD_MAGIC);
+    appendLe32(record, keyBytes.size());
+    appendLe32(record, data.size());
+    appendLe64(record, mtime);
+    record += keyBytes;
+    record += data;
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_usable) {
+        return;
+    }
+    if (!m_pack.seek(m_packSize) || m_pack.write(record) != record.size() ||
+        !m_pack.flush()) {
+        qWarning() << "Could not write thumbnail cache" << m_packPath << ":"
+                   << m_pack.errorString();
+        m_pack.resize(m_packSize);
+        return;
+    }
+
+    Entry entry;
+    entry.mtime = mtime;
+    entry.offset = m_packSize + RECORD_HEADER_SIZE + keyBytes.size();
+    entry.length = data.size();
+    entry.lastUsed = ++m_clock;
+    m_entries.insert(key, entry);
+    m_packSize += record.size();
+
+    if (++m_unsavedInserts >= INDEX_SAVE_INTERVAL) {
+        saveIndex();
+    }
+    const bool compactNow = m_packSize > MAX_PACK_BYTES && !m_compacting;
+    if (compactNow) {
+        m_compacting = true;
+        locker.unlock();
+        compact();
+    }
+}
+
+qint64 ThumbnailDiskCache::packSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_packSize;
+}
+
+int ThumbnailDiskCache::entryCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
+
+bool ThumbnailDiskCache::openPack()
+{
+    m_pack.setFileName(m_packPath);
+    if (!m_pack.open(QIODevice::ReadWrite)) {
+        qWarning() << "Could not open thumbnail cache" << m_packPath << ":"
+                   << m_pack.errorString();
+        return false;
+    }
+    m_packSize = m_pack.size();
+
+    quint32 header[2] = {0, 0};
+    if (m_packSize >= PACK_HEADER_SIZE) {
+        m_pack.read(reinterpret_cast<char *>(header), sizeof(header));
+    }
+    if (qFromLittleEndian(header[0]) != PACK_MAGIC ||
+        qFromLittleEndian(header[1]) != FORMAT_VERSION) {
+        // New, foreign or from an older format, start over
+        QByteArray fresh;
+        appendLe32(fresh, PACK_MAGIC);
+        appendLe32(fresh, FORMAT_VERSION);
+        if (!m_pack.resize(0) || !m_pack.seek(0) ||
+            m_pack.write(fresh) != fresh.size() || !m_pack.flush()) {
+            qWarning() << "Could not initialize thumbnail cache"
+                       << m_packPath;
+            return false;
+        }
+        m_packSize = PACK_HEADER_SIZE;
+        QFile::remove(m_indexPath);
+        return true;
+    }
+
+    if (!loadIndex()) {
+        m_entries.clear();
+        m_clock = 0;
+        scanPack(PACK_HEADER_SIZE);
+    }
+    return true;
+}
+
+bool ThumbnailDiskCache::loadIndex()
+{
+    QFile file(m_indexPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 indexedSize = 0;
+    qint32 count = 0;
+    in >> magic >> version >> indexedSize >> m_clock >> count;
+    if (in.status() != QDataStream::Ok || magic != INDEX_MAGIC ||
+        version != FORMAT_VERSION || indexedSize > m_packSize || count < 0) {
+        qDebug() << "Thumbnail cache index" << m_indexPath
+                 << "is stale, rebuilding it";
+        return false;
+    }
+
+    m_entries.reserve(count);
+    for (qint32 i = 0; i < count; ++i) {
+        QString key;
+        Entry entry;
+        in >> key >> entry.mtime >> entry.offset >> entry.length >>
+            entry.lastUsed;
+        if (in.status() != QDataStream::Ok || entry.offset < 0 ||
+            entry.length <= 0 || entry.offset + entry.length > indexedSize) {
+            qDebug() << "Thumbnail cache index" << m_indexPath
+                     << "is damaged, rebuilding it";
+            return false;
+        }
+        m_entries.insert(key, entry);
+    }
+
+    // Records appended after the index was last written
+    if (indexedSize < m_packSize) {
+        scanPack(indexedSize);
+    }
+    return true;
+}
+
+void ThumbnailDiskCache::scanPack(qint64 from)
+{
+    if (!ensureMapped(m_packSize)) {
+        return;
+    }
+
+    auto read32 = [this](qint64 offset) {
+        quint32 value;
+        std::memcpy(&value, m_map + offset, sizeof(value));
+        return qFromLittleEndian(value);
+    };
+
+    qint64 offset = from;
+    int recovered = 0;
+    while (offset + RECORD_HEADER_SIZE <= m_packSize) {
+        const quint32 keyLength = read32(offset + 4);
+        const quint32 dataLength = read32(offset + 8);
+        const qint64 end =
+            offset + RECORD_HEADER_SIZE + keyLength + dataLength;
+        if (read32(offset) != RECORD_MAGIC || keyLength > MAX_KEY_LENGTH ||
+            dataLength == 0 || dataLength > MAX_DATA_LENGTH ||
+            end > m_packSize) {
+            break;
+        }
+
+        quint64 mtime;
+        std::memcpy(&mtime, m_map + offset + 12, sizeof(mtime));
+        const QString key = QString::fromUtf8(
+            reinterpret_cast<const char *>(m_map + offset +
+                                           RECORD_HEADER_SIZE),
+            keyLength);
+
+        Entry entry;
+        entry.mtime = qFromLittleEndian(mtime);
+        entry.offset = offset + RECORD_HEADER_SIZE + keyLength;
+        entry.length = dataLength;
+        entry.lastUsed = ++m_clock;
+        m_entries.insert(key, entry);
+        recovered++;
+        offset = end;
+    }
+
+    // Cut off a record an interrupted write left half done
+    if (offset < m_packSize) {
+        qDebug() << "Truncating thumbnail cache" << m_packPath << "at"
+                 << offset << "of" << m_packSize << "bytes";
+        m_pack.unmap(m_map);
+        m_map = nullptr;
+        m_mapSize = 0;
+        m_pack.resize(offset);
+        m_packSize = offset;
+    }
+    qDebug() << "Recovered" << recovered << "thumbnails from" << m_packPath;
+}
+
+bool ThumbnailDiskCache::saveIndex()
+{
+    QSaveFile file(m_indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write thumbnail cache index" << m_indexPath;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << INDEX_MAGIC << FORMAT_VERSION << m_packSize << m_clock
+        << static_cast<qint32>(m_entries.size());
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        out << it.key() << it->mtime << it->offset << it->length
+            << it->lastUsed;
+    }
+    if (!file.commit()) {
+        qWarning() << "Could not write thumbnail cache index" << m_indexPath;
+        return false;
+    }
+    m_unsavedInserts = 0;
+    return true;
+}
+
+bool ThumbnailDiskCache::ensureMapped(qint64 end)
+{
+    if (m_map && end <= m_mapSize) {
+        return true;
+    }
+    // Appends grow the file past the mapping, map it again
+    if (m_map) {
+        m_pack.unmap(m_map);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+    m_map = m_pack.map(0, m_packSize);
+    if (!m_map) {
+        qWarning() << "Could not map thumbnail cache" << m_packPath << ":"
+                   << m_pack.errorString();
+        return false;
+    }
+    m_mapSize = m_packSize;
+    return end <= m_mapSize;
+}
+
+/*
+    Copies the most recently used records into a new pack without holding
+    m_mutex, so lookups on the GUI thread go on meanwhile. Records are never
+    rewritten in place, everything below the snapshot's pack size stays
+    valid and is read through a mapping of its own. Only the records
+    appended during the copy and the swap itself happen under the lock.
+*/
+void ThumbnailDiskCache::compact()
+{
+    std::vector<std::pair<QString, Entry>> entries;
+    qint64 snapshotSize;
+    {
+        QMutexLocker locker(&m_mutex);
+        snapshotSize = m_packSize;
+        entries.reserve(m_entries.size());
+        for (auto it = m_entries.constBegin(); it != m_entries.constEnd();
+             ++it) {
+            entries.emplace_back(it.key(), it.value());
+        }
+    }
+    auto done = qScopeGuard([this]() {
+        QMutexLocker locker(&m_mutex);
+        m_compacting = false;
+    });
+
+    // Most recently used first, keep them until the target size is reached
+    std::sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+        return a.second.lastUsed > b.second.lastUsed;
+    });
+
+    QFile in(m_packPath);
+    uchar *map =
+        in.open(QIODevice::ReadOnly) ? in.map(0, snapshotSize) : nullptr;
+    if (!map) {
+        qWarning() << "Could not compact thumbnail cache" << m_packPath << ":"
+                   << in.errorString();
+        return;
+    }
+
+    const qint64 target = MAX_PACK_BYTES * COMPACT_TARGET_PERCENT / 100;
+    const QString newPath = m_packPath + ".new";
+    QFile out(newPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not compact thumbnail cache" << m_packPath;
+        return;
+    }
+
+    QByteArray buffer;
+    appendLe32(buffer, PACK_MAGIC);
+    appendLe32(buffer, FORMAT_VERSION);
+    qint64 written = 0;
+    QHash<QString, Entry> kept;
+    bool ok = true;
+    auto appendRecord = [&](const QString &key, const Entry &entry,
+                            const uchar *data) {
+        const QByteArray keyBytes = key.toUtf8();
+        Entry moved = entry;
+        moved.offset = written + buffer.size() + RECORD_HEADER_SIZE +
+                       keyBytes.size();
+        appendLe32(buffer, RECORD_MAGIC);
+        appendLe32(buffer, keyBytes.size());
+        appendLe32(buffer, entry.length);
+        appendLe64(buffer, entry.mtime);
+        buffer += keyBytes;
+        buffer.append(reinterpret_cast<const char *>(data), entry.length);
+        kept.insert(key, moved);
+
+        if (buffer.size() >= 1024 * 1024) {
+            ok = out.write(buffer) == buffer.size();
+            written += buffer.size();
+            buffer.clear();
+        }
+    };
+    for (const auto &[key, entry] : entries) {
+        const qint64 recordSize =
+            RECORD_HEADER_SIZE + key.toUtf8().size() + entry.length;
+        if (written + buffer.size() + recordSize > target) {
+            break;
+        }
+        appendRecord(key, entry, map + entry.offset);
+        if (!ok) {
+            break;
+        }
+    }
+    in.unmap(map);
+    in.close();
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_usable) {
+        out.close();
+        QFile::remove(newPath);
+        return;
+    }
+
+    // Thumbnails inserted during the copy went to the old pack, bring them
+    // along; lookups meanwhile updated the recency of the others
+    QHash<QString, Entry> merged;
+    merged.reserve(kept.size());
+    if (ok && !ensureMapped(m_packSize)) {
+        ok = false;
+    }
+    for (auto it = m_entries.constBegin(); ok && it != m_entries.constEnd();
+         ++it) {
+        if (it->offset >= snapshotSize) {
+            appendRecord(it.key(), it.value(), m_map + it->offset);
+        }
+    }
+    for (auto it = m_entries.constBegin(); ok && it != m_entries.constEnd();
+         ++it) {
+        auto moved = kept.constFind(it.key());
+        if (moved != kept.constEnd() && moved->mtime == it->mtime) {
+            Entry entry = moved.value();
+            entry.lastUsed = it->lastUsed;
+            merged.insert(it.key(), entry);
+        }
+    }
+    if (ok) {
+        ok = out.write(buffer) == buffer.size();
+        written += buffer.size();
+    }
+    out.close();
+    if (!ok) {
+        qWarning() << "Could not compact thumbnail cache" << m_packPath;
+        QFile::remove(newPath);
+        return;
+    }
+
+    // The old pack has to be unmapped and closed before it can be replaced
+    m_pack.unmap(m_map);
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_pack.close();
+    QFile::remove(m_packPath);
+    if (!QFile::rename(newPath, m_packPath) ||
+        !m_pack.open(QIODevice::ReadWrite)) {
+        qWarning() << "Could not replace thumbnail cache" << m_packPath;
+        m_usable = false;
+        m_entries.clear();
+        return;
+    }
+
+    qDebug() << "Compacted thumbnail cache from" << m_packSize / 1024
+             << "KB to" << written / 1024 << "KB, kept" << merged.size()
+             << "of" << m_entries.size() << "thumbnails";
+    m_entries = std::move(merged);
+    m_packSize = written;
+    saveIndex();
+}
@@ -0,0 +1,125 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAILDISKCACHE_H
+#define THUMBNAILDISKCACHE_H
+
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <memory>
+
+/**
+ * @brief Persistent thumbnail store for one device
+ *
+ * Thumbnails are kept as small JPEGs (PNG when they have alpha) appended to
+ * a single pack file in the cache directory, keyed by device path and
+ * thumbnail size and tagged with the file's mtime so edited photos miss.
+ * The pack is memory mapped and its index lives in a QHash, so a lookup is
+ * a hash probe plus decoding a few KB straight from the mapping, cheap
+ * enough for PhotoModel::data() on the GUI thread.
+ *
+ * The index is written next to the pack every INDEX_SAVE_INTERVAL inserts
+ * and on destruction. Records appended after the last index save are
+ * recovered by scanning the pack's tail. When the pack outgrows its cap
+ * the least recently used thumbnails are dropped and the pack rewritten,
+ * off the lock so lookups don't wait for it.
+ *
+ * All PhotoModels of a device share one instance, see forDevice().
+ */
+class ThumbnailDiskCache
+{
+public:
+    static std::shared_ptr<ThumbnailDiskCache> forDevice(const QString &udid);
+
+    ~ThumbnailDiskCache();
+
+    ThumbnailDiskCache(const ThumbnailDiskCache &) = delete;
+    ThumbnailDiskCache &operator=(const ThumbnailDiskCache &) = delete;
+
+    // Null image on a miss or when the device file changed since (mtime)
+    QImage lookup(const QString &devicePath, const QSize &size,
+                  quint64 mtime);
+    // Thread-safe, called from thumbnail workers
+    void insert(const QString &devicePath, const QSize &size, quint64 mtime,
+                const QImage &thumbnail);
+
+    qint64 packSize() const;
+    int entryCount() const;
+
+private:
+    struct Entry {
+        quint64 mtime = 0;
+        qint64 offset = 0;
+        qint32 length = 0;
+        // Larger is more recently used
+        quint64 lastUsed = 0;
+    };
+
+    static constexpr quint32 PACK_MAGIC = 0x49544850; // "ITHP"
+    static constexpr quint32 RECORD_MAGIC = 0x49544852; // "ITHR"
+    static constexpr quint32 INDEX_MAGIC = 0x49544849;  // "ITHI"
+    static constexpr quint32 FORMAT_VERSION = 1;
+    // Record header: magic, key length, data length, mtime
+    static constexpr int RECORD_HEADER_SIZE = 20;
+
+    static constexpr qint64 MAX_PACK_BYTES = 256LL * 1024 * 1024;
+    // Compaction keeps this share of the cap, so it doesn't run again soon
+    static constexpr int COMPACT_TARGET_PERCENT = 75;
+    static constexpr int INDEX_SAVE_INTERVAL = 64;
+    static constexpr int JPEG_QUALITY = 85;
+
+    ThumbnailDiskCache(const QString &packPath, const QString &indexPath);
+
+    static QString keyFor(const QString &devicePath, const QSize &size);
+
+    // All of these expect m_mutex to be held
+    bool openPack();
+    bool loadIndex();
+    void scanPack(qint64 from);
+    bool saveIndex();
+    bool ensureMapped(qint64 end);
+
+    // Takes m_mutex itself and only for the swap, runs on the inserting
+    // thread
+    void compact();
+
+    QString m_packPath;
+    QString m_indexPath;
+
+    mutable QMutex m_mutex;
+    QFile m_pack;
+    uchar *m_map = nullptr;
+    qint64 m_mapSize = 0;
+    qint64 m_packSize = 0;
+    QHash<QString, Entry> m_entries;
+    quint64 m_clock = 0;
+    int m_unsavedInserts = 0;
+    bool m_usable = false;
+    // A compact() is copying records, inserts don't start another
+    bool m_compacting = false;
+
+    qint64 m_hits = 0;
+    qint64 m_misses = 0;
+};
+
+#endif // THUMBNAILDISKCACHE_H
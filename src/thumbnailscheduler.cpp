@@ -0,0 +1,188 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "thumbnailscheduler.h"
+#include <QDebug>
+#include <QtConcurrent/QtConcurrent>
+
+ThumbnailScheduler::ThumbnailScheduler(int maxInFlight, int prefetchMargin,
+                                       QObject *parent)
+    : QObject(parent), m_maxInFlight(qMax(1, maxInFlight)),
+      m_prefetchMargin(qMax(0, prefetchMargin))
+{
+}
+
+ThumbnailScheduler::~ThumbnailScheduler()
+{
+    clear();
+    logMetrics();
+}
+
+void ThumbnailScheduler::request(const QString &key, int row, Job job)
+{
+    if (m_queued.contains(key) || m_inFlight.contains(key)) {
+        return;
+    }
+
+    Request request;
+    request.row = row;
+    request.sequence = m_sequence++;
+    request.job = std::move(job);
+    m_metrics.requested++;
+    if (priorityOf(request) < 0) {
+        // Already scrolled away by the time the view asked
+        m_metrics.dropped++;
+        return;
+    }
+
+    m_queued.insert(key, std::move(request));
+    dispatch();
+}
+
+bool ThumbnailScheduler::isPending(const QString &key) const
+{
+    return m_queued.contains(key) || m_inFlight.contains(key);
+}
+
+void ThumbnailScheduler::setVisibleRange(int first, int last)
+{
+    if (first == m_first && last == m_last) {
+        return;
+    }
+    m_first = first;
+    m_last = last;
+    dropStale();
+}
+
+void ThumbnailScheduler::dropQueued()
+{
+    m_metrics.dropped += m_queued.size();
+    m_queued.clear();
+}
+
+void ThumbnailScheduler::clear()
+{
+    dropQueued();
+    for (QFutureWatcher<Result> *watcher : std::as_const(m_inFlight)) {
+        watcher->disconnect(this);
+        watcher->waitForFinished();
+        watcher->deleteLater();
+    }
+    m_inFlight.clear();
+}
+
+ThumbnailScheduler::Metrics ThumbnailScheduler::metrics() const
+{
+    Metrics metrics = m_metrics;
+    metrics.queued = m_queued.size();
+    metrics.inFlight = m_inFlight.size();
+    return metrics;
+}
+
+qint64 ThumbnailScheduler::priorityOf(const Request &request) const
+{
+    if (!hasVisibleRange()) {
+        return static_cast<qint64>(request.sequence);
+    }
+
+    // Visible rows top to bottom, then the margin nearest first
+    if (request.row >= m_first && request.row <= m_last) {
+        return request.row - m_first;
+    }
+    const int distance = request.row < m_first ? m_first - request.row
+                                               : request.row - m_last;
+    if (distance > m_prefetchMargin) {
+        return -1;
+    }
+    return static_cast<qint64>(m_last - m_first + 1) + distance;
+}
+
+void ThumbnailScheduler::dropStale()
+{
+    int dropped = 0;
+    for (auto it = m_queued.begin(); it != m_queued.end();) {
+        if (priorityOf(it.value()) < 0) {
+            it = m_queued.erase(it);
+            dropped++;
+        } else {
+            ++it;
+        }
+    }
+    if (dropped > 0) {
+        m_metrics.dropped += dropped;
+        qDebug() << "Dropped" << dropped << "thumbnail requests outside rows"
+                 << m_first << "-" << m_last;
+    }
+}
+
+void ThumbnailScheduler::dispatch()
+{
+    while (m_inFlight.size() < m_maxInFlight && !m_queued.isEmpty()) {
+        // The queue only holds the viewport and its margin, a scan is cheap
+        auto next = m_queued.end();
+        qint64 nextPriority = 0;
+        for (auto it = m_queued.begin(); it != m_queued.end(); ++it) {
+            const qint64 priority = priorityOf(it.value());
+            if (next == m_queued.end() || priority < nextPriority) {
+                next = it;
+                nextPriority = priority;
+            }
+        }
+
+        const QString key = next.key();
+        const int row = next->row;
+        Job job = std::move(next->job);
+        m_queued.erase(next);
+
+        auto *watcher = new QFutureWatcher<Result>(this);
+        m_inFlight.insert(key, watcher);
+        m_metrics.started++;
+        connect(watcher, &QFutureWatcher<Result>::finished, this,
+                [this, watcher, key, row]() {
+                    const Result result = watcher->result();
+                    m_inFlight.remove(key);
+                    watcher->deleteLater();
+
+                    if (result.thumbnail.isNull()) {
+                        m_metrics.failed++;
+                    } else {
+                        m_metrics.completed++;
+                        emit thumbnailReady(key, row, result.thumbnail,
+                                            result.mtime);
+                    }
+                    dispatch();
+                    if (m_queued.isEmpty() && m_inFlight.isEmpty()) {
+                        logMetrics();
+                    }
+                });
+        watcher->setFuture(QtConcurrent::run(std::move(job)));
+    }
+}
+
+void ThumbnailScheduler::logMetrics() const
+{
+    if (m_metrics.requested == 0) {
+        return;
+    }
+    qDebug() << "Thumbnail queue idle - requested:" << m_metrics.requested
+             << "started:" << m_metrics.started
+             << "completed:" << m_metrics.completed
+             << "failed:" << m_metrics.failed
+             << "dropped:" << m_metrics.dropped;
+}
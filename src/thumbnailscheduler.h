@@ -0,0 +1,121 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef THUMBNAILSCHEDULER_H
+#define THUMBNAILSCHEDULER_H
+
+#include <QFutureWatcher>
+#include <QHash>
+#include <QObject>
+#include <QPixmap>
+#include <QString>
+#include <functional>
+
+/**
+ * @brief Viewport-ordered queue for thumbnail loads
+ *
+ * Views ask for every row they lay out, and flinging through a large album
+ * used to start a device read for each of them. Requests are queued here
+ * instead and at most maxInFlight run at once. The view reports its visible
+ * rows through setVisibleRange(): visible rows are served top to bottom
+ * first, then rows within the prefetch margin by distance, and queued
+ * requests that scrolled out of both are dropped. Without a visible range
+ * requests run in arrival order.
+ *
+ * Running loads can't be interrupted, they finish and their result is still
+ * delivered.
+ */
+class ThumbnailScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    static constexpr int DEFAULT_MAX_IN_FLIGHT = 4;
+    // In rows of the model, on each side of the visible range
+    static constexpr int DEFAULT_PREFETCH_MARGIN = 24;
+
+    struct Metrics {
+        int queued = 0;
+        int inFlight = 0;
+        quint64 requested = 0;
+        quint64 started = 0;
+        quint64 completed = 0;
+        quint64 failed = 0;
+        // Queued requests that scrolled away before they started
+        quint64 dropped = 0;
+    };
+
+    struct Result {
+        // A null pixmap counts as failed
+        QPixmap thumbnail;
+        // st_mtime the job stat'ed in nanoseconds, 0 if it didn't need to
+        quint64 mtime = 0;
+    };
+
+    // Runs on a pool thread
+    using Job = std::function<Result()>;
+
+    explicit ThumbnailScheduler(int maxInFlight = DEFAULT_MAX_IN_FLIGHT,
+                                int prefetchMargin = DEFAULT_PREFETCH_MARGIN,
+                                QObject *parent = nullptr);
+    ~ThumbnailScheduler() override;
+
+    // Ignored while key is queued or loading
+    void request(const QString &key, int row, Job job);
+    bool isPending(const QString &key) const;
+
+    void setVisibleRange(int first, int last);
+
+    // For when rows move, e.g. after sorting, running loads continue
+    void dropQueued();
+    // Drops queued requests and waits for running ones without delivering
+    void clear();
+
+    Metrics metrics() const;
+
+signals:
+    void thumbnailReady(const QString &key, int row, const QPixmap &thumbnail,
+                        quint64 mtime);
+
+private:
+    struct Request {
+        int row = 0;
+        quint64 sequence = 0;
+        Job job;
+    };
+
+    // Lower runs first, -1 if the request is stale
+    qint64 priorityOf(const Request &request) const;
+    bool hasVisibleRange() const { return m_first >= 0 && m_last >= m_first; }
+    void dropStale();
+    void dispatch();
+    void logMetrics() const;
+
+    int m_maxInFlight;
+    int m_prefetchMargin;
+    int m_first = -1;
+    int m_last = -1;
+
+    QHash<QString, Request> m_queued;
+    QHash<QString, QFutureWatcher<Result> *> m_inFlight;
+    quint64 m_sequence = 0;
+    Metrics m_metrics;
+};
+
+#endif // THUMBNAILSCHEDULER_H
@@ -0,0 +1,329 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tiledimagesource.h"
+#include "iDescriptor.h"
+#include <QBuffer>
+#include <QDebug>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QTransform>
+#include <libheif/heif.h>
+
+std::unique_ptr<TiledImageSource>
+TiledImageSource::create(const QByteArray &data, const QString &path)
+{
+    const bool heif = path.endsWith(".HEIC", Qt::CaseInsensitive) ||
+                      path.endsWith(".HEIF", Qt::CaseInsensitive);
+
+    std::unique_ptr<TiledImageSource> source(new TiledImageSource(
+        data, heif ? Mode::Heif : Mode::Reader));
+    if (heif ? source->openHeif() : source->openReader(path)) {
+        return source;
+    }
+
+    // No tiling to go by, decode it whole
+    source.reset(new TiledImageSource(data, Mode::Full));
+    if (source->openFull(path)) {
+        return source;
+    }
+    return nullptr;
+}
+
+TiledImageSource::TiledImageSource(const QByteArray &data, Mode mode)
+    : m_data(data), m_mode(mode), m_tileSize(TILE_SIZE, TILE_SIZE),
+      m_transformation(QImageIOHandler::TransformationNone)
+{
+}
+
+TiledImageSource::~TiledImageSource()
+{
+    if (m_heifHandle) {
+        heif_image_handle_release(m_heifHandle);
+    }
+    if (m_heifContext) {
+        heif_context_free(m_heifContext);
+    }
+}
+
+QRect TiledImageSource::tileRect(int column, int row) const
+{
+    const QRect tile(m_origin + QPoint(column * m_tileSize.width(),
+                                       row * m_tileSize.height()),
+                     m_tileSize);
+    return tile.intersected(QRect(QPoint(0, 0), m_size));
+}
+
+qint64 TiledImageSource::residentBytes() const
+{
+    return m_data.size() + m_full.sizeInBytes();
+}
+
+bool TiledImageSource::openHeif()
+{
+#ifdef LIBHEIF_HAVE_VERSION
+#if LIBHEIF_HAVE_VERSION(1, 18, 0)
+    m_heifContext = heif_context_alloc();
+    if (!m_heifContext) {
+        return false;
+    }
+    // m_data outlives the context
+    heif_error err = heif_context_read_from_memory_without_copy(
+        m_heifContext, m_data.constData(), m_data.size(), nullptr);
+    if (err.code != heif_error_Ok) {
+        qWarning() << "Failed to read HEIC from memory:" << err.message;
+        return false;
+    }
+    err = heif_context_get_primary_image_handle(m_heifContext, &m_heifHandle);
+    if (err.code != heif_error_Ok) {
+        qWarning() << "Failed to get primary image handle:" << err.message;
+        return false;
+    }
+
+    // Tiling of the upright image, grid tiles decode with irot/imir applied
+    heif_image_tiling tiling;
+    err = heif_image_handle_get_image_tiling(m_heifHandle, 1, &tiling);
+    if (err.code != heif_error_Ok || tiling.tile_width == 0 ||
+        tiling.tile_height == 0 ||
+        tiling.num_columns * tiling.num_rows <= 1) {
+        return false;
+    }
+    m_size = QSize(heif_image_handle_get_width(m_heifHandle),
+                   heif_image_handle_get_height(m_heifHandle));
+    m_tileSize = QSize(tiling.tile_width, tiling.tile_height);
+    m_origin = QPoint(-static_cast<int>(tiling.left_offset),
+                      -static_cast<int>(tiling.top_offset));
+    m_columns = tiling.num_columns;
+    m_rows = tiling.num_rows;
+    m_heifAlpha = heif_image_handle_has_alpha_channel(m_heifHandle);
+    return !m_size.isEmpty();
+#endif
+#endif
+    // Decoding single tiles needs libheif 1.18
+    return false;
+}
+
+bool TiledImageSource::openReader(const QString &path)
+{
+    QBuffer buffer;
+    buffer.setData(m_data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer);
+    reader.setAutoTransform(true);
+
+    // Without these the plugin decodes everything for each tile anyway
+    if (!reader.canRead() ||
+        !reader.supportsOption(QImageIOHandler::ClipRect) ||
+        !reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        return false;
+    }
+    m_format = reader.format();
+    m_storedSize = reader.size();
+    if (m_storedSize.isEmpty()) {
+        qDebug() << "No size in the header of" << path;
+        return false;
+    }
+    m_transformation = reader.transformation();
+    m_size = m_transformation & QImageIOHandler::TransformationRotate90
+                 ? m_storedSize.transposed()
+                 : m_storedSize;
+    m_columns = (m_size.width() + TILE_SIZE - 1) / TILE_SIZE;
+    m_rows = (m_size.height() + TILE_SIZE - 1) / TILE_SIZE;
+    return true;
+}
+
+bool TiledImageSource::openFull(const QString &path)
+{
+    if (path.endsWith(".HEIC", Qt::CaseInsensitive) ||
+        path.endsWith(".HEIF", Qt::CaseInsensitive)) {
+        m_full = load_heic_image(m_data);
+    } else {
+        QBuffer buffer;
+        buffer.setData(m_data);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer);
+        reader.setAutoTransform(true);
+        m_full = reader.read();
+        if (m_full.isNull()) {
+            qDebug() << "Could not decode image data for:" << path
+                     << reader.errorString();
+        }
+    }
+    if (m_full.isNull()) {
+        return false;
+    }
+
+    // Everything is in m_full now
+    m_data.clear();
+    m_size = m_full.size();
+    m_columns = (m_size.width() + TILE_SIZE - 1) / TILE_SIZE;
+    m_rows = (m_size.height() + TILE_SIZE - 1) / TILE_SIZE;
+    return true;
+}
+
+QImage TiledImageSource::decodeTile(int column, int row)
+{
+    const QRect rect = tileRect(column, row);
+    if (rect.isEmpty()) {
+        return QImage();
+    }
+
+    switch (m_mode) {
+    case Mode::Heif:
+        return decodeHeifTile(column, row);
+    case Mode::Reader:
+        return read(storedRect(rect), QSize());
+    case Mode::Full:
+        return m_full.copy(rect);
+    }
+    return QImage();
+}
+
+QImage TiledImageSource::decodeScaled(const QSize &size)
+{
+    QSize target = m_size;
+    if (target.width() > size.width() || target.height() > size.height()) {
+        target = m_size.scaled(size, Qt::KeepAspectRatio)
+                     .expandedTo(QSize(1, 1));
+    }
+
+    switch (m_mode) {
+    case Mode::Heif:
+        return decodeHeifScaled(target);
+    case Mode::Reader:
+        // JPEG scales while decoding (DCT scaling), before the transform
+        return read(QRect(),
+                    m_transformation & QImageIOHandler::TransformationRotate90
+                        ? target.transposed()
+                        : target);
+    case Mode::Full:
+        return m_full.scaled(target, Qt::IgnoreAspectRatio,
+                             Qt::SmoothTransformation);
+    }
+    return QImage();
+}
+
+QRect TiledImageSource::storedRect(const QRect &rect) const
+{
+    // Stored to display as QImageReader does it: mirror and flip, then a
+    // clockwise quarter turn
+    const qreal width = m_storedSize.width();
+    const qreal height = m_storedSize.height();
+    const bool mirror =
+        m_transformation & QImageIOHandler::TransformationMirror;
+    const bool flip = m_transformation & QImageIOHandler::TransformationFlip;
+    QTransform transform(mirror ? -1 : 1, 0, 0, flip ? -1 : 1,
+                         mirror ? width : 0, flip ? height : 0);
+    if (m_transformation & QImageIOHandler::TransformationRotate90) {
+        transform *= QTransform(0, 1, -1, 0, height, 0);
+    }
+    return transform.inverted().mapRect(QRectF(rect)).toAlignedRect();
+}
+
+QImage TiledImageSource::read(const QRect &clipRect,
+                              const QSize &scaledSize) const
+{
+    QBuffer buffer;
+    buffer.setData(m_data);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, m_format);
+    reader.setAutoTransform(true);
+    if (clipRect.isValid()) {
+        reader.setClipRect(clipRect);
+    }
+    if (scaledSize.isValid()) {
+        reader.setScaledSize(scaledSize);
+    }
+
+    const QImage image = reader.read();
+    if (image.isNull()) {
+        qWarning() << "Failed to decode image part:" << reader.errorString();
+    }
+    return image;
+}
+
+QImage TiledImageSource::decodeHeifTile(int column, int row)
+{
+#ifdef LIBHEIF_HAVE_VERSION
+#if LIBHEIF_HAVE_VERSION(1, 18, 0)
+    QMutexLocker locker(&m_heifMutex);
+    heif_image *img = nullptr;
+    const heif_error err = heif_image_handle_decode_image_tile(
+        m_heifHandle, &img, heif_colorspace_RGB, heif_chroma_interleaved_RGBA,
+        nullptr, column, row);
+    locker.unlock();
+    if (err.code != heif_error_Ok) {
+        qWarning() << "Failed to decode HEIC tile" << column << row << ":"
+                   << err.message;
+        return QImage();
+    }
+
+    const QImage tile = heif_image_to_qimage(img, m_heifAlpha);
+    // Grid tiles overhang the image at its edges
+    const QPoint start = m_origin + QPoint(column * m_tileSize.width(),
+                                           row * m_tileSize.height());
+    const QRect rect = tileRect(column, row);
+    if (tile.isNull() || rect.size() == tile.size()) {
+        return tile;
+    }
+    return tile.copy(rect.translated(-start));
+#endif
+#endif
+    Q_UNUSED(column)
+    Q_UNUSED(row)
+    return QImage();
+}
+
+/*
+    Tile by tile, each scaled down on its own, so only one full resolution
+    tile is in memory at a time instead of the whole primary image
+*/
+QImage TiledImageSource::decodeHeifScaled(const QSize &size)
+{
+    QImage result(size, QImage::Format_ARGB32_Premultiplied);
+    result.fill(Qt::transparent);
+    QPainter painter(&result);
+
+    const qreal sx = qreal(size.width()) / m_size.width();
+    const qreal sy = qreal(size.height()) / m_size.height();
+    for (int row = 0; row < m_rows; row++) {
+        for (int column = 0; column < m_columns; column++) {
+            const QRect rect = tileRect(column, row);
+            // Integer edges, so neighbouring tiles meet without seams
+            const QPoint topLeft(qRound(rect.left() * sx),
+                                 qRound(rect.top() * sy));
+            const QPoint bottomRight(qRound((rect.right() + 1) * sx),
+                                     qRound((rect.bottom() + 1) * sy));
+            const QSize scaled(bottomRight.x() - topLeft.x(),
+                               bottomRight.y() - topLeft.y());
+            if (rect.isEmpty() || scaled.isEmpty()) {
+                continue;
+            }
+            const QImage tile = decodeHeifTile(column, row);
+            if (tile.isNull()) {
+                continue;
+            }
+            painter.drawImage(topLeft,
+                              tile.scaled(scaled, Qt::IgnoreAspectRatio,
+                                          Qt::SmoothTransformation));
+        }
+    }
+    return result;
+}
@@ -0,0 +1,120 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEDIMAGESOURCE_H
+#define TILEDIMAGESOURCE_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QImageIOHandler>
+#include <QMutex>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <memory>
+
+struct heif_context;
+struct heif_image_handle;
+
+/**
+ * @brief Decodes a photo in parts, for viewing it without decoding it whole
+ *
+ * The image is split into a grid of tiles in display orientation, each of
+ * which decodes at full resolution on its own, and decodeScaled() gives the
+ * whole image at about screen size. How that works depends on the file:
+ *
+ * - HEIC grids (iPhone photos are 512px tiles) decode one grid tile per
+ *   tile, never the whole primary image.
+ * - Formats whose Qt plugin clips while decoding (JPEG) decode each tile's
+ *   rectangle from the file, and decodeScaled() uses the plugin's scaled
+ *   decoding.
+ * - Anything else is decoded once in full and tiles are cut from that.
+ *
+ * The file's data is kept for the source's lifetime. All decode functions
+ * may be called from several threads at once.
+ */
+class TiledImageSource
+{
+public:
+    // Tile edge for sources that don't come with their own tiling
+    static constexpr int TILE_SIZE = 512;
+
+    // Returns nullptr if the data can't be decoded
+    static std::unique_ptr<TiledImageSource> create(const QByteArray &data,
+                                                    const QString &path);
+    ~TiledImageSource();
+
+    TiledImageSource(const TiledImageSource &) = delete;
+    TiledImageSource &operator=(const TiledImageSource &) = delete;
+
+    // Full resolution size, upright
+    QSize size() const { return m_size; }
+    int columns() const { return m_columns; }
+    int rows() const { return m_rows; }
+    // Part of the image covered by a tile, edge tiles are smaller
+    QRect tileRect(int column, int row) const;
+
+    QImage decodeTile(int column, int row);
+    // The whole image scaled to fit size, never up
+    QImage decodeScaled(const QSize &size);
+
+    // File data plus whatever decoded pixels the source holds on to
+    qint64 residentBytes() const;
+
+private:
+    enum class Mode { Heif, Reader, Full };
+
+    TiledImageSource(const QByteArray &data, Mode mode);
+
+    bool openHeif();
+    bool openReader(const QString &path);
+    bool openFull(const QString &path);
+
+    // Display rect to the rect in the file's stored orientation
+    QRect storedRect(const QRect &rect) const;
+    // A reader of its own per call, so calls can run concurrently
+    QImage read(const QRect &clipRect, const QSize &scaledSize) const;
+
+    QImage decodeHeifTile(int column, int row);
+    QImage decodeHeifScaled(const QSize &size);
+
+    QByteArray m_data;
+    Mode m_mode;
+    QSize m_size;
+    int m_columns = 0;
+    int m_rows = 0;
+    QSize m_tileSize;
+    // Where tile (0, 0) starts, negative for rotated HEIC grids
+    QPoint m_origin;
+
+    // Reader mode
+    QByteArray m_format;
+    QSize m_storedSize;
+    QImageIOHandler::Transformations m_transformation;
+    // Full mode
+    QImage m_full;
+
+    // libheif contexts aren't safe for concurrent decoding
+    QMutex m_heifMutex;
+    heif_context *m_heifContext = nullptr;
+    heif_image_handle *m_heifHandle = nullptr;
+    bool m_heifAlpha = false;
+};
+
+#endif // TILEDIMAGESOURCE_H
@@ -0,0 +1,705 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "videothumbnailer.h"
+#include "servicemanager.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTransform>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/display.h>
+#include <libswscale/swscale.h>
+}
+
+namespace
+{
+// A box found in an ISO BMFF buffer, offsets are into that buffer
+struct Box {
+    qsizetype payload;
+    qsizetype end;
+};
+
+// Byte range of one sample in the file
+struct SampleRange {
+    uint64_t offset;
+    uint32_t size;
+};
+
+quint32 be32(const QByteArray &data, qsizetype offset)
+{
+    return qFromBigEndian<quint32>(data.constData() + offset);
+}
+
+quint64 be64(const QByteArray &data, qsizetype offset)
+{
+    return qFromBigEndian<quint64>(data.constData() + offset);
+}
+
+// First box of type among the siblings in [from, end)
+std::optional<Box> findBox(const QByteArray &data, qsizetype from,
+                           qsizetype end, const char *type)
+{
+    while (from + 8 <= end) {
+        quint64 size = be32(data, from);
+        qsizetype header = 8;
+        if (size == 1) {
+            if (from + 16 > end) {
+                return std::nullopt;
+            }
+            size = be64(data, from + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = end - from;
+        }
+        if (size < static_cast<quint64>(header) ||
+            size > static_cast<quint64>(end - from)) {
+            return std::nullopt;
+        }
+        if (std::memcmp(data.constData() + from + 4, type, 4) == 0) {
+            return Box{from + header, from + static_cast<qsizetype>(size)};
+        }
+        from += static_cast<qsizetype>(size);
+    }
+    return std::nullopt;
+}
+
+// Entries of a sample table box, after its version, flags and entry count
+class SampleTable
+{
+public:
+    /*
+        skip is the number of bytes between the flags and the entry count,
+        4 for stsz's sample_size
+    */
+    static std::optional<SampleTable> find(const QByteArray &data,
+                                           const Box &stbl, const char *type,
+                                           int entrySize, int skip = 0)
+    {
+        const std::optional<Box> box =
+            findBox(data, stbl.payload, stbl.end, type);
+        if (!box || box->payload + 8 + skip > box->end) {
+            return std::nullopt;
+        }
+        SampleTable table(data, *box);
+        table.m_count = be32(data, box->payload + 4 + skip);
+        table.m_entries = box->payload + 8 + skip;
+        table.m_entrySize = entrySize;
+        if (static_cast<quint64>(table.m_count) * entrySize >
+            static_cast<quint64>(box->end - table.m_entries)) {
+            return std::nullopt;
+        }
+        return table;
+    }
+
+    quint32 count() const { return m_count; }
+    const Box &box() const { return m_box; }
+
+    quint32 u32(quint32 index, int field = 0) const
+    {
+        return be32(m_data, m_entries + qsizetype(index) * m_entrySize +
+                                field * 4);
+    }
+
+    quint64 u64(quint32 index) const
+    {
+        return be64(m_data, m_entries + qsizetype(index) * m_entrySize);
+    }
+
+private:
+    SampleTable(const QByteArray &data, const Box &box)
+        : m_data(data), m_box(box)
+    {
+    }
+
+    const QByteArray &m_data;
+    Box m_box;
+    quint32 m_count = 0;
+    qsizetype m_entries = 0;
+    int m_entrySize = 0;
+};
+
+// Where the first sync sample of the track with this stbl is stored
+std::optional<SampleRange> firstSyncSample(const QByteArray &moov,
+                                           const Box &stbl)
+{
+    // Without stss every sample is a sync sample
+    quint32 sample = 1;
+    if (const auto stss = SampleTable::find(moov, stbl, "stss", 4)) {
+        if (stss->count() == 0) {
+            return std::nullopt;
+        }
+        sample = stss->u32(0);
+    }
+
+    const auto stsc = SampleTable::find(moov, stbl, "stsc", 12);
+    const auto stsz = SampleTable::find(moov, stbl, "stsz", 4, 4);
+    const auto co64 = SampleTable::find(moov, stbl, "co64", 8);
+    const auto stco =
+        co64 ? std::nullopt : SampleTable::find(moov, stbl, "stco", 4);
+    const auto &chunks = co64 ? co64 : stco;
+    if (!stsc || !stsz || !chunks || sample == 0) {
+        return std::nullopt;
+    }
+
+    const quint32 fixedSize = be32(moov, stsz->box().payload + 4);
+    auto sampleSize = [&](quint32 number) -> std::optional<quint32> {
+        if (fixedSize != 0) {
+            return fixedSize;
+        }
+        if (number == 0 || number > stsz->count()) {
+            return std::nullopt;
+        }
+        return stsz->u32(number - 1);
+    };
+
+    // stsc lists runs of chunks with the same number of samples each
+    quint64 runStart = 1;
+    for (quint32 i = 0; i < stsc->count(); i++) {
+        const quint32 firstChunk = stsc->u32(i, 0);
+        const quint32 perChunk = stsc->u32(i, 1);
+        const quint64 nextChunk = i + 1 < stsc->count()
+                                      ? stsc->u32(i + 1, 0)
+                                      : quint64(chunks->count()) + 1;
+        if (firstChunk == 0 || perChunk == 0 || nextChunk <= firstChunk) {
+            return std::nullopt;
+        }
+        const quint64 runSamples = (nextChunk - firstChunk) * perChunk;
+        if (sample >= runStart + runSamples) {
+            runStart += runSamples;
+            continue;
+        }
+
+        const quint64 index = sample - runStart;
+        const quint64 chunk = firstChunk + index / perChunk;
+        const quint32 within = static_cast<quint32>(index % perChunk);
+        if (chunk > chunks->count()) {
+            return std::nullopt;
+        }
+        const quint32 chunkIndex = static_cast<quint32>(chunk - 1);
+        uint64_t offset =
+            co64 ? chunks->u64(chunkIndex) : chunks->u32(chunkIndex);
+        for (quint32 before = sample - within; before < sample; before++) {
+            const std::optional<quint32> size = sampleSize(before);
+            if (!size) {
+                return std::nullopt;
+            }
+            offset += *size;
+        }
+        const std::optional<quint32> size = sampleSize(sample);
+        if (!size) {
+            return std::nullopt;
+        }
+        return SampleRange{offset, *size};
+    }
+    return std::nullopt;
+}
+
+// First keyframe of the first video track described by a moov box
+std::optional<SampleRange> firstKeyframe(const QByteArray &moov)
+{
+    const std::optional<Box> root = findBox(moov, 0, moov.size(), "moov");
+    if (!root) {
+        return std::nullopt;
+    }
+
+    for (auto trak = findBox(moov, root->payload, root->end, "trak"); trak;
+         trak = findBox(moov, trak->end, root->end, "trak")) {
+        const auto mdia = findBox(moov, trak->payload, trak->end, "mdia");
+        if (!mdia) {
+            continue;
+        }
+        // Version, flags and pre_defined come before the handler type
+        const auto hdlr = findBox(moov, mdia->payload, mdia->end, "hdlr");
+        if (!hdlr || hdlr->payload + 12 > hdlr->end ||
+            std::memcmp(moov.constData() + hdlr->payload + 8, "vide", 4) !=
+                0) {
+            continue;
+        }
+        const auto minf = findBox(moov, mdia->payload, mdia->end, "minf");
+        const auto stbl =
+            minf ? findBox(moov, minf->payload, minf->end, "stbl")
+                 : std::nullopt;
+        if (!stbl) {
+            return std::nullopt;
+        }
+        return firstSyncSample(moov, *stbl);
+    }
+    return std::nullopt;
+}
+
+/*
+    Clockwise degrees the frames have to be turned to show upright, phones
+    record in sensor orientation and only set the display matrix
+*/
+int rotationOf(const AVStream *stream)
+{
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(60, 31, 102)
+    const AVPacketSideData *side = av_packet_side_data_get(
+        stream->codecpar->coded_side_data, stream->codecpar->nb_coded_side_data,
+        AV_PKT_DATA_DISPLAYMATRIX);
+    const uint8_t *matrix =
+        side && side->size >= 9 * sizeof(int32_t) ? side->data : nullptr;
+#else
+#if LIBAVFORMAT_VERSION_MAJOR >= 59
+    size_t size = 0;
+#else
+    int size = 0;
+#endif
+    const uint8_t *matrix =
+        av_stream_get_side_data(stream, AV_PKT_DATA_DISPLAYMATRIX, &size);
+    if (static_cast<size_t>(size) < 9 * sizeof(int32_t)) {
+        matrix = nullptr;
+    }
+#endif
+    if (!matrix) {
+        return 0;
+    }
+
+    // The matrix rotates counterclockwise
+    const double angle =
+        av_display_rotation_get(reinterpret_cast<const int32_t *>(matrix));
+    if (std::isnan(angle)) {
+        return 0;
+    }
+    const int degrees = static_cast<int>(std::lround(-angle / 90.0)) * 90;
+    return (degrees % 360 + 360) % 360;
+}
+
+QImage scaleFrame(const AVFrame *frame, const QSize &size)
+{
+    SwsContext *swsCtx = sws_getContext(
+        frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+        size.width(), size.height(), AV_PIX_FMT_RGB32, SWS_BILINEAR, nullptr,
+        nullptr, nullptr);
+    if (!swsCtx) {
+        return QImage();
+    }
+
+    // AV_PIX_FMT_RGB32 is native endian 0xAARRGGBB like Format_RGB32, so
+    // the frame is scaled straight into the image
+    QImage image(size, QImage::Format_RGB32);
+    uint8_t *dst[4] = {image.bits(), nullptr, nullptr, nullptr};
+    int dstStride[4] = {static_cast<int>(image.bytesPerLine()), 0, 0, 0};
+    sws_scale(swsCtx, frame->data, frame->linesize, 0, frame->height, dst,
+              dstStride);
+    sws_freeContext(swsCtx);
+    return image;
+}
+} // namespace
+
+VideoThumbnailer::VideoThumbnailer(iDescriptorDevice *device,
+                                   const QString &path,
+                                   std::optional<afc_client_t> altAfc)
+    : m_device(device), m_path(path.toUtf8()), m_afc(altAfc)
+{
+}
+
+VideoThumbnailer::~VideoThumbnailer() { close(); }
+
+QImage VideoThumbnailer::read(const QSize &size)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (!open()) {
+        return QImage();
+    }
+
+    const bool knownLayout = prefetch();
+    const QImage thumbnail = decode(size, knownLayout);
+    close();
+
+    if (thumbnail.isNull()) {
+        qDebug() << "No thumbnail frame in" << m_path << "after"
+                 << m_bytesRead << "bytes";
+        return QImage();
+    }
+    qDebug() << "Video thumbnail of" << m_path << "in" << timer.elapsed()
+             << "ms," << m_readCount << "reads," << m_bytesRead << "of"
+             << m_size << "bytes";
+    return thumbnail;
+}
+
+bool VideoThumbnailer::open()
+{
+    if (m_open) {
+        return true;
+    }
+
+    MediaEntry info;
+    if (ServiceManager::cachedStat(m_device, m_path.constData(), info,
+                                   m_afc) != AFC_E_SUCCESS ||
+        info.size == 0) {
+        qWarning() << "Invalid video file size for thumbnail:" << m_path;
+        return false;
+    }
+    m_size = info.size;
+
+    if (ServiceManager::safeAfcFileOpen(m_device, m_path.constData(),
+                                        AFC_FOPEN_RDONLY, &m_handle,
+                                        m_afc) != AFC_E_SUCCESS ||
+        m_handle == 0) {
+        qWarning() << "Failed to open video file for thumbnail:" << m_path;
+        return false;
+    }
+    m_open = true;
+    return true;
+}
+
+void VideoThumbnailer::close()
+{
+    if (m_codec) {
+        avcodec_free_context(&m_codec);
+    }
+    if (m_format) {
+        avformat_close_input(&m_format);
+    }
+    if (m_avio) {
+        // The demuxer may have swapped the buffer we handed it
+        av_freep(&m_avio->buffer);
+        avio_context_free(&m_avio);
+    }
+    if (m_open) {
+        ServiceManager::safeAfcFileClose(m_device, m_handle, m_afc);
+        m_open = false;
+        m_handle = 0;
+    }
+    m_ranges.clear();
+}
+
+QMap<uint64_t, QByteArray>::const_iterator
+VideoThumbnailer::rangeAt(uint64_t pos) const
+{
+    auto best = m_ranges.cend();
+    uint64_t bestEnd = pos;
+    for (auto it = m_ranges.cbegin();
+         it != m_ranges.cend() && it.key() <= pos; ++it) {
+        const uint64_t end = it.key() + it->size();
+        if (end > bestEnd) {
+            best = it;
+            bestEnd = end;
+        }
+    }
+    return best;
+}
+
+bool VideoThumbnailer::ensure(uint64_t offset, uint32_t length)
+{
+    if (!m_open || offset > m_size || length > m_size - offset) {
+        return false;
+    }
+    const auto cached = rangeAt(offset);
+    if (cached != m_ranges.cend() &&
+        cached.key() + cached->size() >= offset + length) {
+        return true;
+    }
+
+    const uint32_t want = static_cast<uint32_t>(
+        qMin<uint64_t>(qMax(length, FETCH_SIZE), m_size - offset));
+    if (m_bytesRead + want > MAX_READ_BYTES) {
+        qDebug() << "Video" << m_path << "is past the read budget";
+        return false;
+    }
+    if (ServiceManager::safeAfcFileSeek(m_device, m_handle, offset, SEEK_SET,
+                                        m_afc) != AFC_E_SUCCESS) {
+        return false;
+    }
+
+    QByteArray data(want, Qt::Uninitialized);
+    uint32_t filled = 0;
+    while (filled < want) {
+        uint32_t got = 0;
+        if (ServiceManager::safeAfcFileRead(m_device, m_handle,
+                                            data.data() + filled,
+                                            want - filled, &got,
+                                            m_afc) != AFC_E_SUCCESS ||
+            got == 0) {
+            return false;
+        }
+        filled += got;
+    }
+    m_bytesRead += want;
+    m_readCount++;
+
+    auto existing = m_ranges.constFind(offset);
+    if (existing == m_ranges.cend() || existing->size() < data.size()) {
+        m_ranges.insert(offset, data);
+    }
+    return true;
+}
+
+QByteArray VideoThumbnailer::readAt(uint64_t offset, uint32_t length)
+{
+    if (!ensure(offset, length)) {
+        return QByteArray();
+    }
+    const auto range = rangeAt(offset);
+    return range->mid(static_cast<qsizetype>(offset - range.key()), length);
+}
+
+bool VideoThumbnailer::prefetch()
+{
+    // ftyp and, for files with moov at the end, the start of mdat with the
+    // first keyframe. Short clips fit in here entirely.
+    if (!ensure(0, qMin<uint64_t>(HEAD_FETCH_SIZE, m_size))) {
+        return false;
+    }
+
+    uint64_t offset = 0;
+    while (offset + 8 <= m_size) {
+        const QByteArray header =
+            readAt(offset, static_cast<uint32_t>(
+                               qMin<uint64_t>(16, m_size - offset)));
+        if (header.size() < 8) {
+            return false;
+        }
+        uint64_t boxSize = be32(header, 0);
+        if (boxSize == 1 && header.size() >= 16) {
+            boxSize = be64(header, 8);
+        } else if (boxSize == 0) {
+            boxSize = m_size - offset;
+        }
+        if (boxSize < 8 || boxSize > m_size - offset) {
+            return false;
+        }
+
+        if (header.mid(4, 4) != "moov") {
+            offset += boxSize;
+            continue;
+        }
+
+        if (boxSize > MAX_MOOV_BYTES) {
+            qDebug() << "moov of" << m_path << "is" << boxSize
+                     << "bytes, not prefetching it";
+            return true;
+        }
+        const QByteArray moov =
+            readAt(offset, static_cast<uint32_t>(boxSize));
+        if (moov.isEmpty()) {
+            return false;
+        }
+        if (const std::optional<SampleRange> keyframe = firstKeyframe(moov)) {
+            if (keyframe->offset < m_size &&
+                keyframe->size <= m_size - keyframe->offset) {
+                ensure(keyframe->offset, keyframe->size);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+int VideoThumbnailer::readPacket(void *opaque, uint8_t *buf, int bufSize)
+{
+    auto *self = static_cast<VideoThumbnailer *>(opaque);
+    if (self->m_position >= self->m_size) {
+        return AVERROR_EOF;
+    }
+
+    auto range = self->rangeAt(self->m_position);
+    if (range == self->m_ranges.cend()) {
+        if (!self->ensure(self->m_position, 1)) {
+            return AVERROR(EIO);
+        }
+        range = self->rangeAt(self->m_position);
+    }
+
+    // Short reads are fine, the next call continues from the next range
+    const uint64_t within = self->m_position - range.key();
+    const int count = static_cast<int>(
+        qMin<uint64_t>(bufSize, range->size() - within));
+    std::memcpy(buf, range->constData() + within, count);
+    self->m_position += count;
+    return count;
+}
+
+int64_t VideoThumbnailer::seekPacket(void *opaque, int64_t offset, int whence)
+{
+    auto *self = static_cast<VideoThumbnailer *>(opaque);
+    const int64_t size = static_cast<int64_t>(self->m_size);
+
+    int64_t newPos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:
+        return size;
+    case SEEK_SET:
+        newPos = offset;
+        break;
+    case SEEK_CUR:
+        newPos = static_cast<int64_t>(self->m_position) + offset;
+        break;
+    case SEEK_END:
+        newPos = size + offset;
+        break;
+    default:
+        return -1;
+    }
+
+    if (newPos < 0 || newPos > size) {
+        return -1;
+    }
+    // Nothing to do on the device, the next read is served by offset
+    self->m_position = static_cast<uint64_t>(newPos);
+    return newPos;
+}
+
+QImage VideoThumbnailer::decode(const QSize &size, bool knownLayout)
+{
+    unsigned char *buffer =
+        static_cast<unsigned char *>(av_malloc(AVIO_BUFFER_SIZE));
+    if (!buffer) {
+        return QImage();
+    }
+    m_position = 0;
+    m_avio = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, this,
+                                &VideoThumbnailer::readPacket, nullptr,
+                                &VideoThumbnailer::seekPacket);
+    if (!m_avio) {
+        av_free(buffer);
+        return QImage();
+    }
+
+    m_format = avformat_alloc_context();
+    if (!m_format) {
+        qWarning() << "Failed to allocate format context";
+        return QImage();
+    }
+    m_format->pb = m_avio;
+    m_format->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    // A top level moov box means QuickTime/MP4, no need to probe
+    const AVInputFormat *inputFormat =
+        knownLayout ? av_find_input_format("mov") : nullptr;
+    // Frees m_format and clears it on failure
+    if (avformat_open_input(&m_format, nullptr, inputFormat, nullptr) < 0) {
+        qWarning() << "Failed to open video format of" << m_path;
+        return QImage();
+    }
+
+    const AVCodec *codec = nullptr;
+    const int streamIndex =
+        av_find_best_stream(m_format, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (streamIndex < 0 || !codec) {
+        qWarning() << "No video stream found in" << m_path;
+        return QImage();
+    }
+    AVStream *stream = m_format->streams[streamIndex];
+
+    // moov describes the stream fully, only probe packets if it didn't
+    if (stream->codecpar->width <= 0 || stream->codecpar->height <= 0) {
+        if (avformat_find_stream_info(m_format, nullptr) < 0 ||
+            stream->codecpar->width <= 0 || stream->codecpar->height <= 0) {
+            qWarning() << "Failed to find stream info of" << m_path;
+            return QImage();
+        }
+    }
+    // Audio and metadata packets are skipped without being read
+    for (unsigned int i = 0; i < m_format->nb_streams; i++) {
+        if (static_cast<int>(i) != streamIndex) {
+            m_format->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    // Fit the displayed picture, then go back to frame orientation
+    const int rotation = rotationOf(stream);
+    const bool sideways = rotation % 180 != 0;
+    QSize display(stream->codecpar->width, stream->codecpar->height);
+    const AVRational sar = stream->codecpar->sample_aspect_ratio;
+    if (sar.num > 0 && sar.den > 0) {
+        display.setWidth(qMax(1, qRound(display.width() * av_q2d(sar))));
+    }
+    if (sideways) {
+        display.transpose();
+    }
+    QSize target = display.scaled(size, Qt::KeepAspectRatio);
+    target = target.expandedTo(QSize(1, 1));
+    const QSize frameTarget = sideways ? target.transposed() : target;
+
+    m_codec = avcodec_alloc_context3(codec);
+    if (!m_codec ||
+        avcodec_parameters_to_context(m_codec, stream->codecpar) < 0) {
+        return QImage();
+    }
+    // Only the keyframe is wanted, and deblocking doesn't show at
+    // thumbnail size
+    m_codec->skip_frame = AVDISCARD_NONKEY;
+    m_codec->skip_loop_filter = AVDISCARD_ALL;
+    m_codec->flags2 |= AV_CODEC_FLAG2_FAST;
+    // Several clips decode at once, a thread pool per clip doesn't pay off
+    m_codec->thread_count = 1;
+    int lowres = 0;
+    while (lowres < codec->max_lowres &&
+           (stream->codecpar->width >> (lowres + 1)) >= frameTarget.width() &&
+           (stream->codecpar->height >> (lowres + 1)) >=
+               frameTarget.height()) {
+        lowres++;
+    }
+    m_codec->lowres = lowres;
+
+    if (avcodec_open2(m_codec, codec, nullptr) < 0) {
+        qWarning() << "Failed to open decoder for" << m_path;
+        return QImage();
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    if (!packet || !frame) {
+        av_packet_free(&packet);
+        av_frame_free(&frame);
+        return QImage();
+    }
+
+    bool decoded = false;
+    int attempts = 0;
+    while (!decoded && attempts < MAX_KEYFRAME_ATTEMPTS &&
+           av_read_frame(m_format, packet) >= 0) {
+        if (packet->stream_index != streamIndex ||
+            !(packet->flags & AV_PKT_FLAG_KEY)) {
+            av_packet_unref(packet);
+            continue;
+        }
+        attempts++;
+        // Draining right away gets the frame out of decoders that would
+        // otherwise wait for more packets to reorder
+        if (avcodec_send_packet(m_codec, packet) >= 0 &&
+            avcodec_send_packet(m_codec, nullptr) >= 0 &&
+            avcodec_receive_frame(m_codec, frame) >= 0) {
+            decoded = true;
+        } else {
+            avcodec_flush_buffers(m_codec);
+        }
+        av_packet_unref(packet);
+    }
+
+    QImage image;
+    if (decoded) {
+        image = scaleFrame(frame, frameTarget);
+    }
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+
+    if (!image.isNull() && rotation != 0) {
+        image = image.transformed(QTransform().rotate(rotation));
+    }
+    return image;
+}
@@ -0,0 +1,114 @@
+/*
+ * iDescriptor: A free and open-source idevice management tool.
+ *
+ * Copyright (C) 2025 Uncore <https://github.com/uncor3>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VIDEOTHUMBNAILER_H
+#define VIDEOTHUMBNAILER_H
+
+#include "iDescriptor.h"
+#include <QByteArray>
+#include <QImage>
+#include <QMap>
+#include <QSize>
+#include <QString>
+#include <optional>
+
+struct AVCodecContext;
+struct AVFormatContext;
+struct AVIOContext;
+
+/**
+ * @brief Grabs the first keyframe of a video on the device as a thumbnail
+ *
+ * The file is read in a few large ranges instead of the demuxer's stream of
+ * small reads: one at the start of the file, which usually covers ftyp and
+ * the first keyframe, one for the moov box wherever it is, and one for the
+ * first keyframe's sample if the sample tables put it elsewhere. FFmpeg's
+ * reads are then served from memory, only misses go to the device.
+ *
+ * The container is taken as described by moov rather than probed, the
+ * decoder only handles keyframes (at lowres where it supports that) and the
+ * frame is scaled straight to the thumbnail size.
+ */
+class VideoThumbnailer
+{
+public:
+    static constexpr uint32_t HEAD_FETCH_SIZE = 256 * 1024;
+    // Smallest read issued for a miss
+    static constexpr uint32_t FETCH_SIZE = 256 * 1024;
+    static constexpr uint64_t MAX_MOOV_BYTES = 8 * 1024 * 1024;
+    static constexpr uint64_t MAX_READ_BYTES = 32 * 1024 * 1024;
+
+    VideoThumbnailer(iDescriptorDevice *device, const QString &path,
+                     std::optional<afc_client_t> altAfc = std::nullopt);
+    ~VideoThumbnailer();
+
+    VideoThumbnailer(const VideoThumbnailer &) = delete;
+    VideoThumbnailer &operator=(const VideoThumbnailer &) = delete;
+
+    // Scaled to fit size and turned upright, null if nothing decoded
+    QImage read(const QSize &size);
+
+    // Transfers from the device so far
+    uint64_t bytesRead() const { return m_bytesRead; }
+    int readCount() const { return m_readCount; }
+
+private:
+    static constexpr int AVIO_BUFFER_SIZE = 64 * 1024;
+    // Keyframes tried before giving up on a damaged file
+    static constexpr int MAX_KEYFRAME_ATTEMPTS = 3;
+
+    bool open();
+    void close();
+
+    /*
+        Makes sure length bytes at offset are in memory, reading at least
+        FETCH_SIZE from the device in one go when they aren't
+    */
+    bool ensure(uint64_t offset, uint32_t length);
+    QByteArray readAt(uint64_t offset, uint32_t length);
+    // The cached range holding pos that reaches furthest, or end()
+    QMap<uint64_t, QByteArray>::const_iterator rangeAt(uint64_t pos) const;
+
+    // Reads moov and the first keyframe, false if no moov was found
+    bool prefetch();
+    QImage decode(const QSize &size, bool knownLayout);
+
+    static int readPacket(void *opaque, uint8_t *buf, int bufSize);
+    static int64_t seekPacket(void *opaque, int64_t offset, int whence);
+
+    iDescriptorDevice *m_device;
+    QByteArray m_path;
+    std::optional<afc_client_t> m_afc;
+
+    uint64_t m_handle = 0;
+    bool m_open = false;
+    uint64_t m_size = 0;
+    uint64_t m_bytesRead = 0;
+    int m_readCount = 0;
+    // Start offset to contents, ranges may overlap
+    QMap<uint64_t, QByteArray> m_ranges;
+    // Read position of the AVIO callbacks
+    uint64_t m_position = 0;
+
+    AVIOContext *m_avio = nullptr;
+    AVFormatContext *m_format = nullptr;
+    AVCodecContext *m_codec = nullptr;
+};
+
+#endif // VIDEOTHUMBNAILER_H